@@ -91,22 +91,128 @@ typedef enum {
  */
 typedef struct api_pool_t api_pool_t;
 
+/*
+ * Pool usage, see api_pool_stats.
+ * Huge page coverage is huge_bytes / (region_bytes + heap_bytes)
+ */
+typedef struct api_pool_stats_t {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t regions;       /* 2MB regions mapped */
+    uint64_t hugetlb;       /* regions backed by MAP_HUGETLB */
+    uint64_t thp;           /* regions advised for transparent huge pages */
+    uint64_t region_bytes;  /* bytes in use carved from regions */
+    uint64_t huge_bytes;    /* part of region_bytes backed by huge pages */
+    uint64_t heap_bytes;    /* bytes in use outside of regions */
+} api_pool_stats_t;
+
+/*
+ * Per loop configuration, zeroed structure means defaults
+ */
+typedef struct api_loop_config_t {
+    /*
+     * Carve pool memory and task stacks from 2MB huge page regions.
+     * Memory allocated from such pool must be freed to the same pool
+     */
+    int huge_pages;
+
+    /*
+     * Number of times loop polls its async queue before blocking in
+     * the kernel, producers skip the wakeup syscall while loop spins.
+     * Pays off only when loops have dedicated cores. Zero disables
+     * spinning, ignored on windows
+     */
+    int async_spin;
+
+    /*
+     * Account cpu time and waits of tasks by their callbacks, see
+     * api_loop_task_stats. Costs reading cpu tick counter on each
+     * task switch
+     */
+    int task_accounting;
+
+    /*
+     * Keep this many most recent scheduler and I/O events in a ring,
+     * rounded up to power of two, see api_trace_write. Zero disables
+     */
+    size_t trace_events;
+
+    /*
+     * Sample TCP_INFO of each tcp stream at most once per this many
+     * milliseconds, when it reads or writes. Fills api_tcp_t info and
+     * LATENCY_Rtt histogram of loop. Zero disables
+     */
+    uint64_t tcp_info_period;
+} api_loop_config_t;
+
+/*
+ * Blocking work offload usage, see api_offload_stats.
+ * Times are in microseconds
+ */
+typedef struct api_offload_stats_t {
+    uint64_t threads;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t rejected;      /* queue limit reached */
+    uint64_t queued;        /* waiting for a thread now */
+    uint64_t queued_max;
+    uint64_t wait_total;    /* from submit to start */
+    uint64_t wait_max;
+    uint64_t run_total;     /* from start to completion */
+    uint64_t run_max;
+} api_offload_stats_t;
+
 /*
  * Platform specific event loop
  */
 typedef struct api_loop_t api_loop_t;
 
+typedef enum api_event_mode_t {
+    EVENT_Manual,   /* stays signaled until api_event_reset */
+    EVENT_Auto      /* each signal releases a single wait */
+} api_event_mode_t;
+
 /*
- * Signaling suppurt.
- * Currently inside single loop was implemented
+ * Signaling support.
+ * Any number of tasks from any loops may wait, signal can come
+ * from any loop or foreign thread. Waiters are woken through
+ * async queue of their own loop
  */
 typedef struct api_event_t {
-    api_loop_t* loop;
-    uint64_t value;
-    void* reserved;
-    int error;
+    volatile long signaled;
+    volatile long generation;   /* bumped by api_event_broadcast */
+    void* volatile waiters;     /* lock free stack of waiting tasks */
+    api_event_mode_t mode;
 } api_event_t;
 
+/*
+ * Bounded channel passing fixed size items between loops.
+ * Any number of tasks or threads may send, one task at a time receives.
+ * Blocking calls suspend calling task, not the thread
+ */
+typedef struct api_channel_t api_channel_t;
+
+/*
+ * Result of callback posted to other loop, see api_future_post
+ */
+typedef struct api_future_t api_future_t;
+
+/*
+ * Reference counted buffer.
+ * Memory block is taken from loop pool and can be shared by several
+ * api_buf_t as slices of it, block is released with its last slice.
+ * Buffers are chained with next pointer.
+ *
+ * api_buf_t not thread safe, use inside loop it was allocated from
+ */
+typedef struct api_buf_t {
+    struct api_buf_t* next;
+    struct api_buf_block_t* block;
+    char* data;
+    size_t length;  /* bytes used */
+    size_t size;    /* bytes available at data */
+} api_buf_t;
+
 /*
  * Filters are mechanisms to inject api_stream_t and change its behavior,
  * for example ssl_stream_t is just a filter attached to api_stream_t.
@@ -128,6 +234,22 @@ typedef struct api_filter_t {
     void* data;
 } api_filter_t;
 
+/*
+ * Log linear histogram of values up to about 2^40, buckets are 1/32 of
+ * their power of two wide so percentiles are within 3%. Fixed size and
+ * allocation free, histograms of same kind merge by adding buckets
+ */
+#define API_HISTOGRAM_SUB 32
+#define API_HISTOGRAM_BUCKETS (36 * API_HISTOGRAM_SUB)
+
+typedef struct api_histogram_t {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[API_HISTOGRAM_BUCKETS];
+} api_histogram_t;
+
 typedef enum api_stream_type_t {
     STREAM_Memory,
     STREAM_File,
@@ -202,12 +324,13 @@ typedef struct api_stream_t {
         uint64_t period;
     } read_bandwidth;
 
+    /* optional microsecond latency of each read and write, storage is
+     * provided by user after stream is initialized */
+    api_histogram_t* read_latency;
+    api_histogram_t* write_latency;
+
     /* internal use only */
-    struct {
-        char* buffer;
-        size_t offset;
-        size_t length;
-    } unread;
+    api_buf_t* unread;
 } api_stream_t;
 
 typedef struct api_address_t {
@@ -215,10 +338,27 @@ typedef struct api_address_t {
     socklen_t length;
 } api_address_t;
 
+/*
+ * Transport state of tcp connection as kernel sees it,
+ * see api_tcp_info_sample
+ */
+typedef struct api_tcp_info_t {
+    uint64_t sampled;       /* api_time_current of last sample, 0 if none */
+    uint64_t samples;
+    uint32_t rtt;           /* smoothed round trip time, microseconds */
+    uint32_t rtt_var;
+    uint32_t cwnd;          /* congestion window, segments */
+    uint32_t mss;
+    uint64_t retransmits;   /* segments retransmitted over connection life */
+    uint64_t delivery_rate; /* bytes per second, 0 if not reported */
+    uint64_t unacked;       /* bytes sent and not acknowledged yet */
+} api_tcp_info_t;
+
 /* tcp is subclass of api_stream_t with remote address */
 typedef struct api_tcp_t {
     api_stream_t stream;
     api_address_t address;
+    api_tcp_info_t info;
 } api_tcp_t;
 
 /* performs tcp bind, listen and conditional connection accepts */
@@ -282,6 +422,15 @@ typedef struct api_fs_event_t {
  */
 typedef void (*api_loop_fn)(api_loop_t* loop, void* arg);
 
+/*
+ * Task description for api_loop_post_batch
+ */
+typedef struct api_loop_post_t {
+    api_loop_fn callback;
+    void* arg;
+    size_t stack_size;
+} api_loop_post_t;
+
 /*
  * if not specified, all api calls with int return types are returning
  * API_OK on success and API_* error code on failure.
@@ -300,12 +449,49 @@ API_EXTERN void api_init();
 API_EXTERN api_pool_t* api_pool_default(api_loop_t* loop);
 
 /*
- * Not thread safe, call for loop in wich caller executes
+ * Not thread safe, call for loop in wich caller executes.
+ * With huge_pages block must be freed to the pool it came from,
+ * api_free finds it in regions of that pool
  */
 API_EXTERN void* api_alloc(api_pool_t* pool, size_t size);
 API_EXTERN void* api_calloc(api_pool_t* pool, size_t size);
 API_EXTERN void api_free(api_pool_t* pool, size_t size, void* ptr);
 
+/*
+ * Copy of pool counters, can be called from any thread. Pool updates
+ * them without atomics, so each counter is consistent on its own
+ */
+API_EXTERN void api_pool_stats(api_pool_t* pool, api_pool_stats_t* stats);
+
+
+/*
+ * Allocate buffer with size bytes available and zero length
+ */
+API_EXTERN api_buf_t* api_buf_alloc(api_pool_t* pool, size_t size);
+
+/*
+ * Create new buffer referencing part of buf memory, no data copied
+ */
+API_EXTERN api_buf_t* api_buf_slice(api_buf_t* buf,
+                                    size_t offset, size_t length);
+
+/*
+ * Returns non zero if memory of buf is referenced by other buffers too,
+ * such buffer must be copied before it is changed in place
+ */
+API_EXTERN int api_buf_shared(api_buf_t* buf);
+
+/*
+ * Release single buffer, or all buffers chained by next
+ */
+API_EXTERN void api_buf_free(api_buf_t* buf);
+API_EXTERN void api_buf_free_chain(api_buf_t* buf);
+
+/*
+ * Total length of buffers chained by next
+ */
+API_EXTERN size_t api_buf_chain_length(api_buf_t* buf);
+
 
 /*
  * Starts new api_loop_t in seperate thread, and returns its handle
@@ -315,10 +501,19 @@ API_EXTERN void api_free(api_pool_t* pool, size_t size, void* ptr);
  *   api_loop_stop_and_wait
  *   api_loop_wait
  *   api_loop_post
+ *   api_loop_post_batch
+ *   api_loop_post_all
  *   api_loop_exec
+ *   api_loop_group_post
  */
 API_EXTERN int api_loop_start(api_loop_t** loop);
 
+/*
+ * Same as api_loop_start with specified configuration
+ */
+API_EXTERN int api_loop_start_ex(api_loop_t** loop,
+                                const api_loop_config_t* config);
+
 /*
  * Stops specified loop, without wait, the loop parameter can be
  * loop in wich caller executes
@@ -351,6 +546,22 @@ API_EXTERN int api_loop_post(api_loop_t* loop,
                             api_loop_fn callback, void* arg,
                             size_t stack_size);
 
+/*
+ * Create parallel tasks for all items in loop at once, target loop
+ * is notified a single time for the whole batch.
+ * Nothing is posted if API_NO_MEMORY returned
+ */
+API_EXTERN int api_loop_post_batch(api_loop_t* loop,
+                                const api_loop_post_t* items,
+                                size_t count);
+
+/*
+ * Post the same callback and argument to each of loops
+ */
+API_EXTERN int api_loop_post_all(api_loop_t** loops, size_t count,
+                                api_loop_fn callback, void* arg,
+                                size_t stack_size);
+
 /*
  * Create new parallel task, run it in loop and wait for its completion
  * Pass 0 as stack_size for default
@@ -359,6 +570,386 @@ API_EXTERN int api_loop_exec(api_loop_t* current, api_loop_t* loop,
                             api_loop_fn callback, void* arg,
                             size_t stack_size);
 
+/*
+ * Opt-in set of loops sharing posted tasks, see api_loop_group_create
+ */
+typedef struct api_loop_group_t api_loop_group_t;
+
+/*
+ * Elastic group settings, see api_loop_group_start.
+ * Utilisations are per mille averaged over group, periods are
+ * in milliseconds
+ */
+typedef struct api_loop_elastic_t {
+    size_t min_loops;
+    size_t max_loops;
+    size_t capacity;        /* queue of each loop */
+    int grow_utilisation;   /* start loop when above */
+    int shrink_utilisation; /* retire loop when below */
+    int hysteresis;         /* consecutive samples before acting */
+    uint64_t period;        /* between samples */
+    uint64_t drain;         /* retiring loop is stopped after */
+} api_loop_elastic_t;
+
+/*
+ * Join loops into group. Each loop gets queue of capacity (power of 2)
+ * tasks posted with api_loop_group_post and not started yet. Loop about
+ * to block starts its own queued tasks first, then steals from siblings.
+ * Started tasks stay in loop which started them.
+ * Loop may belong to single group only
+ */
+API_EXTERN int api_loop_group_create(api_loop_group_t** group,
+                                    api_loop_t** loops, size_t count,
+                                    size_t capacity);
+
+/*
+ * Create elastic group starting min_loops loops, api_loop_group_supervise
+ * adds and retires loops between min_loops and max_loops by utilisation
+ */
+API_EXTERN int api_loop_group_start(api_loop_group_t** group,
+                                    const api_loop_elastic_t* config);
+
+/*
+ * Run supervisor of elastic group in current task until
+ * api_loop_group_stop, then stop and wait all loops of group, so group
+ * can be freed. If current loop stops first, loops are only stopped.
+ * Tasks still queued to retired loop are posted to other loops of group
+ */
+API_EXTERN int api_loop_group_supervise(api_loop_t* current,
+                                        api_loop_group_t* group);
+
+/*
+ * Make supervisor return, can be called from any loop
+ */
+API_EXTERN void api_loop_group_stop(api_loop_group_t* group);
+
+/*
+ * Returns non zero if supervisor is retiring loop. Long lived
+ * connections should finish or api_stream_migrate to other loop
+ * before drain period is over
+ */
+API_EXTERN int api_loop_is_retiring(api_loop_t* loop);
+
+/*
+ * Free group after all its loops stopped, tasks still queued are dropped
+ */
+API_EXTERN void api_loop_group_free(api_loop_group_t* group);
+
+/*
+ * Queue task to loop at index of group, any sibling may start it.
+ * Posted directly to that loop if its queue is full
+ */
+API_EXTERN int api_loop_group_post(api_loop_group_t* group, size_t index,
+                                   api_loop_fn callback, void* arg,
+                                   size_t stack_size);
+
+/*
+ * Load of a loop, see api_loop_load
+ */
+typedef struct api_loop_load_t {
+    size_t tasks;       /* created and not finished */
+    size_t streams;     /* attached */
+    size_t queued;      /* posted through group, not started yet */
+    int utilisation;    /* per mille of time not waiting for events */
+} api_loop_load_t;
+
+/*
+ * Policy of api_loop_group_pick
+ */
+typedef enum {
+    PICK_LeastConnections,  /* fewest attached streams and queued tasks */
+    PICK_PowerOfTwo,        /* less connected of two random loops */
+    PICK_Utilisation        /* least busy in last 100 milliseconds */
+} api_loop_pick_t;
+
+/*
+ * Snapshot of load signals the loop publishes each time it waits for
+ * events, can be called from any thread
+ */
+API_EXTERN void api_loop_load(api_loop_t* loop, api_loop_load_t* load);
+
+/*
+ * Counters of a loop since it started, see api_loop_stats_snapshot
+ */
+typedef struct api_loop_stats_t {
+    uint64_t iterations;        /* times loop waited for events */
+    uint64_t events;            /* events returned by those waits */
+    uint64_t events_max;        /* most events returned by one wait */
+    uint64_t blocked;           /* microseconds waiting for events */
+    uint64_t busy;              /* microseconds running */
+    uint64_t tasks_created;
+    uint64_t tasks_completed;
+    uint64_t switches;          /* task context switches */
+    uint64_t timers;            /* sleeps, idles and timeouts fired */
+    uint64_t asyncs;            /* posts, execs and wakeups processed */
+    uint64_t async_depth_max;   /* most asyncs drained at once */
+    size_t tasks;               /* created and not finished */
+    size_t streams;             /* attached */
+    int utilisation;            /* as reported by api_loop_load */
+} api_loop_stats_t;
+
+/*
+ * Copies counters the loop publishes each iteration, can be called
+ * from any thread. Loop updates them without atomics, so each counter
+ * is consistent on its own but not with the others
+ */
+API_EXTERN void api_loop_stats_snapshot(api_loop_t* loop,
+                                        api_loop_stats_t* stats);
+
+/*
+ * Totals of tasks started with same callback, see api_loop_task_stats.
+ * Times are in microseconds
+ */
+typedef struct api_task_stats_t {
+    void* callback;         /* 0 for callbacks that did not fit table */
+    uint64_t tasks;         /* started */
+    uint64_t switches;      /* times resumed */
+    uint64_t run;           /* running on loop thread */
+    uint64_t run_max;       /* longest single run */
+    uint64_t wait_io;       /* reading, writing, connecting, offloading */
+    uint64_t wait_timer;    /* sleeping */
+    uint64_t wait_event;    /* events, channels, futures, other loops */
+} api_task_stats_t;
+
+/*
+ * Copies up to count callback totals of loop started with
+ * task_accounting, returns number copied. Can be called from any
+ * thread while loop runs
+ */
+API_EXTERN size_t api_loop_task_stats(api_loop_t* loop,
+                                      api_task_stats_t* stats, size_t count);
+
+/*
+ * Latencies every loop records in microseconds, see api_loop_latency
+ */
+typedef enum {
+    LATENCY_Read,       /* stream read, from call to completion */
+    LATENCY_Write,      /* stream write, from call to completion */
+    LATENCY_Accept,     /* tcp accept, from call to new connection */
+    LATENCY_Connect,    /* tcp connect, from call to completion */
+    LATENCY_Queue,      /* posted task, from post to start */
+    LATENCY_Timer,      /* sleep, from due time to wakeup */
+    LATENCY_Rtt,        /* tcp round trip time, see tcp_info_period */
+    LATENCY_Count
+} api_latency_t;
+
+/*
+ * Copy latency histogram of loop, can be called from any thread.
+ * Copy races with loop, so some buckets may miss latest values
+ */
+API_EXTERN void api_loop_latency(api_loop_t* loop, api_latency_t kind,
+                                 api_histogram_t* histogram);
+
+API_EXTERN void api_histogram_reset(api_histogram_t* histogram);
+API_EXTERN void api_histogram_record(api_histogram_t* histogram,
+                                     uint64_t value);
+
+/*
+ * Add values of from to histogram, e.g. to get latency of all loops
+ */
+API_EXTERN void api_histogram_merge(api_histogram_t* histogram,
+                                    const api_histogram_t* from);
+
+/*
+ * Value below which given percent of recorded values are, 0 if none
+ */
+API_EXTERN uint64_t api_histogram_percentile(
+                        const api_histogram_t* histogram, double percent);
+
+/*
+ * Write rings of all loops started with trace_events to path as Chrome
+ * trace event JSON, loads in chrome://tracing and Perfetto
+ */
+API_EXTERN int api_trace_write(const char* path);
+
+/*
+ * Write rings as api_trace_write does when process crashes
+ */
+API_EXTERN int api_trace_on_crash(const char* path);
+
+#define API_STALL_FRAMES 32
+
+/*
+ * Loop found stalled by watchdog, see api_watchdog_start
+ */
+typedef struct api_loop_stall_t {
+    api_loop_t* loop;
+    void* task;                     /* running task, 0 for loop itself */
+    uint64_t stalled;               /* milliseconds since loop woke */
+    void* frames[API_STALL_FRAMES]; /* stack of loop thread */
+    int count;                      /* 0 if stack was not captured */
+} api_loop_stall_t;
+
+/*
+ * Receives stalls, called in watchdog thread so must not call api_*
+ * functions of any loop and should return quickly. Loop may have exited
+ * by the time sink runs, it only tells stalls apart
+ */
+typedef void (*api_watchdog_fn)(const api_loop_stall_t* stall, void* arg);
+
+/*
+ * Start thread checking every running loop, loop that has not come back
+ * to wait for events for threshold milliseconds is reported to sink
+ * once per stall. Null sink prints to stderr. Loops do nothing extra,
+ * watchdog reads the timestamp they publish before and after waiting
+ */
+API_EXTERN int api_watchdog_start(uint64_t threshold,
+                                  api_watchdog_fn sink, void* arg);
+
+/*
+ * Stop watchdog thread and wait for it to finish
+ */
+API_EXTERN void api_watchdog_stop();
+
+/*
+ * Start sampling cpu time of whole process frequency times per second
+ * of it, at most 10000. Samples are tagged with task and its callback,
+ * so they can be told apart even when stacks of many tasks look alike.
+ * Returns API_NOT_PERMITTED on windows
+ */
+API_EXTERN int api_profiler_start(int frequency);
+
+/*
+ * Stop sampling, samples are kept until profiler starts again
+ */
+API_EXTERN int api_profiler_stop();
+
+/*
+ * Write samples of stopped profiler to path in folded stacks format,
+ * root frame of each stack is callback task was started with. Link
+ * with -rdynamic so functions of executable have names
+ */
+API_EXTERN int api_profiler_write(const char* path);
+
+/*
+ * Index of loop in group to post next connection to
+ */
+API_EXTERN size_t api_loop_group_pick(api_loop_group_t* group,
+                                      api_loop_pick_t policy);
+
+/*
+ * Body of api_loop_parallel_for, called for subranges [begin, end)
+ */
+typedef void (*api_parallel_fn)(api_loop_t* loop, size_t begin,
+                                size_t end, void* arg);
+
+/*
+ * Body of api_loop_parallel_reduce, accumulates subrange [begin, end)
+ * into partial result of the loop it runs in
+ */
+typedef void (*api_reduce_fn)(api_loop_t* loop, size_t begin, size_t end,
+                              void* partial, void* arg);
+
+/*
+ * Merges partial result into result
+ */
+typedef void (*api_combine_fn)(void* result, const void* partial, void* arg);
+
+/*
+ * Split [begin, end) into chunks of grain items and run callback over
+ * them in the given loops, current task waits until all are done.
+ * Each loop gets one task which first takes chunks from its own share
+ * and then steals half of the remaining share of others, so busy loops
+ * do less. Loops may include current, its share runs in current task.
+ * Stopping current loop still waits for other loops to finish, then
+ * API_TERMINATE is returned
+ */
+API_EXTERN int api_loop_parallel_for(api_loop_t* current,
+                                    api_loop_t** loops, size_t count,
+                                    size_t begin, size_t end, size_t grain,
+                                    api_parallel_fn callback, void* arg);
+
+/*
+ * Same as api_loop_parallel_for, but each loop accumulates into its own
+ * copy of result, which are merged into result by combine at the end.
+ * Result must hold identity value on entry
+ */
+API_EXTERN int api_loop_parallel_reduce(api_loop_t* current,
+                                    api_loop_t** loops, size_t count,
+                                    size_t begin, size_t end, size_t grain,
+                                    void* result, size_t result_size,
+                                    api_reduce_fn callback,
+                                    api_combine_fn combine, void* arg);
+
+/*
+ * Blocking work run by api_loop_offload, it executes in a worker thread
+ * so must not call api_* functions of any loop
+ */
+typedef void (*api_offload_fn)(void* arg);
+
+/*
+ * Configure worker pool shared by all loops, threads 0 means number of
+ * cpus, queue_limit 0 means unlimited. Call before first offload,
+ * otherwise pool starts with defaults
+ */
+API_EXTERN int api_offload_init(int threads, size_t queue_limit);
+
+/*
+ * Run blocking callback in worker pool, only calling task is suspended
+ * and resumed in its loop when callback completes, stopping loop waits
+ * for it too. Returns API_LIMIT if queue limit reached, API_TERMINATE
+ * if loop is stopped
+ */
+API_EXTERN int api_loop_offload(api_loop_t* loop,
+                                api_offload_fn callback, void* arg);
+
+/*
+ * Snapshot of worker pool counters
+ */
+API_EXTERN void api_offload_stats(api_offload_stats_t* stats);
+
+/*
+ * Callback returning value for api_future_t
+ */
+typedef void* (*api_future_fn)(api_loop_t* loop, void* arg);
+
+/*
+ * Run callback as new parallel task in loop and return future of its
+ * result without waiting. Future is allocated from pool of current,
+ * wait and free it inside current loop
+ */
+API_EXTERN int api_future_post(api_future_t** future,
+                            api_loop_t* current, api_loop_t* loop,
+                            api_future_fn callback, void* arg,
+                            size_t stack_size);
+
+/*
+ * Wait for callback to complete and take its result to value,
+ * value can be 0. Pass 0 timeout to wait infinitely
+ */
+API_EXTERN int api_future_wait(api_future_t* future, void** value,
+                            uint64_t timeout);
+
+/*
+ * Wait until any of futures completes, its position stored to index.
+ * Only one task may wait on a future at a time, API_ALREADY_EXIST is
+ * returned if another one waits on any of futures
+ */
+API_EXTERN int api_future_wait_any(api_future_t** futures, size_t count,
+                                size_t* index, uint64_t timeout);
+
+/*
+ * Wait until all futures complete, timeout is for the whole set
+ */
+API_EXTERN int api_future_wait_all(api_future_t** futures, size_t count,
+                                uint64_t timeout);
+
+/*
+ * Returns non zero if callback completed
+ */
+API_EXTERN int api_future_done(api_future_t* future);
+
+/*
+ * Result of completed callback
+ */
+API_EXTERN void* api_future_value(api_future_t* future);
+
+/*
+ * Free future, if callback is still running its result is dropped
+ * and future is freed on completion
+ */
+API_EXTERN void api_future_free(api_future_t* future);
+
 /*
  * Call callback with new stack
  */
@@ -372,6 +963,13 @@ API_EXTERN int api_loop_call(api_loop_t* loop,
  */
 API_EXTERN int api_loop_run(api_loop_fn callback, void* arg, size_t stack_size);
 
+/*
+ * Same as api_loop_run with specified configuration
+ */
+API_EXTERN int api_loop_run_ex(api_loop_fn callback, void* arg,
+                                size_t stack_size,
+                                const api_loop_config_t* config);
+
 /*
  * Sleep current executing task in specified period of milliseconds
  */
@@ -387,17 +985,92 @@ API_EXTERN int api_loop_idle(api_loop_t* loop, uint64_t period);
 /*
  * Initialize event for signaling
  */
-API_EXTERN int api_event_init(api_event_t* ev, api_loop_t* loop);
+API_EXTERN int api_event_init(api_event_t* ev, api_event_mode_t mode);
+
+/*
+ * Set event signaled. Manual event releases all waits until reset,
+ * auto event releases one wait, now or the next one to come.
+ * Can be called from any thread
+ */
+API_EXTERN int api_event_signal(api_event_t* ev);
+
+/*
+ * Release all tasks waiting at the moment, event state is not changed.
+ * Can be called from any thread
+ */
+API_EXTERN int api_event_broadcast(api_event_t* ev);
+
+/*
+ * Set event not signaled
+ */
+API_EXTERN int api_event_reset(api_event_t* ev);
+
+/*
+ * Wait for signal, loop is the one in wich caller executes.
+ * Pass 0 timeout to wait infinitely, API_TIMEDOUT returned
+ * when period of milliseconds elapsed without signal
+ */
+API_EXTERN int api_event_wait(api_event_t* ev, api_loop_t* loop,
+                                uint64_t timeout);
+
+
+/*
+ * Create channel for items of item_size bytes, capacity is rounded up
+ * to power of two. Channel memory is not taken from loop pool
+ */
+API_EXTERN int api_channel_create(api_channel_t** channel,
+                                size_t item_size, size_t capacity);
+
+/*
+ * Free channel, no task may wait on it
+ */
+API_EXTERN void api_channel_free(api_channel_t* channel);
 
 /*
- * Increment signal count
+ * Wake up all waiting tasks, pending items still can be received.
+ * Send and receive on closed and drained channel return API_TERMINATE
  */
-API_EXTERN int api_event_signal(api_event_t* ev, api_loop_t* loop);
+API_EXTERN void api_channel_close(api_channel_t* channel);
 
 /*
- * Wait for signal
+ * Copy item into channel, waits while channel is full.
+ * loop is the one in wich caller executes, API_TERMINATE if
+ * channel is closed or loop is stopped while waiting
  */
-API_EXTERN int api_event_wait(api_event_t* ev, uint64_t timeout);
+API_EXTERN int api_channel_send(api_channel_t* channel, api_loop_t* loop,
+                                const void* item);
+
+/*
+ * Copy item out of channel, waits while channel is empty,
+ * API_TERMINATE if closed and drained or loop is stopped
+ */
+API_EXTERN int api_channel_recv(api_channel_t* channel, api_loop_t* loop,
+                                void* item);
+
+/*
+ * Send count items stored contiguously, receiver is woken once per
+ * batch. Returns number of items sent, less than count if closed
+ * or loop is stopped
+ */
+API_EXTERN size_t api_channel_send_batch(api_channel_t* channel,
+                                        api_loop_t* loop,
+                                        const void* items, size_t count);
+
+/*
+ * Wait for at least one item and receive up to count items.
+ * Returns number of items received, 0 if closed and drained
+ * or loop is stopped
+ */
+API_EXTERN size_t api_channel_recv_batch(api_channel_t* channel,
+                                        api_loop_t* loop,
+                                        void* items, size_t count);
+
+/*
+ * Non blocking variants, can be called from any thread.
+ * Return API_TEMPORARY_UNAVAILABLE when channel is full or empty
+ */
+API_EXTERN int api_channel_try_send(api_channel_t* channel, const void* item);
+API_EXTERN int api_channel_try_recv(api_channel_t* channel, void* item);
 
 
 /*
@@ -432,6 +1105,20 @@ API_EXTERN size_t api_stream_read_exact(api_stream_t* stream, char* buffer, size
 API_EXTERN size_t api_stream_unread(api_stream_t* stream,
                                     const char* buffer, size_t length);
 
+/*
+ * Read into buffer allocated from stream loop pool.
+ * Unreaded data is returned without copy.
+ * Returns 0 on failure, check stream.status fields for reason
+ */
+API_EXTERN api_buf_t* api_stream_read_buf(api_stream_t* stream,
+                                    size_t length);
+
+/*
+ * Put chain of buffers back to stream in front of unreaded data,
+ * stream takes ownership, no data copied
+ */
+API_EXTERN size_t api_stream_unread_buf(api_stream_t* stream, api_buf_t* buf);
+
 /*
  * Write to stream.
  * Returns amount of bytes writed.
@@ -441,6 +1128,12 @@ API_EXTERN size_t api_stream_unread(api_stream_t* stream,
 API_EXTERN size_t api_stream_write(api_stream_t* stream,
                                     const char* buffer, size_t length);
 
+/*
+ * Write chain of buffers, buffers remain owned by caller.
+ * Returns amount of bytes writed
+ */
+API_EXTERN size_t api_stream_write_buf(api_stream_t* stream, api_buf_t* buf);
+
 /*
  * Transfers from src to dst.
  * Like a proxy, read and write operations will run in parallel
@@ -451,6 +1144,22 @@ API_EXTERN int api_stream_transfer(api_stream_t* dst,
                                 size_t* transferred);
 
 
+/*
+ * Move stream attached to current loop into target loop and continue
+ * with callback in new task there. Calling task itself stays in current
+ * loop, its stack can not move, so it hands what it needs to callback.
+ * Stream must be idle, not read or written by other task, and its memory
+ * and filters must not come from current loop pool. Unread data moves
+ * along. Calling task must not touch stream after success. Callback
+ * checks stream.loop, if stream could not attach to target it is 0 and
+ * status.terminated or status.error tells why, stream can only be
+ * closed then.
+ * Not supported on windows
+ */
+API_EXTERN int api_stream_migrate(api_stream_t* stream, api_loop_t* target,
+                                  api_loop_fn callback, void* arg,
+                                  size_t stack_size);
+
 /*
  * Close stream
  */
@@ -476,6 +1185,16 @@ API_EXTERN int api_tcp_listen(api_tcp_listener_t* listener,
  */
 API_EXTERN int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp);
 
+/*
+ * Accept already pending tcp connection without waiting, returns
+ * API_TEMPORARY_UNAVAILABLE if there is none and API_BAD_FILE once
+ * listener is closed. Lets acceptor collect
+ * a burst of connections for api_loop_post_batch.
+ * On windows always returns API_TEMPORARY_UNAVAILABLE
+ */
+API_EXTERN int api_tcp_try_accept(api_tcp_listener_t* listener,
+                                api_tcp_t* tcp);
+
 /*
  * Stop listening for tcp connections and close listener
  */
@@ -490,6 +1209,13 @@ API_EXTERN int api_tcp_connect(api_tcp_t* tcp,
                                 const char* ip, int port,
                                 uint64_t timeout);
 
+/*
+ * Read transport state of connection into tcp info now, regardless of
+ * tcp_info_period. Returns API_NOT_PERMITTED if platform has no such
+ * query
+ */
+API_EXTERN int api_tcp_info_sample(api_tcp_t* tcp);
+
 /*
  *	udp
  */
@@ -538,6 +1264,11 @@ API_EXTERN int api_fs_listen(api_loop_t* loop, api_fs_event_t* options);
  */
 API_EXTERN uint64_t api_time_current();
 
+/*
+ * Get monotonic time in microseconds, for measuring intervals only
+ */
+API_EXTERN uint64_t api_time_precise();
+
 
 #ifdef __cplusplus
 } // extern "C"
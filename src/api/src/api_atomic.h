@@ -0,0 +1,166 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef API_ATOMIC_H_INCLUDED
+#define API_ATOMIC_H_INCLUDED
+
+#include "../include/api.h"
+
+/*
+ * Atomics shared by common code, all of them are full barriers,
+ * exchange is sequentially consistent unlike __sync_lock_test_and_set
+ * which is only an acquire barrier
+ */
+
+#ifndef API_CACHE_LINE
+#define API_CACHE_LINE 64
+#endif
+
+#if defined(__linux__)
+
+static int api_atomic_cas_long(volatile long* ptr, long old, long val)
+{
+    return __sync_bool_compare_and_swap(ptr, old, val);
+}
+
+static int api_atomic_cas_64(volatile int64_t* ptr, int64_t old, int64_t val)
+{
+    return __sync_bool_compare_and_swap(ptr, old, val);
+}
+
+static int api_atomic_cas_ptr(void* volatile* ptr, void* old, void* val)
+{
+    return __sync_bool_compare_and_swap(ptr, old, val);
+}
+
+static long api_atomic_xchg_long(volatile long* ptr, long val)
+{
+    return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static void* api_atomic_xchg_ptr(void* volatile* ptr, void* val)
+{
+    return __atomic_exchange_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+static long api_atomic_add_long(volatile long* ptr, long val)
+{
+    return __sync_add_and_fetch(ptr, val);
+}
+
+static int64_t api_atomic_add_64(volatile int64_t* ptr, int64_t val)
+{
+    return __sync_add_and_fetch(ptr, val);
+}
+
+static void api_atomic_barrier()
+{
+    __sync_synchronize();
+}
+
+static void api_cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Cheap monotonic tick counter, rate is not known up front
+ */
+static uint64_t api_cycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return api_time_precise();
+#endif
+}
+
+#else
+
+#include <intrin.h>
+
+static int api_atomic_cas_long(volatile long* ptr, long old, long val)
+{
+    return InterlockedCompareExchange(ptr, val, old) == old;
+}
+
+static int api_atomic_cas_64(volatile int64_t* ptr, int64_t old, int64_t val)
+{
+    return InterlockedCompareExchange64(ptr, val, old) == old;
+}
+
+static int api_atomic_cas_ptr(void* volatile* ptr, void* old, void* val)
+{
+    return InterlockedCompareExchangePointer(ptr, val, old) == old;
+}
+
+static long api_atomic_xchg_long(volatile long* ptr, long val)
+{
+    return InterlockedExchange(ptr, val);
+}
+
+static void* api_atomic_xchg_ptr(void* volatile* ptr, void* val)
+{
+    return InterlockedExchangePointer(ptr, val);
+}
+
+static long api_atomic_add_long(volatile long* ptr, long val)
+{
+    return InterlockedAdd(ptr, val);
+}
+
+static int64_t api_atomic_add_64(volatile int64_t* ptr, int64_t val)
+{
+    return InterlockedAdd64(ptr, val);
+}
+
+static void api_atomic_barrier()
+{
+    MemoryBarrier();
+}
+
+static void api_cpu_relax()
+{
+    YieldProcessor();
+}
+
+static uint64_t api_cycles()
+{
+#if defined(_M_IX86) || defined(_M_X64)
+    return __rdtsc();
+#else
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return (uint64_t)ticks.QuadPart;
+#endif
+}
+
+#endif
+
+#endif // API_ATOMIC_H_INCLUDED
\ No newline at end of file
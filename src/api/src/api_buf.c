@@ -0,0 +1,122 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <memory.h>
+
+#include "api_pool.h"
+
+/*
+ * Block memory layout: api_buf_block_t, first api_buf_t, data.
+ * Slices allocate only api_buf_t and reference the block
+ */
+typedef struct api_buf_block_t {
+    api_pool_t* pool;
+    size_t refs;
+    size_t size;
+} api_buf_block_t;
+
+#define api_buf_embedded(block) ((api_buf_t*)((block) + 1))
+
+api_buf_t* api_buf_alloc(api_pool_t* pool, size_t size)
+{
+    size_t total = sizeof(api_buf_block_t) + sizeof(api_buf_t) + size;
+    api_buf_block_t* block = (api_buf_block_t*)api_alloc(pool, total);
+    api_buf_t* buf;
+
+    if (block == 0)
+        return 0;
+
+    block->pool = pool;
+    block->refs = 1;
+    block->size = total;
+
+    buf = api_buf_embedded(block);
+    buf->next = 0;
+    buf->block = block;
+    buf->data = (char*)(buf + 1);
+    buf->length = 0;
+    buf->size = size;
+
+    return buf;
+}
+
+api_buf_t* api_buf_slice(api_buf_t* buf, size_t offset, size_t length)
+{
+    api_buf_t* slice;
+
+    if (offset > buf->length || length > buf->length - offset)
+        return 0;
+
+    slice = (api_buf_t*)api_alloc(buf->block->pool, sizeof(*slice));
+    if (slice == 0)
+        return 0;
+
+    ++buf->block->refs;
+
+    slice->next = 0;
+    slice->block = buf->block;
+    slice->data = buf->data + offset;
+    slice->length = length;
+    slice->size = length;
+
+    return slice;
+}
+
+int api_buf_shared(api_buf_t* buf)
+{
+    return buf->block->refs > 1;
+}
+
+void api_buf_free(api_buf_t* buf)
+{
+    api_buf_block_t* block = buf->block;
+
+    if (buf != api_buf_embedded(block))
+        api_free(block->pool, sizeof(*buf), buf);
+
+    if (--block->refs == 0)
+        api_free(block->pool, block->size, block);
+}
+
+void api_buf_free_chain(api_buf_t* buf)
+{
+    api_buf_t* next;
+
+    while (buf != 0)
+    {
+        next = buf->next;
+        api_buf_free(buf);
+        buf = next;
+    }
+}
+
+size_t api_buf_chain_length(api_buf_t* buf)
+{
+    size_t length = 0;
+
+    while (buf != 0)
+    {
+        length += buf->length;
+        buf = buf->next;
+    }
+
+    return length;
+}
\ No newline at end of file
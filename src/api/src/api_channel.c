@@ -0,0 +1,411 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <memory.h>
+#include <malloc.h>
+
+#include "api_loop_base.h"
+#include "api_task.h"
+#include "api_atomic.h"
+
+/*
+ * Bounded ring of Dmitry Vyukov, each slot carries sequence number
+ * telling whether it is free for position or holds item of position.
+ * Producer and consumer positions sit on separate cache lines.
+ *
+ * Waiting receiver is published with a flag, sender clearing the flag
+ * owns the wakeup. Waiting senders are pushed to a lock free stack
+ * which is taken whole by receiver when it frees slots.
+ * Tasks are woken through async queue of their own loop. Waiter of
+ * terminated loop takes its record back, or if it was already taken,
+ * absorbs the wakeup on the way, as event waiters do
+ */
+
+typedef struct api_channel_slot_t {
+    volatile int64_t sequence;
+} api_channel_slot_t;
+
+typedef struct api_channel_waiter_t {
+    struct api_channel_waiter_t* next;
+    api_loop_t* loop;
+    api_task_t* task;
+} api_channel_waiter_t;
+
+struct api_channel_t {
+    char pad0[API_CACHE_LINE];
+    volatile int64_t enqueue;
+    char pad1[API_CACHE_LINE - sizeof(int64_t)];
+    volatile int64_t dequeue;
+    char pad2[API_CACHE_LINE - sizeof(int64_t)];
+    api_channel_waiter_t* volatile senders;
+    volatile long receiving;
+    api_loop_t* receiver_loop;
+    api_task_t* receiver;
+    char pad3[API_CACHE_LINE];
+    volatile long closed;
+    size_t mask;
+    size_t item_size;
+    size_t slot_size;
+    char* slots;
+};
+
+extern int api_async_wakeup(api_loop_t* loop, api_task_t* task);
+
+#define api_channel_slot(channel, position) \
+    ((api_channel_slot_t*)((channel)->slots + \
+        ((size_t)(position) & (channel)->mask) * (channel)->slot_size))
+
+int api_channel_create(api_channel_t** channel,
+                       size_t item_size, size_t capacity)
+{
+    api_channel_t* ch;
+    api_channel_slot_t* slot;
+    size_t size = 2;
+    size_t i;
+
+    *channel = 0;
+
+    if (item_size == 0 || capacity == 0)
+        return API__INVALID_ARGUMENT;
+
+    while (size < capacity)
+        size <<= 1;
+
+    ch = (api_channel_t*)malloc(sizeof(*ch));
+    if (ch == 0)
+        return API__NO_MEMORY;
+
+    memset(ch, 0, sizeof(*ch));
+    ch->mask = size - 1;
+    ch->item_size = item_size;
+    ch->slot_size = (sizeof(api_channel_slot_t) + item_size + 7) & ~(size_t)7;
+
+    ch->slots = (char*)malloc(size * ch->slot_size);
+    if (ch->slots == 0)
+    {
+        free(ch);
+        return API__NO_MEMORY;
+    }
+
+    for (i = 0; i < size; ++i)
+    {
+        slot = api_channel_slot(ch, i);
+        slot->sequence = (int64_t)i;
+    }
+
+    *channel = ch;
+    return API__OK;
+}
+
+void api_channel_free(api_channel_t* channel)
+{
+    free(channel->slots);
+    free(channel);
+}
+
+static int api_channel_push(api_channel_t* channel, const void* item)
+{
+    api_channel_slot_t* slot;
+    int64_t position = channel->enqueue;
+    int64_t diff;
+
+    while (1)
+    {
+        slot = api_channel_slot(channel, position);
+        diff = slot->sequence - position;
+
+        if (diff == 0)
+        {
+            if (api_atomic_cas_64(&channel->enqueue, position, position + 1))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return 0;
+        }
+
+        position = channel->enqueue;
+    }
+
+    memcpy(slot + 1, item, channel->item_size);
+    api_atomic_barrier();
+    slot->sequence = position + 1;
+
+    return 1;
+}
+
+static int api_channel_pop(api_channel_t* channel, void* item)
+{
+    api_channel_slot_t* slot;
+    int64_t position = channel->dequeue;
+    int64_t diff;
+
+    while (1)
+    {
+        slot = api_channel_slot(channel, position);
+        diff = slot->sequence - (position + 1);
+
+        if (diff == 0)
+        {
+            if (api_atomic_cas_64(&channel->dequeue, position, position + 1))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return 0;
+        }
+
+        position = channel->dequeue;
+    }
+
+    api_atomic_barrier();
+    memcpy(item, slot + 1, channel->item_size);
+    api_atomic_barrier();
+    slot->sequence = position + channel->mask + 1;
+
+    return 1;
+}
+
+static int api_channel_full(api_channel_t* channel)
+{
+    int64_t position = channel->enqueue;
+    
+    return api_channel_slot(channel, position)->sequence != position;
+}
+
+static int api_channel_empty(api_channel_t* channel)
+{
+    int64_t position = channel->dequeue;
+    
+    return api_channel_slot(channel, position)->sequence != position + 1;
+}
+
+/*
+ * Barriers order publishing of slot before reading of waiters,
+ * waiters publish themselves before checking slots
+ */
+
+static void api_channel_wakeup_receiver(api_channel_t* channel)
+{
+    api_atomic_barrier();
+
+    if (channel->receiving &&
+        api_atomic_cas_long(&channel->receiving, 1, 0))
+        api_async_wakeup(channel->receiver_loop, channel->receiver);
+}
+
+/* wake all taken senders except skip, returns 1 if skip was taken */
+static int api_channel_wakeup_senders(api_channel_t* channel,
+                                      api_channel_waiter_t* skip)
+{
+    api_channel_waiter_t* waiter;
+    api_channel_waiter_t* next;
+    int found = 0;
+
+    api_atomic_barrier();
+
+    if (channel->senders == 0)
+        return 0;
+
+    waiter = (api_channel_waiter_t*)
+        api_atomic_xchg_ptr((void* volatile*)&channel->senders, 0);
+
+    while (waiter != 0)
+    {
+        /* waiter frame is gone once its task runs */
+        next = waiter->next;
+
+        if (waiter == skip)
+            found = 1;
+        else
+            api_async_wakeup(waiter->loop, waiter->task);
+
+        waiter = next;
+    }
+
+    return found;
+}
+
+static int api_channel_wait_send(api_channel_t* channel, api_loop_t* loop)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    api_channel_waiter_t waiter;
+    api_task_t* task = base->scheduler.current;
+
+    waiter.loop = loop;
+    waiter.task = task;
+
+    do
+    {
+        waiter.next = channel->senders;
+    }
+    while (!api_atomic_cas_ptr((void* volatile*)&channel->senders,
+                                waiter.next, &waiter));
+
+    /*
+     * Slot freed before we were seen, take the stack ourselves.
+     * Every waiter on it, us included, gets exactly one wakeup
+     */
+    if (!api_channel_full(channel) || channel->closed)
+        api_channel_wakeup_senders(channel, 0);
+
+    api_loop_sleep_task(base, task);
+
+    if (!base->terminated)
+        return API__OK;
+
+    /* record is still on the stack or its wakeup is on the way */
+    if (!api_channel_wakeup_senders(channel, &waiter))
+        api_loop_absorb_task(base, task);
+
+    return API__TERMINATE;
+}
+
+static int api_channel_wait_recv(api_channel_t* channel, api_loop_t* loop)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    api_task_t* task = base->scheduler.current;
+
+    channel->receiver_loop = loop;
+    channel->receiver = task;
+    api_atomic_xchg_long(&channel->receiving, 1);
+
+    /* item arrived meanwhile, sleep only if a sender took the wakeup */
+    if (!api_channel_empty(channel) || channel->closed)
+    {
+        if (api_atomic_cas_long(&channel->receiving, 1, 0))
+            return API__OK;
+    }
+
+    api_loop_sleep_task(base, task);
+
+    if (!base->terminated)
+        return API__OK;
+
+    /* sender clearing the flag first owns the wakeup */
+    if (!api_atomic_cas_long(&channel->receiving, 1, 0))
+        api_loop_absorb_task(base, task);
+
+    return API__TERMINATE;
+}
+
+int api_channel_try_send(api_channel_t* channel, const void* item)
+{
+    if (channel->closed)
+        return API__TERMINATE;
+
+    if (!api_channel_push(channel, item))
+        return API__TEMPORARY_UNAVAILABLE;
+
+    api_channel_wakeup_receiver(channel);
+    return API__OK;
+}
+
+int api_channel_try_recv(api_channel_t* channel, void* item)
+{
+    if (!api_channel_pop(channel, item))
+        return channel->closed ? API__TERMINATE : API__TEMPORARY_UNAVAILABLE;
+
+    api_channel_wakeup_senders(channel, 0);
+    return API__OK;
+}
+
+size_t api_channel_send_batch(api_channel_t* channel, api_loop_t* loop,
+                              const void* items, size_t count)
+{
+    const char* item = (const char*)items;
+    size_t sent = 0;
+
+    while (sent < count && !channel->closed)
+    {
+        if (api_channel_push(channel, item))
+        {
+            item += channel->item_size;
+            ++sent;
+            continue;
+        }
+
+        /* receiver must drain before we can go on */
+        api_channel_wakeup_receiver(channel);
+        if (API__OK != api_channel_wait_send(channel, loop))
+            break;
+    }
+
+    if (sent > 0)
+        api_channel_wakeup_receiver(channel);
+
+    return sent;
+}
+
+size_t api_channel_recv_batch(api_channel_t* channel, api_loop_t* loop,
+                              void* items, size_t count)
+{
+    char* item = (char*)items;
+    size_t received = 0;
+
+    if (count == 0)
+        return 0;
+
+    while (1)
+    {
+        while (received < count && api_channel_pop(channel, item))
+        {
+            item += channel->item_size;
+            ++received;
+        }
+
+        if (received > 0 || channel->closed)
+            break;
+
+        if (API__OK != api_channel_wait_recv(channel, loop))
+            break;
+    }
+
+    if (received > 0)
+        api_channel_wakeup_senders(channel, 0);
+
+    return received;
+}
+
+int api_channel_send(api_channel_t* channel, api_loop_t* loop,
+                     const void* item)
+{
+    if (api_channel_send_batch(channel, loop, item, 1) == 1)
+        return API__OK;
+
+    return API__TERMINATE;
+}
+
+int api_channel_recv(api_channel_t* channel, api_loop_t* loop, void* item)
+{
+    if (api_channel_recv_batch(channel, loop, item, 1) == 1)
+        return API__OK;
+
+    return API__TERMINATE;
+}
+
+void api_channel_close(api_channel_t* channel)
+{
+    api_atomic_xchg_long(&channel->closed, 1);
+
+    api_channel_wakeup_receiver(channel);
+    api_channel_wakeup_senders(channel, 0);
+}
\ No newline at end of file
@@ -0,0 +1,182 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <memory.h>
+
+#include "api_loop_base.h"
+#include "api_task.h"
+#include "api_timer.h"
+#include "api_atomic.h"
+
+/*
+ * Waiting task pushes record from its own frame to lock free stack.
+ * Signaler takes the whole stack at once and wakes every record
+ * exactly once, woken tasks check the event again.
+ * Record must not leave the stack unseen, so timed out waiter takes
+ * the stack itself and, if its record was already taken by someone
+ * else, sleeps once more to absorb the wakeup on the way. Waiter of
+ * terminated loop absorbs too, task must outlive its queued wakeup
+ */
+typedef struct api_event_waiter_t {
+    struct api_event_waiter_t* next;
+    api_loop_t* loop;
+    api_task_t* task;
+} api_event_waiter_t;
+
+extern int api_async_wakeup(api_loop_t* loop, api_task_t* task);
+
+int api_event_init(api_event_t* ev, api_event_mode_t mode)
+{
+    memset(ev, 0, sizeof(*ev));
+
+    ev->mode = mode;
+
+    return API__OK;
+}
+
+/* wake all taken records except skip, returns 1 if skip was taken */
+static int api_event_wakeup(api_event_t* ev, api_event_waiter_t* skip)
+{
+    api_event_waiter_t* waiter;
+    api_event_waiter_t* next;
+    int found = 0;
+
+    api_atomic_barrier();
+
+    if (ev->waiters == 0)
+        return 0;
+
+    waiter = (api_event_waiter_t*)api_atomic_xchg_ptr(&ev->waiters, 0);
+
+    while (waiter != 0)
+    {
+        /* waiter frame is gone once its task runs */
+        next = waiter->next;
+
+        if (waiter == skip)
+            found = 1;
+        else
+            api_async_wakeup(waiter->loop, waiter->task);
+
+        waiter = next;
+    }
+
+    return found;
+}
+
+int api_event_signal(api_event_t* ev)
+{
+    api_atomic_xchg_long(&ev->signaled, 1);
+    api_event_wakeup(ev, 0);
+
+    return API__OK;
+}
+
+int api_event_broadcast(api_event_t* ev)
+{
+    api_atomic_add_long(&ev->generation, 1);
+    api_event_wakeup(ev, 0);
+
+    return API__OK;
+}
+
+int api_event_reset(api_event_t* ev)
+{
+    api_atomic_xchg_long(&ev->signaled, 0);
+
+    return API__OK;
+}
+
+static int api_event_try(api_event_t* ev, long generation)
+{
+    if (ev->mode == EVENT_Auto)
+    {
+        if (ev->signaled && api_atomic_cas_long(&ev->signaled, 1, 0))
+            return 1;
+    }
+    else if (ev->signaled)
+    {
+        return 1;
+    }
+
+    return ev->generation != generation;
+}
+
+/* take own record back, it is either found or its wakeup is absorbed */
+static void api_event_leave(api_event_t* ev, api_event_waiter_t* waiter)
+{
+    api_loop_base_t* base = (api_loop_base_t*)waiter->loop;
+
+    if (!api_event_wakeup(ev, waiter))
+        api_loop_absorb_task(base, waiter->task);
+}
+
+int api_event_wait(api_event_t* ev, api_loop_t* loop, uint64_t timeout)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    long generation = ev->generation;
+    api_event_waiter_t waiter;
+    api_timer_t timer;
+
+    waiter.loop = loop;
+    waiter.task = base->scheduler.current;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.task = waiter.task;
+
+    if (timeout > 0)
+        api_timer_set(&base->sleeps, &timer, TIMER_Sleep, timeout);
+
+    while (!api_event_try(ev, generation))
+    {
+        if (base->terminated)
+        {
+            api_timer_set(&base->sleeps, &timer, TIMER_Sleep, 0);
+            return API__TERMINATE;
+        }
+
+        if (timer.elapsed)
+            return API__TIMEDOUT;
+
+        do
+        {
+            waiter.next = (api_event_waiter_t*)ev->waiters;
+        }
+        while (!api_atomic_cas_ptr(&ev->waiters, waiter.next, &waiter));
+
+        /* signaled meanwhile */
+        if (api_event_try(ev, generation))
+        {
+            api_event_leave(ev, &waiter);
+            break;
+        }
+
+        api_loop_sleep_task(base, waiter.task);
+
+        /* timer or terminate woke us, record may still be on stack */
+        if (timer.elapsed || base->terminated)
+            api_event_leave(ev, &waiter);
+    }
+
+    api_timer_set(&base->sleeps, &timer, TIMER_Sleep, 0);
+
+    return API__OK;
+}
\ No newline at end of file
@@ -0,0 +1,317 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <memory.h>
+#include <stdlib.h>
+
+#include "api_loop_base.h"
+#include "api_task.h"
+#include "api_timer.h"
+#include "api_atomic.h"
+
+/*
+ * Future state is a single pointer exchanged by completing loop:
+ * 0 - running, nobody waits
+ * waiter - running, task of owner loop waits on it
+ * FUTURE_DONE - completed, value is set
+ * FUTURE_ABANDONED - freed by owner before completion
+ *
+ * Only one task may wait on a future at a time.
+ * Waiter is allocated by waiting task. Completing loop wakes it only
+ * if it wins armed flag, refs counts waiting task and futures still
+ * able to touch it, the last one to release it frees it
+ */
+
+#define FUTURE_DONE ((void*)1)
+#define FUTURE_ABANDONED ((void*)2)
+
+typedef struct api_future_waiter_t {
+    api_loop_t* loop;
+    api_task_t* task;
+    volatile long armed;
+    volatile long refs;
+} api_future_waiter_t;
+
+struct api_future_t {
+    api_loop_t* owner;
+    api_future_fn callback;
+    void* arg;
+    void* value;
+    void* volatile state;
+};
+
+extern int api_async_wakeup(api_loop_t* loop, api_task_t* task);
+
+static void api_future_waiter_release(api_future_waiter_t* waiter)
+{
+    if (api_atomic_add_long(&waiter->refs, -1) == 0)
+        free(waiter);
+}
+
+static void api_future_release(api_loop_t* loop, void* arg)
+{
+    api_free(api_pool_default(loop), sizeof(api_future_t), arg);
+}
+
+static void api_future_run(api_loop_t* loop, void* arg)
+{
+    api_future_t* future = (api_future_t*)arg;
+    api_future_waiter_t* waiter;
+
+    future->value = future->callback(loop, future->arg);
+
+    /* future may be freed right after exchange */
+    waiter = (api_future_waiter_t*)
+                api_atomic_xchg_ptr(&future->state, FUTURE_DONE);
+
+    if (waiter == FUTURE_ABANDONED)
+    {
+        /* pool is not thread safe, owner frees it */
+        api_loop_post(future->owner, api_future_release, future, 0);
+    }
+    else if (waiter != 0)
+    {
+        if (api_atomic_cas_long(&waiter->armed, 1, 0))
+            api_async_wakeup(waiter->loop, waiter->task);
+
+        api_future_waiter_release(waiter);
+    }
+}
+
+int api_future_post(api_future_t** future,
+                    api_loop_t* current, api_loop_t* loop,
+                    api_future_fn callback, void* arg, size_t stack_size)
+{
+    api_future_t* f;
+    int error;
+
+    *future = 0;
+
+    f = (api_future_t*)api_alloc(api_pool_default(current), sizeof(*f));
+    if (f == 0)
+        return API__NO_MEMORY;
+
+    f->owner = current;
+    f->callback = callback;
+    f->arg = arg;
+    f->value = 0;
+    f->state = 0;
+
+    error = api_loop_post(loop, api_future_run, f, stack_size);
+    if (error != API__OK)
+    {
+        api_free(api_pool_default(current), sizeof(*f), f);
+        return error;
+    }
+
+    *future = f;
+    return API__OK;
+}
+
+int api_future_done(api_future_t* future)
+{
+    return future->state == FUTURE_DONE;
+}
+
+void* api_future_value(api_future_t* future)
+{
+    return future->value;
+}
+
+void api_future_free(api_future_t* future)
+{
+    if (future->state == 0 &&
+        api_atomic_cas_ptr(&future->state, 0, FUTURE_ABANDONED))
+        return;
+
+    api_free(api_pool_default(future->owner), sizeof(*future), future);
+}
+
+static int api_future_find_done(api_future_t** futures, size_t count,
+                                size_t* index)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (futures[i]->state == FUTURE_DONE)
+        {
+            if (index != 0)
+                *index = i;
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int api_future_wait_any(api_future_t** futures, size_t count,
+                        size_t* index, uint64_t timeout)
+{
+    api_loop_base_t* base;
+    api_future_waiter_t* waiter;
+    api_timer_t timer;
+    size_t registered = 0;
+    void* state;
+    int woken = 0;
+    int done = 0;
+    int error = API__OK;
+    size_t i;
+
+    if (count == 0)
+        return API__INVALID_ARGUMENT;
+
+    if (api_future_find_done(futures, count, index))
+        return API__OK;
+
+    base = (api_loop_base_t*)futures[0]->owner;
+
+    if (base->terminated)
+        return API__TERMINATE;
+
+    waiter = (api_future_waiter_t*)malloc(sizeof(*waiter));
+    if (waiter == 0)
+        return API__NO_MEMORY;
+
+    waiter->loop = futures[0]->owner;
+    waiter->task = base->scheduler.current;
+    waiter->armed = 1;
+    waiter->refs = 1;
+
+    for (i = 0; i < count; ++i)
+    {
+        api_atomic_add_long(&waiter->refs, 1);
+
+        while (!api_atomic_cas_ptr(&futures[i]->state, 0, waiter))
+        {
+            state = futures[i]->state;
+
+            /* previous waiter is leaving, try again */
+            if (state == 0)
+                continue;
+
+            api_atomic_add_long(&waiter->refs, -1);
+
+            /* same future given twice, keeps single reference */
+            if (state == waiter)
+                break;
+
+            /* not completed meanwhile, another task waits on it */
+            if (state != FUTURE_DONE && state != FUTURE_ABANDONED)
+                error = API__ALREADY_EXIST;
+
+            done = 1;
+            break;
+        }
+
+        if (done)
+            break;
+
+        ++registered;
+    }
+
+    if (!done)
+    {
+        memset(&timer, 0, sizeof(timer));
+        timer.task = waiter->task;
+
+        if (timeout > 0)
+            api_timer_set(&base->sleeps, &timer, TIMER_Sleep, timeout);
+
+        api_loop_sleep_task(base, waiter->task);
+
+        woken = !timer.elapsed && !base->terminated;
+        api_timer_set(&base->sleeps, &timer, TIMER_Sleep, 0);
+    }
+
+    /*
+     * Completion which won armed flag wakes us, absorb it.
+     * Terminated loop too, task must outlive the queued wakeup
+     */
+    if (!woken && !api_atomic_cas_long(&waiter->armed, 1, 0))
+        api_loop_absorb_task(base, waiter->task);
+
+    /* futures taken back drop their references, completing ones do later */
+    for (i = 0; i < registered; ++i)
+    {
+        if (api_atomic_cas_ptr(&futures[i]->state, waiter, 0))
+            api_atomic_add_long(&waiter->refs, -1);
+    }
+
+    api_future_waiter_release(waiter);
+
+    if (error != API__OK)
+        return error;
+
+    if (api_future_find_done(futures, count, index))
+        return API__OK;
+
+    if (base->terminated)
+        return API__TERMINATE;
+
+    return API__TIMEDOUT;
+}
+
+int api_future_wait(api_future_t* future, void** value, uint64_t timeout)
+{
+    int error = api_future_wait_any(&future, 1, 0, timeout);
+
+    if (error == API__OK && value != 0)
+        *value = future->value;
+
+    return error;
+}
+
+int api_future_wait_all(api_future_t** futures, size_t count,
+                        uint64_t timeout)
+{
+    uint64_t deadline = api_time_current() + timeout;
+    uint64_t now;
+    int error;
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (timeout > 0)
+        {
+            now = api_time_current();
+            if (now >= deadline)
+            {
+                if (!api_future_done(futures[i]))
+                    return API__TIMEDOUT;
+
+                continue;
+            }
+
+            error = api_future_wait_any(&futures[i], 1, 0, deadline - now);
+        }
+        else
+        {
+            error = api_future_wait_any(&futures[i], 1, 0, 0);
+        }
+
+        if (error != API__OK)
+            return error;
+    }
+
+    return API__OK;
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <memory.h>
+
+#include "api_loop_base.h"
+
+#if !defined(__linux__)
+#include <intrin.h>
+#endif
+
+/* values above are counted in last bucket */
+#define API_HISTOGRAM_MAX ((uint64_t)1 << 40)
+
+static int api_histogram_msb(uint64_t value)
+{
+#if defined(__linux__)
+    return 63 - __builtin_clzll(value);
+#else
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#endif
+}
+
+/*
+ * Values below 2 * SUB have bucket each, above that bucket holds
+ * values with same top 6 bits
+ */
+static size_t api_histogram_index(uint64_t value)
+{
+    int shift;
+
+    if (value < 2 * API_HISTOGRAM_SUB)
+        return (size_t)value;
+
+    if (value >= API_HISTOGRAM_MAX)
+        value = API_HISTOGRAM_MAX - 1;
+
+    shift = api_histogram_msb(value) - 5;
+
+    return (size_t)shift * API_HISTOGRAM_SUB + (size_t)(value >> shift);
+}
+
+/*
+ * Largest value that falls into bucket
+ */
+static uint64_t api_histogram_highest(size_t index)
+{
+    int shift;
+    uint64_t mantissa;
+
+    if (index < 2 * API_HISTOGRAM_SUB)
+        return (uint64_t)index;
+
+    shift = (int)(index / API_HISTOGRAM_SUB) - 1;
+    mantissa = (uint64_t)(index - (size_t)shift * API_HISTOGRAM_SUB);
+
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void api_histogram_reset(api_histogram_t* histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+void api_histogram_record(api_histogram_t* histogram, uint64_t value)
+{
+    if (histogram->count == 0 || value < histogram->min)
+        histogram->min = value;
+
+    if (value > histogram->max)
+        histogram->max = value;
+
+    histogram->count += 1;
+    histogram->sum += value;
+    histogram->buckets[api_histogram_index(value)] += 1;
+}
+
+void api_histogram_merge(api_histogram_t* histogram,
+                         const api_histogram_t* from)
+{
+    size_t i;
+
+    if (from->count == 0)
+        return;
+
+    if (histogram->count == 0 || from->min < histogram->min)
+        histogram->min = from->min;
+
+    if (from->max > histogram->max)
+        histogram->max = from->max;
+
+    histogram->count += from->count;
+    histogram->sum += from->sum;
+
+    for (i = 0; i < API_HISTOGRAM_BUCKETS; ++i)
+        histogram->buckets[i] += from->buckets[i];
+}
+
+uint64_t api_histogram_percentile(const api_histogram_t* histogram,
+                                  double percent)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    uint64_t value;
+    size_t i;
+
+    if (histogram->count == 0)
+        return 0;
+
+    if (percent >= 100.0)
+        return histogram->max;
+
+    rank = (uint64_t)(percent / 100.0 * (double)histogram->count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    for (i = 0; i < API_HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            value = api_histogram_highest(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+void api_loop_latency(api_loop_t* loop, api_latency_t kind,
+                      api_histogram_t* histogram)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+
+    memcpy(histogram, &base->latency[kind], sizeof(*histogram));
+}
\ No newline at end of file
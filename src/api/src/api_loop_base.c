@@ -21,6 +21,8 @@
 
 #include "api_loop_base.h"
 #include "api_task.h"
+#include "api_atomic.h"
+#include "api_trace.h"
 
 typedef struct api_call_t {
     api_loop_t* loop;
@@ -39,9 +41,13 @@ void* api_call_task_fn(api_task_t* task)
 uint64_t api_loop_calculate_wait_timeout(api_loop_base_t* loop)
 {
     uint64_t timeout = (uint64_t)-1;
-    uint64_t timeout_sleep = api_timers_nearest_event(&loop->sleeps, loop->now);
-    uint64_t timeout_idle = api_timers_nearest_event(&loop->idles, loop->now);
-    uint64_t timeout_timeout = api_timers_nearest_event(&loop->timeouts, loop->now);
+    uint64_t inactive = loop->now - loop->last_activity;
+    uint64_t timeout_sleep = api_timers_nearest_event(&loop->sleeps,
+                                                TIMER_Sleep, loop->now);
+    uint64_t timeout_idle = api_timers_nearest_event(&loop->idles,
+                                                TIMER_Idle, inactive);
+    uint64_t timeout_timeout = api_timers_nearest_event(&loop->timeouts,
+                                                TIMER_Timeout, inactive);
 
     if (timeout_sleep < timeout)
         timeout = timeout_sleep;
@@ -55,6 +61,192 @@ uint64_t api_loop_calculate_wait_timeout(api_loop_base_t* loop)
     return timeout;
 }
 
+void api_loop_load_wait(api_loop_base_t* loop)
+{
+    api_scheduler_t* scheduler = &loop->scheduler;
+    uint64_t now = api_time_precise();
+
+    /* only touch shared line when changed */
+    if (loop->load.tasks != (uint32_t)scheduler->tasks)
+        loop->load.tasks = (uint32_t)scheduler->tasks;
+
+    if (loop->load.streams != loop->streams)
+        loop->load.streams = loop->streams;
+
+    if (loop->load.started == 0)
+        loop->load.started = now;
+
+    /* task counters are kept by scheduler, it does not know its loop */
+    loop->load.created = scheduler->created;
+    loop->load.completed = scheduler->completed;
+    loop->load.switches = scheduler->switches;
+    loop->load.timers = loop->sleeps.fired + loop->idles.fired +
+                        loop->timeouts.fired;
+    ++loop->load.iterations;
+
+    loop->load.since = now << 1 | 1;
+}
+
+void api_loop_load_wake(api_loop_base_t* loop, int events)
+{
+    uint64_t now = api_time_precise();
+    uint64_t elapsed;
+
+    loop->load.blocked += now - (loop->load.since >> 1);
+
+    api_trace(&loop->scheduler, TRACE_Poll, 0, 0, 0,
+              events > 0 ? (uint32_t)events : 0);
+
+    if (events > 0)
+    {
+        loop->load.events += (uint64_t)events;
+        if (loop->load.events_max < (uint64_t)events)
+            loop->load.events_max = (uint64_t)events;
+    }
+
+    /* first wake opens the window, time blocked before it is not counted */
+    if (loop->window == 0)
+    {
+        loop->load.since = now << 1;
+        loop->window = now;
+        return;
+    }
+
+    loop->idle += now - (loop->load.since >> 1);
+    loop->load.since = now << 1;
+
+    elapsed = now - loop->window;
+    if (elapsed < API_LOAD_WINDOW)
+        return;
+
+    if (loop->idle > elapsed)
+        loop->idle = elapsed;
+
+    loop->load.utilisation = (uint32_t)
+                            ((elapsed - loop->idle) * 1000 / elapsed);
+
+    loop->window = now;
+    loop->idle = 0;
+}
+
+void api_loop_sleep_task(api_loop_base_t* loop, api_task_t* task)
+{
+    api_loop_waiting_t waiting;
+
+    if (loop->terminated)
+        return;
+
+    waiting.task = task;
+    api_list_push_tail(&loop->waiting, &waiting.node);
+
+    api_task_sleep(task);
+
+    api_list_remove(&loop->waiting, &waiting.node);
+}
+
+void api_loop_terminate_waiting(api_loop_base_t* loop)
+{
+    api_loop_waiting_t* waiting;
+
+    loop->terminated = 1;
+
+    /* woken task removes its record itself */
+    while (loop->waiting.head != 0)
+    {
+        waiting = (api_loop_waiting_t*)loop->waiting.head;
+        api_task_wakeup(waiting->task);
+    }
+}
+
+void api_loop_absorb_task(api_loop_base_t* loop, api_task_t* task)
+{
+    ++loop->absorbing;
+    api_task_sleep(task);
+    --loop->absorbing;
+}
+
+void api_loop_stats_snapshot(api_loop_t* loop, api_loop_stats_t* stats)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    api_loop_load_t load;
+    uint64_t since = base->load.since;
+    uint64_t started = base->load.started;
+    uint64_t now = api_time_precise();
+    uint64_t running;
+
+    api_loop_load(loop, &load);
+
+    stats->iterations = base->load.iterations;
+    stats->events = base->load.events;
+    stats->events_max = base->load.events_max;
+    stats->blocked = base->load.blocked;
+    stats->tasks_created = base->load.created;
+    stats->tasks_completed = base->load.completed;
+    stats->switches = base->load.switches;
+    stats->timers = base->load.timers;
+    stats->asyncs = base->load.asyncs;
+    stats->async_depth_max = base->load.async_depth_max;
+    stats->tasks = load.tasks;
+    stats->streams = load.streams;
+    stats->utilisation = load.utilisation;
+    stats->busy = 0;
+
+    if (started == 0)
+        return;
+
+    /* current wait is not in blocked yet */
+    if (since & 1)
+        stats->blocked += now - (since >> 1);
+
+    running = now - started;
+    if (running > stats->blocked)
+        stats->busy = running - stats->blocked;
+}
+
+size_t api_loop_task_stats(api_loop_t* loop,
+                           api_task_stats_t* stats, size_t count)
+{
+    api_scheduler_t* scheduler = &((api_loop_base_t*)loop)->scheduler;
+    api_task_account_t* accounts = scheduler->accounts;
+    api_task_account_t* account;
+    uint64_t ticks;
+    uint64_t time;
+    double scale = 1.0;
+    size_t copied = 0;
+    size_t i;
+
+    if (accounts == 0)
+        return 0;
+
+    /* tick rate is measured over time accounting is enabled */
+    ticks = api_cycles() - scheduler->clock_started;
+    time = api_time_precise() - scheduler->time_started;
+    if (ticks != 0)
+        scale = (double)time / (double)ticks;
+
+    for (i = 0; i < API_TASK_ACCOUNTS && copied < count; ++i)
+    {
+        account = &accounts[i];
+        if (account->tasks == 0)
+            continue;
+
+        stats[copied].callback = account->callback;
+        stats[copied].tasks = account->tasks;
+        stats[copied].switches = account->switches;
+        stats[copied].run = (uint64_t)(account->run * scale);
+        stats[copied].run_max = (uint64_t)(account->run_max * scale);
+        stats[copied].wait_io = (uint64_t)
+                        (account->wait[TASK_WAIT_Io] * scale);
+        stats[copied].wait_timer = (uint64_t)
+                        (account->wait[TASK_WAIT_Timer] * scale);
+        stats[copied].wait_event = (uint64_t)
+                        (account->wait[TASK_WAIT_Event] * scale);
+        ++copied;
+    }
+
+    return copied;
+}
+
 api_pool_t* api_pool_default(api_loop_t* loop)
 {
     api_loop_base_t* base = (api_loop_base_t*)loop;
@@ -62,10 +254,32 @@ api_pool_t* api_pool_default(api_loop_t* loop)
     return &base->pool;
 }
 
+int api_loop_post_all(api_loop_t** loops, size_t count,
+                      api_loop_fn callback, void* arg, size_t stack_size)
+{
+    int result = API__OK;
+    int error;
+    size_t i;
+
+    /* keep posting to others if one fails */
+    for (i = 0; i < count; ++i)
+    {
+        error = api_loop_post(loops[i], callback, arg, stack_size);
+        if (error != API__OK && result == API__OK)
+            result = error;
+    }
+
+    return result;
+}
+
 int api_loop_sleep(api_loop_t* loop, uint64_t period)
 {
     api_loop_base_t* base = (api_loop_base_t*)loop;
 
+    /* timers are terminated already, nothing would wake it */
+    if (base->terminated)
+        return API__TERMINATE;
+
     return api_sleep_exec(&base->sleeps, base->scheduler.current, period);
 }
 
@@ -73,6 +287,9 @@ int api_loop_idle(api_loop_t* loop, uint64_t period)
 {
     api_loop_base_t* base = (api_loop_base_t*)loop;
 
+    if (base->terminated)
+        return API__TERMINATE;
+
     return api_idle_exec(&base->idles, base->scheduler.current, period);
 }
 
@@ -88,6 +305,7 @@ int api_loop_call(api_loop_t* loop, api_loop_fn callback, void* arg, size_t stac
 
     task = api_task_create(&base->scheduler, api_call_task_fn, stack_size);
     task->data = &call;
+    task->origin = (void*)callback;
     api_task_exec(task);
     api_task_delete(task);
 
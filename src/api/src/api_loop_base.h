@@ -29,12 +29,52 @@
 #define API_READ    1
 #define API_WRITE   2
 
+#ifndef API_CACHE_LINE
+#define API_CACHE_LINE 64
+#endif
+
+/* utilisation is measured over this many microseconds */
+#define API_LOAD_WINDOW 100000
+
+/*
+ * Load signals and counters written by loop only and read by any thread,
+ * padded so readers do not share cache line with loop private data
+ */
+typedef struct api_loop_signals_t {
+    char before[API_CACHE_LINE];
+    volatile uint64_t since;        // time of last wait or wake << 1 | waiting
+    volatile uint32_t tasks;
+    volatile uint32_t streams;
+    volatile uint32_t utilisation;  // per mille of busy time in last window
+    volatile uint64_t started;      // time of first wait
+    volatile uint64_t iterations;
+    volatile uint64_t events;
+    volatile uint64_t events_max;
+    volatile uint64_t blocked;      // microseconds waiting for events
+    volatile uint64_t created;
+    volatile uint64_t completed;
+    volatile uint64_t switches;
+    volatile uint64_t timers;
+    volatile uint64_t asyncs;
+    volatile uint64_t async_depth_max;
+    char after[API_CACHE_LINE];
+} api_loop_signals_t;
+
+/*
+ * Task sleeping in a wait which may have no timer to resume it
+ */
+typedef struct api_loop_waiting_t {
+    api_node_t node;
+    struct api_task_t* task;
+} api_loop_waiting_t;
+
 /*
  * Common system independent loop properties
  */
 typedef struct api_loop_base_t {
     int terminated;
     uint64_t refs;
+    api_loop_config_t config;
     struct api_pool_t pool;
     uint64_t now;
     uint64_t last_activity;
@@ -42,6 +82,16 @@ typedef struct api_loop_base_t {
     struct api_timers_t sleeps;
     struct api_timers_t idles;
     struct api_timers_t timeouts;
+    api_list_t waiting;     // api_loop_waiting_t resumed on terminate
+    size_t absorbing;       // tasks in api_loop_absorb_task
+    volatile long offloads; // requests owned by offload workers
+    struct api_loop_group_t* volatile group;
+    size_t group_slot;
+    uint64_t window;    // start of utilisation window
+    uint64_t idle;      // time blocked in this window
+    uint32_t streams;
+    api_loop_signals_t load;
+    api_histogram_t latency[LATENCY_Count];
 } api_loop_base_t;
 
 /*
@@ -50,4 +100,41 @@ typedef struct api_loop_base_t {
  */
 uint64_t api_loop_calculate_wait_timeout(api_loop_base_t* loop);
 
+/*
+ * Called right before and after loop blocks waiting for events,
+ * publish load signals and counters
+ */
+void api_loop_load_wait(api_loop_base_t* loop);
+void api_loop_load_wake(api_loop_base_t* loop, int events);
+
+/*
+ * Sleep task until woken or loop terminates, returns at once if
+ * terminated already. Caller checks terminated to tell them apart
+ */
+void api_loop_sleep_task(api_loop_base_t* loop, struct api_task_t* task);
+
+/*
+ * Mark loop terminated and resume tasks in api_loop_sleep_task,
+ * called by loop cleanup before timers are terminated
+ */
+void api_loop_terminate_waiting(api_loop_base_t* loop);
+
+/*
+ * Sleep task until wakeup already taken by other thread arrives, even
+ * if loop is terminated. Loop cleanup waits for wakeups until none is left
+ */
+void api_loop_absorb_task(api_loop_base_t* loop, struct api_task_t* task);
+
+/*
+ * Record microsecond latency of loop operation
+ */
+#define api_loop_latency_record(loop, kind, value) \
+    api_histogram_record(&((api_loop_base_t*)(loop))->latency[kind], value)
+
+/*
+ * Starts tasks queued to loop through its group, or steals from siblings
+ * when loop is about to block. Returns number of started tasks
+ */
+int api_loop_group_process(api_loop_t* loop, int blocking);
+
 #endif // API_LOOP_BASE_H_INCLUDED
\ No newline at end of file
@@ -0,0 +1,735 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "api_loop_base.h"
+#include "api_task.h"
+#include "api_atomic.h"
+
+/*
+ * Each loop of group has bounded queue of tasks not started yet, any
+ * thread may push and any loop of group may pop. Loop drains own queue
+ * before blocking and steals from siblings when it is empty.
+ * Poster notifies target loop, and one idle sibling too when target is
+ * busy, so backlog is picked up without central dispatcher.
+ *
+ * Elastic group has slot for each of max loops, supervisor fills empty
+ * slots and retires loops. Retiring loop gets no new tasks, but still
+ * drains its queue, and is stopped when its streams are gone or drain
+ * period is over.
+ * Threads using loop of slot pin the slot first, supervisor empties slot
+ * and waits for pins to go before it stops the loop
+ */
+
+#define GROUP_BATCH 64
+
+typedef struct api_loop_group_slot_t {
+    api_loop_t* volatile loop;  // 0 when slot is empty
+    api_channel_t* queue;
+    volatile long queued;
+    volatile long idle;
+    volatile long retiring;
+    volatile long pins;         // users of loop, see api_loop_group_pin
+    uint64_t retired;           // supervisor only
+} api_loop_group_slot_t;
+
+/* slots are whole cache lines apart whatever the size of fields */
+#define GROUP_SLOT_SIZE \
+    ((sizeof(api_loop_group_slot_t) + API_CACHE_LINE - 1) & \
+        ~(size_t)(API_CACHE_LINE - 1))
+
+#define api_loop_group_slot(group, index) \
+    ((api_loop_group_slot_t*)((group)->slots + (index) * GROUP_SLOT_SIZE))
+
+struct api_loop_group_t {
+    char* slots;
+    size_t count;
+    void* memory;
+    uint32_t seed;  // racy updates are fine, only spreads picks
+    int elastic;
+    volatile long stopping;
+    api_loop_elastic_t config;
+};
+
+typedef struct api_loop_group_call_t {
+    api_loop_t* loop;
+    api_loop_post_t item;
+} api_loop_group_call_t;
+
+extern int api_async_notify(api_loop_t* loop);
+
+/*
+ * Loop of pinned slot is not stopped until unpinned, 0 for empty slot
+ */
+static api_loop_t* api_loop_group_pin(api_loop_group_slot_t* slot)
+{
+    api_loop_t* loop;
+
+    api_atomic_add_long(&slot->pins, 1);
+
+    loop = slot->loop;
+    if (loop == 0)
+        api_atomic_add_long(&slot->pins, -1);
+
+    return loop;
+}
+
+static void api_loop_group_unpin(api_loop_group_slot_t* slot)
+{
+    api_atomic_add_long(&slot->pins, -1);
+}
+
+/*
+ * Empty slot, its loop may be stopped once those who pinned it are done
+ */
+static void api_loop_group_vacate(api_loop_group_slot_t* slot)
+{
+    slot->loop = 0;
+    api_atomic_barrier();
+
+    /* pins are held only around a push and notify */
+    while (slot->pins != 0)
+        api_cpu_relax();
+}
+
+static void* api_loop_group_task_fn(api_task_t* task)
+{
+    api_loop_group_call_t* call = (api_loop_group_call_t*)task->data;
+    api_loop_group_call_t copy = *call;
+
+    api_free(task->scheduler->pool, sizeof(*call), call);
+    copy.item.callback(copy.loop, copy.item.arg);
+
+    return 0;
+}
+
+static void api_loop_group_run(api_loop_t* loop, api_loop_post_t* item)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    api_loop_group_call_t* call;
+    api_task_t* task;
+
+    call = (api_loop_group_call_t*)api_alloc(&base->pool, sizeof(*call));
+    call->loop = loop;
+    call->item = *item;
+
+    task = api_task_create(&base->scheduler, api_loop_group_task_fn,
+                            item->stack_size);
+    task->data = call;
+    task->origin = (void*)item->callback;
+    api_task_post(task);
+}
+
+static int api_loop_group_pop(api_loop_group_slot_t* slot,
+                              api_loop_post_t* item)
+{
+    if (API__OK != api_channel_try_recv(slot->queue, item))
+        return 0;
+
+    api_atomic_add_long(&slot->queued, -1);
+    return 1;
+}
+
+int api_loop_group_process(api_loop_t* loop, int blocking)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    api_loop_group_t* group = base->group;
+    api_loop_group_slot_t* slot;
+    api_loop_group_slot_t* victim;
+    api_loop_post_t item;
+    long steal;
+    int started = 0;
+    size_t i;
+
+    if (group == 0)
+        return 0;
+
+    slot = api_loop_group_slot(group, base->group_slot);
+    slot->idle = 0;
+
+    while (started < GROUP_BATCH && api_loop_group_pop(slot, &item))
+    {
+        api_loop_group_run(loop, &item);
+        ++started;
+    }
+
+    /* retiring loop only finishes what it has */
+    if (started != 0 || !blocking || slot->retiring)
+        return started;
+
+    /* own queue is empty, take half of the first sibling backlog */
+    for (i = 1; i < group->count && started == 0; ++i)
+    {
+        victim = api_loop_group_slot(group,
+                                     (base->group_slot + i) % group->count);
+
+        steal = (victim->queued + 1) / 2;
+        if (steal > GROUP_BATCH)
+            steal = GROUP_BATCH;
+
+        while (steal-- > 0 && api_loop_group_pop(victim, &item))
+        {
+            api_loop_group_run(loop, &item);
+            ++started;
+        }
+    }
+
+    /* nothing to do, posters may wake us to steal */
+    if (started == 0)
+    {
+        slot->idle = 1;
+        api_atomic_barrier();
+    }
+
+    return started;
+}
+
+static int api_loop_group_alloc(api_loop_group_t** group,
+                                size_t count, size_t capacity)
+{
+    api_loop_group_t* result;
+    size_t i;
+    int error;
+
+    if (count == 0)
+        return API__INVALID_ARGUMENT;
+
+    result = (api_loop_group_t*)malloc(sizeof(api_loop_group_t));
+    if (result == 0)
+        return API__NO_MEMORY;
+
+    memset(result, 0, sizeof(*result));
+
+    result->count = count;
+    result->memory = malloc(count * GROUP_SLOT_SIZE + API_CACHE_LINE);
+    if (result->memory == 0)
+    {
+        free(result);
+        return API__NO_MEMORY;
+    }
+
+    result->slots = (char*)(((size_t)result->memory + API_CACHE_LINE - 1) &
+                            ~(size_t)(API_CACHE_LINE - 1));
+
+    memset(result->slots, 0, count * GROUP_SLOT_SIZE);
+
+    for (i = 0; i < count; ++i)
+    {
+        error = api_channel_create(&api_loop_group_slot(result, i)->queue,
+                                   sizeof(api_loop_post_t), capacity);
+        if (error != API__OK)
+        {
+            api_loop_group_free(result);
+            return error;
+        }
+    }
+
+    *group = result;
+
+    return API__OK;
+}
+
+static void api_loop_group_join(api_loop_group_t* group, size_t index,
+                                api_loop_t* loop)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+
+    /* slot must be visible before group, loop reads them together */
+    base->group_slot = index;
+    api_atomic_barrier();
+    base->group = group;
+
+    api_loop_group_slot(group, index)->retiring = 0;
+    api_atomic_barrier();
+    api_loop_group_slot(group, index)->loop = loop;
+}
+
+int api_loop_group_create(api_loop_group_t** group,
+                          api_loop_t** loops, size_t count, size_t capacity)
+{
+    api_loop_group_t* result;
+    size_t i;
+    int error;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (((api_loop_base_t*)loops[i])->group != 0)
+            return API__ALREADY_EXIST;
+    }
+
+    error = api_loop_group_alloc(&result, count, capacity);
+    if (error != API__OK)
+        return error;
+
+    for (i = 0; i < count; ++i)
+        api_loop_group_join(result, i, loops[i]);
+
+    *group = result;
+
+    return API__OK;
+}
+
+int api_loop_group_start(api_loop_group_t** group,
+                         const api_loop_elastic_t* config)
+{
+    api_loop_group_t* result;
+    api_loop_t* loop;
+    size_t i;
+    int error;
+
+    if (config->min_loops == 0 || config->max_loops < config->min_loops)
+        return API__INVALID_ARGUMENT;
+
+    error = api_loop_group_alloc(&result, config->max_loops,
+                            config->capacity != 0 ? config->capacity : 1024);
+    if (error != API__OK)
+        return error;
+
+    result->elastic = 1;
+    result->config = *config;
+
+    if (result->config.grow_utilisation == 0)
+        result->config.grow_utilisation = 750;
+    if (result->config.shrink_utilisation == 0)
+        result->config.shrink_utilisation = 250;
+    if (result->config.hysteresis == 0)
+        result->config.hysteresis = 3;
+    if (result->config.period == 0)
+        result->config.period = 1000;
+    if (result->config.drain == 0)
+        result->config.drain = 30 * 1000;
+
+    /* loops join once all started, stopped ones never see the group */
+    for (i = 0; i < config->min_loops; ++i)
+    {
+        error = api_loop_start(&loop);
+        if (error != API__OK)
+        {
+            while (i-- > 0)
+                api_loop_stop(api_loop_group_slot(result, i)->loop);
+
+            api_loop_group_free(result);
+            return error;
+        }
+
+        api_loop_group_slot(result, i)->loop = loop;
+    }
+
+    for (i = 0; i < config->min_loops; ++i)
+    {
+        loop = api_loop_group_slot(result, i)->loop;
+        api_loop_group_join(result, i, loop);
+    }
+
+    *group = result;
+
+    return API__OK;
+}
+
+int api_loop_is_retiring(api_loop_t* loop)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    api_loop_group_t* group = base->group;
+
+    if (group == 0)
+        return 0;
+
+    return api_loop_group_slot(group, base->group_slot)->retiring != 0;
+}
+
+void api_loop_group_stop(api_loop_group_t* group)
+{
+    api_atomic_xchg_long(&group->stopping, 1);
+}
+
+/*
+ * Move tasks retiring loop did not start to other loops of group,
+ * returns 0 if some are left in its queue
+ */
+static int api_loop_group_requeue(api_loop_t* loop, api_loop_group_t* group,
+                                  api_loop_group_slot_t* slot)
+{
+    api_loop_post_t item;
+
+    while (api_loop_group_pop(slot, &item))
+    {
+        if (API__OK != api_loop_group_post(group, 0, item.callback,
+                                           item.arg, item.stack_size))
+        {
+            /* retiring loop is still running, it will start it */
+            if (API__OK != api_loop_post(loop, item.callback, item.arg,
+                                         item.stack_size))
+            {
+                /* vacated slot gets no pushes, popped place is still free */
+                api_atomic_add_long(&slot->queued, 1);
+                api_channel_try_send(slot->queue, &item);
+            }
+
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Stop retiring loops which are drained or out of time, tasks still
+ * queued to them are run by siblings
+ */
+static void api_loop_group_retire(api_loop_t* current,
+                                  api_loop_group_t* group)
+{
+    api_loop_group_slot_t* slot;
+    api_loop_load_t load;
+    api_loop_t* loop;
+    uint64_t now = api_time_current();
+    size_t i;
+
+    for (i = 0; i < group->count; ++i)
+    {
+        slot = api_loop_group_slot(group, i);
+        loop = slot->loop;
+
+        if (loop == 0 || !slot->retiring)
+            continue;
+
+        api_loop_load(loop, &load);
+
+        if ((load.tasks != 0 || load.streams != 0 || load.queued != 0) &&
+            now - slot->retired < group->config.drain)
+            continue;
+
+        /* no new tasks are queued to empty slot */
+        api_loop_group_vacate(slot);
+
+        if (!api_loop_group_requeue(loop, group, slot))
+        {
+            slot->loop = loop;
+            continue;
+        }
+
+        api_loop_stop_and_wait(current, loop);
+    }
+}
+
+int api_loop_group_supervise(api_loop_t* current, api_loop_group_t* group)
+{
+    api_loop_elastic_t* config = &group->config;
+    api_loop_group_slot_t* slot;
+    api_loop_load_t load;
+    api_loop_t* loop;
+    size_t active;
+    size_t empty;
+    size_t index;
+    int utilisation;
+    int above = 0;
+    int below = 0;
+    int error = API__OK;
+    size_t i;
+
+    if (!group->elastic)
+        return API__INVALID_ARGUMENT;
+
+    while (!group->stopping)
+    {
+        error = api_loop_sleep(current, config->period);
+        if (error != API__OK)
+            break;
+
+        api_loop_group_retire(current, group);
+
+        active = 0;
+        empty = group->count;
+        utilisation = 0;
+
+        for (i = 0; i < group->count; ++i)
+        {
+            slot = api_loop_group_slot(group, i);
+            loop = slot->loop;
+
+            if (loop == 0)
+            {
+                empty = i;
+                continue;
+            }
+
+            if (slot->retiring)
+                continue;
+
+            api_loop_load(loop, &load);
+            utilisation += load.utilisation;
+            ++active;
+        }
+
+        if (active != 0)
+            utilisation /= (int)active;
+
+        /* act only on sustained load, then start counting again */
+        above = utilisation > config->grow_utilisation ? above + 1 : 0;
+        below = utilisation < config->shrink_utilisation ? below + 1 : 0;
+
+        if (above >= config->hysteresis && active < config->max_loops &&
+            empty != group->count)
+        {
+            above = 0;
+
+            if (API__OK == api_loop_start(&loop))
+                api_loop_group_join(group, empty, loop);
+        }
+
+        if (below >= config->hysteresis && active > config->min_loops)
+        {
+            below = 0;
+
+            index = api_loop_group_pick(group, PICK_LeastConnections);
+            slot = api_loop_group_slot(group, index);
+
+            slot->retired = api_time_current();
+            slot->retiring = 1;
+        }
+    }
+
+    for (i = 0; i < group->count; ++i)
+    {
+        slot = api_loop_group_slot(group, i);
+        loop = slot->loop;
+        if (loop == 0)
+            continue;
+
+        api_loop_group_vacate(slot);
+
+        /* stopping loop can not wait others */
+        if (error == API__OK)
+            api_loop_stop_and_wait(current, loop);
+        else
+            api_loop_stop(loop);
+    }
+
+    return error;
+}
+
+void api_loop_group_free(api_loop_group_t* group)
+{
+    size_t i;
+
+    for (i = 0; i < group->count; ++i)
+    {
+        if (api_loop_group_slot(group, i)->queue != 0)
+            api_channel_free(api_loop_group_slot(group, i)->queue);
+    }
+
+    free(group->memory);
+    free(group);
+}
+
+int api_loop_group_post(api_loop_group_t* group, size_t index,
+                        api_loop_fn callback, void* arg, size_t stack_size)
+{
+    api_loop_group_slot_t* slot;
+    api_loop_group_slot_t* sibling;
+    api_loop_post_t item;
+    api_loop_t* loop;
+    size_t i;
+    int error;
+
+    index %= group->count;
+    slot = api_loop_group_slot(group, index);
+
+    loop = slot->retiring ? 0 : api_loop_group_pin(slot);
+    if (loop == 0)
+    {
+        index = api_loop_group_pick(group, PICK_LeastConnections);
+        slot = api_loop_group_slot(group, index);
+
+        loop = api_loop_group_pin(slot);
+        if (loop == 0)
+            return API__NOT_FOUND;
+    }
+
+    item.callback = callback;
+    item.arg = arg;
+    item.stack_size = stack_size;
+
+    /* counted before push, so consumers never see it negative */
+    api_atomic_add_long(&slot->queued, 1);
+
+    if (API__OK != api_channel_try_send(slot->queue, &item))
+    {
+        api_atomic_add_long(&slot->queued, -1);
+        error = api_loop_post(loop, callback, arg, stack_size);
+        api_loop_group_unpin(slot);
+        return error;
+    }
+
+    api_async_notify(loop);
+    api_loop_group_unpin(slot);
+
+    /* idle target picks it up itself, busy one needs help */
+    if (slot->idle)
+        return API__OK;
+
+    for (i = 1; i < group->count; ++i)
+    {
+        sibling = api_loop_group_slot(group, (index + i) % group->count);
+
+        if (sibling->idle && api_atomic_cas_long(&sibling->idle, 1, 0))
+        {
+            loop = api_loop_group_pin(sibling);
+            if (loop != 0)
+            {
+                api_async_notify(loop);
+                api_loop_group_unpin(sibling);
+            }
+
+            break;
+        }
+    }
+
+    return API__OK;
+}
+
+void api_loop_load(api_loop_t* loop, api_loop_load_t* load)
+{
+    api_loop_base_t* base = (api_loop_base_t*)loop;
+    api_loop_group_t* group = base->group;
+    uint64_t since = base->load.since;
+
+    load->tasks = base->load.tasks;
+    load->streams = base->load.streams;
+    load->utilisation = (int)base->load.utilisation;
+    load->queued = 0;
+
+    if (group != 0)
+        load->queued = (size_t)
+                    api_loop_group_slot(group, base->group_slot)->queued;
+
+    /* no wait or wake for whole window, published value is stale */
+    if (since != 0 && api_time_precise() - (since >> 1) >= API_LOAD_WINDOW)
+        load->utilisation = (since & 1) ? 0 : 1000;
+}
+
+/*
+ * Empty and retiring slots are never picked
+ */
+static size_t api_loop_group_connections(api_loop_group_slot_t* slot)
+{
+    api_loop_base_t* base;
+    size_t value;
+
+    if (slot->retiring)
+        return (size_t)-1;
+
+    base = (api_loop_base_t*)api_loop_group_pin(slot);
+    if (base == 0)
+        return (size_t)-1;
+
+    value = (size_t)base->load.streams + (size_t)slot->queued;
+    api_loop_group_unpin(slot);
+
+    return value;
+}
+
+static size_t api_loop_group_random(api_loop_group_t* group)
+{
+    uint32_t x = group->seed;
+
+    if (x == 0)
+        x = (uint32_t)api_time_precise() | 1;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    group->seed = x;
+
+    return x % group->count;
+}
+
+size_t api_loop_group_pick(api_loop_group_t* group, api_loop_pick_t policy)
+{
+    api_loop_group_slot_t* slot;
+    api_loop_load_t load;
+    api_loop_t* loop;
+    size_t best = 0;
+    size_t best_value = (size_t)-1;
+    size_t value;
+    size_t first;
+    size_t second;
+    size_t i;
+
+    if (group->count == 1)
+        return 0;
+
+    if (policy == PICK_PowerOfTwo)
+    {
+        first = api_loop_group_random(group);
+        second = api_loop_group_random(group);
+
+        value = api_loop_group_connections(
+                                api_loop_group_slot(group, first));
+        best_value = api_loop_group_connections(
+                                api_loop_group_slot(group, second));
+
+        if (best_value < value)
+            return second;
+
+        if (value != (size_t)-1)
+            return first;
+
+        /* both empty or retiring, look at all */
+        best_value = (size_t)-1;
+    }
+
+    for (i = 0; i < group->count; ++i)
+    {
+        if (policy == PICK_Utilisation)
+        {
+            slot = api_loop_group_slot(group, i);
+            if (slot->retiring)
+                continue;
+
+            loop = api_loop_group_pin(slot);
+            if (loop == 0)
+                continue;
+
+            api_loop_load(loop, &load);
+            api_loop_group_unpin(slot);
+
+            /* connections break ties of equally idle loops */
+            value = (size_t)load.utilisation * 1024 +
+                    load.streams + load.queued;
+        }
+        else
+        {
+            value = api_loop_group_connections(
+                                api_loop_group_slot(group, i));
+        }
+
+        if (value < best_value)
+        {
+            best_value = value;
+            best = i;
+        }
+    }
+
+    return best;
+}
\ No newline at end of file
@@ -0,0 +1,338 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <memory.h>
+
+#include "api_loop_base.h"
+#include "api_task.h"
+#include "api_atomic.h"
+
+/*
+ * Every participating loop owns a share of chunks packed into single
+ * 64 bit word as next << 32 | end, so taking from the front and
+ * stealing the back half are both one compare and swap. Chunk indexes
+ * are never handed out twice, so a share can not return to a value it
+ * had before.
+ * Job lives in frame of the waiting task and shares in its pool, last
+ * finishing participant wakes it. Own loop works in the waiting task
+ * itself, its post would be dropped when the loop stops. Waiter of
+ * terminated loop absorbs the wakeup of last participant, so frame is
+ * not left while others still use it
+ */
+
+#define PARALLEL_STACK_SIZE (64 * 1024)
+#define PARALLEL_MAX_CHUNKS 0xFFFFFFFFu
+
+#define SHARE_NEXT(range) ((uint32_t)((uint64_t)(range) >> 32))
+#define SHARE_END(range) ((uint32_t)(range))
+#define SHARE_PACK(next, end) ((int64_t)(((uint64_t)(next) << 32) | (end)))
+
+typedef struct api_parallel_share_t {
+    volatile int64_t range;
+    struct api_parallel_job_t* job;
+    void* partial;
+    char pad[API_CACHE_LINE - sizeof(int64_t) - 2 * sizeof(void*)];
+} api_parallel_share_t;
+
+typedef struct api_parallel_job_t {
+    api_loop_t* loop;
+    api_task_t* task;
+    api_loop_t** loops;
+    api_parallel_share_t* shares;
+    size_t count;
+    size_t begin;
+    size_t end;
+    size_t grain;
+    api_parallel_fn parallel;
+    api_reduce_fn reduce;
+    void* arg;
+    volatile long remaining;
+} api_parallel_job_t;
+
+extern int api_async_wakeup(api_loop_t* loop, api_task_t* task);
+
+static void api_parallel_chunk(api_loop_t* loop, api_parallel_share_t* share,
+                               uint32_t chunk)
+{
+    api_parallel_job_t* job = share->job;
+    size_t begin = job->begin + (size_t)chunk * job->grain;
+    size_t end = job->end;
+
+    if (end - begin > job->grain)
+        end = begin + job->grain;
+
+    if (job->reduce != 0)
+        job->reduce(loop, begin, end, share->partial, job->arg);
+    else
+        job->parallel(loop, begin, end, job->arg);
+}
+
+/*
+ * Take one chunk from the front of own share
+ */
+static int api_parallel_take(api_parallel_share_t* share, uint32_t* chunk)
+{
+    int64_t range;
+
+    for (;;)
+    {
+        range = share->range;
+        if (SHARE_NEXT(range) >= SHARE_END(range))
+            return 0;
+
+        if (api_atomic_cas_64(&share->range, range,
+                SHARE_PACK(SHARE_NEXT(range) + 1, SHARE_END(range))))
+        {
+            *chunk = SHARE_NEXT(range);
+            return 1;
+        }
+    }
+}
+
+/*
+ * Move back half of the largest other share into own empty share
+ */
+static int api_parallel_steal(api_parallel_share_t* share)
+{
+    api_parallel_job_t* job = share->job;
+    api_parallel_share_t* victim;
+    int64_t range;
+    uint32_t left;
+    uint32_t best;
+    uint32_t mid;
+    size_t i;
+
+    for (;;)
+    {
+        victim = 0;
+        best = 0;
+
+        for (i = 0; i < job->count; ++i)
+        {
+            range = job->shares[i].range;
+            if (SHARE_NEXT(range) >= SHARE_END(range))
+                continue;
+
+            left = SHARE_END(range) - SHARE_NEXT(range);
+            if (left > best)
+            {
+                best = left;
+                victim = &job->shares[i];
+            }
+        }
+
+        if (victim == 0)
+            return 0;
+
+        range = victim->range;
+        if (SHARE_NEXT(range) >= SHARE_END(range))
+            continue;
+
+        mid = SHARE_NEXT(range) +
+                (SHARE_END(range) - SHARE_NEXT(range)) / 2;
+
+        if (api_atomic_cas_64(&victim->range, range,
+                SHARE_PACK(SHARE_NEXT(range), mid)))
+        {
+            /* nobody else writes empty share, cas only for atomicity */
+            api_atomic_cas_64(&share->range, share->range,
+                SHARE_PACK(mid, SHARE_END(range)));
+            return 1;
+        }
+
+        api_cpu_relax();
+    }
+}
+
+static void api_parallel_work(api_loop_t* loop, api_parallel_share_t* share)
+{
+    uint32_t chunk;
+
+    do
+    {
+        while (api_parallel_take(share, &chunk))
+            api_parallel_chunk(loop, share, chunk);
+    }
+    while (api_parallel_steal(share));
+}
+
+static void api_parallel_participant(api_loop_t* loop, void* arg)
+{
+    api_parallel_share_t* share = (api_parallel_share_t*)arg;
+    api_parallel_job_t* job = share->job;
+
+    api_parallel_work(loop, share);
+
+    /* job is alive until last participant wakes the waiter */
+    if (0 == api_atomic_add_long(&job->remaining, -1))
+        api_async_wakeup(job->loop, job->task);
+}
+
+static int api_parallel_run(api_parallel_job_t* job, void* result,
+                            size_t result_size, api_combine_fn combine)
+{
+    api_loop_base_t* base = (api_loop_base_t*)job->loop;
+    api_pool_t* pool = api_pool_default(job->loop);
+    api_parallel_share_t* own = 0;
+    int error = API__OK;
+    size_t partial_size;
+    size_t memory_size;
+    size_t chunks;
+    size_t posted = 0;
+    char* memory;
+    char* partials;
+    size_t i;
+
+    if (job->count == 0 || job->grain == 0 || job->end < job->begin)
+        return API__INVALID_ARGUMENT;
+
+    if (job->end == job->begin)
+        return API__OK;
+
+    chunks = (job->end - job->begin - 1) / job->grain + 1;
+    if (chunks > PARALLEL_MAX_CHUNKS)
+        return API__INVALID_ARGUMENT;
+
+    if (job->count > chunks)
+        job->count = chunks;
+
+    /* partials also padded, they are written by different loops */
+    partial_size = (result_size + API_CACHE_LINE - 1) &
+                    ~(size_t)(API_CACHE_LINE - 1);
+    memory_size = job->count * (sizeof(api_parallel_share_t) + partial_size)
+                    + API_CACHE_LINE;
+
+    memory = (char*)api_alloc(pool, memory_size);
+    if (memory == 0)
+        return API__NO_MEMORY;
+
+    job->shares = (api_parallel_share_t*)(((size_t)memory + API_CACHE_LINE - 1)
+                                            & ~(size_t)(API_CACHE_LINE - 1));
+    partials = (char*)(job->shares + job->count);
+
+    for (i = 0; i < job->count; ++i)
+    {
+        job->shares[i].range = SHARE_PACK(chunks * i / job->count,
+                                          chunks * (i + 1) / job->count);
+        job->shares[i].job = job;
+        job->shares[i].partial = 0;
+
+        if (result_size != 0)
+        {
+            job->shares[i].partial = partials + i * partial_size;
+            memcpy(job->shares[i].partial, result, result_size);
+        }
+    }
+
+    /* reference of this task keeps job from completing while posting */
+    job->remaining = (long)job->count + 1;
+
+    for (i = 0; i < job->count; ++i)
+    {
+        if (job->loops[i] == job->loop)
+        {
+            if (own == 0)
+                own = &job->shares[i];
+
+            continue;
+        }
+
+        if (API__OK == api_loop_post(job->loops[i], api_parallel_participant,
+                                    &job->shares[i], PARALLEL_STACK_SIZE))
+            ++posted;
+    }
+
+    /* shares of failed loops and other own shares are stolen */
+    if (own != 0 || posted == 0)
+        api_parallel_work(job->loop, own != 0 ? own : &job->shares[0]);
+
+    if (posted != 0 && 0 != api_atomic_add_long(&job->remaining,
+                                -(long)(job->count - posted + 1)))
+    {
+        api_loop_sleep_task(base, job->task);
+
+        /* terminate woke us, last participant has still to come */
+        if (base->terminated)
+        {
+            api_loop_absorb_task(base, job->task);
+            error = API__TERMINATE;
+        }
+    }
+
+    if (combine != 0)
+    {
+        for (i = 0; i < job->count; ++i)
+            combine(result, job->shares[i].partial, job->arg);
+    }
+
+    api_free(pool, memory_size, memory);
+
+    return error;
+}
+
+int api_loop_parallel_for(api_loop_t* current,
+                        api_loop_t** loops, size_t count,
+                        size_t begin, size_t end, size_t grain,
+                        api_parallel_fn callback, void* arg)
+{
+    api_parallel_job_t job;
+
+    memset(&job, 0, sizeof(job));
+
+    job.loop = current;
+    job.task = ((api_loop_base_t*)current)->scheduler.current;
+    job.loops = loops;
+    job.count = count;
+    job.begin = begin;
+    job.end = end;
+    job.grain = grain;
+    job.parallel = callback;
+    job.arg = arg;
+
+    return api_parallel_run(&job, 0, 0, 0);
+}
+
+int api_loop_parallel_reduce(api_loop_t* current,
+                        api_loop_t** loops, size_t count,
+                        size_t begin, size_t end, size_t grain,
+                        void* result, size_t result_size,
+                        api_reduce_fn callback,
+                        api_combine_fn combine, void* arg)
+{
+    api_parallel_job_t job;
+
+    if (result == 0 || result_size == 0 || combine == 0)
+        return API__INVALID_ARGUMENT;
+
+    memset(&job, 0, sizeof(job));
+
+    job.loop = current;
+    job.task = ((api_loop_base_t*)current)->scheduler.current;
+    job.loops = loops;
+    job.count = count;
+    job.begin = begin;
+    job.end = end;
+    job.grain = grain;
+    job.reduce = callback;
+    job.arg = arg;
+
+    return api_parallel_run(&job, result, result_size, combine);
+}
\ No newline at end of file
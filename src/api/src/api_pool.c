@@ -22,33 +22,337 @@
 #include <malloc.h>
 #include <memory.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 #include "api_pool.h"
 
-void api_pool_init(api_pool_t* pool)
+#define API_POOL_REGION_MASK ((uintptr_t)API_POOL_REGION_SIZE - 1)
+
+#if defined(__linux__)
+#define api_pool_usable_size(ptr) malloc_usable_size(ptr)
+#else
+#define api_pool_usable_size(ptr) _msize(ptr)
+#endif
+
+#if defined(__linux__)
+
+static void* api_pool_map_aligned(size_t size)
+{
+    char* ptr;
+    char* aligned;
+    size_t head;
+    size_t tail;
+
+    /* over map to cut out region aligned address */
+    ptr = (char*)mmap(0, size + API_POOL_REGION_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return 0;
+
+    aligned = (char*)(((uintptr_t)ptr + API_POOL_REGION_MASK) &
+                        ~API_POOL_REGION_MASK);
+    head = aligned - ptr;
+    tail = API_POOL_REGION_SIZE - head;
+
+    if (head > 0)
+        munmap(ptr, head);
+
+    if (tail > 0)
+        munmap(aligned + size, tail);
+
+    return aligned;
+}
+
+static void* api_pool_map(size_t size, int huge, api_pool_backing_t* backing)
+{
+    void* ptr;
+
+    *backing = POOL_Regular;
+
+    if (huge)
+    {
+        /* mappings of MAP_HUGETLB are aligned to huge page size */
+        ptr = mmap(0, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED)
+        {
+            *backing = POOL_HugeTlb;
+            return ptr;
+        }
+    }
+
+    ptr = api_pool_map_aligned(size);
+    if (ptr == 0)
+        return 0;
+
+#if defined(MADV_HUGEPAGE)
+    if (huge && 0 == madvise(ptr, size, MADV_HUGEPAGE))
+        *backing = POOL_Thp;
+#endif
+
+    return ptr;
+}
+
+static void api_pool_unmap(void* ptr, size_t size)
+{
+    munmap(ptr, size);
+}
+
+#else
+
+static void* api_pool_map(size_t size, int huge, api_pool_backing_t* backing)
+{
+    char* ptr;
+    char* aligned;
+    int attempt;
+
+    *backing = POOL_Regular;
+
+    if (huge && GetLargePageMinimum() == API_POOL_REGION_SIZE)
+    {
+        /* requires SeLockMemoryPrivilege, large pages are aligned */
+        ptr = (char*)VirtualAlloc(0, size,
+                    MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (ptr != 0)
+        {
+            *backing = POOL_HugeTlb;
+            return ptr;
+        }
+    }
+
+    /* reserve, release and take aligned address, retry if stolen */
+    for (attempt = 0; attempt < 8; ++attempt)
+    {
+        ptr = (char*)VirtualAlloc(0, size + API_POOL_REGION_SIZE,
+                                MEM_RESERVE, PAGE_NOACCESS);
+        if (ptr == 0)
+            return 0;
+
+        VirtualFree(ptr, 0, MEM_RELEASE);
+
+        aligned = (char*)(((uintptr_t)ptr + API_POOL_REGION_MASK) &
+                            ~API_POOL_REGION_MASK);
+        ptr = (char*)VirtualAlloc(aligned, size,
+                                MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (ptr != 0)
+            return ptr;
+    }
+
+    return 0;
+}
+
+static void api_pool_unmap(void* ptr, size_t size)
+{
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+#endif
+
+static int api_pool_size_class(size_t size)
+{
+    int size_class = 0;
+    size_t class_size = (size_t)1 << API_POOL_MIN_CLASS;
+
+    while (class_size < size)
+    {
+        class_size <<= 1;
+        ++size_class;
+    }
+
+    return size_class;
+}
+
+static api_pool_region_t* api_pool_region_create(api_pool_t* pool,
+                                        size_t size, int size_class)
+{
+    api_pool_region_t* region;
+    api_pool_backing_t backing;
+
+    /* large blocks are not worth a huge page */
+    region = (api_pool_region_t*)api_pool_map(size,
+                size_class != API_POOL_LARGE, &backing);
+    if (region == 0)
+        return 0;
+
+    region->size = size;
+    region->offset = API_POOL_REGION_HEADER;
+    region->size_class = size_class;
+    region->backing = backing;
+
+    api_list_push_tail(&pool->regions, (api_node_t*)region);
+
+    if (size_class != API_POOL_LARGE)
+    {
+        pool->stats.regions += 1;
+
+        if (backing == POOL_HugeTlb)
+            pool->stats.hugetlb += 1;
+        else if (backing == POOL_Thp)
+            pool->stats.thp += 1;
+    }
+
+    return region;
+}
+
+static void* api_pool_region_alloc(api_pool_t* pool, size_t size)
+{
+    api_pool_region_t* region;
+    size_t class_size;
+    size_t mapped;
+    int size_class;
+    void* ptr;
+
+    if (size > ((size_t)1 << (API_POOL_MIN_CLASS + API_POOL_CLASSES - 1)))
+    {
+        /* single block region, address masking still finds its header */
+        mapped = API_POOL_REGION_HEADER + size;
+        region = api_pool_region_create(pool, mapped, API_POOL_LARGE);
+        if (region == 0)
+            return 0;
+
+        pool->stats.heap_bytes += size;
+        return (char*)region + API_POOL_REGION_HEADER;
+    }
+
+    size_class = api_pool_size_class(size);
+    class_size = (size_t)1 << (API_POOL_MIN_CLASS + size_class);
+
+    ptr = pool->free[size_class];
+    if (ptr != 0)
+    {
+        pool->free[size_class] = *(void**)ptr;
+    }
+    else
+    {
+        region = pool->current[size_class];
+        if (region == 0 || region->offset + class_size > region->size)
+        {
+            region = api_pool_region_create(pool, API_POOL_REGION_SIZE,
+                                            size_class);
+            if (region == 0)
+                return 0;
+
+            pool->current[size_class] = region;
+        }
+
+        ptr = (char*)region + region->offset;
+        region->offset += class_size;
+    }
+
+    region = (api_pool_region_t*)((uintptr_t)ptr & ~API_POOL_REGION_MASK);
+
+    if (region->backing != POOL_Regular)
+        pool->stats.huge_bytes += class_size;
+
+    pool->stats.region_bytes += class_size;
+
+    return ptr;
+}
+
+static void api_pool_region_free(api_pool_t* pool, void* ptr)
+{
+    api_pool_region_t* region =
+        (api_pool_region_t*)((uintptr_t)ptr & ~API_POOL_REGION_MASK);
+    size_t class_size;
+
+    if (region->size_class == API_POOL_LARGE)
+    {
+        pool->stats.heap_bytes -= region->size - API_POOL_REGION_HEADER;
+
+        api_list_remove(&pool->regions, (api_node_t*)region);
+        api_pool_unmap(region, region->size);
+        return;
+    }
+
+    class_size = (size_t)1 << (API_POOL_MIN_CLASS + region->size_class);
+
+    if (region->backing != POOL_Regular)
+        pool->stats.huge_bytes -= class_size;
+
+    pool->stats.region_bytes -= class_size;
+
+    *(void**)ptr = pool->free[region->size_class];
+    pool->free[region->size_class] = ptr;
+}
+
+void api_pool_init(api_pool_t* pool, int huge_pages)
 {
     memset(pool, 0, sizeof(*pool));
+
+    pool->huge_pages = huge_pages;
 }
 
 void api_pool_cleanup(api_pool_t* pool)
 {
+    api_pool_region_t* region;
+
+    region = (api_pool_region_t*)api_list_pop_head(&pool->regions);
+    while (region != 0)
+    {
+        api_pool_unmap(region, region->size);
+        region = (api_pool_region_t*)api_list_pop_head(&pool->regions);
+    }
+
+    memset(pool->current, 0, sizeof(pool->current));
+    memset(pool->free, 0, sizeof(pool->free));
 }
 
 void* api_alloc(api_pool_t* pool, size_t size)
 {
-    return malloc(size);
+    void* ptr;
+
+    if (pool->huge_pages)
+    {
+        ptr = api_pool_region_alloc(pool, size);
+    }
+    else
+    {
+        ptr = malloc(size);
+        if (ptr != 0)
+            pool->stats.heap_bytes += api_pool_usable_size(ptr);
+    }
+
+    if (ptr != 0)
+        pool->stats.allocs += 1;
+
+    return ptr;
 }
 
 void* api_calloc(api_pool_t* pool, size_t size)
 {
     void* ptr = api_alloc(pool, size);
 
-    memset(ptr, 0, size);
+    if (ptr != 0)
+        memset(ptr, 0, size);
+
     return ptr;
 }
 
-/* size parameter can be hint for memory manager */
+/*
+ * size parameter can be hint for memory manager, with huge pages
+ * block size is taken from its region
+ */
 void api_free(api_pool_t* pool, size_t size, void* ptr)
 {
-    if (size > 0)
+    if (size == 0 || ptr == 0)
+        return;
+
+    pool->stats.frees += 1;
+
+    if (pool->huge_pages)
+    {
+        api_pool_region_free(pool, ptr);
+    }
+    else
+    {
+        pool->stats.heap_bytes -= api_pool_usable_size(ptr);
         free(ptr);
+    }
+}
+
+void api_pool_stats(api_pool_t* pool, api_pool_stats_t* stats)
+{
+    memcpy(stats, &pool->stats, sizeof(*stats));
 }
\ No newline at end of file
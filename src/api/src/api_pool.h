@@ -24,19 +24,50 @@
 
 #include <stddef.h>
 
+#include "../include/api.h"
 #include "api_list.h"
 
 /*
- * Single threaded memory manager
+ * Single threaded memory manager.
  *
- * ToDo: implement something usefull rather than just calling malloc/free :)
+ * By default allocations are served by malloc/free. When pool was
+ * initialized with huge pages, memory is carved from 2MB regions backed
+ * by MAP_HUGETLB or, if no huge pages reserved, by transparent huge pages.
+ * Each region serves a single power of two size class and its header
+ * is found by masking block address, so api_free does not depend on
+ * size hint in that mode.
  */
 
+#define API_POOL_REGION_SIZE    (2 * 1024 * 1024)
+#define API_POOL_REGION_HEADER  64
+#define API_POOL_MIN_CLASS      4   /* 16 bytes */
+#define API_POOL_CLASSES        16  /* up to 512KB */
+#define API_POOL_LARGE          API_POOL_CLASSES
+
+typedef enum api_pool_backing_t {
+    POOL_Regular,
+    POOL_HugeTlb,
+    POOL_Thp
+} api_pool_backing_t;
+
+typedef struct api_pool_region_t {
+    struct api_pool_region_t* next;
+    struct api_pool_region_t* prev;
+    size_t size;        /* mapped size */
+    size_t offset;      /* bump offset for next block */
+    int size_class;     /* API_POOL_LARGE for single large block */
+    api_pool_backing_t backing;
+} api_pool_region_t;
+
 typedef struct api_pool_t {
-    int dummy;
+    int huge_pages;
+    api_list_t regions;
+    api_pool_region_t* current[API_POOL_CLASSES];
+    void* free[API_POOL_CLASSES];
+    api_pool_stats_t stats;
 } api_pool_t;
 
-void api_pool_init(api_pool_t* pool);
+void api_pool_init(api_pool_t* pool, int huge_pages);
 void api_pool_cleanup(api_pool_t* pool);
 
 #endif // API_POOL_H_INCLUDED
\ No newline at end of file
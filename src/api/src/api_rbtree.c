@@ -280,22 +280,24 @@ void api_rbtree_swap(api_rbnode_t* node1, api_rbnode_t* node2)
 
 api_rbnode_t* api_rbtree_next(api_rbnode_t* node)
 {
-    api_rbnode_t* next = 0;
+    api_rbnode_t* next;
 
     if (node->right)
     {
         next = node->right;
-    }
-    else if (node->parent)
-    {
-        if (node != node->parent->right)
-            next = node->parent->right;
-    }
 
-    if (next)
-    {
         while (next->left)
             next = next->left;
+
+        return next;
+    }
+
+    /* first ancestor reached from its left subtree */
+    next = node->parent;
+    while (next && node == next->right)
+    {
+        node = next;
+        next = next->parent;
     }
 
     return next;
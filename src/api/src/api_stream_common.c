@@ -26,18 +26,11 @@
 #include "api_task.h"
 #include "api_stream_common.h"
 
-/* used in api_stream_transfer */
-typedef struct api_buffer_t {
-    struct api_buffer_t* next;
-    struct api_buffer_t* prev;
-    char*   buffer;
-    size_t  used;
-} api_buffer_t;
-
 /* data for api_stream_transfer */
 typedef struct api_transfer_t {
     api_stream_t* src;
-    api_list_t buffers;
+    api_buf_t* head;
+    api_buf_t* tail;
     api_task_t* writer;
     size_t chunk_size;
     int read_done;
@@ -107,49 +100,156 @@ size_t api_stream_read_exact(api_stream_t* stream, char* buffer, size_t length)
 
 size_t api_stream_unread(api_stream_t* stream, const char* buffer, size_t length)
 {
+    api_buf_t* buf;
+
     if (length == 0)
         return length;
 
-    if (stream->unread.length > 0)
-        api_free(api_pool_default(stream->loop), stream->unread.length, stream->unread.buffer);
+    api_stream_unread_clean(stream);
+
+    buf = api_buf_alloc(api_pool_default(stream->loop), length);
+    if (buf == 0)
+        return 0;
 
-    stream->unread.buffer = 
-        (char*)api_alloc(api_pool_default(stream->loop), length);
-    stream->unread.length = length;
-    stream->unread.offset = 0;
+    memcpy(buf->data, buffer, length);
+    buf->length = length;
 
-    memcpy(stream->unread.buffer, buffer, length);
+    stream->unread = buf;
 
     return length;
 }
 
+size_t api_stream_unread_buf(api_stream_t* stream, api_buf_t* buf)
+{
+    api_buf_t* tail = buf;
+
+    if (buf == 0)
+        return 0;
+
+    while (tail->next != 0)
+        tail = tail->next;
+
+    tail->next = stream->unread;
+    stream->unread = buf;
+
+    return api_buf_chain_length(buf);
+}
+
+size_t api_stream_read_unread(api_stream_t* stream, char* buffer, size_t length)
+{
+    api_buf_t* buf = stream->unread;
+    size_t done;
+
+    if (buf == 0)
+        return 0;
+
+    done = length < buf->length ? length : buf->length;
+
+    memcpy(buffer, buf->data, done);
+    buf->data += done;
+    buf->length -= done;
+    buf->size -= done;
+
+    if (buf->length == 0)
+    {
+        stream->unread = buf->next;
+        api_buf_free(buf);
+    }
+
+    return done;
+}
+
+void api_stream_unread_clean(api_stream_t* stream)
+{
+    api_buf_free_chain(stream->unread);
+    stream->unread = 0;
+}
+
+api_buf_t* api_stream_read_buf(api_stream_t* stream, size_t length)
+{
+    api_buf_t* buf = stream->unread;
+    api_buf_t* slice;
+
+    if (length == 0 || stream->loop == 0)
+        return 0;
+
+    if (buf != 0)
+    {
+        /* hand out unreaded data as is */
+        if (buf->length <= length)
+        {
+            stream->unread = buf->next;
+            buf->next = 0;
+            return buf;
+        }
+
+        slice = api_buf_slice(buf, 0, length);
+        if (slice != 0)
+        {
+            buf->data += length;
+            buf->length -= length;
+            buf->size -= length;
+        }
+
+        return slice;
+    }
+
+    buf = api_buf_alloc(api_pool_default(stream->loop), length);
+    if (buf == 0)
+        return 0;
+
+    buf->length = api_stream_read(stream, buf->data, length);
+    if (buf->length == 0)
+    {
+        api_buf_free(buf);
+        return 0;
+    }
+
+    return buf;
+}
+
+size_t api_stream_write_buf(api_stream_t* stream, api_buf_t* buf)
+{
+    size_t total = 0;
+    size_t wrote;
+
+    while (buf != 0)
+    {
+        wrote = api_stream_write(stream, buf->data, buf->length);
+        total += wrote;
+
+        if (wrote != buf->length)
+            break;
+
+        buf = buf->next;
+    }
+
+    return total;
+}
+
 void api_transfer_reader(api_loop_t* loop, void* arg)
 {
     api_transfer_t* transfer = (api_transfer_t*)arg;
-    api_pool_t* pool = api_pool_default(transfer->src->loop);
-    api_buffer_t* buffer;
-    size_t nread;
+    api_buf_t* buf;
 
     while (1)
     {
-        buffer = (api_buffer_t*)api_alloc(pool, sizeof(*buffer));
-        buffer->buffer = (char*)api_alloc(pool, transfer->chunk_size);
-
-        nread = api_stream_read(transfer->src, buffer->buffer,
-                                transfer->chunk_size);
+        /* unreaded data passed along without copy */
+        buf = api_stream_read_buf(transfer->src, transfer->chunk_size);
 
-        if (nread == 0)
+        if (buf == 0)
         {
-            api_free(pool, transfer->chunk_size, buffer->buffer);
-            api_free(pool, sizeof(*buffer), buffer);
-
             transfer->read_done = 1;
             break;
         }
         else
         {
-            buffer->used = nread;
-            api_list_push_tail(&transfer->buffers, (api_node_t*)buffer);
+            if (transfer->tail != 0)
+                transfer->tail->next = buf;
+            else
+                transfer->head = buf;
+
+            transfer->tail = buf;
         }
 
         if (transfer->write_done)
@@ -181,8 +281,7 @@ int api_stream_transfer(api_stream_t* dst,
     size_t used;
     int error;
     int failed = 0;
-    api_buffer_t* buffer;
-    api_pool_t* pool = api_pool_default(src->loop);
+    api_buf_t* buf;
 
     memset(&transfer, 0, sizeof(transfer));
 
@@ -196,23 +295,27 @@ int api_stream_transfer(api_stream_t* dst,
 
     while (1)
     {
-        api_task_sleep(transfer.writer);
+        api_task_wait(transfer.writer, TASK_WAIT_Io);
 
         ++transfer.num_wakeup_done;
 
-        buffer = (api_buffer_t*)api_list_pop_head(&transfer.buffers);
-        while (buffer != 0)
+        buf = transfer.head;
+        while (buf != 0)
         {
-            used = buffer->used;
+            transfer.head = buf->next;
+            if (transfer.head == 0)
+                transfer.tail = 0;
+
+            used = buf->length;
 
-            wrote = api_stream_write(dst, buffer->buffer, used);
+            wrote = api_stream_write(dst, buf->data, used);
+            total += wrote;
 
-            api_free(pool, chunk_size, buffer->buffer);
-            api_free(pool, sizeof(*buffer), buffer);
+            api_buf_free(buf);
 
             if (used == wrote)
             {
-                buffer = (api_buffer_t*)api_list_pop_head(&transfer.buffers);
+                buf = transfer.head;
             }
             else
             {
@@ -225,19 +328,11 @@ int api_stream_transfer(api_stream_t* dst,
         if (failed)
             break;
 
-        total += wrote;
-        if (transfer.read_done == 1 && transfer.buffers.head == 0)
+        if (transfer.read_done == 1 && transfer.head == 0)
             break;
     }
 
-    buffer = (api_buffer_t*)api_list_pop_head(&transfer.buffers);
-    while (buffer != 0)
-    {
-        api_free(pool, chunk_size, buffer->buffer);
-        api_free(pool, sizeof(*buffer), buffer);
-
-        buffer = (api_buffer_t*)api_list_pop_head(&transfer.buffers);
-    }
+    api_buf_free_chain(transfer.head);
 
     if (transferred != 0)
         *transferred = total;
@@ -264,4 +359,39 @@ void api_filter_detach(api_filter_t* filter, api_stream_t* stream)
 {
     api_list_remove((api_list_t*)&stream->filter_head, (api_node_t*)filter);
     filter->stream = 0;
+}
+
+/*
+ * Samples transport state of tcp stream once per configured period,
+ * piggybacks on reads and writes so idle connections cost nothing
+ */
+void api_stream_tcp_info(api_tcp_t* tcp)
+{
+    api_loop_base_t* base = (api_loop_base_t*)tcp->stream.loop;
+    uint64_t now = api_time_current();
+
+    if (tcp->info.sampled != 0 &&
+        now - tcp->info.sampled < base->config.tcp_info_period)
+        return;
+
+    if (API__OK == api_tcp_info_sample(tcp))
+        api_loop_latency_record(base, LATENCY_Rtt, tcp->info.rtt);
+    else
+        tcp->info.sampled = now;
+}
+
+void api_stream_latency(api_stream_t* stream, api_latency_t kind,
+                        uint64_t elapsed)
+{
+    api_loop_latency_record(stream->loop, kind, elapsed);
+
+    if (kind == LATENCY_Read && stream->read_latency != 0)
+        api_histogram_record(stream->read_latency, elapsed);
+
+    if (kind == LATENCY_Write && stream->write_latency != 0)
+        api_histogram_record(stream->write_latency, elapsed);
+
+    if (stream->type == STREAM_Tcp &&
+        ((api_loop_base_t*)stream->loop)->config.tcp_info_period != 0)
+        api_stream_tcp_info((api_tcp_t*)stream);
 }
\ No newline at end of file
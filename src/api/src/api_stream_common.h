@@ -28,4 +28,17 @@ void api_filter_on_write_timeout(api_filter_t* filter);
 void api_filter_on_error(api_filter_t* filter, int code);
 void api_filter_on_peerclosed(api_filter_t* filter);
 void api_filter_on_closed(api_filter_t* filter);
-void api_filter_on_terminate(api_filter_t* filter);
\ No newline at end of file
+void api_filter_on_terminate(api_filter_t* filter);
+
+/*
+ * Copy unreaded data to buffer, returns 0 if there is nothing unreaded
+ */
+size_t api_stream_read_unread(api_stream_t* stream, char* buffer, size_t length);
+void api_stream_unread_clean(api_stream_t* stream);
+
+/*
+ * Record latency of stream operation to its loop and to stream
+ * histogram if user provided one
+ */
+void api_stream_latency(api_stream_t* stream, api_latency_t kind,
+                        uint64_t elapsed);
\ No newline at end of file
@@ -19,7 +19,11 @@
  * IN THE SOFTWARE.
  */
 
+#include <stdlib.h>
+
 #include "api_task.h"
+#include "api_atomic.h"
+#include "api_trace.h"
 
 #if defined(__linux__)
 
@@ -79,6 +83,77 @@ done:
 
 #endif
 
+static api_task_account_t* api_task_account_find(api_scheduler_t* scheduler,
+                                                 void* callback)
+{
+    api_task_account_t* account;
+    size_t start = ((size_t)callback >> 4) % (API_TASK_ACCOUNTS - 1);
+    size_t i = start;
+
+    /* open addressing over entries 1.., entry 0 takes the rest */
+    do
+    {
+        account = &scheduler->accounts[i + 1];
+
+        if (account->callback == callback)
+            return account;
+
+        if (account->callback == 0)
+        {
+            api_atomic_barrier();
+            account->callback = callback;
+            return account;
+        }
+
+        i = (i + 1) % (API_TASK_ACCOUNTS - 1);
+    }
+    while (i != start);
+
+    return &scheduler->accounts[0];
+}
+
+/*
+ * Run slice of task switched out is charged to its callback, task
+ * switched in is charged time it waited for
+ */
+static void api_task_account(api_scheduler_t* scheduler,
+                             api_task_t* current, api_task_t* other)
+{
+    api_task_account_t* account;
+    uint64_t now = api_cycles();
+    uint64_t slice;
+
+    account = current->account;
+    if (current != &scheduler->main && account != 0)
+    {
+        slice = now - current->resumed;
+        account->run += slice;
+        if (account->run_max < slice)
+            account->run_max = slice;
+
+        current->suspended = now;
+    }
+
+    if (other == &scheduler->main)
+        return;
+
+    account = other->account;
+    if (account == 0)
+    {
+        account = api_task_account_find(scheduler, other->origin);
+        other->account = account;
+        ++account->tasks;
+    }
+    else
+    {
+        account->wait[other->reason] += now - other->suspended;
+    }
+
+    ++account->switches;
+    other->reason = TASK_WAIT_Event;
+    other->resumed = now;
+}
+
 #if !defined(__linux__)
 #pragma optimize( "", off)
 #endif
@@ -93,6 +168,14 @@ void api_task_swapcontext(api_task_t* current, api_task_t* other)
     DWORD win_error = GetLastError();
 #endif
 
+    ++scheduler->switches;
+    if (scheduler->accounts != 0)
+        api_task_account(scheduler, current, other);
+
+    api_trace(scheduler, TRACE_Switch, 0,
+              other != &scheduler->main ? other : 0,
+              (uint64_t)(size_t)other->origin, 0);
+
     scheduler->prev = current;
     scheduler->current = other;
     api_task_swapcontext_native(&current->platform, &other->platform);
@@ -123,6 +206,7 @@ static void api_task_entry_point(api_task_t* task, api_task_fn callback)
 {
     callback(task);
     task->is_done = 1;
+    ++task->scheduler->completed;
 
     api_task_swapcontext(task, task->parent);
 }
@@ -135,6 +219,7 @@ static void api_task_entry_point(api_task_t* task, api_task_fn callback)
 void api_task_defer(api_task_t* task)
 {
     task->is_done = 1;
+    ++task->scheduler->completed;
     task->scheduler->prev = task;
     api_task_setcontext(task->parent);
 }
@@ -162,11 +247,38 @@ void api_scheduler_init(api_scheduler_t* scheduler)
 {
     scheduler->current = &scheduler->main;
     scheduler->main.scheduler = scheduler;
+    scheduler->main.origin = 0;
     scheduler->prev = 0;
+    scheduler->tasks = 0;
+    scheduler->created = 0;
+    scheduler->completed = 0;
+    scheduler->switches = 0;
+    scheduler->accounts = 0;
+    scheduler->trace = 0;
 }
 
 void api_scheduler_destroy(api_scheduler_t* scheduler)
 {
+    free(scheduler->accounts);
+    scheduler->accounts = 0;
+
+    api_trace_detach(scheduler);
+}
+
+int api_scheduler_account(api_scheduler_t* scheduler)
+{
+    if (scheduler->accounts != 0)
+        return API__OK;
+
+    scheduler->accounts = (api_task_account_t*)
+                calloc(API_TASK_ACCOUNTS, sizeof(api_task_account_t));
+    if (scheduler->accounts == 0)
+        return API__NO_MEMORY;
+
+    scheduler->clock_started = api_cycles();
+    scheduler->time_started = api_time_precise();
+
+    return API__OK;
 }
 
 api_task_t* api_task_create(api_scheduler_t* scheduler, 
@@ -182,11 +294,22 @@ api_task_t* api_task_create(api_scheduler_t* scheduler,
     task = (api_task_t*)api_alloc(scheduler->pool, sizeof(*task) + stack_size);
 
     task->data = 0;
+    task->async.next = 0;
+    task->async.handler = 0;
+    task->async.pending = 0;
     task->is_done = 0;
     task->is_post = 0;
     task->parent = 0;
     task->stack_size = stack_size;
     task->scheduler = scheduler;
+    task->origin = (void*)callback;
+    task->account = 0;
+    task->reason = TASK_WAIT_Event;
+
+    ++scheduler->tasks;
+    api_trace(scheduler, TRACE_Create, 0, task,
+              (uint64_t)(size_t)callback, 0);
+    ++scheduler->created;
 
 #if defined(__linux__)
 
@@ -216,8 +339,11 @@ void api_task_delete(api_task_t* task)
 {
     /* dont delete yourself */
     if (task->scheduler->current != task)
+    {
+        --task->scheduler->tasks;
         api_free(task->scheduler->pool,
                 sizeof(*task) + task->stack_size, task);
+    }
 }
 
 void api_task_yield(api_task_t* current, void* value)
@@ -269,10 +395,19 @@ void api_task_post(api_task_t* task)
 
 void api_task_sleep(api_task_t* current)
 {
+    api_trace(current->scheduler, TRACE_Sleep, current->reason, current, 0, 0);
+    api_task_swapcontext(current, &current->scheduler->main);
+}
+
+void api_task_wait(api_task_t* current, api_task_wait_t reason)
+{
+    current->reason = reason;
+    api_trace(current->scheduler, TRACE_Sleep, reason, current, 0, 0);
     api_task_swapcontext(current, &current->scheduler->main);
 }
 
 void api_task_wakeup(api_task_t* task)
 {
+    api_trace(task->scheduler, TRACE_Wakeup, 0, task, 0, 0);
     api_task_swapcontext(task->scheduler->current, task);
 }
\ No newline at end of file
@@ -37,6 +37,42 @@ typedef CONTEXT api_context_t;
 
 #endif
 
+/*
+ * Intrusive node used to wake task up from other loops without
+ * allocation. Layout of next and handler matches head of api_async_t
+ */
+typedef struct api_task_async_t {
+    void* volatile next;
+    void* handler;
+    volatile long pending;
+} api_task_async_t;
+
+/*
+ * What sleeping task waits for, decides where its wait time is accounted
+ */
+typedef enum {
+    TASK_WAIT_Event = 0,    // events, channels, futures, other tasks
+    TASK_WAIT_Io,           // streams, connects, accepts, offloads
+    TASK_WAIT_Timer,        // sleeps and idles
+    TASK_WAIT_Count
+} api_task_wait_t;
+
+/*
+ * Totals of tasks started with same callback, in clock ticks. Written by
+ * loop only, callback is set last so readers see complete entry
+ */
+typedef struct api_task_account_t {
+    void* volatile callback;
+    volatile uint64_t tasks;
+    volatile uint64_t switches;
+    volatile uint64_t run;
+    volatile uint64_t run_max;
+    volatile uint64_t wait[TASK_WAIT_Count];
+} api_task_account_t;
+
+/* table size, tasks of callbacks that do not fit go to first entry */
+#define API_TASK_ACCOUNTS 128
+
 typedef struct api_task_t {
     api_context_t   platform;
     struct api_scheduler_t* scheduler;
@@ -45,6 +81,12 @@ typedef struct api_task_t {
     int     is_done;    // finished
     int     is_post;    // task is posted
     void*   data;       // user data
+    api_task_async_t async; // cross loop wakeup node
+    void*   origin;     // callback accounting is aggregated by
+    api_task_account_t* account;
+    uint64_t resumed;   // clock when current run slice began
+    uint64_t suspended; // clock when task last switched out
+    api_task_wait_t reason;
 } api_task_t;
 
 typedef struct api_scheduler_t {
@@ -53,6 +95,14 @@ typedef struct api_scheduler_t {
     struct api_task_t   main;
     void* value;
     api_pool_t* pool;
+    size_t tasks;   // created and not deleted yet
+    uint64_t created;
+    uint64_t completed;
+    uint64_t switches;
+    api_task_account_t* accounts;   // 0 unless accounting enabled
+    uint64_t clock_started;         // clock and time when enabled,
+    uint64_t time_started;          // to convert ticks to microseconds
+    struct api_trace_t* trace;      // 0 unless tracing enabled
 } api_scheduler_t;
 
 typedef void* (*api_task_fn)(api_task_t* task);
@@ -60,6 +110,11 @@ typedef void* (*api_task_fn)(api_task_t* task);
 API_EXTERN void api_scheduler_init(api_scheduler_t* scheduler);
 API_EXTERN void api_scheduler_destroy(api_scheduler_t* scheduler);
 
+/*
+ * Start accounting cpu time and waits of tasks by their callbacks
+ */
+API_EXTERN int api_scheduler_account(api_scheduler_t* scheduler);
+
 API_EXTERN api_task_t* api_task_create(api_scheduler_t* scheduler,
                         api_task_fn callback, size_t stack_size);
 API_EXTERN void api_task_delete(api_task_t* task);
@@ -70,6 +125,7 @@ API_EXTERN void* api_task_exec(api_task_t* task);
 API_EXTERN void  api_task_post(api_task_t* task);
 
 API_EXTERN void api_task_sleep(api_task_t* current);
+API_EXTERN void api_task_wait(api_task_t* current, api_task_wait_t reason);
 API_EXTERN void api_task_wakeup(api_task_t* task);
 
 #endif // API_TASK_H_INCLUDED
\ No newline at end of file
@@ -22,6 +22,7 @@
 #include <memory.h>
 
 #include "api_timer.h"
+#include "api_trace.h"
 
 int api_timer_compare(api_rbnode_t* node1, api_rbnode_t* node2)
 {
@@ -87,6 +88,10 @@ void api_timer_set(api_timers_t* timers, api_timer_t* timer,
     if (value == 0)
         return;
 
+    if (timer->task != 0)
+        api_trace(timer->task->scheduler, TRACE_Arm, type, timer->task,
+                  value, 0);
+
     /* find or create list with matching value */
 
     list.value = value;
@@ -115,7 +120,7 @@ int api_sleep_exec(api_timers_t* timers, api_task_t* task, uint64_t value)
     timer.task = task;
 
     api_timer_set(timers, &timer, TIMER_Sleep, value);
-    api_task_sleep(task);
+    api_task_wait(task, TASK_WAIT_Timer);
 
     if (timer.elapsed)
         return API__OK;
@@ -135,7 +140,7 @@ int api_idle_exec(api_timers_t* timers, api_task_t* task, uint64_t value)
     timer.task = task;
 
     api_timer_set(timers, &timer, TIMER_Idle, value);
-    api_task_sleep(timer.task);
+    api_task_wait(timer.task, TASK_WAIT_Timer);
 
     if (timer.elapsed)
         return API__OK;
@@ -200,6 +205,13 @@ int api_timer_process(api_timers_t* timers, api_timer_type_t type, uint64_t valu
                     timer->list = 0;
 
                     timer->elapsed = 1;
+
+                    if (type == TIMER_Sleep && timers->lateness != 0)
+                        api_histogram_record(timers->lateness, 1000 *
+                                (value - timer->issued - list->value));
+
+                    api_trace(timer->task->scheduler, TRACE_Fire, type,
+                              timer->task, 0, 0);
                     api_task_wakeup(timer->task);
 
                     timer = temp;
@@ -224,6 +236,7 @@ int api_timer_process(api_timers_t* timers, api_timer_type_t type, uint64_t valu
     }
 
     timers->processing = 0;
+    timers->fired += count;
 
     return count;
 }
@@ -268,12 +281,35 @@ void api_timer_terminate(api_timers_t* timers)
     timers->processing = 0;
 }
 
-uint64_t api_timers_nearest_event(api_timers_t* timers, uint64_t now)
+uint64_t api_timers_nearest_event(api_timers_t* timers,
+                                  api_timer_type_t type, uint64_t value)
 {
     api_timer_list_t* list = (api_timer_list_t*)api_rbtree_first(timers->root);
+    uint64_t nearest = (uint64_t)-1;
+    uint64_t remains;
+    uint64_t elapsed;
+
+    while (list != 0)
+    {
+        if (list->head != 0)
+        {
+            /* head of list is issued first, so fires first */
+            if (type == TIMER_Sleep)
+                elapsed = value - list->head->issued;
+            else
+                elapsed = value;
+
+            remains = elapsed < list->value ? list->value - elapsed : 0;
+            if (remains < nearest)
+                nearest = remains;
 
-    if (list)
-        return now - list->head->issued;
+            /* lists are ordered by value, only sleeps need all of them */
+            if (type != TIMER_Sleep)
+                break;
+        }
+
+        list = (api_timer_list_t*)api_rbtree_next(&list->node);
+    }
 
-    return -1;
+    return nearest;
 }
\ No newline at end of file
@@ -53,6 +53,8 @@ typedef struct api_timers_t {
     api_rbnode_t* root;
     api_pool_t* pool;
     uint64_t version;
+    uint64_t fired;
+    api_histogram_t* lateness;  // microseconds sleeps fired late, optional
     int processing;
 } api_timers_t;
 
@@ -70,6 +72,11 @@ int api_timeout_exec(api_timers_t* timers, api_timer_t* timer, uint64_t value);
 int api_timer_process(api_timers_t* timers, api_timer_type_t type, uint64_t value);
 void api_timer_terminate(api_timers_t* timers);
 
-uint64_t api_timers_nearest_event(api_timers_t* timers, uint64_t now);
+/*
+ * Milliseconds until first timer fires, value is the same as for
+ * api_timer_process. -1 if there are no timers
+ */
+uint64_t api_timers_nearest_event(api_timers_t* timers,
+                                  api_timer_type_t type, uint64_t value);
 
 #endif // API_TIMER_H_INCLUDED
\ No newline at end of file
@@ -0,0 +1,311 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <signal.h>
+#endif
+
+#include "api_trace.h"
+
+/*
+ * Rings of all tracing loops, written as Chrome trace event JSON that
+ * chrome://tracing and Perfetto open. Loop is a thread, task runs are
+ * complete events and the rest are instant events
+ */
+
+static api_trace_t* g_api_traces;
+static volatile long g_api_traces_lock;
+static char g_api_trace_crash_path[260];
+
+static void api_trace_lock()
+{
+    while (!api_atomic_cas_long(&g_api_traces_lock, 0, 1))
+        api_cpu_relax();
+}
+
+static void api_trace_unlock()
+{
+    api_atomic_xchg_long(&g_api_traces_lock, 0);
+}
+
+int api_trace_attach(api_scheduler_t* scheduler, void* loop, size_t size)
+{
+    api_trace_t* trace;
+    uint64_t entries = 1;
+
+    while (entries < size)
+        entries <<= 1;
+
+    trace = (api_trace_t*)malloc(sizeof(*trace));
+    if (trace == 0)
+        return API__NO_MEMORY;
+
+    trace->entries = (api_trace_entry_t*)
+                        calloc((size_t)entries, sizeof(api_trace_entry_t));
+    if (trace->entries == 0)
+    {
+        free(trace);
+        return API__NO_MEMORY;
+    }
+
+    trace->mask = entries - 1;
+    trace->head = 0;
+    trace->loop = loop;
+    trace->clock_started = api_cycles();
+    trace->time_started = api_time_precise();
+
+    api_trace_lock();
+    trace->next = g_api_traces;
+    g_api_traces = trace;
+    api_trace_unlock();
+
+    scheduler->trace = trace;
+
+    return API__OK;
+}
+
+void api_trace_detach(api_scheduler_t* scheduler)
+{
+    api_trace_t* trace = scheduler->trace;
+    api_trace_t** link;
+
+    if (trace == 0)
+        return;
+
+    scheduler->trace = 0;
+
+    api_trace_lock();
+
+    for (link = &g_api_traces; *link != 0; link = &(*link)->next)
+    {
+        if (*link == trace)
+        {
+            *link = trace->next;
+            break;
+        }
+    }
+
+    api_trace_unlock();
+
+    free(trace->entries);
+    free(trace);
+}
+
+static const char* api_trace_name(int type)
+{
+    switch (type) {
+    case TRACE_Create:  return "create";
+    case TRACE_Switch:  return "switch";
+    case TRACE_Sleep:   return "sleep";
+    case TRACE_Wakeup:  return "wakeup";
+    case TRACE_Poll:    return "poll";
+    case TRACE_Read:    return "read";
+    case TRACE_Write:   return "write";
+    case TRACE_Arm:     return "arm";
+    case TRACE_Fire:    return "fire";
+    case TRACE_Post:    return "post";
+    default:            return "unknown";
+    }
+}
+
+static const char* api_trace_reason(const api_trace_entry_t* entry)
+{
+    static const char* waits[] = { "event", "io", "timer" };
+    static const char* timers[] = { "sleep", "idle", "timeout" };
+
+    if (entry->type == TRACE_Sleep && entry->reason < TASK_WAIT_Count)
+        return waits[entry->reason];
+
+    if ((entry->type == TRACE_Arm || entry->type == TRACE_Fire) &&
+        entry->reason < 3)
+        return timers[entry->reason];
+
+    return "";
+}
+
+static void api_trace_write_ring(FILE* file, api_trace_t* trace,
+                                 int tid, int* first)
+{
+    api_trace_entry_t* entry;
+    uint64_t head = trace->head;
+    uint64_t index;
+    uint64_t ticks = api_cycles() - trace->clock_started;
+    uint64_t time = api_time_precise() - trace->time_started;
+    double scale = 1.0;
+    double ts;
+    double run_ts = 0;
+    void* run_task = 0;
+    uint64_t run_callback = 0;
+
+    /* ticks to microseconds, rate measured over life of ring */
+    if (ticks != 0)
+        scale = (double)time / (double)ticks;
+
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"name\":\"loop %p\"}}",
+            *first ? "" : ",\n", tid, trace->loop);
+    *first = 0;
+
+    index = head > trace->mask + 1 ? head - (trace->mask + 1) : 0;
+
+    for (; index < head; ++index)
+    {
+        entry = &trace->entries[index & trace->mask];
+        ts = (double)trace->time_started +
+             (double)(entry->clock - trace->clock_started) * scale;
+
+        switch (entry->type) {
+        case TRACE_Switch:
+            if (run_task != 0)
+            {
+                fprintf(file, ",\n{\"name\":\"task\",\"ph\":\"X\","
+                        "\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"args\":{\"task\":\"%p\",\"callback\":\"%#llx\"}}",
+                        tid, run_ts, ts - run_ts, run_task,
+                        (unsigned long long)run_callback);
+            }
+
+            run_task = entry->subject;
+            run_callback = entry->value;
+            run_ts = ts;
+            break;
+
+        case TRACE_Read:
+        case TRACE_Write:
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"stream\":\"%p\",\"bytes\":%u}}",
+                    api_trace_name(entry->type), tid, ts,
+                    (double)entry->value * scale, entry->subject,
+                    entry->extra);
+            break;
+
+        default:
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+                    "\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                    "\"args\":{\"subject\":\"%p\",\"value\":%llu,"
+                    "\"extra\":%u,\"reason\":\"%s\"}}",
+                    api_trace_name(entry->type), tid, ts, entry->subject,
+                    (unsigned long long)entry->value, entry->extra,
+                    api_trace_reason(entry));
+            break;
+        }
+    }
+}
+
+static int api_trace_write_all(const char* path)
+{
+    api_trace_t* trace;
+    FILE* file;
+    int first = 1;
+    int tid = 1;
+
+    file = fopen(path, "w");
+    if (file == 0)
+        return API__IO_ERROR;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    for (trace = g_api_traces; trace != 0; trace = trace->next)
+        api_trace_write_ring(file, trace, tid++, &first);
+
+    fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    if (0 != fclose(file))
+        return API__IO_ERROR;
+
+    return API__OK;
+}
+
+int api_trace_write(const char* path)
+{
+    int error;
+
+    api_trace_lock();
+    error = api_trace_write_all(path);
+    api_trace_unlock();
+
+    return error;
+}
+
+/*
+ * Process is going down anyway, so rings are written without lock
+ * and with functions that are not async signal safe
+ */
+
+#if defined(__linux__)
+
+static void api_trace_crash_handler(int signum)
+{
+    api_trace_write_all(g_api_trace_crash_path);
+    raise(signum);
+}
+
+int api_trace_on_crash(const char* path)
+{
+    static const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    struct sigaction action;
+    size_t i;
+
+    if (strlen(path) >= sizeof(g_api_trace_crash_path))
+        return API__INVALID_ARGUMENT;
+
+    strcpy(g_api_trace_crash_path, path);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = api_trace_crash_handler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i)
+    {
+        if (-1 == sigaction(signals[i], &action, 0))
+            return API__NOT_PERMITTED;
+    }
+
+    return API__OK;
+}
+
+#else
+
+static LONG WINAPI api_trace_crash_filter(EXCEPTION_POINTERS* exception)
+{
+    api_trace_write_all(g_api_trace_crash_path);
+
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+int api_trace_on_crash(const char* path)
+{
+    if (strlen(path) >= sizeof(g_api_trace_crash_path))
+        return API__INVALID_ARGUMENT;
+
+    strcpy(g_api_trace_crash_path, path);
+    SetUnhandledExceptionFilter(api_trace_crash_filter);
+
+    return API__OK;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,117 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef API_TRACE_H_INCLUDED
+#define API_TRACE_H_INCLUDED
+
+#include "api_task.h"
+#include "api_atomic.h"
+
+typedef enum {
+    TRACE_Create = 1,   // subject task, value callback
+    TRACE_Switch,       // subject task switched in, 0 for loop, value callback
+    TRACE_Sleep,        // subject task, reason api_task_wait_t
+    TRACE_Wakeup,       // subject task
+    TRACE_Poll,         // extra events returned by wait
+    TRACE_Read,         // subject stream, value ticks, extra bytes
+    TRACE_Write,        // subject stream, value ticks, extra bytes
+    TRACE_Arm,          // subject task, value period, reason timer type
+    TRACE_Fire,         // subject task, reason timer type
+    TRACE_Post          // subject callback, posted from other thread
+} api_trace_type_t;
+
+typedef struct api_trace_entry_t {
+    uint64_t clock;
+    uint64_t value;
+    void* subject;
+    uint32_t extra;
+    uint16_t type;
+    uint16_t reason;
+} api_trace_entry_t;
+
+/*
+ * Ring of most recent events of one loop, written by loop only.
+ * Readers copy it racing with loop, so newest entries may be torn
+ */
+typedef struct api_trace_t {
+    api_trace_entry_t* entries;
+    uint64_t mask;
+    volatile uint64_t head;
+    void* loop;
+    uint64_t clock_started;
+    uint64_t time_started;
+    struct api_trace_t* next;
+} api_trace_t;
+
+/*
+ * Create ring of at least size entries for scheduler of loop
+ * and make it visible to api_trace_write
+ */
+int api_trace_attach(api_scheduler_t* scheduler, void* loop, size_t size);
+void api_trace_detach(api_scheduler_t* scheduler);
+
+static void api_trace_push(api_trace_t* trace, api_trace_type_t type,
+                           int reason, void* subject, uint64_t value,
+                           uint32_t extra, uint64_t clock)
+{
+    api_trace_entry_t* entry = &trace->entries[trace->head & trace->mask];
+
+    entry->clock = clock;
+    entry->value = value;
+    entry->subject = subject;
+    entry->extra = extra;
+    entry->type = (uint16_t)type;
+    entry->reason = (uint16_t)reason;
+
+    trace->head += 1;
+}
+
+/*
+ * Record event now when scheduler traces, costs a branch otherwise
+ */
+#define api_trace(scheduler, type, reason, subject, value, extra)         \
+    do {                                                                  \
+        if ((scheduler)->trace != 0)                                      \
+            api_trace_push((scheduler)->trace, type, reason, subject,    \
+                           value, extra, api_cycles());                   \
+    } while (0)
+
+/*
+ * Clock to pass to api_trace_span, 0 when scheduler does not trace
+ */
+static uint64_t api_trace_clock(api_scheduler_t* scheduler)
+{
+    return scheduler->trace != 0 ? api_cycles() : 0;
+}
+
+/*
+ * Record event that started at clock and lasted until now
+ */
+static void api_trace_span(api_scheduler_t* scheduler,
+                           api_trace_type_t type, void* subject,
+                           uint32_t extra, uint64_t clock)
+{
+    if (scheduler->trace != 0 && clock != 0)
+        api_trace_push(scheduler->trace, type, 0, subject,
+                       api_cycles() - clock, extra, clock);
+}
+
+#endif // API_TRACE_H_INCLUDED
\ No newline at end of file
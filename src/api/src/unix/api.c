@@ -34,4 +34,11 @@ uint64_t api_time_current()
     struct timeval tv;       
     if (gettimeofday(&tv, 0) != 0) return 0;
     return (uint64_t)((tv.tv_sec * 1000ul) + (tv.tv_usec / 1000ul));
+}
+
+uint64_t api_time_precise()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) return 0;
+    return (uint64_t)ts.tv_sec * 1000000ul + (uint64_t)ts.tv_nsec / 1000ul;
 }
\ No newline at end of file
@@ -19,15 +19,23 @@
  * IN THE SOFTWARE.
  */
 
+#include <poll.h>
+
+#include "../api_atomic.h"
 #include "api_error.h"
 #include "api_misc.h"
 #include "api_async.h"
+#include "../api_trace.h"
 
 void* api_async_task_fn(api_task_t* task)
 {
     api_async_t* async = (api_async_t*)task->data;
+
+    api_loop_latency_record(async->loop, LATENCY_Queue,
+                            api_time_precise() - async->posted);
+
     async->callback(async->loop, async->arg);
-    api_free(&async->loop->base.pool, sizeof(*async), async);
+    free(async);
 
     return 0;
 }
@@ -48,13 +56,16 @@ void api_async_post_handler(api_loop_t* loop, struct api_async_t* async,
     /* handle terminate */
     if (events == -1)
     {
-        api_free(&async->loop->base.pool, sizeof(*async), async);
+        free(async);
     }
     else
     {
         task = api_task_create(&loop->base.scheduler, api_async_task_fn,
                             async->stack_size);
         task->data = async;
+        task->origin = (void*)async->callback;
+        api_trace(&loop->base.scheduler, TRACE_Post, 0,
+                  (void*)async->callback, 0, 0);
         api_task_post(task);
     }
 }
@@ -62,7 +73,14 @@ void api_async_post_handler(api_loop_t* loop, struct api_async_t* async,
 void api_async_wakeup_handler(api_loop_t* loop, struct api_async_t* async,
                             int events)
 {
-    api_task_wakeup((api_task_t*)async->arg);
+    api_task_t* task = (api_task_t*)
+                        ((char*)async - offsetof(api_task_t, async));
+
+    /* allow task to be queued again before it runs */
+    __sync_lock_release(&task->async.pending);
+
+    if (events != -1)
+        api_task_wakeup(task);
 }
 
 void api_async_exec_completed_handler(api_loop_t* loop,
@@ -70,7 +88,8 @@ void api_async_exec_completed_handler(api_loop_t* loop,
 {
     api_exec_t* exec = (api_exec_t*)async;
 
-    api_task_wakeup(exec->task);
+    if (events != -1)
+        api_task_wakeup(exec->task);
 }
 
 void api_async_exec_handler(api_loop_t* loop, struct api_async_t* async,
@@ -89,6 +108,7 @@ void api_async_exec_handler(api_loop_t* loop, struct api_async_t* async,
         task = api_task_create(&loop->base.scheduler, api_exec_task_fn,
                                 async->stack_size);
         task->data = async;
+        task->origin = (void*)async->callback;
         api_task_exec(task);
         api_task_delete(task);
 
@@ -96,27 +116,92 @@ void api_async_exec_handler(api_loop_t* loop, struct api_async_t* async,
     }
 
     exec->async.handler = api_async_exec_completed_handler;
-    api_async_post(exec->loop, 0, 0, 0);
+    api_async_push(exec->loop, &exec->async);
 }
 
 void api_async_processor(void* a, int events)
 {
     api_loop_t* loop = (api_loop_t*)((char*)a - offsetof(api_loop_t, asyncs));
-    eventfd_t value;
+    eventfd_t value = 0;
     api_async_t* async = 0;
+    uint64_t count = 0;
     int error = 0;
 
+    /*
+     * eventfd may be not written when called from api_async_spin,
+     * EAGAIN from nonblocking read is fine then
+     */
     error = eventfd_read(loop->asyncs.fd, &value);
     if (error)
     {
         /* handle error */
     }
+    else if (value >= API_ASYNC_STOP)
+    {
+        loop->asyncs.stopped = 1;
+    }
+
+    /*
+     * Producers pushing from now on have to notify again,
+     * barrier orders the release before draining
+     */
+    __sync_lock_release(&loop->asyncs.notified);
+    __sync_synchronize();
 
     async = (api_async_t*)api_mpscq_pop(&loop->asyncs.queue);
     while (async != 0)
     {
         async->handler(loop, async, events);
         async = (api_async_t*)api_mpscq_pop(&loop->asyncs.queue);
+        ++count;
+    }
+
+    loop->base.load.asyncs += count;
+    if (loop->base.load.async_depth_max < count)
+        loop->base.load.async_depth_max = count;
+}
+
+/*
+ * Used by cleanup of stopped loop while tasks absorb wakeups taken before
+ * terminate. Blocks on eventfd instead of spinning, resumes only wakeups
+ * and terminates everything else as api_async_terminate would, so posts
+ * create no tasks on loop going down
+ */
+void api_async_absorb(api_loop_t* loop)
+{
+    struct pollfd fd;
+    eventfd_t value = 0;
+    api_async_t* async;
+
+    fd.fd = loop->asyncs.fd;
+    fd.events = POLLIN;
+
+    while (loop->base.absorbing != 0)
+    {
+        if (-1 == eventfd_read(loop->asyncs.fd, &value))
+        {
+            /* EAGAIN, nothing pushed since last drain */
+        }
+
+        __sync_lock_release(&loop->asyncs.notified);
+        __sync_synchronize();
+
+        async = (api_async_t*)api_mpscq_pop(&loop->asyncs.queue);
+        while (async != 0)
+        {
+            if ((void*)async->handler == (void*)api_async_wakeup_handler)
+                async->handler(loop, async, 0);
+            else
+                async->handler(loop, async, -1);
+
+            async = (api_async_t*)api_mpscq_pop(&loop->asyncs.queue);
+        }
+
+        /* wakeup pushed after release writes eventfd */
+        if (loop->base.absorbing != 0 && -1 == poll(&fd, 1, 10))
+        {
+            /* EINTR, check again */
+        }
     }
 }
 
@@ -173,25 +258,33 @@ int api_async_terminate(api_loop_t* loop)
     return api_error_translate(error);
 }
 
-int api_async_post(api_loop_t* loop, 
-                   api_loop_fn callback, void* arg, size_t stack_size)
+/*
+ * Queue async and write to eventfd only if loop was not notified
+ * since it last drained the queue, or is spinning on the queue,
+ * exchange is a full barrier so the queued node is visible first
+ */
+int api_async_push(api_loop_t* loop, api_async_t* async)
 {
-    api_async_t* async =
-        (api_async_t*)api_alloc(&loop->base.pool, sizeof(api_async_t));
+    api_mpscq_push(&loop->asyncs.queue, &async->node);
 
-    if (async == 0)
+    if (__atomic_exchange_n(&loop->asyncs.notified, 1, __ATOMIC_SEQ_CST) != 0)
+        return API__OK;
+
+    if (-1 == eventfd_write(loop->asyncs.fd, 1))
     {
-        errno = ENOMEM;
-        return API__NO_MEMORY;
+        return api_error_translate(errno);
     }
 
-    async->loop = loop;
-    async->handler = api_async_post_handler;
-    async->callback = callback;
-    async->arg = arg;
-    async->stack_size = stack_size;
+    return API__OK;
+}
 
-    api_mpscq_push(&loop->asyncs.queue, &async->node);
+int api_async_push_chain(api_loop_t* loop,
+                         api_async_t* first, api_async_t* last)
+{
+    api_mpscq_push_chain(&loop->asyncs.queue, &first->node, &last->node);
+
+    if (__atomic_exchange_n(&loop->asyncs.notified, 1, __ATOMIC_SEQ_CST) != 0)
+        return API__OK;
 
     if (-1 == eventfd_write(loop->asyncs.fd, 1))
     {
@@ -201,10 +294,62 @@ int api_async_post(api_loop_t* loop,
     return API__OK;
 }
 
-int api_async_wakeup(api_loop_t* loop, api_task_t* task)
+/*
+ * Make loop run its iteration without queueing anything,
+ * coalesced with pending asyncs the same way
+ */
+int api_async_notify(api_loop_t* loop)
 {
-    api_async_t* async =
-        (api_async_t*)api_alloc(&loop->base.pool, sizeof(api_async_t));
+    if (__atomic_exchange_n(&loop->asyncs.notified, 1, __ATOMIC_SEQ_CST) != 0)
+        return API__OK;
+
+    if (-1 == eventfd_write(loop->asyncs.fd, 1))
+    {
+        return api_error_translate(errno);
+    }
+
+    return API__OK;
+}
+
+int api_async_spin(api_loop_t* loop, int spin)
+{
+    /* already notified, epoll will report eventfd */
+    if (__atomic_exchange_n(&loop->asyncs.notified, 1, __ATOMIC_SEQ_CST) != 0)
+        return 0;
+
+    while (spin-- > 0)
+    {
+        if (!api_mpscq_empty(&loop->asyncs.queue))
+        {
+            loop->asyncs.processor(&loop->asyncs, 0);
+            return 1;
+        }
+
+        api_cpu_relax();
+    }
+
+    __sync_lock_release(&loop->asyncs.notified);
+    __sync_synchronize();
+
+    /* pushed before release, producer relied on our spin */
+    if (!api_mpscq_empty(&loop->asyncs.queue))
+    {
+        loop->asyncs.processor(&loop->asyncs, 0);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * asyncs are allocated by foreign threads and freed by loop,
+ * so they are not taken from loop pool which is not thread safe
+ */
+
+int api_async_post(api_loop_t* loop, 
+                   api_loop_fn callback, void* arg, size_t stack_size)
+{
+    api_async_t* async = (api_async_t*)malloc(sizeof(api_async_t));
 
     if (async == 0)
     {
@@ -213,17 +358,74 @@ int api_async_wakeup(api_loop_t* loop, api_task_t* task)
     }
 
     async->loop = loop;
-    async->handler = api_async_wakeup_handler;
-    async->arg = task;
+    async->handler = api_async_post_handler;
+    async->callback = callback;
+    async->arg = arg;
+    async->stack_size = stack_size;
+    async->posted = api_time_precise();
 
-    api_mpscq_push(&loop->asyncs.queue, &async->node);
+    return api_async_push(loop, async);
+}
 
-    if (-1 == eventfd_write(loop->asyncs.fd, 1))
+int api_async_post_batch(api_loop_t* loop,
+                         const api_loop_post_t* items, size_t count)
+{
+    api_async_t* first = 0;
+    api_async_t* last = 0;
+    api_async_t* async;
+    size_t i;
+
+    if (count == 0)
+        return API__OK;
+
+    /* link in order, so tasks are created as items go */
+    for (i = 0; i < count; ++i)
     {
-        return api_error_translate(errno);
+        async = (api_async_t*)malloc(sizeof(api_async_t));
+        if (async == 0)
+        {
+            while (first != 0)
+            {
+                async = (api_async_t*)first->node.next;
+                free(first);
+                first = async;
+            }
+
+            errno = ENOMEM;
+            return API__NO_MEMORY;
+        }
+
+        async->loop = loop;
+        async->handler = api_async_post_handler;
+        async->callback = items[i].callback;
+        async->arg = items[i].arg;
+        async->stack_size = items[i].stack_size;
+        async->posted = api_time_precise();
+        async->node.next = 0;
+
+        if (last != 0)
+            last->node.next = &async->node;
+        else
+            first = async;
+
+        last = async;
     }
 
-    return API__OK;
+    return api_async_push_chain(loop, first, last);
+}
+
+/*
+ * Uses node embedded in task, so nothing is allocated. Wakeup of task
+ * already queued is merged with the pending one
+ */
+int api_async_wakeup(api_loop_t* loop, api_task_t* task)
+{
+    if (__sync_lock_test_and_set(&task->async.pending, 1) != 0)
+        return API__OK;
+
+    task->async.handler = (void*)api_async_wakeup_handler;
+
+    return api_async_push(loop, (api_async_t*)&task->async);
 }
 
 int api_async_exec(api_loop_t* current, api_loop_t* loop,
@@ -240,9 +442,7 @@ int api_async_exec(api_loop_t* current, api_loop_t* loop,
     exec.task = current->base.scheduler.current;
     exec.result = 0;
 
-    api_mpscq_push(&loop->asyncs.queue, &exec.async.node);
-
-    if (-1 == eventfd_write(loop->asyncs.fd, 1))
+    if (API__OK != api_async_push(loop, &exec.async))
     {
         /* handle error */
     }
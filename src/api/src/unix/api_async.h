@@ -30,6 +30,9 @@
 #include "api_loop.h"
 #include "api_mpscq.h"
 
+/* added to eventfd counter by api_loop_stop, posters add 1 */
+#define API_ASYNC_STOP ((eventfd_t)1 << 40)
+
 typedef struct api_async_t {
     api_mpscq_node_t node;
     void(*handler)(api_loop_t* loop, struct api_async_t* async, int events);
@@ -37,6 +40,7 @@ typedef struct api_async_t {
     api_loop_fn callback;
     void* arg;
     size_t stack_size;
+    uint64_t posted;            // api_time_precise when posted
 } api_async_t;
 
 typedef struct api_exec_t {
@@ -49,8 +53,16 @@ typedef struct api_exec_t {
 
 int api_async_init(api_loop_t* loop);
 int api_async_terminate(api_loop_t* loop);
+void api_async_absorb(api_loop_t* loop);
+int api_async_push(api_loop_t* loop, api_async_t* async);
+int api_async_push_chain(api_loop_t* loop,
+                         api_async_t* first, api_async_t* last);
+int api_async_notify(api_loop_t* loop);
+int api_async_spin(api_loop_t* loop, int spin);
 int api_async_post(api_loop_t* loop, 
                    api_loop_fn callback, void* arg, size_t stack_size);
+int api_async_post_batch(api_loop_t* loop,
+                         const api_loop_post_t* items, size_t count);
 int api_async_wakeup(api_loop_t* loop, api_task_t* task);
 int api_async_exec(api_loop_t* current, api_loop_t* loop,
                    api_loop_fn callback, void* arg, size_t stack_size);
@@ -27,6 +27,7 @@
 #include "api_error.h"
 #include "api_misc.h"
 #include "api_loop.h"
+#include "../api_trace.h"
 #include "api_async.h"
 #include "api_wait.h"
 #include "api_stream.h"
@@ -38,42 +39,83 @@ typedef struct os_linux_t {
     struct epoll_event e;
 } os_linux_t;
 
-int api_loop_init(api_loop_t* loop)
+int api_loop_init(api_loop_t* loop, const api_loop_config_t* config)
 {
-    api_pool_init(&loop->base.pool);
+    if (config != 0)
+        memcpy(&loop->base.config, config, sizeof(*config));
+
+    api_pool_init(&loop->base.pool, loop->base.config.huge_pages);
     api_mpscq_create(&loop->asyncs.queue);
     loop->base.sleeps.pool = &loop->base.pool;
     loop->base.idles.pool = &loop->base.pool;
     loop->base.timeouts.pool = &loop->base.pool;
+    loop->base.sleeps.lateness = &loop->base.latency[LATENCY_Timer];
     api_wait_init(loop);
     return api_async_init(loop);
 }
 
 int api_loop_cleanup(api_loop_t* loop)
 {
+    int error;
+
+    api_loop_terminate_waiting(&loop->base);
+
+    /*
+     * Wakeups taken before terminate are still on the way, absorbing
+     * tasks may have timers too, so absorbed before timers terminate
+     */
+    api_async_absorb(loop);
+
+    /* offload worker lets go of loop right after queueing its wakeup */
+    while (loop->base.offloads != 0)
+        api_cpu_relax();
+
     api_timer_terminate(&loop->base.idles);
     api_timer_terminate(&loop->base.sleeps);
     api_timer_terminate(&loop->base.timeouts);
     api_wait_notify(loop);
+
+    /*
+     * Asyncs drained while tasks and pool are alive,
+     * task wakeups are embedded in pool allocated tasks
+     */
+    error = api_async_terminate(loop);
     api_scheduler_destroy(&loop->base.scheduler);
     api_pool_cleanup(&loop->base.pool);
-    return api_async_terminate(loop);
+    return error;
 }
 
 int api_loop_run_internal(api_loop_t* loop)
 {
     struct epoll_event events[API_MAX_EVENTS];
     os_linux_t* os_linux;
+    int timeout;
     int n, i;
 
     api_scheduler_init(&loop->base.scheduler);
     loop->base.scheduler.pool = &loop->base.pool;
 
+    if (loop->base.config.task_accounting &&
+        api_scheduler_account(&loop->base.scheduler) != API__OK)
+    {
+        /* run without accounting */
+    }
+
+    if (loop->base.config.trace_events != 0 &&
+        api_trace_attach(&loop->base.scheduler, loop,
+                         loop->base.config.trace_events) != API__OK)
+    {
+        /* run without tracing */
+    }
+
     memset(events, 0, sizeof(struct epoll_event) * API_MAX_EVENTS);
+    loop->events = events;
     loop->base.now = api_time_current();
     loop->base.last_activity = loop->base.now;
 
     api_loop_ref(loop);
+    api_watchdog_attach(loop);
+    api_profiler_attach(loop);
 
     do
     {
@@ -83,8 +125,31 @@ int api_loop_run_internal(api_loop_t* loop)
             loop->base.last_activity = loop->base.now;
         }
 
-        n = epoll_wait(loop->epoll, events, API_MAX_EVENTS,
-            (int)api_loop_calculate_wait_timeout(&loop->base));
+        timeout = (int)api_loop_calculate_wait_timeout(&loop->base);
+
+        /* asyncs taken while spinning, just poll for other events */
+        if (timeout != 0 && loop->base.config.async_spin > 0 &&
+            api_async_spin(loop, loop->base.config.async_spin))
+        {
+            timeout = 0;
+            loop->base.now = api_time_current();
+            loop->base.last_activity = loop->base.now;
+        }
+
+        /*
+         * After spin released notified, so tasks queued by group
+         * posters relying on the spin are not missed
+         */
+        if (api_loop_group_process(loop, timeout != 0))
+        {
+            timeout = 0;
+            loop->base.now = api_time_current();
+            loop->base.last_activity = loop->base.now;
+        }
+
+        api_loop_load_wait(&loop->base);
+        n = epoll_wait(loop->epoll, events, API_MAX_EVENTS, timeout);
+        api_loop_load_wake(&loop->base, n);
 
         loop->base.now = api_time_current();
 
@@ -99,13 +164,21 @@ int api_loop_run_internal(api_loop_t* loop)
 
         if (n > 0)
         {
+            loop->events_count = n;
+
             for (i = 0; i < n; ++i)
             {
+                /* source left the loop while batch was processed */
+                if (events[i].data.ptr == 0)
+                    continue;
+
                 os_linux = (os_linux_t*)events[i].data.ptr;
                 os_linux->processor(os_linux, events[i].events);
                 loop->base.now = api_time_current();
                 loop->base.last_activity = loop->base.now;
             }
+
+            loop->events_count = 0;
         }
         else
         {
@@ -120,7 +193,10 @@ int api_loop_run_internal(api_loop_t* loop)
         api_timer_process(&loop->base.timeouts, TIMER_Timeout,
                 loop->base.now - loop->base.last_activity);
     }
-    while (1);
+    while (!loop->asyncs.stopped);
+
+    api_profiler_detach(loop);
+    api_watchdog_detach(loop);
 
     if (api_loop_cleanup(loop) != API__OK)
     {
@@ -147,6 +223,11 @@ static void* loop_thread_start(void* arg)
 }
 
 int api_loop_start(api_loop_t** loop)
+{
+    return api_loop_start_ex(loop, 0);
+}
+
+int api_loop_start_ex(api_loop_t** loop, const api_loop_config_t* config)
 {
     pthread_t thread;
 
@@ -173,7 +254,7 @@ int api_loop_start(api_loop_t** loop)
         return api_error_translate(sys_error);
     }
 
-    error = api_loop_init(*loop);
+    error = api_loop_init(*loop, config);
     if (error != API__OK)
     {
         sys_error = errno;
@@ -213,29 +294,26 @@ int api_loop_start(api_loop_t** loop)
     return error;
 }
 
+/*
+ * Stop is a single eventfd write recognized by its value, loop thread
+ * closes epoll and frees the loop, so nothing is touched after the write
+ */
 int api_loop_stop(api_loop_t* loop)
 {
-    return api_close(loop->epoll);
+    if (-1 == eventfd_write(loop->asyncs.fd, API_ASYNC_STOP))
+        return api_error_translate(errno);
+
+    return API__OK;
 }
 
 int api_loop_stop_and_wait(api_loop_t* current, api_loop_t* loop)
 {
-    int error = 0;
-
-    api_wait_exec(current, loop, 0);
-
-    error = api_close(loop->epoll);
-
-    api_task_sleep(current->base.scheduler.current);
-
-    return error;
+    return api_wait_exec(current, loop, 1);
 }
 
 int api_loop_wait(api_loop_t* current, api_loop_t* loop)
 {
-    api_wait_exec(current, loop, 1);
-
-    return API__OK;
+    return api_wait_exec(current, loop, 0);
 }
 
 int api_loop_post(api_loop_t* loop, api_loop_fn callback, void* arg,
@@ -244,6 +322,12 @@ int api_loop_post(api_loop_t* loop, api_loop_fn callback, void* arg,
     return api_async_post(loop, callback, arg, stack_size);
 }
 
+int api_loop_post_batch(api_loop_t* loop,
+                        const api_loop_post_t* items, size_t count)
+{
+    return api_async_post_batch(loop, items, count);
+}
+
 int api_loop_exec(api_loop_t* current, api_loop_t* loop,
                   api_loop_fn callback, void* arg, size_t stack_size)
 {
@@ -251,6 +335,12 @@ int api_loop_exec(api_loop_t* current, api_loop_t* loop,
 }
 
 int api_loop_run(api_loop_fn callback, void* arg, size_t stack_size)
+{
+    return api_loop_run_ex(callback, arg, stack_size, 0);
+}
+
+int api_loop_run_ex(api_loop_fn callback, void* arg, size_t stack_size,
+                    const api_loop_config_t* config)
 {
     api_loop_t loop;
     int error;
@@ -264,7 +354,7 @@ int api_loop_run(api_loop_fn callback, void* arg, size_t stack_size)
         return api_error_translate(errno);
     }
 
-    error = api_loop_init(&loop);
+    error = api_loop_init(&loop, config);
     if (error < 0)
     {
         sys_error = errno;
@@ -280,7 +370,7 @@ int api_loop_run(api_loop_fn callback, void* arg, size_t stack_size)
 
     if (callback != 0)
     {
-        error = api_loop_post(&loop, callback, arg, 0);
+        error = api_loop_post(&loop, callback, arg, stack_size);
 
         if (API__OK != error)
         {
@@ -23,23 +23,49 @@
 #define API_LOOP_H_INCLUDED
 
 #include <malloc.h>
+#include <pthread.h>
 
 #include "../api_loop_base.h"
 #include "../api_task.h"
+#include "api_error.h"
 #include "api_mpscq.h"
 
 typedef struct api_loop_t {
     api_loop_base_t base;
     int epoll;
+    struct epoll_event* events; // batch being processed
+    int events_count;
     api_mpscq_t waiters;
     struct {
         void(*processor)(void* asyncs, int events);
         struct epoll_event e;
         int fd;
         api_mpscq_t queue;
+        volatile int notified;  // eventfd written or loop spinning
+        int stopped;            // stop value read from eventfd
     } asyncs;
+    struct {
+        pthread_t thread;
+        struct api_loop_t* next;
+        uint64_t reported;      // since value of last reported stall
+    } watchdog;
 } api_loop_t;
 
+/*
+ * Drop events of source not processed yet in current batch, removing
+ * it from epoll does not take back what epoll_wait already returned
+ */
+static void api_loop_events_forget(api_loop_t* loop, void* source)
+{
+    int i;
+
+    for (i = 0; i < loop->events_count; ++i)
+    {
+        if (loop->events[i].data.ptr == source)
+            loop->events[i].data.ptr = 0;
+    }
+}
+
 static int api_loop_update(api_loop_t* loop, int fd, struct epoll_event* e, int events)
 {
     int error;
@@ -107,4 +133,16 @@ static uint64_t api_loop_unref(api_loop_t* loop)
     return refs;
 }
 
+/*
+ * Make running loop known to watchdog, called by loop thread
+ */
+void api_watchdog_attach(api_loop_t* loop);
+void api_watchdog_detach(api_loop_t* loop);
+
+/*
+ * Make samples taken in loop thread tagged with loop
+ */
+void api_profiler_attach(api_loop_t* loop);
+void api_profiler_detach(api_loop_t* loop);
+
 #endif // API_LOOP_H_INCLUDED
\ No newline at end of file
@@ -44,10 +44,32 @@ static void api_mpscq_push(api_mpscq_t* self, api_mpscq_node_t* n)
     api_mpscq_node_t* prev;
 
     n->next = 0;
-    prev = __sync_lock_test_and_set(&self->head, n);
+    prev = __atomic_exchange_n(&self->head, n, __ATOMIC_SEQ_CST);
     prev->next = n;
 }
 
+/*
+ * Splice chain of nodes linked by next, single exchange for all
+ */
+static void api_mpscq_push_chain(api_mpscq_t* self,
+                                 api_mpscq_node_t* first,
+                                 api_mpscq_node_t* last)
+{
+    api_mpscq_node_t* prev;
+
+    last->next = 0;
+    prev = __atomic_exchange_n(&self->head, last, __ATOMIC_SEQ_CST);
+    prev->next = first;
+}
+
+/*
+ * Can be called only by consumer, push in progress may be seen as empty
+ */
+static int api_mpscq_empty(api_mpscq_t* self)
+{
+    return self->tail == &self->stub && self->stub.next == 0;
+}
+
 static api_mpscq_node_t* api_mpscq_pop(api_mpscq_t* self)
 {
     api_mpscq_node_t* tail = self->tail;
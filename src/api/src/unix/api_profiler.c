@@ -0,0 +1,357 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "api_loop.h"
+#include "api_error.h"
+
+/*
+ * SIGPROF sampling of cpu time used by whole process. Samples are taken
+ * in thread that used the time, on whatever stack it runs, so unwinding
+ * a task ends at its entry point instead of getting lost in swapcontext.
+ * Each sample is tagged with loop, task and callback task was started
+ * with, and the callback becomes root frame of folded stacks
+ */
+
+#define API_PROFILER_DEPTH 32
+#define API_PROFILER_SAMPLES 16384
+
+/* handler and signal trampoline frames */
+#define API_PROFILER_SKIP 2
+
+/* itimer can not fire more often than about every scheduler tick */
+#define API_PROFILER_MAX_FREQUENCY 10000
+
+typedef struct api_profiler_sample_t {
+    api_loop_t* loop;
+    void* task;
+    void* callback;
+    int count;
+    void* frames[API_PROFILER_DEPTH];
+} api_profiler_sample_t;
+
+typedef struct api_profiler_t {
+    pthread_mutex_t lock;
+    api_profiler_sample_t* samples;
+    size_t capacity;
+    volatile long taken;        // claimed slots, may exceed capacity
+    volatile int running;
+    struct sigaction previous;
+} api_profiler_t;
+
+static api_profiler_t g_api_profiler = { PTHREAD_MUTEX_INITIALIZER };
+
+static __thread api_loop_t* g_api_profiler_loop;
+
+static void api_profiler_handler(int signum)
+{
+    api_profiler_t* profiler = &g_api_profiler;
+    api_loop_t* loop = g_api_profiler_loop;
+    api_profiler_sample_t* sample;
+    api_scheduler_t* scheduler;
+    api_task_t* task;
+    void* frames[API_PROFILER_DEPTH + API_PROFILER_SKIP];
+    long index;
+    int error = errno;
+    int count;
+
+    if (!profiler->running)
+        return;
+
+    index = __sync_fetch_and_add(&profiler->taken, 1);
+    if (index >= (long)profiler->capacity)
+        return;
+
+    sample = &profiler->samples[index];
+    sample->loop = loop;
+    sample->task = 0;
+    sample->callback = 0;
+
+    if (loop != 0)
+    {
+        scheduler = &loop->base.scheduler;
+        task = scheduler->current;
+
+        if (task != &scheduler->main)
+        {
+            sample->task = task;
+            sample->callback = task->origin;
+        }
+    }
+
+    count = backtrace(frames, API_PROFILER_DEPTH + API_PROFILER_SKIP);
+    count -= API_PROFILER_SKIP;
+    if (count < 0)
+        count = 0;
+
+    memcpy(sample->frames, frames + API_PROFILER_SKIP,
+           sizeof(void*) * count);
+    sample->count = count;
+
+    errno = error;
+}
+
+void api_profiler_attach(api_loop_t* loop)
+{
+    g_api_profiler_loop = loop;
+}
+
+void api_profiler_detach(api_loop_t* loop)
+{
+    g_api_profiler_loop = 0;
+}
+
+int api_profiler_start(int frequency)
+{
+    api_profiler_t* profiler = &g_api_profiler;
+    struct sigaction action;
+    struct itimerval timer;
+    void* frames[1];
+    uint64_t period;
+    int error = API__OK;
+
+    if (frequency <= 0)
+        return API__INVALID_ARGUMENT;
+
+    if (frequency > API_PROFILER_MAX_FREQUENCY)
+        frequency = API_PROFILER_MAX_FREQUENCY;
+
+    /* microseconds, tv_usec must stay below a second */
+    period = 1000000 / (uint64_t)frequency;
+
+    /* first backtrace loads unwinder, must not happen in handler */
+    backtrace(frames, 1);
+
+    pthread_mutex_lock(&profiler->lock);
+
+    if (profiler->running)
+    {
+        pthread_mutex_unlock(&profiler->lock);
+        return API__ALREADY_EXIST;
+    }
+
+    /* samples of previous run are kept until profiler starts again */
+    free(profiler->samples);
+    profiler->taken = 0;
+    profiler->capacity = API_PROFILER_SAMPLES;
+    profiler->samples = (api_profiler_sample_t*)
+                malloc(sizeof(api_profiler_sample_t) * profiler->capacity);
+
+    if (profiler->samples == 0)
+    {
+        profiler->capacity = 0;
+        pthread_mutex_unlock(&profiler->lock);
+        errno = ENOMEM;
+        return API__NO_MEMORY;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = api_profiler_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (-1 == sigaction(SIGPROF, &action, &profiler->previous))
+    {
+        error = api_error_translate(errno);
+        pthread_mutex_unlock(&profiler->lock);
+        return error;
+    }
+
+    profiler->running = 1;
+
+    timer.it_interval.tv_sec = (time_t)(period / 1000000);
+    timer.it_interval.tv_usec = (suseconds_t)(period % 1000000);
+    timer.it_value = timer.it_interval;
+
+    if (-1 == setitimer(ITIMER_PROF, &timer, 0))
+    {
+        error = api_error_translate(errno);
+        profiler->running = 0;
+        sigaction(SIGPROF, &profiler->previous, 0);
+    }
+
+    pthread_mutex_unlock(&profiler->lock);
+
+    return error;
+}
+
+int api_profiler_stop()
+{
+    api_profiler_t* profiler = &g_api_profiler;
+    struct itimerval timer;
+
+    pthread_mutex_lock(&profiler->lock);
+
+    if (!profiler->running)
+    {
+        pthread_mutex_unlock(&profiler->lock);
+        return API__OK;
+    }
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, 0);
+
+    profiler->running = 0;
+    __sync_synchronize();
+
+    /* signal already pending is ignored rather than killing process */
+    signal(SIGPROF, SIG_IGN);
+    sigaction(SIGPROF, &profiler->previous, 0);
+
+    pthread_mutex_unlock(&profiler->lock);
+
+    return API__OK;
+}
+
+static int api_profiler_compare(const void* a, const void* b)
+{
+    const api_profiler_sample_t* x = (const api_profiler_sample_t*)a;
+    const api_profiler_sample_t* y = (const api_profiler_sample_t*)b;
+
+    if (x->callback != y->callback)
+        return x->callback < y->callback ? -1 : 1;
+
+    if (x->count != y->count)
+        return x->count < y->count ? -1 : 1;
+
+    return memcmp(x->frames, y->frames, sizeof(void*) * x->count);
+}
+
+/*
+ * Addresses inside named function become its start, so samples differ
+ * only by functions on the stack
+ */
+static void api_profiler_normalize(api_profiler_sample_t* sample)
+{
+    Dl_info info;
+    int i;
+
+    for (i = 0; i < sample->count; ++i)
+    {
+        if (dladdr(sample->frames[i], &info) && info.dli_saddr != 0)
+            sample->frames[i] = info.dli_saddr;
+    }
+}
+
+static void api_profiler_symbol(FILE* file, void* address)
+{
+    Dl_info info;
+
+    if (!dladdr(address, &info))
+        fprintf(file, "%p", address);
+    else if (info.dli_sname != 0)
+        fprintf(file, "%s", info.dli_sname);
+    else
+        fprintf(file, "%s+%#lx", info.dli_fname,
+                (unsigned long)((char*)address - (char*)info.dli_fbase));
+}
+
+static void api_profiler_stack(FILE* file,
+                               const api_profiler_sample_t* sample,
+                               size_t samples)
+{
+    int i;
+
+    if (sample->loop == 0)
+        fprintf(file, "[thread]");
+    else if (sample->callback == 0)
+        fprintf(file, "[loop]");
+    else
+        api_profiler_symbol(file, sample->callback);
+
+    /* folded stacks go from root to leaf */
+    for (i = sample->count - 1; i >= 0; --i)
+    {
+        fputc(';', file);
+        api_profiler_symbol(file, sample->frames[i]);
+    }
+
+    fprintf(file, " %zu\n", samples);
+}
+
+int api_profiler_write(const char* path)
+{
+    api_profiler_t* profiler = &g_api_profiler;
+    api_profiler_sample_t* samples;
+    FILE* file;
+    size_t count;
+    size_t first;
+    size_t i;
+    int error = API__OK;
+
+    pthread_mutex_lock(&profiler->lock);
+
+    if (profiler->running)
+    {
+        pthread_mutex_unlock(&profiler->lock);
+        return API__TEMPORARY_UNAVAILABLE;
+    }
+
+    file = fopen(path, "w");
+    if (file == 0)
+    {
+        error = api_error_translate(errno);
+        pthread_mutex_unlock(&profiler->lock);
+        return error;
+    }
+
+    samples = profiler->samples;
+    count = (size_t)profiler->taken;
+    if (count > profiler->capacity)
+        count = profiler->capacity;
+
+    for (i = 0; i < count; ++i)
+        api_profiler_normalize(&samples[i]);
+
+    /* equal stacks become adjacent, each run is one folded line */
+    if (count != 0)
+        qsort(samples, count, sizeof(*samples), api_profiler_compare);
+
+    for (first = 0, i = 1; i <= count; ++i)
+    {
+        if (i == count ||
+            api_profiler_compare(&samples[first], &samples[i]) != 0)
+        {
+            api_profiler_stack(file, &samples[first], i - first);
+            first = i;
+        }
+    }
+
+    if (0 != fclose(file))
+        error = api_error_translate(errno);
+
+    pthread_mutex_unlock(&profiler->lock);
+
+    return error;
+}
\ No newline at end of file
@@ -65,6 +65,21 @@ int api_socket_recv_buffer_size(int fd, int size)
     return api_error_translate(errno);
 }
 
+int api_socket_error(int fd)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+
+    if (0 != getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length))
+        error = errno;
+
+    /* EPOLLERR always means failure, even when reason is gone */
+    if (error == 0)
+        return API__IO_ERROR;
+
+    return api_error_translate(error);
+}
+
 int api_tcp_nodelay(int fd, int enable)
 {
     int result = setsockopt(fd,
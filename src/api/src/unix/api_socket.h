@@ -31,6 +31,11 @@ int api_socket_non_block(int fd, int on);
 int api_socket_send_buffer_size(int fd, int size);
 int api_socket_recv_buffer_size(int fd, int size);
 
+/*
+ * Pending error of socket reported by EPOLLERR, never API__OK
+ */
+int api_socket_error(int fd);
+
 
 /*
  * tcp
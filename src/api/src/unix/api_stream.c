@@ -27,8 +27,10 @@
 
 #include "../../include/api.h"
 #include "api_error.h"
+#include "api_socket.h"
 #include "api_stream.h"
 #include "api_async.h"
+#include "../api_trace.h"
 
 typedef struct api_stream_read_t {
     char* buffer;
@@ -115,6 +117,7 @@ size_t api_stream_on_read(struct api_filter_t* filter,
     api_stream_read_t read;
     api_timer_t timeout;
     struct timespec start, end, elapsed;
+    uint64_t traced;
     uint64_t timeout_value = stream->read_timeout;
 
     if (length == 0)
@@ -128,6 +131,12 @@ size_t api_stream_on_read(struct api_filter_t* filter,
         stream->status.terminated)
         return 0;
 
+    if (stream->loop->base.terminated)
+    {
+        stream->status.terminated = 1;
+        return 0;
+    }
+
     read.buffer = buffer;
     read.length = length;
     read.done = 0;
@@ -144,14 +153,19 @@ size_t api_stream_on_read(struct api_filter_t* filter,
     }
 
     clock_gettime(CLOCK_MONOTONIC, &start);
+    traced = api_trace_clock(&stream->loop->base.scheduler);
 
     api_loop_read_add(stream->loop, stream->fd, &stream->os_linux.e);
 
-    api_task_sleep(read.task);
+    /* untimed read is resumed by loop cleanup too */
+    read.task->reason = TASK_WAIT_Io;
+    api_loop_sleep_task(&stream->loop->base, read.task);
 
     api_loop_read_del(stream->loop, stream->fd, &stream->os_linux.e);
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    api_trace_span(&stream->loop->base.scheduler, TRACE_Read, stream,
+                   (uint32_t)read.done, traced);
 
 	if (end.tv_nsec - start.tv_nsec < 0)
     {
@@ -170,6 +184,16 @@ size_t api_stream_on_read(struct api_filter_t* filter,
     stream->os_linux.reserved[0] = 0;
     stream->read_bandwidth.read += read.done;
     stream->read_bandwidth.period += elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+    api_stream_latency(stream, LATENCY_Read,
+                       elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000);
+
+    if (read.done == 0 && stream->loop->base.terminated)
+    {
+        stream->status.terminated = 1;
+        stream->filter_head->on_terminate(stream->filter_head);
+
+        return 0;
+    }
 
     if (timeout_value > 0 && timeout.elapsed)
     {
@@ -191,6 +215,7 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     api_stream_write_t write;
     api_timer_t timeout;
     struct timespec start, end, elapsed;
+    uint64_t traced;
     uint64_t timeout_value = stream->write_timeout;
 
     if (length == 0)
@@ -222,12 +247,21 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     }
 
     clock_gettime(CLOCK_MONOTONIC, &start);
+    traced = api_trace_clock(&stream->loop->base.scheduler);
 
     api_loop_write_add(stream->loop, stream->fd, &stream->os_linux.e);
 
     do
     {
-        api_task_sleep(write.task);
+        write.task->reason = TASK_WAIT_Io;
+        api_loop_sleep_task(&stream->loop->base, write.task);
+
+        if (stream->loop->base.terminated)
+        {
+            stream->status.terminated = 1;
+            stream->filter_head->on_terminate(stream->filter_head);
+            break;
+        }
 
         if (stream->status.write_timeout ||
             stream->status.error != API__OK ||
@@ -244,6 +278,8 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     api_loop_write_del(stream->loop, stream->fd, &stream->os_linux.e);
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    api_trace_span(&stream->loop->base.scheduler, TRACE_Write, stream,
+                   (uint32_t)write.offset, traced);
 
 	if (end.tv_nsec - start.tv_nsec < 0)
     {
@@ -262,6 +298,8 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     stream->os_linux.reserved[1] = 0;
     stream->write_bandwidth.sent += write.offset;
     stream->write_bandwidth.period += elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+    api_stream_latency(stream, LATENCY_Write,
+                       elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000);
 
     if (timeout_value > 0 && timeout.elapsed)
     {
@@ -272,7 +310,7 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     return write.offset;
 }
 
-void aio_read_completion_handler(sigval_t sigval)
+void aio_read_completion_handler(union sigval sigval)
 {
     api_stream_file_read_t* read = (api_stream_file_read_t*)sigval.sival_ptr;
     ssize_t result;
@@ -297,7 +335,7 @@ void aio_read_completion_handler(sigval_t sigval)
     api_async_wakeup(read->loop, read->task);
 }
 
-void aio_write_completion_handler(sigval_t sigval)
+void aio_write_completion_handler(union sigval sigval)
 {
     api_stream_file_write_t* write =
         (api_stream_file_write_t*)sigval.sival_ptr;
@@ -330,6 +368,7 @@ size_t api_stream_file_on_read(struct api_filter_t* filter,
     api_stream_file_read_t read;
     api_timer_t timeout;
     struct timespec start, end, elapsed;
+    uint64_t traced;
     uint64_t timeout_value = stream->read_timeout;
     int result;
 
@@ -377,10 +416,13 @@ size_t api_stream_file_on_read(struct api_filter_t* filter,
     }
 
     clock_gettime(CLOCK_MONOTONIC, &start);
+    traced = api_trace_clock(&stream->loop->base.scheduler);
 
-    api_task_sleep(read.task);
+    api_task_wait(read.task, TASK_WAIT_Io);
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    api_trace_span(&stream->loop->base.scheduler, TRACE_Read, stream,
+                   (uint32_t)read.done, traced);
 
 	if (end.tv_nsec - start.tv_nsec < 0)
     {
@@ -398,6 +440,8 @@ size_t api_stream_file_on_read(struct api_filter_t* filter,
 
     stream->read_bandwidth.read += read.done;
     stream->read_bandwidth.period += elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+    api_stream_latency(stream, LATENCY_Read,
+                       elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000);
 
     if (timeout_value > 0 && timeout.elapsed)
     {
@@ -430,6 +474,7 @@ size_t api_stream_file_on_write(struct api_filter_t* filter,
     api_timer_t timeout;
     uint64_t timeout_value = stream->write_timeout;
     struct timespec start, end, elapsed;
+    uint64_t traced;
     uint64_t done = 0;
     int result;
 
@@ -455,6 +500,7 @@ size_t api_stream_file_on_write(struct api_filter_t* filter,
     }
 
     clock_gettime(CLOCK_MONOTONIC, &start);
+    traced = api_trace_clock(&stream->loop->base.scheduler);
 
     do
     {
@@ -483,7 +529,7 @@ size_t api_stream_file_on_write(struct api_filter_t* filter,
             break;
         }
 
-        api_task_sleep(write.task);
+        api_task_wait(write.task, TASK_WAIT_Io);
 
         if (stream->loop->base.terminated)
             break;
@@ -511,6 +557,8 @@ size_t api_stream_file_on_write(struct api_filter_t* filter,
     while (done < length);
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    api_trace_span(&stream->loop->base.scheduler, TRACE_Write, stream,
+                   (uint32_t)done, traced);
 
 	if (end.tv_nsec - start.tv_nsec < 0)
     {
@@ -528,6 +576,8 @@ size_t api_stream_file_on_write(struct api_filter_t* filter,
 
     stream->write_bandwidth.sent += done;
     stream->write_bandwidth.period += elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+    api_stream_latency(stream, LATENCY_Write,
+                       elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000);
 
     if (timeout_value > 0 && timeout.elapsed)
     {
@@ -573,6 +623,10 @@ void api_stream_processor(api_stream_t* stream, int events)
 {
     api_task_t* task = 0;
 
+    /* migrating, not attached to any loop */
+    if (stream->loop == 0)
+        return;
+
     if (events == -1)
     {
         stream->status.terminated = 1;
@@ -581,10 +635,17 @@ void api_stream_processor(api_stream_t* stream, int events)
     else
     if (events & EPOLLERR)
     {
-        stream->status.error = api_error_translate(errno);
+        stream->status.error = api_socket_error(stream->fd);
         stream->filter_head->on_error(stream->filter_head, 
                                         stream->status.error);
     }
+    else if ((events & (EPOLLIN | EPOLLPRI)) && (events & (EPOLLHUP | EPOLLRDHUP)) &&
+             stream->os_linux.reserved[0] != 0)
+    {
+        /* peer wrote and closed at once, deliver data before close */
+        api_stream_read_try(stream);
+        task = ((api_stream_read_t*)stream->os_linux.reserved[0])->task;
+    }
     else if (events & EPOLLHUP)
     {
         stream->status.closed = 1;
@@ -684,6 +745,7 @@ int api_stream_attach(api_stream_t* stream, api_loop_t* loop)
     if (!error)
     {
         stream->loop = loop;
+        ++loop->base.streams;
         api_loop_ref(loop);
         return API__OK;
     }
@@ -693,8 +755,6 @@ int api_stream_attach(api_stream_t* stream, api_loop_t* loop)
 
 size_t api_stream_read(api_stream_t* stream, char* buffer, size_t length)
 {
-    size_t done = 0;
-
     if (length == 0)
         return length;
 
@@ -712,28 +772,8 @@ size_t api_stream_read(api_stream_t* stream, char* buffer, size_t length)
         return 0;
     }
 
-    if (stream->unread.length > 0)
-    {
-        if (stream->unread.length <= length)
-        {
-            done = stream->unread.length;
-            memcpy(buffer, stream->unread.buffer + stream->unread.offset,
-                stream->unread.length);
-            api_free(api_pool_default(stream->loop), stream->unread.length,
-                stream->unread.buffer);
-            stream->unread.length = 0;
-        }
-        else
-        {
-            done = length;
-            memcpy(buffer, stream->unread.buffer + stream->unread.offset,
-                length);
-            stream->unread.offset += length;
-            stream->unread.length -= length;
-        }
-
-        return done;
-    }
+    if (stream->unread != 0)
+        return api_stream_read_unread(stream, buffer, length);
 
     return stream->filter_head->on_read(stream->filter_head, buffer, length);
 }
@@ -761,8 +801,9 @@ int api_stream_close(api_stream_t* stream)
 {
     int error = 0;
 
-    if (stream->type == STREAM_File)
+    if (stream->type == STREAM_File || stream->loop == 0)
     {
+        /* migrated stream not attached is out of epoll already */
         stream->status.closed = 1;
         close(stream->fd);
     }
@@ -779,19 +820,118 @@ int api_stream_close(api_stream_t* stream)
 
     stream->filter_head->on_closed(stream->filter_head);
 
-    if (stream->unread.length > 0) 
-    {
-        api_free(api_pool_default(stream->loop), stream->unread.length,
-                    stream->unread.buffer);
-        stream->unread.length = 0;
-    }
+    api_stream_unread_clean(stream);
 
     if (stream->loop != 0)
     {
+        --stream->loop->base.streams;
         api_loop_unref(stream->loop);
         stream->loop = 0;
         return API__OK;
     }
 
+    if (stream->status.closed)
+        return API__OK;
+
     return api_error_translate(errno);
+}
+
+/*
+ * Stream in transit between loops, unread data is copied out of
+ * source loop pool as pools are not thread safe.
+ * Task stack and scheduler belong to source loop, so migrating task can
+ * not resume on target, stream continues in new task of target instead
+ */
+typedef struct api_stream_migration_t {
+    api_stream_t* stream;
+    api_loop_fn callback;
+    void* arg;
+    size_t length;
+    char data[1];
+} api_stream_migration_t;
+
+static void api_stream_migrated(api_loop_t* loop, void* arg)
+{
+    api_stream_migration_t* migration = (api_stream_migration_t*)arg;
+    api_stream_t* stream = migration->stream;
+    int error;
+
+    error = api_stream_attach(stream, loop);
+    if (error == API__OK && migration->length > 0)
+        api_stream_unread(stream, migration->data, migration->length);
+
+    /* not attached, callback sees why and can still close it */
+    if (error != API__OK && error != API__TERMINATE)
+        stream->status.error = error;
+
+    migration->callback(loop, migration->arg);
+
+    free(migration);
+}
+
+int api_stream_migrate(api_stream_t* stream, api_loop_t* target,
+                       api_loop_fn callback, void* arg, size_t stack_size)
+{
+    api_stream_migration_t* migration;
+    api_loop_t* source = stream->loop;
+    size_t length;
+    int error;
+
+    if (source == 0 || stream->status.closed)
+        return API__BAD_FILE;
+
+    /* quiesce, no task may wait on stream in source loop */
+    if (stream->os_linux.reserved[0] != 0 ||
+        stream->os_linux.reserved[1] != 0)
+        return API__TEMPORARY_UNAVAILABLE;
+
+    length = api_buf_chain_length(stream->unread);
+
+    migration = (api_stream_migration_t*)
+                    malloc(sizeof(api_stream_migration_t) + length);
+    if (migration == 0)
+        return API__NO_MEMORY;
+
+    if (stream->type == STREAM_Tcp)
+    {
+        if (-1 == epoll_ctl(source->epoll, EPOLL_CTL_DEL, stream->fd,
+                            &stream->os_linux.e))
+        {
+            error = errno;
+            free(migration);
+            return api_error_translate(error);
+        }
+
+        api_loop_events_forget(source, &stream->os_linux);
+    }
+
+    migration->stream = stream;
+    migration->callback = callback;
+    migration->arg = arg;
+    migration->length = 0;
+
+    /* each call takes at most one buffer of the chain */
+    while (stream->unread != 0)
+    {
+        migration->length += api_stream_read_unread(stream,
+                                    migration->data + migration->length,
+                                    length - migration->length);
+    }
+
+    --source->base.streams;
+    stream->loop = 0;
+    api_loop_unref(source);
+
+    error = api_loop_post(target, api_stream_migrated, migration, stack_size);
+    if (error != API__OK)
+    {
+        /* target is gone, take stream back */
+        if (API__OK == api_stream_attach(stream, source) &&
+            migration->length > 0)
+            api_stream_unread(stream, migration->data, migration->length);
+
+        free(migration);
+    }
+
+    return error;
 }
\ No newline at end of file
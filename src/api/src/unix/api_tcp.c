@@ -35,6 +35,25 @@
 #include "api_loop.h"
 
 
+/*
+ * Kernel tcp_info continues past tcpi_total_retrans, where libc
+ * declaration ends. Fields are appended only, so layout is stable
+ */
+typedef struct api_tcp_info_linux_t {
+    struct tcp_info info;
+    uint64_t pacing_rate;
+    uint64_t max_pacing_rate;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t segs_out;
+    uint32_t segs_in;
+    uint32_t notsent_bytes;
+    uint32_t min_rtt;
+    uint32_t data_segs_in;
+    uint32_t data_segs_out;
+    uint64_t delivery_rate;
+} api_tcp_info_linux_t;
+
 typedef struct api_tcp_listener_accept_t {
     api_tcp_t* tcp;
     int success;
@@ -85,6 +104,7 @@ int api_tcp_listener_accept_try(struct api_tcp_listener_t* listener)
         error = api_tcp_nodelay(data->tcp->stream.fd, 1);
 
         api_stream_init(&data->tcp->stream, STREAM_Tcp, data->tcp->stream.fd);
+        memset(&data->tcp->info, 0, sizeof(data->tcp->info));
     }
 
     return data->success;
@@ -235,9 +255,22 @@ int api_tcp_listen(api_tcp_listener_t* listener, api_loop_t* loop,
     return api_error_translate(error);
 }
 
+/* listener closed or terminated without error still fails accept */
+static int api_tcp_listener_failure(api_tcp_listener_t* listener)
+{
+    if (listener->status.error != API__OK)
+        return listener->status.error;
+
+    if (listener->status.terminated)
+        return API__TERMINATE;
+
+    return API__BAD_FILE;
+}
+
 int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
 {
     api_tcp_listener_accept_t accept;
+    uint64_t started = api_time_precise();
 
     if (listener->loop->base.terminated)
         return API__TERMINATE;
@@ -245,7 +278,7 @@ int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
     if (listener->status.closed ||
         listener->status.terminated ||
         listener->status.error != API__OK)
-        return listener->status.error;
+        return api_tcp_listener_failure(listener);
 
     accept.task = listener->loop->base.scheduler.current;
     accept.tcp = tcp;
@@ -258,18 +291,55 @@ int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
 
     api_loop_read_add(listener->loop, listener->fd, &listener->os_linux.e);
 
-    api_task_sleep(accept.task);
+    api_task_wait(accept.task, TASK_WAIT_Io);
 
     api_loop_read_del(listener->loop, listener->fd, &listener->os_linux.e);
 
     listener->os_linux.reserved = 0;
 
     if (accept.success)
+    {
+        api_loop_latency_record(listener->loop, LATENCY_Accept,
+                                api_time_precise() - started);
         return API__OK;
+    }
 
     return listener->status.error;
 }
 
+int api_tcp_try_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
+{
+    api_tcp_listener_accept_t accept;
+    void* reserved = listener->os_linux.reserved;
+
+    if (listener->loop->base.terminated)
+        return API__TERMINATE;
+
+    if (listener->status.closed ||
+        listener->status.terminated ||
+        listener->status.error != API__OK)
+        return api_tcp_listener_failure(listener);
+
+    accept.task = 0;
+    accept.tcp = tcp;
+    accept.success = 0;
+
+    tcp->address.address.ss_family = listener->os_linux.af;
+    tcp->address.length = sizeof(tcp->address.address);
+
+    listener->os_linux.reserved = &accept;
+    api_tcp_listener_accept_try(listener);
+    listener->os_linux.reserved = reserved;
+
+    if (accept.success)
+        return API__OK;
+
+    if (listener->status.error != API__OK)
+        return listener->status.error;
+
+    return API__TEMPORARY_UNAVAILABLE;
+}
+
 int api_tcp_close(api_tcp_listener_t* listener)
 {
     int error;
@@ -298,7 +368,7 @@ void api_tcp_connect_processor(api_stream_t* stream, int events)
     else
     if (events & EPOLLERR)
     {
-        stream->status.error = api_error_translate(errno);
+        stream->status.error = api_socket_error(stream->fd);
     }
     else if (events & EPOLLHUP)
     {
@@ -324,6 +394,7 @@ int api_tcp_connect(api_tcp_t* tcp,
     int error = API__OK;
     api_timer_t timeout;
     uint64_t timeout_value = tmeout;
+    uint64_t started = api_time_precise();
 
     memset(tcp, 0, sizeof(*tcp));
 
@@ -405,7 +476,8 @@ int api_tcp_connect(api_tcp_t* tcp,
                                                     timeout_value);
                     }
 
-                    api_task_sleep(loop->base.scheduler.current);
+                    api_task_wait(loop->base.scheduler.current,
+                                  TASK_WAIT_Io);
 
                     if (timeout_value > 0)
                         api_timeout_exec(&loop->base.timeouts, &timeout, 0);
@@ -445,6 +517,8 @@ int api_tcp_connect(api_tcp_t* tcp,
         api_stream_init(&tcp->stream, STREAM_Tcp, tcp->stream.fd);
         tcp->stream.loop = loop;
         api_loop_ref(loop);
+        api_loop_latency_record(loop, LATENCY_Connect,
+                                api_time_precise() - started);
         return API__OK;
     }
 
@@ -457,4 +531,32 @@ int api_tcp_connect(api_tcp_t* tcp,
         return tcp->stream.status.error;
 
     return -1;
+}
+
+int api_tcp_info_sample(api_tcp_t* tcp)
+{
+    api_tcp_info_linux_t info;
+    socklen_t length = sizeof(info);
+
+    memset(&info, 0, sizeof(info));
+
+    if (0 != getsockopt(tcp->stream.fd, IPPROTO_TCP, TCP_INFO,
+                        &info, &length))
+        return api_error_translate(errno);
+
+    tcp->info.sampled = api_time_current();
+    tcp->info.samples += 1;
+    tcp->info.rtt = info.info.tcpi_rtt;
+    tcp->info.rtt_var = info.info.tcpi_rttvar;
+    tcp->info.cwnd = info.info.tcpi_snd_cwnd;
+    tcp->info.mss = info.info.tcpi_snd_mss;
+    tcp->info.retransmits = info.info.tcpi_total_retrans;
+    tcp->info.unacked = (uint64_t)info.info.tcpi_unacked *
+                        info.info.tcpi_snd_mss;
+
+    /* older kernels return shorter structure */
+    if (length >= sizeof(info))
+        tcp->info.delivery_rate = info.delivery_rate;
+
+    return API__OK;
 }
\ No newline at end of file
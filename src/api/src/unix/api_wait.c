@@ -23,7 +23,8 @@
 
 void api_wait_handler(api_loop_t* loop, api_wait_t* wait, int events)
 {
-    api_task_wakeup(wait->task);
+    if (events != -1)
+        api_task_wakeup(wait->task);
 }
 
 void api_wait_init(api_loop_t* loop)
@@ -31,9 +32,13 @@ void api_wait_init(api_loop_t* loop)
     api_mpscq_create(&loop->waiters);
 }
 
-void api_wait_exec(api_loop_t* current, api_loop_t* loop, int sleep)
+/*
+ * Wait lives in this frame, so caller sleeps here until notified
+ */
+int api_wait_exec(api_loop_t* current, api_loop_t* loop, int stop)
 {
     api_wait_t wait;
+    int error = API__OK;
 
     wait.from = current;
     wait.to = loop;
@@ -41,8 +46,12 @@ void api_wait_exec(api_loop_t* current, api_loop_t* loop, int sleep)
 
     api_mpscq_push(&loop->waiters, &wait.node);
 
-    if (sleep)
-        api_task_sleep(current->base.scheduler.current);
+    if (stop)
+        error = api_loop_stop(loop);
+
+    api_task_sleep(current->base.scheduler.current);
+
+    return error;
 }
 
 void api_wait_notify(api_loop_t* loop)
@@ -54,8 +63,7 @@ void api_wait_notify(api_loop_t* loop)
     while (wait != 0)
     {
         wait->handler = api_wait_handler;
-        api_mpscq_push(&wait->from->asyncs.queue, &wait->node);
-        if (-1 == eventfd_write(wait->from->asyncs.fd, 1))
+        if (API__OK != api_async_push(wait->from, (api_async_t*)wait))
         {
             /* handle error */
         }
@@ -34,7 +34,7 @@ typedef struct api_wait_t {
 } api_wait_t;
 
 void api_wait_init(api_loop_t* loop);
-void api_wait_exec(api_loop_t* current, api_loop_t* loop, int sleep);
+int api_wait_exec(api_loop_t* current, api_loop_t* loop, int stop);
 void api_wait_notify(api_loop_t* loop);
 
 #endif // API_WAIT_H_INCLUDED
\ No newline at end of file
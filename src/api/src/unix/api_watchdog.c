@@ -0,0 +1,342 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <memory.h>
+#include <errno.h>
+#include <time.h>
+
+#include "api_loop.h"
+#include "api_error.h"
+
+/*
+ * Thread watching timestamps loops publish around epoll_wait. Stack of
+ * stalled loop is captured by its own thread in a signal handler, so
+ * loops pay nothing until they actually stall. Calls that are not
+ * restarted after a handler, like nanosleep, return EINTR in that case
+ */
+
+#define API_WATCHDOG_SIGNAL (SIGRTMIN + 3)
+
+/* how long to wait for stalled thread to run signal handler, in us */
+#define API_WATCHDOG_CAPTURE 100000
+
+typedef struct api_watchdog_t {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    api_loop_t* loops;
+    int started;
+    int stopping;
+    uint64_t threshold;
+    api_watchdog_fn sink;
+    void* arg;
+} api_watchdog_t;
+
+typedef struct api_watchdog_capture_t {
+    void* frames[API_STALL_FRAMES];
+    volatile int count;
+    volatile int pending;
+} api_watchdog_capture_t;
+
+static api_watchdog_t g_api_watchdog = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+static api_watchdog_capture_t g_api_watchdog_capture;
+
+static void api_watchdog_handler(int signum)
+{
+    api_watchdog_capture_t* capture = &g_api_watchdog_capture;
+    int error = errno;
+
+    capture->count = backtrace(capture->frames, API_STALL_FRAMES);
+    __sync_synchronize();
+    capture->pending = 0;
+
+    errno = error;
+}
+
+static void api_watchdog_print(const api_loop_stall_t* stall, void* arg)
+{
+    fprintf(stderr, "loop %p stalled for %llu ms in task %p\n",
+            (void*)stall->loop, (unsigned long long)stall->stalled,
+            stall->task);
+
+    if (stall->count > 0)
+        backtrace_symbols_fd(stall->frames, stall->count, STDERR_FILENO);
+}
+
+/*
+ * Ask stalled thread for its stack, called under lock so the loop can
+ * not detach and exit meanwhile. Returns 0 if nothing will be captured
+ */
+static int api_watchdog_signal(api_loop_t* loop)
+{
+    api_watchdog_capture_t* capture = &g_api_watchdog_capture;
+
+    /* handler of previous stall never ran, slot still belongs to it */
+    if (capture->pending)
+        return 0;
+
+    capture->count = 0;
+    capture->pending = 1;
+    __sync_synchronize();
+
+    if (0 != pthread_kill(loop->watchdog.thread, API_WATCHDOG_SIGNAL))
+    {
+        capture->pending = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+/* wait for handler without lock, loop may exit before it runs */
+static void api_watchdog_collect(api_loop_stall_t* stall)
+{
+    api_watchdog_capture_t* capture = &g_api_watchdog_capture;
+    int waited = 0;
+
+    while (capture->pending && waited < API_WATCHDOG_CAPTURE)
+    {
+        usleep(100);
+        waited += 100;
+    }
+
+    if (capture->pending)
+        return;
+
+    __sync_synchronize();
+    stall->count = capture->count;
+    memcpy(stall->frames, capture->frames, sizeof(void*) * stall->count);
+}
+
+/*
+ * Fill stall report of loop not reported yet, returns 0 if it is fine
+ */
+static int api_watchdog_check(api_watchdog_t* watchdog, api_loop_t* loop,
+                              uint64_t now, api_loop_stall_t* stall,
+                              int* capturing)
+{
+    api_scheduler_t* scheduler = &loop->base.scheduler;
+    uint64_t since = loop->base.load.since;
+    uint64_t woke = since >> 1;
+    api_task_t* task;
+
+    /* not started yet, waiting, or already reported */
+    if (since == 0 || (since & 1) || since == loop->watchdog.reported)
+        return 0;
+
+    if (now < woke || now - woke < watchdog->threshold * 1000)
+        return 0;
+
+    loop->watchdog.reported = since;
+
+    task = scheduler->current;
+
+    stall->loop = loop;
+    stall->task = task != &scheduler->main ? task : 0;
+    stall->stalled = (now - woke) / 1000;
+    stall->count = 0;
+
+    *capturing = api_watchdog_signal(loop);
+
+    return 1;
+}
+
+static void* api_watchdog_thread(void* arg)
+{
+    api_watchdog_t* watchdog = (api_watchdog_t*)arg;
+    struct timespec deadline;
+    uint64_t period = watchdog->threshold * 1000 / 4;
+    api_loop_stall_t stall;
+    api_watchdog_fn sink;
+    api_loop_t* loop;
+    int capturing;
+    void* sink_arg;
+
+    if (period < 1000)
+        period = 1000;
+
+    pthread_mutex_lock(&watchdog->lock);
+
+    while (!watchdog->stopping)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t)(period / 1000000);
+        deadline.tv_nsec += (long)(period % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&watchdog->cond, &watchdog->lock, &deadline);
+
+        /*
+         * Loops detach under lock, so none is freed while checked.
+         * Report is copied and lock released for capture and sink,
+         * reported loops are skipped when list is walked again
+         */
+        loop = watchdog->loops;
+        while (loop != 0 && !watchdog->stopping)
+        {
+            if (!api_watchdog_check(watchdog, loop, api_time_precise(),
+                                    &stall, &capturing))
+            {
+                loop = loop->watchdog.next;
+                continue;
+            }
+
+            sink = watchdog->sink;
+            sink_arg = watchdog->arg;
+
+            pthread_mutex_unlock(&watchdog->lock);
+
+            if (capturing)
+                api_watchdog_collect(&stall);
+
+            sink(&stall, sink_arg);
+
+            pthread_mutex_lock(&watchdog->lock);
+
+            loop = watchdog->loops;
+        }
+    }
+
+    pthread_mutex_unlock(&watchdog->lock);
+
+    return 0;
+}
+
+void api_watchdog_attach(api_loop_t* loop)
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+
+    loop->watchdog.thread = pthread_self();
+    loop->watchdog.reported = 0;
+
+    pthread_mutex_lock(&watchdog->lock);
+    loop->watchdog.next = watchdog->loops;
+    watchdog->loops = loop;
+    pthread_mutex_unlock(&watchdog->lock);
+}
+
+void api_watchdog_detach(api_loop_t* loop)
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+    api_loop_t** link;
+
+    pthread_mutex_lock(&watchdog->lock);
+
+    for (link = &watchdog->loops; *link != 0; link = &(*link)->watchdog.next)
+    {
+        if (*link == loop)
+        {
+            *link = loop->watchdog.next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&watchdog->lock);
+}
+
+int api_watchdog_start(uint64_t threshold,
+                       api_watchdog_fn sink, void* arg)
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+    struct sigaction action;
+    void* frames[1];
+    int error = API__OK;
+
+    if (threshold == 0)
+        return API__INVALID_ARGUMENT;
+
+    /* first backtrace loads unwinder, must not happen in handler */
+    backtrace(frames, 1);
+
+    pthread_mutex_lock(&watchdog->lock);
+
+    if (watchdog->started)
+    {
+        pthread_mutex_unlock(&watchdog->lock);
+        return API__ALREADY_EXIST;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = api_watchdog_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (-1 == sigaction(API_WATCHDOG_SIGNAL, &action, 0))
+    {
+        error = api_error_translate(errno);
+        pthread_mutex_unlock(&watchdog->lock);
+        return error;
+    }
+
+    watchdog->threshold = threshold;
+    watchdog->sink = sink != 0 ? sink : api_watchdog_print;
+    watchdog->arg = arg;
+    watchdog->stopping = 0;
+
+    error = pthread_create(&watchdog->thread, 0, api_watchdog_thread,
+                           watchdog);
+    if (error != 0)
+    {
+        pthread_mutex_unlock(&watchdog->lock);
+        return api_error_translate(error);
+    }
+
+    watchdog->started = 1;
+
+    pthread_mutex_unlock(&watchdog->lock);
+
+    return API__OK;
+}
+
+void api_watchdog_stop()
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+    pthread_t thread;
+
+    pthread_mutex_lock(&watchdog->lock);
+
+    if (!watchdog->started)
+    {
+        pthread_mutex_unlock(&watchdog->lock);
+        return;
+    }
+
+    watchdog->started = 0;
+    watchdog->stopping = 1;
+    thread = watchdog->thread;
+    pthread_cond_signal(&watchdog->cond);
+
+    pthread_mutex_unlock(&watchdog->lock);
+
+    pthread_join(thread, 0);
+}
\ No newline at end of file
@@ -21,14 +21,21 @@
 
 #include "api_error.h"
 #include "api_async.h"
+#include "../api_trace.h"
 
 static struct os_win_t g_api_async_processor;
+static struct os_win_t g_api_async_wakeup_processor;
+static struct os_win_t g_api_async_notify_processor;
 
 void* api_async_task_fn(api_task_t* task)
 {
     api_async_t* async = (api_async_t*)task->data;
+
+    api_loop_latency_record(async->loop, LATENCY_Queue,
+                            api_time_precise() - async->posted);
+
     async->callback(async->loop, async->arg);
-    api_free(&async->loop->base.pool, sizeof(*async), async);
+    free(async);
 
     return 0;
 }
@@ -47,9 +54,38 @@ void api_async_processor(struct os_win_t* e, DWORD transferred,
 {
     api_async_t* async = (api_async_t*)overlapped;
 
+    /* each async is a completion of its own, so depth is always one */
+    ++loop->base.load.asyncs;
+    loop->base.load.async_depth_max = 1;
+
     async->handler(async);
 }
 
+/*
+ * Wakeups are posted with task itself in place of overlapped
+ */
+void api_async_wakeup_processor(struct os_win_t* e, DWORD transferred,
+                        OVERLAPPED* overlapped, api_loop_t* loop,
+                        DWORD error)
+{
+    api_task_t* task = (api_task_t*)overlapped;
+
+    /* allow task to be queued again before it runs */
+    InterlockedExchange(&task->async.pending, 0);
+    ++loop->base.load.asyncs;
+    api_task_wakeup(task);
+}
+
+/*
+ * Notify only makes loop run its iteration
+ */
+void api_async_notify_processor(struct os_win_t* e, DWORD transferred,
+                        OVERLAPPED* overlapped, api_loop_t* loop,
+                        DWORD error)
+{
+    InterlockedExchange(&loop->notified, 0);
+}
+
 void api_async_post_handler(struct api_async_t* async)
 {
     api_task_t* task;
@@ -57,12 +93,25 @@ void api_async_post_handler(struct api_async_t* async)
     task = api_task_create(&async->loop->base.scheduler, api_async_task_fn,
                             async->stack_size);
     task->data = async;
+    task->origin = (void*)async->callback;
+    api_trace(&async->loop->base.scheduler, TRACE_Post, 0,
+              (void*)async->callback, 0, 0);
     api_task_post(task);
 }
 
-void api_async_wakeup_handler(struct api_async_t* async)
+/*
+ * Batch travels as a single completion, first async heads the chain
+ */
+void api_async_batch_handler(struct api_async_t* async)
 {
-    api_task_wakeup((api_task_t*)async->arg);
+    api_async_t* next;
+
+    while (async != 0)
+    {
+        next = async->next;
+        api_async_post_handler(async);
+        async = next;
+    }
 }
 
 void api_async_exec_completed_handler(struct api_async_t* async)
@@ -80,23 +129,36 @@ void api_async_exec_handler(struct api_async_t* async)
     task = api_task_create(&async->loop->base.scheduler, api_exec_task_fn,
                             async->stack_size);
     task->data = async;
+    task->origin = (void*)async->callback;
     api_task_exec(task);
     api_task_delete(task);
 
     exec->result = API__OK;
 
     exec->async.handler = api_async_exec_completed_handler;
-    api_async_post(exec->loop, 0, 0, 0);
+
+    if (!PostQueuedCompletionStatus(exec->loop->iocp, sizeof(*exec),
+            (ULONG_PTR)&g_api_async_processor, (LPOVERLAPPED)exec))
+    {
+        /* handle error */
+    }
 }
 
 void api_async_init()
 {
     g_api_async_processor.processor = api_async_processor;
+    g_api_async_wakeup_processor.processor = api_async_wakeup_processor;
+    g_api_async_notify_processor.processor = api_async_notify_processor;
 }
 
+/*
+ * asyncs are allocated by foreign threads and freed by loop,
+ * so they are not taken from loop pool which is not thread safe
+ */
+
 int api_async_post(api_loop_t* loop, api_loop_fn callback, void* arg, size_t stack_size)
 {
-    api_async_t* async = (api_async_t*)api_alloc(&loop->base.pool, sizeof(api_async_t));
+    api_async_t* async = (api_async_t*)malloc(sizeof(api_async_t));
     int error = 0;
 
     if (async == 0)
@@ -106,38 +168,107 @@ int api_async_post(api_loop_t* loop, api_loop_fn callback, void* arg, size_t sta
     async->callback = callback;
     async->arg = arg;
     async->stack_size = stack_size;
+    async->posted = api_time_precise();
     async->handler = api_async_post_handler;
 
     if (!PostQueuedCompletionStatus(loop->iocp, sizeof(*async),
                     (ULONG_PTR)&g_api_async_processor, (LPOVERLAPPED)async))
     {
         error = api_error_translate(GetLastError());
-        api_free(&loop->base.pool, sizeof(api_async_t), async);
+        free(async);
         return error;
     }
 
     return API__OK;
 }
 
-int api_async_wakeup(api_loop_t* loop, api_task_t* task)
+int api_async_post_batch(api_loop_t* loop,
+                         const api_loop_post_t* items, size_t count)
 {
-    api_async_t* async = (api_async_t*)api_alloc(&loop->base.pool, sizeof(api_async_t));
+    api_async_t* first = 0;
+    api_async_t* last = 0;
+    api_async_t* async;
+    size_t i;
     int error = 0;
 
-    if (async == 0)
-        return API__NO_MEMORY;
+    if (count == 0)
+        return API__OK;
 
-    async->loop = loop;
-    async->arg = task;
-    async->stack_size = 0;
-    async->handler = api_async_wakeup_handler;
+    for (i = 0; i < count; ++i)
+    {
+        async = (api_async_t*)malloc(sizeof(api_async_t));
+        if (async == 0)
+        {
+            error = API__NO_MEMORY;
+            break;
+        }
+
+        async->loop = loop;
+        async->callback = items[i].callback;
+        async->arg = items[i].arg;
+        async->stack_size = items[i].stack_size;
+        async->posted = api_time_precise();
+        async->handler = api_async_post_handler;
+        async->next = 0;
+
+        if (last != 0)
+            last->next = async;
+        else
+            first = async;
+
+        last = async;
+    }
 
-    if (!PostQueuedCompletionStatus(loop->iocp, sizeof(*async),
-                (ULONG_PTR)&g_api_async_processor, (LPOVERLAPPED)async))
+    if (error == 0)
     {
+        first->handler = api_async_batch_handler;
+
+        if (PostQueuedCompletionStatus(loop->iocp, sizeof(*first),
+                    (ULONG_PTR)&g_api_async_processor, (LPOVERLAPPED)first))
+            return API__OK;
+
         error = api_error_translate(GetLastError());
-        api_free(&loop->base.pool, sizeof(api_async_t), async);
-        return error;
+    }
+
+    while (first != 0)
+    {
+        async = first->next;
+        free(first);
+        first = async;
+    }
+
+    return error;
+}
+
+/*
+ * Nothing is allocated, task pointer travels through completion port.
+ * Wakeup of task already queued is merged with the pending one
+ */
+int api_async_wakeup(api_loop_t* loop, api_task_t* task)
+{
+    if (InterlockedExchange(&task->async.pending, 1) != 0)
+        return API__OK;
+
+    if (!PostQueuedCompletionStatus(loop->iocp, 0,
+                (ULONG_PTR)&g_api_async_wakeup_processor, (LPOVERLAPPED)task))
+    {
+        InterlockedExchange(&task->async.pending, 0);
+        return api_error_translate(GetLastError());
+    }
+
+    return API__OK;
+}
+
+int api_async_notify(api_loop_t* loop)
+{
+    if (InterlockedExchange(&loop->notified, 1) != 0)
+        return API__OK;
+
+    if (!PostQueuedCompletionStatus(loop->iocp, 0,
+                (ULONG_PTR)&g_api_async_notify_processor, NULL))
+    {
+        InterlockedExchange(&loop->notified, 0);
+        return api_error_translate(GetLastError());
     }
 
     return API__OK;
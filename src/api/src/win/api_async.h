@@ -29,7 +29,9 @@ typedef struct api_async_t {
     api_loop_fn callback;
     void* arg;
     size_t stack_size;
+    uint64_t posted;            // api_time_precise when posted
     void (*handler)(struct api_async_t* async);
+    struct api_async_t* next;   // rest of batch
 } api_async_t;
 
 typedef struct api_exec_t {
@@ -41,7 +43,10 @@ typedef struct api_exec_t {
 
 void api_async_init();
 int api_async_post(api_loop_t* loop, api_loop_fn callback, void* arg, size_t stack_size);
+int api_async_post_batch(api_loop_t* loop,
+                         const api_loop_post_t* items, size_t count);
 int api_async_wakeup(api_loop_t* loop, api_task_t* task);
+int api_async_notify(api_loop_t* loop);
 int api_async_exec(api_loop_t* current, api_loop_t* loop,
                    api_loop_fn callback, void* arg, size_t stack_size);
 
@@ -23,13 +23,18 @@
 
 #include "api_error.h"
 #include "api_loop.h"
+#include "../api_trace.h"
 
-int api_loop_init(api_loop_t* loop)
+int api_loop_init(api_loop_t* loop, const api_loop_config_t* config)
 {
-    api_pool_init(&loop->base.pool);
+    if (config != 0)
+        memcpy(&loop->base.config, config, sizeof(*config));
+
+    api_pool_init(&loop->base.pool, loop->base.config.huge_pages);
     loop->base.sleeps.pool = &loop->base.pool;
     loop->base.idles.pool = &loop->base.pool;
     loop->base.timeouts.pool = &loop->base.pool;
+    loop->base.sleeps.lateness = &loop->base.latency[LATENCY_Timer];
     loop->waiters = 0;
 
     QueryPerformanceFrequency(&loop->frequency); 
@@ -39,6 +44,16 @@ int api_loop_init(api_loop_t* loop)
 
 int api_loop_cleanup(api_loop_t* loop)
 {
+    /*
+     * Completion port is closed already, wakeups cannot arrive and
+     * tasks in api_loop_absorb_task stay until pool is released
+     */
+    api_loop_terminate_waiting(&loop->base);
+
+    /* offload requests live in frames of pool allocated tasks */
+    while (loop->base.offloads != 0)
+        Sleep(1);
+
     api_timer_terminate(&loop->base.idles);
     api_timer_terminate(&loop->base.sleeps);
     api_timer_terminate(&loop->base.timeouts);
@@ -55,17 +70,32 @@ int api_loop_run_internal(api_loop_t* loop)
     DWORD transfered;
     ULONG_PTR key;
     OVERLAPPED* overlapped;
+    DWORD timeout;
     DWORD error;
     BOOL failed;
     os_win_t* win;
 
     api_scheduler_init(&loop->base.scheduler);
     loop->base.scheduler.pool = &loop->base.pool;
+
+    if (loop->base.config.task_accounting &&
+        api_scheduler_account(&loop->base.scheduler) != API__OK)
+    {
+        /* run without accounting */
+    }
+
+    if (loop->base.config.trace_events != 0 &&
+        api_trace_attach(&loop->base.scheduler, loop,
+                         loop->base.config.trace_events) != API__OK)
+    {
+        /* run without tracing */
+    }
 	
     loop->base.now = api_time_current();
     loop->base.last_activity = loop->base.now;
 
     api_loop_ref(loop);
+    api_watchdog_attach(loop);
 
     do
     {
@@ -75,10 +105,22 @@ int api_loop_run_internal(api_loop_t* loop)
             loop->base.last_activity = loop->base.now;
         }
 
+        timeout = (DWORD)api_loop_calculate_wait_timeout(&loop->base);
+
+        if (api_loop_group_process(loop, timeout != 0))
+        {
+            timeout = 0;
+            loop->base.now = api_time_current();
+            loop->base.last_activity = loop->base.now;
+        }
+
         failed = 0;
         error = 0;
+        api_loop_load_wait(&loop->base);
         status = GetQueuedCompletionStatus(loop->iocp, &transfered, &key,
-            &overlapped, (DWORD)api_loop_calculate_wait_timeout(&loop->base));
+            &overlapped, timeout);
+        api_loop_load_wake(&loop->base,
+                            (status || overlapped != NULL) ? 1 : 0);
 
         loop->base.now = api_time_current();
 
@@ -149,6 +191,8 @@ int api_loop_run_internal(api_loop_t* loop)
     }
     while (!failed);
 
+    api_watchdog_detach(loop);
+
     if (API__OK != api_loop_cleanup(loop))
     {
         /* handle error */
@@ -177,6 +221,11 @@ static unsigned int __stdcall loop_thread_start(void* arg)
 }
 
 int api_loop_start(api_loop_t** loop)
+{
+    return api_loop_start_ex(loop, 0);
+}
+
+int api_loop_start_ex(api_loop_t** loop, const api_loop_config_t* config)
 {
     uintptr_t handle;
     unsigned int id;
@@ -204,7 +253,7 @@ int api_loop_start(api_loop_t** loop)
         return api_error_translate(sys_error);
     }
 
-    error = api_loop_init(*loop);
+    error = api_loop_init(*loop, config);
     if (error != API__OK)
     {
         if (!CloseHandle((*loop)->iocp))
@@ -255,24 +304,12 @@ int api_loop_stop(api_loop_t* loop)
 
 int api_loop_stop_and_wait(api_loop_t* current, api_loop_t* loop)
 {
-    int error = 0;
-
-    error = api_wait_exec(current, loop, 0);
-    if (error != API__OK)
-        return error;
-
-    error = api_loop_stop(loop);
-    if (error != API__OK)
-        return error;
-
-    api_task_sleep(current->base.scheduler.current);
-
-    return API__OK;
+    return api_wait_exec(current, loop, 1);
 }
 
 int api_loop_wait(api_loop_t* current, api_loop_t* loop)
 {
-    return api_wait_exec(current, loop, 1);
+    return api_wait_exec(current, loop, 0);
 }
 
 int api_loop_post(api_loop_t* loop, 
@@ -281,6 +318,12 @@ int api_loop_post(api_loop_t* loop,
     return api_async_post(loop, callback, arg, stack_size);
 }
 
+int api_loop_post_batch(api_loop_t* loop,
+                        const api_loop_post_t* items, size_t count)
+{
+    return api_async_post_batch(loop, items, count);
+}
+
 int api_loop_exec(api_loop_t* current, api_loop_t* loop,
                   api_loop_fn callback, void* arg, size_t stack_size)
 {
@@ -288,6 +331,12 @@ int api_loop_exec(api_loop_t* current, api_loop_t* loop,
 }
 
 int api_loop_run(api_loop_fn callback, void* arg, size_t stack_size)
+{
+    return api_loop_run_ex(callback, arg, stack_size, 0);
+}
+
+int api_loop_run_ex(api_loop_fn callback, void* arg, size_t stack_size,
+                    const api_loop_config_t* config)
 {
     api_loop_t loop;
     int error;
@@ -300,7 +349,7 @@ int api_loop_run(api_loop_fn callback, void* arg, size_t stack_size)
         return api_error_translate(GetLastError());
     }
 
-    error = api_loop_init(&loop);
+    error = api_loop_init(&loop, config);
     if (error != API__OK)
     {
         if (!CloseHandle(loop.iocp))
@@ -36,6 +36,12 @@ typedef struct api_loop_t {
     HANDLE iocp;
     struct api_wait_t* waiters;
     LARGE_INTEGER frequency;
+    volatile long notified;     // notify completion is pending
+    struct {
+        DWORD thread;
+        struct api_loop_t* next;
+        uint64_t reported;      // since value of last reported stall
+    } watchdog;
 } api_loop_t;
 
 static uint64_t api_loop_ref(api_loop_t* loop)
@@ -55,4 +61,10 @@ static uint64_t api_loop_unref(api_loop_t* loop)
     return refs;
 }
 
+/*
+ * Make running loop known to watchdog, called by loop thread
+ */
+void api_watchdog_attach(api_loop_t* loop);
+void api_watchdog_detach(api_loop_t* loop);
+
 #endif // API_LOOP_H_INCLUDED
\ No newline at end of file
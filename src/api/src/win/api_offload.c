@@ -0,0 +1,239 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <process.h>
+
+#include "api_loop.h"
+#include "api_error.h"
+
+/*
+ * Worker pool shared by all loops. Request lives in frame of the
+ * suspended task, so submitting allocates nothing and queue is bounded
+ * by number of sleeping tasks plus optional queue_limit. Loop cleanup
+ * waits for workers to let go of requests of the loop
+ */
+
+typedef struct api_offload_t {
+    struct api_offload_t* next;
+    api_loop_t* loop;
+    api_task_t* task;
+    api_offload_fn callback;
+    void* arg;
+    uint64_t submitted;
+} api_offload_t;
+
+typedef struct api_offload_pool_t {
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+    api_offload_t* head;
+    api_offload_t* tail;
+    int threads;
+    int started;
+    size_t queue_limit;
+    int error;
+    api_offload_stats_t stats;
+} api_offload_pool_t;
+
+static api_offload_pool_t g_api_offload = {
+    SRWLOCK_INIT, CONDITION_VARIABLE_INIT
+};
+
+extern int api_async_wakeup(api_loop_t* loop, api_task_t* task);
+
+static unsigned int __stdcall api_offload_worker(void* arg)
+{
+    api_offload_pool_t* pool = (api_offload_pool_t*)arg;
+    api_offload_t* offload;
+    api_loop_t* loop;
+    api_task_t* task;
+    uint64_t started;
+    uint64_t elapsed;
+
+    AcquireSRWLockExclusive(&pool->lock);
+
+    for (;;)
+    {
+        while (pool->head == 0)
+            SleepConditionVariableSRW(&pool->cond, &pool->lock, INFINITE, 0);
+
+        offload = pool->head;
+        pool->head = offload->next;
+        if (pool->head == 0)
+            pool->tail = 0;
+
+        pool->stats.queued -= 1;
+
+        started = api_time_precise();
+        elapsed = started - offload->submitted;
+        pool->stats.wait_total += elapsed;
+        if (elapsed > pool->stats.wait_max)
+            pool->stats.wait_max = elapsed;
+
+        ReleaseSRWLockExclusive(&pool->lock);
+
+        offload->callback(offload->arg);
+
+        elapsed = api_time_precise() - started;
+
+        /* offload dies as soon as task runs */
+        loop = offload->loop;
+        task = offload->task;
+
+        AcquireSRWLockExclusive(&pool->lock);
+
+        pool->stats.completed += 1;
+        pool->stats.run_total += elapsed;
+        if (elapsed > pool->stats.run_max)
+            pool->stats.run_max = elapsed;
+
+        ReleaseSRWLockExclusive(&pool->lock);
+
+        api_async_wakeup(loop, task);
+
+        /* loop may be released right after, not touched any more */
+        InterlockedDecrement(&loop->base.offloads);
+
+        AcquireSRWLockExclusive(&pool->lock);
+    }
+
+    return 0;
+}
+
+static int api_offload_start(api_offload_pool_t* pool)
+{
+    SYSTEM_INFO info;
+    uintptr_t handle;
+    int i;
+
+    if (pool->started)
+        return pool->error;
+
+    pool->started = 1;
+
+    if (pool->threads <= 0)
+    {
+        GetSystemInfo(&info);
+        pool->threads = info.dwNumberOfProcessors > 0
+                            ? (int)info.dwNumberOfProcessors : 1;
+    }
+
+    for (i = 0; i < pool->threads; ++i)
+    {
+        handle = _beginthreadex(0, 0, api_offload_worker, pool, 0, 0);
+        if (handle == 0)
+            break;
+
+        CloseHandle((HANDLE)handle);
+    }
+
+    pool->stats.threads = i;
+    if (i == 0)
+        pool->error = API__LIMIT;
+
+    return pool->error;
+}
+
+int api_offload_init(int threads, size_t queue_limit)
+{
+    api_offload_pool_t* pool = &g_api_offload;
+    int error = API__OK;
+
+    AcquireSRWLockExclusive(&pool->lock);
+
+    if (pool->started)
+    {
+        error = API__ALREADY_EXIST;
+    }
+    else
+    {
+        pool->threads = threads;
+        pool->queue_limit = queue_limit;
+        error = api_offload_start(pool);
+    }
+
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    return error;
+}
+
+int api_loop_offload(api_loop_t* loop, api_offload_fn callback, void* arg)
+{
+    api_offload_pool_t* pool = &g_api_offload;
+    api_offload_t offload;
+    int error;
+
+    offload.next = 0;
+    if (loop->base.terminated)
+        return API__TERMINATE;
+
+    offload.loop = loop;
+    offload.task = loop->base.scheduler.current;
+    offload.callback = callback;
+    offload.arg = arg;
+
+    AcquireSRWLockExclusive(&pool->lock);
+
+    error = api_offload_start(pool);
+    if (error == API__OK && pool->queue_limit != 0 &&
+        pool->stats.queued >= pool->queue_limit)
+    {
+        pool->stats.rejected += 1;
+        error = API__LIMIT;
+    }
+
+    if (error != API__OK)
+    {
+        ReleaseSRWLockExclusive(&pool->lock);
+        return error;
+    }
+
+    offload.submitted = api_time_precise();
+
+    if (pool->tail == 0)
+        pool->head = &offload;
+    else
+        pool->tail->next = &offload;
+    pool->tail = &offload;
+
+    pool->stats.submitted += 1;
+    pool->stats.queued += 1;
+    if (pool->stats.queued > pool->stats.queued_max)
+        pool->stats.queued_max = pool->stats.queued;
+
+    InterlockedIncrement(&loop->base.offloads);
+
+    WakeConditionVariable(&pool->cond);
+    ReleaseSRWLockExclusive(&pool->lock);
+
+    offload.task->reason = TASK_WAIT_Io;
+    api_loop_absorb_task(&loop->base, offload.task);
+
+    return API__OK;
+}
+
+void api_offload_stats(api_offload_stats_t* stats)
+{
+    api_offload_pool_t* pool = &g_api_offload;
+
+    AcquireSRWLockExclusive(&pool->lock);
+    *stats = pool->stats;
+    ReleaseSRWLockExclusive(&pool->lock);
+}
\ No newline at end of file
@@ -19,60 +19,24 @@
  * IN THE SOFTWARE.
  */
 
-#include "../../include/api.h"
-#include "api_error.h"
 #include "api_loop.h"
+#include "api_error.h"
 
-int api_event_init(api_event_t* ev, api_loop_t* loop)
-{
-    memset(ev, 0, sizeof(*ev));
-
-    ev->loop = loop;
+/*
+ * No SIGPROF on windows, use ETW based profilers there
+ */
 
-    return API__OK;
+int api_profiler_start(int frequency)
+{
+    return API__NOT_PERMITTED;
 }
 
-int api_event_signal(api_event_t* ev, api_loop_t* loop)
+int api_profiler_stop()
 {
-    api_task_t* task;
-
-    ++ev->value;
-
-    if (ev->reserved != 0)
-    {
-        task = (api_task_t*)ev->reserved;
-        ev->reserved = 0;
-
-        api_task_wakeup(task);
-    }
-
     return API__OK;
 }
 
-int api_event_wait(api_event_t* ev, uint64_t timeout)
+int api_profiler_write(const char* path)
 {
-    api_timer_t timer;
-
-    if (ev->value == 0)
-    {
-        if (timeout > 0)
-        {
-            memset(&timer, 0, sizeof(timer));
-            timer.task = ev->loop->base.scheduler.current;
-
-            api_timeout_exec(&ev->loop->base.timeouts, &timer, timeout);
-        }
-
-        ev->reserved = ev->loop->base.scheduler.current;
-        api_task_sleep(ev->loop->base.scheduler.current);
-        ev->loop->base.scheduler.current = 0;
-
-        if (timeout > 0)
-            api_timeout_exec(&ev->loop->base.timeouts, &timer, 0);
-
-        if (timeout > 0 && timer.elapsed)
-            return api_error_translate(ETIMEDOUT);
-    }
-
-    return API__OK;
+    return API__NOT_PERMITTED;
 }
\ No newline at end of file
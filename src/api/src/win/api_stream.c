@@ -25,6 +25,7 @@
 #include "api_error.h"
 #include "api_stream.h"
 #include "api_async.h"
+#include "../api_trace.h"
 
 /* read/write request */
 typedef struct api_stream_req_t {
@@ -40,6 +41,7 @@ size_t api_stream_on_read(struct api_filter_t* filter,
     api_timer_t timeout;
     uint64_t timeout_value = stream->read_timeout;
     LARGE_INTEGER start, end, elapsed;
+    uint64_t traced;
     WSABUF wsabuf;
     DWORD flags = 0;
     DWORD sys_error;
@@ -70,6 +72,7 @@ size_t api_stream_on_read(struct api_filter_t* filter,
     }
 
     QueryPerformanceCounter(&start);
+    traced = api_trace_clock(&stream->loop->base.scheduler);
 
     switch (stream->type) {
         case STREAM_File: {
@@ -139,9 +142,11 @@ size_t api_stream_on_read(struct api_filter_t* filter,
     }
 
     if (!completed)
-        api_task_sleep(read.task);
+        api_task_wait(read.task, TASK_WAIT_Io);
 
     QueryPerformanceCounter(&end);
+    api_trace_span(&stream->loop->base.scheduler, TRACE_Read, stream,
+                   (uint32_t)read.done, traced);
     elapsed.QuadPart = end.QuadPart - start.QuadPart;
     elapsed.QuadPart *= 1000000;
     elapsed.QuadPart /= stream->loop->frequency.QuadPart;
@@ -152,6 +157,7 @@ size_t api_stream_on_read(struct api_filter_t* filter,
     stream->os_win.reserved[0] = 0;
     stream->read_bandwidth.read += read.done;
     stream->read_bandwidth.period += elapsed.QuadPart;
+    api_stream_latency(stream, LATENCY_Read, elapsed.QuadPart);
 
     if (stream->type == STREAM_File)
         stream->impl.file.read_offset += read.done;
@@ -177,6 +183,7 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     api_timer_t timeout;
     uint64_t timeout_value = stream->write_timeout;
     LARGE_INTEGER start, end, elapsed;
+    uint64_t traced;
     size_t offset = 0;
     WSABUF wsabuf;
     DWORD flags = 0;
@@ -210,6 +217,7 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     }
 
     QueryPerformanceCounter(&start);
+    traced = api_trace_clock(&stream->loop->base.scheduler);
 
     do
     {
@@ -282,7 +290,7 @@ size_t api_stream_on_write(struct api_filter_t* filter,
         }
 
         if (!completed)
-            api_task_sleep(write.task);
+            api_task_wait(write.task, TASK_WAIT_Io);
 
         if (stream->type == STREAM_File)
             stream->impl.file.write_offset += write.done;
@@ -302,6 +310,8 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     while (offset < length && write.done > 0);
 
     QueryPerformanceCounter(&end);
+    api_trace_span(&stream->loop->base.scheduler, TRACE_Write, stream,
+                   (uint32_t)offset, traced);
     elapsed.QuadPart = end.QuadPart - start.QuadPart;
     elapsed.QuadPart *= 1000000;
     elapsed.QuadPart /= stream->loop->frequency.QuadPart;
@@ -312,6 +322,7 @@ size_t api_stream_on_write(struct api_filter_t* filter,
     stream->os_win.reserved[1] = 0;
     stream->write_bandwidth.sent += write.done;
     stream->write_bandwidth.period += elapsed.QuadPart;
+    api_stream_latency(stream, LATENCY_Write, elapsed.QuadPart);
 
     if (timeout_value > 0 && timeout.elapsed)
     {
@@ -442,6 +453,7 @@ int api_stream_attach(api_stream_t* stream, api_loop_t* loop)
     if (!error)
     {
         stream->loop = loop;
+        ++loop->base.streams;
         api_loop_ref(loop);
     }
 
@@ -450,8 +462,6 @@ int api_stream_attach(api_stream_t* stream, api_loop_t* loop)
 
 size_t api_stream_read(api_stream_t* stream, char* buffer, size_t length)
 {
-    size_t done = 0;
-
     if (length == 0)
         return length;
 
@@ -469,28 +479,8 @@ size_t api_stream_read(api_stream_t* stream, char* buffer, size_t length)
         return 0;
     }
 
-    if (stream->unread.length > 0)
-    {
-        if (stream->unread.length <= length)
-        {
-            done = stream->unread.length;
-            memcpy(buffer, stream->unread.buffer + stream->unread.offset,
-                    stream->unread.length);
-            api_free(api_pool_default(stream->loop), stream->unread.length,
-                        stream->unread.buffer);
-            stream->unread.length = 0;
-        }
-        else
-        {
-            done = length;
-            memcpy(buffer, stream->unread.buffer + stream->unread.offset, 
-                    length);
-            stream->unread.offset += length;
-            stream->unread.length -= length;
-        }
-
-        return done;
-    }
+    if (stream->unread != 0)
+        return api_stream_read_unread(stream, buffer, length);
 
     return stream->filter_head->on_read(stream->filter_head, buffer, length);
 }
@@ -537,18 +527,23 @@ int api_stream_close(api_stream_t* stream)
 
     stream->filter_head->on_closed(stream->filter_head);
 
-    if (stream->unread.length > 0) 
-    {
-        api_free(api_pool_default(stream->loop), stream->unread.length,
-            stream->unread.buffer);
-        stream->unread.length = 0;
-    }
+    api_stream_unread_clean(stream);
 
     if (stream->loop != 0)
     {
+        --stream->loop->base.streams;
         api_loop_unref(stream->loop);
         stream->loop = 0;
     }
 
     return error;
+}
+
+/*
+ * Handle can not be dissociated from completion port once bound
+ */
+int api_stream_migrate(api_stream_t* stream, api_loop_t* target,
+                       api_loop_fn callback, void* arg, size_t stack_size)
+{
+    return API__NOT_PERMITTED;
 }
\ No newline at end of file
@@ -26,5 +26,6 @@
 #include "../api_task.h"
 #include "../api_list.h"
 #include "../api_timer.h"
+#include "../api_stream_common.h"
 
 #endif // API_STREAM_H_INCLUDED
\ No newline at end of file
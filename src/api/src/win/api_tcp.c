@@ -20,6 +20,8 @@
  */
 
 #include <memory.h>
+#include <winsock2.h>
+#include <mstcpip.h>
 
 #include "api_stream.h"
 #include "api_socket.h"
@@ -154,6 +156,18 @@ int api_tcp_listen(api_tcp_listener_t* listener, api_loop_t* loop,
     return error;
 }
 
+/* listener closed or terminated without error still fails accept */
+static int api_tcp_listener_failure(api_tcp_listener_t* listener)
+{
+    if (listener->status.error != API__OK)
+        return listener->status.error;
+
+    if (listener->status.terminated)
+        return API__TERMINATE;
+
+    return API__BAD_FILE;
+}
+
 int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
 {
     api_tcp_listener_accept_t accept;
@@ -168,6 +182,7 @@ int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
     BOOL completed = FALSE;
     DWORD sys_error;
     int error = API__OK;
+    uint64_t started = api_time_precise();
 
     memset(&listener->os_win.ovl, 0, sizeof(listener->os_win.ovl));
 
@@ -177,7 +192,7 @@ int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
     if (listener->status.closed ||
         listener->status.terminated ||
         listener->status.error != API__OK)
-        return listener->status.error;
+        return api_tcp_listener_failure(listener);
 
     accept.task = listener->loop->base.scheduler.current;
 
@@ -216,7 +231,7 @@ int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
         }
 
         if (!completed)
-            api_task_sleep(accept.task);
+            api_task_wait(accept.task, TASK_WAIT_Io);
 
         lpfnGetAcceptExSockaddrs(buffer, 0, 
             sizeof(SOCKADDR_IN) + 16, sizeof(SOCKADDR_IN) + 16,
@@ -235,6 +250,7 @@ int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
             error = api_tcp_nodelay(tcp->stream.fd, 1);
 
             api_stream_init(&tcp->stream, STREAM_Tcp, tcp->stream.fd);
+            memset(&tcp->info, 0, sizeof(tcp->info));
         }
         else
         {
@@ -246,11 +262,32 @@ int api_tcp_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
     listener->os_win.reserved = 0;
 
     if (success)
+    {
+        api_loop_latency_record(listener->loop, LATENCY_Accept,
+                                api_time_precise() - started);
         return API__OK;
+    }
 
     return listener->status.error;
 }
 
+/*
+ * AcceptEx has no nonblocking form without an outstanding request,
+ * callers fall back to api_tcp_accept
+ */
+int api_tcp_try_accept(api_tcp_listener_t* listener, api_tcp_t* tcp)
+{
+    if (listener->loop->base.terminated)
+        return API__TERMINATE;
+
+    if (listener->status.closed ||
+        listener->status.terminated ||
+        listener->status.error != API__OK)
+        return api_tcp_listener_failure(listener);
+
+    return API__TEMPORARY_UNAVAILABLE;
+}
+
 int api_tcp_close(api_tcp_listener_t* listener)
 {
     closesocket(listener->fd);
@@ -288,6 +325,7 @@ int api_tcp_connect(api_tcp_t* tcp,
     struct sockaddr* a = (struct sockaddr*)&tcp->address.address;
     api_timer_t timeout;
     uint64_t timeout_value = tmeout;
+    uint64_t started = api_time_precise();
     HANDLE handle;
     DWORD dwSent = 0;
     DWORD sys_error = 0;
@@ -406,7 +444,7 @@ int api_tcp_connect(api_tcp_t* tcp,
     }
 
     if (!completed)
-        api_task_sleep(loop->base.scheduler.current);
+        api_task_wait(loop->base.scheduler.current, TASK_WAIT_Io);
 
     if (timeout_value > 0)
         api_timeout_exec(&loop->base.timeouts, &timeout, 0);
@@ -423,6 +461,8 @@ int api_tcp_connect(api_tcp_t* tcp,
         tcp->stream.loop = loop;
         
         api_loop_ref(loop);
+        api_loop_latency_record(loop, LATENCY_Connect,
+                                api_time_precise() - started);
         return API__OK;
     }
     else
@@ -431,4 +471,34 @@ int api_tcp_connect(api_tcp_t* tcp,
     }
 
     return error;
+}
+
+int api_tcp_info_sample(api_tcp_t* tcp)
+{
+#if defined(SIO_TCP_INFO)
+    TCP_INFO_v0 info;
+    DWORD version = 0;
+    DWORD bytes = 0;
+
+    if (0 != WSAIoctl((SOCKET)tcp->stream.fd, SIO_TCP_INFO,
+                      &version, sizeof(version), &info, sizeof(info),
+                      &bytes, NULL, NULL))
+        return api_error_translate(WSAGetLastError());
+
+    tcp->info.sampled = api_time_current();
+    tcp->info.samples += 1;
+    tcp->info.rtt = info.RttUs;
+    tcp->info.rtt_var = 0;
+    tcp->info.mss = info.Mss;
+
+    /* windows reports window and retransmissions in bytes */
+    tcp->info.cwnd = info.Mss != 0 ? info.Cwnd / info.Mss : 0;
+    tcp->info.retransmits = info.Mss != 0 ? info.BytesRetrans / info.Mss : 0;
+    tcp->info.delivery_rate = 0;
+    tcp->info.unacked = info.BytesInFlight;
+
+    return API__OK;
+#else
+    return API__NOT_PERMITTED;
+#endif
 }
\ No newline at end of file
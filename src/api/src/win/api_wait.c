@@ -50,9 +50,14 @@ void api_wait_init()
     g_api_wait_notifier.processor = api_wait_notifier;
 }
 
+/*
+ * Wait lives in this frame, so caller sleeps here until notified
+ */
 int api_wait_exec(struct api_loop_t* current,
-                struct api_loop_t* loop, int sleep)
+                struct api_loop_t* loop, int stop)
 {
+    int error;
+
     api_wait_t wait;
 
     wait.from = current;
@@ -64,8 +69,14 @@ int api_wait_exec(struct api_loop_t* current,
         return api_error_translate(GetLastError());
     }
 
-    if (sleep)
-        api_task_sleep(current->base.scheduler.current);
+    if (stop)
+    {
+        error = api_loop_stop(loop);
+        if (error != API__OK)
+            return error;
+    }
+
+    api_task_sleep(current->base.scheduler.current);
 
     return API__OK;
 }
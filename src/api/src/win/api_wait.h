@@ -32,7 +32,7 @@ typedef struct api_wait_t {
 
 void api_wait_init();
 int api_wait_exec(struct api_loop_t* current, 
-                struct api_loop_t* loop, int sleep);
+                struct api_loop_t* loop, int stop);
 void api_wait_notify(struct api_loop_t* loop);
 
 #endif // API_WAIT_H_INCLUDED
\ No newline at end of file
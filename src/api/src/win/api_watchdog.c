@@ -0,0 +1,265 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <process.h>
+#include <stdio.h>
+
+#include "api_loop.h"
+#include "api_error.h"
+
+/*
+ * Thread watching timestamps loops publish around completion port
+ * wait. Stack of stalled loop is walked while its thread is suspended,
+ * so loops pay nothing until they actually stall
+ */
+
+typedef struct api_watchdog_t {
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+    HANDLE thread;
+    api_loop_t* loops;
+    int started;
+    int stopping;
+    uint64_t threshold;
+    api_watchdog_fn sink;
+    void* arg;
+} api_watchdog_t;
+
+static api_watchdog_t g_api_watchdog = {
+    SRWLOCK_INIT, CONDITION_VARIABLE_INIT
+};
+
+static void api_watchdog_print(const api_loop_stall_t* stall, void* arg)
+{
+    int i;
+
+    fprintf(stderr, "loop %p stalled for %llu ms in task %p\n",
+            (void*)stall->loop, (unsigned long long)stall->stalled,
+            stall->task);
+
+    for (i = 0; i < stall->count; ++i)
+        fprintf(stderr, "  %p\n", stall->frames[i]);
+}
+
+static void api_watchdog_backtrace(api_loop_t* loop, api_loop_stall_t* stall)
+{
+    HANDLE thread;
+    CONTEXT context;
+#if defined(_WIN64)
+    PRUNTIME_FUNCTION function;
+    DWORD64 image;
+    DWORD64 frame;
+    PVOID handler;
+#endif
+
+    stall->count = 0;
+
+    thread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT |
+                        THREAD_QUERY_INFORMATION, FALSE,
+                        loop->watchdog.thread);
+    if (thread == NULL)
+        return;
+
+    if (SuspendThread(thread) == (DWORD)-1)
+    {
+        CloseHandle(thread);
+        return;
+    }
+
+    memset(&context, 0, sizeof(context));
+    context.ContextFlags = CONTEXT_FULL;
+
+    if (GetThreadContext(thread, &context))
+    {
+#if defined(_WIN64)
+        while (stall->count < API_STALL_FRAMES && context.Rip != 0)
+        {
+            stall->frames[stall->count++] = (void*)context.Rip;
+
+            function = RtlLookupFunctionEntry(context.Rip, &image, NULL);
+            if (function == NULL)
+            {
+                /* leaf function, return address is on top of stack */
+                context.Rip = *(DWORD64*)context.Rsp;
+                context.Rsp += sizeof(DWORD64);
+            }
+            else
+            {
+                RtlVirtualUnwind(UNW_FLAG_NHANDLER, image, context.Rip,
+                                 function, &context, &handler, &frame, NULL);
+            }
+        }
+#else
+        stall->frames[stall->count++] = (void*)context.Eip;
+#endif
+    }
+
+    ResumeThread(thread);
+    CloseHandle(thread);
+}
+
+static void api_watchdog_check(api_watchdog_t* watchdog, api_loop_t* loop,
+                               uint64_t now)
+{
+    api_loop_stall_t stall;
+    api_scheduler_t* scheduler = &loop->base.scheduler;
+    uint64_t since = loop->base.load.since;
+    uint64_t woke = since >> 1;
+    api_task_t* task;
+
+    /* not started yet, waiting, or already reported */
+    if (since == 0 || (since & 1) || since == loop->watchdog.reported)
+        return;
+
+    if (now < woke || now - woke < watchdog->threshold * 1000)
+        return;
+
+    loop->watchdog.reported = since;
+
+    task = scheduler->current;
+
+    stall.loop = loop;
+    stall.task = task != &scheduler->main ? task : 0;
+    stall.stalled = (now - woke) / 1000;
+
+    api_watchdog_backtrace(loop, &stall);
+
+    watchdog->sink(&stall, watchdog->arg);
+}
+
+static unsigned int __stdcall api_watchdog_thread(void* arg)
+{
+    api_watchdog_t* watchdog = (api_watchdog_t*)arg;
+    DWORD period = (DWORD)(watchdog->threshold / 4);
+    api_loop_t* loop;
+
+    if (period == 0)
+        period = 1;
+
+    AcquireSRWLockExclusive(&watchdog->lock);
+
+    while (!watchdog->stopping)
+    {
+        SleepConditionVariableSRW(&watchdog->cond, &watchdog->lock,
+                                  period, 0);
+
+        /* loops detach under lock, so none is freed while checked */
+        for (loop = watchdog->loops; loop != 0; loop = loop->watchdog.next)
+            api_watchdog_check(watchdog, loop, api_time_precise());
+    }
+
+    ReleaseSRWLockExclusive(&watchdog->lock);
+
+    return 0;
+}
+
+void api_watchdog_attach(api_loop_t* loop)
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+
+    loop->watchdog.thread = GetCurrentThreadId();
+    loop->watchdog.reported = 0;
+
+    AcquireSRWLockExclusive(&watchdog->lock);
+    loop->watchdog.next = watchdog->loops;
+    watchdog->loops = loop;
+    ReleaseSRWLockExclusive(&watchdog->lock);
+}
+
+void api_watchdog_detach(api_loop_t* loop)
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+    api_loop_t** link;
+
+    AcquireSRWLockExclusive(&watchdog->lock);
+
+    for (link = &watchdog->loops; *link != 0; link = &(*link)->watchdog.next)
+    {
+        if (*link == loop)
+        {
+            *link = loop->watchdog.next;
+            break;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&watchdog->lock);
+}
+
+int api_watchdog_start(uint64_t threshold,
+                       api_watchdog_fn sink, void* arg)
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+    uintptr_t handle;
+
+    if (threshold == 0)
+        return API__INVALID_ARGUMENT;
+
+    AcquireSRWLockExclusive(&watchdog->lock);
+
+    if (watchdog->started)
+    {
+        ReleaseSRWLockExclusive(&watchdog->lock);
+        return API__ALREADY_EXIST;
+    }
+
+    watchdog->threshold = threshold;
+    watchdog->sink = sink != 0 ? sink : api_watchdog_print;
+    watchdog->arg = arg;
+    watchdog->stopping = 0;
+
+    handle = _beginthreadex(0, 0, api_watchdog_thread, watchdog, 0, 0);
+    if (handle == 0)
+    {
+        ReleaseSRWLockExclusive(&watchdog->lock);
+        return api_error_translate(GetLastError());
+    }
+
+    watchdog->thread = (HANDLE)handle;
+    watchdog->started = 1;
+
+    ReleaseSRWLockExclusive(&watchdog->lock);
+
+    return API__OK;
+}
+
+void api_watchdog_stop()
+{
+    api_watchdog_t* watchdog = &g_api_watchdog;
+    HANDLE thread;
+
+    AcquireSRWLockExclusive(&watchdog->lock);
+
+    if (!watchdog->started)
+    {
+        ReleaseSRWLockExclusive(&watchdog->lock);
+        return;
+    }
+
+    watchdog->started = 0;
+    watchdog->stopping = 1;
+    thread = watchdog->thread;
+    WakeConditionVariable(&watchdog->cond);
+
+    ReleaseSRWLockExclusive(&watchdog->lock);
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
\ No newline at end of file
@@ -0,0 +1,771 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Stress of api_buf_t and buffer stream io across loops, results are
+ * printed to stdout as JSON and exit code is 1 if any check failed.
+ *
+ *   buf_stress [loops] [connections] [bytes] [port]
+ *
+ * Buffers belong to the loop they were allocated in, so loops contend
+ * through a loopback echo server on first loop instead.
+ *
+ * churn     - tasks of every loop allocate, slice, chain and free
+ *             buffers, contents are checked and pool stays balanced
+ * transfer  - connections of every loop write sliced chains and read
+ *             echo back with varying lengths, putting tails back
+ * timeout   - read_buf of silent connection fails with read timeout
+ * terminate - read_buf blocked when its loop stops fails terminated
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+
+#define STRESS_STACK (64 * 1024)
+#define STRESS_WAIT (30 * 1000)
+#define STRESS_TIMEOUT 20
+#define STRESS_CHUNK 1024
+#define STRESS_ROUNDS 1000
+
+#define STRESS_ECHO 'E'
+#define STRESS_SILENT 'S'
+
+typedef struct stress_t stress_t;
+
+typedef struct stress_worker_t {
+    stress_t* stress;
+    stress_t* connected;    // first report of terminate phase
+    uint32_t id;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t mismatches;
+    uint64_t elapsed;
+    int result;
+} stress_worker_t;
+
+struct stress_t {
+    api_loop_t* main;
+    api_event_t done;
+    size_t pending;     // main loop only
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t mismatches;
+    uint64_t elapsed_min;
+    size_t ok;
+    size_t timedout;
+    size_t terminated;
+};
+
+typedef struct stress_balance_t {
+    api_loop_t** loops;
+    size_t count;
+    int64_t outstanding;
+} stress_balance_t;
+
+size_t loops_count = 4;
+size_t connections = 8;
+uint64_t bytes = 1024 * 1024;
+int port = 9731;
+api_loop_t** loops = 0;
+api_tcp_listener_t listener;
+int reported = 0;
+int failed = 0;
+
+/* fields are appended after name and ok, format starts with comma */
+void stress_report(const char* name, int ok, const char* format, ...)
+{
+    va_list args;
+
+    printf("%s\n    {\"name\": \"%s\", \"ok\": %s",
+           reported++ ? "," : "", name, ok ? "true" : "false");
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+
+    printf("}");
+    fflush(stdout);
+
+    if (!ok)
+        failed = 1;
+}
+
+void stress_init(stress_t* stress, api_loop_t* loop, size_t pending)
+{
+    memset(stress, 0, sizeof(*stress));
+    stress->main = loop;
+    stress->pending = pending;
+    stress->elapsed_min = (uint64_t)-1;
+    api_event_init(&stress->done, EVENT_Manual);
+}
+
+/* runs in main loop, workers report here so counters need no atomics */
+void stress_collect(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_t* stress = worker->stress;
+
+    stress->count += worker->count;
+    stress->bytes += worker->bytes;
+    stress->mismatches += worker->mismatches;
+
+    if (worker->elapsed < stress->elapsed_min)
+        stress->elapsed_min = worker->elapsed;
+
+    if (worker->result == API_OK)
+        ++stress->ok;
+    else if (worker->result == API_TIMEDOUT)
+        ++stress->timedout;
+    else if (worker->result == API_TERMINATE)
+        ++stress->terminated;
+
+    if (--stress->pending == 0)
+        api_event_signal(&stress->done);
+}
+
+void stress_collect_connected(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+
+    if (--worker->connected->pending == 0)
+        api_event_signal(&worker->connected->done);
+}
+
+int stress_wait(stress_t* stress, api_loop_t* loop)
+{
+    return API_OK == api_event_wait(&stress->done, loop, STRESS_WAIT);
+}
+
+/* byte at offset of stream, period is prime so chunks do not repeat */
+#define stress_byte(offset) ((char)((offset) % 251))
+
+void stress_fill(char* data, size_t length, uint64_t offset)
+{
+    size_t i;
+
+    for (i = 0; i < length; ++i)
+        data[i] = stress_byte(offset + i);
+}
+
+uint64_t stress_check(const char* data, size_t length, uint64_t offset)
+{
+    uint64_t mismatches = 0;
+    size_t i;
+
+    for (i = 0; i < length; ++i)
+        if (data[i] != stress_byte(offset + i))
+            ++mismatches;
+
+    return mismatches;
+}
+
+/* runs in each loop by api_loop_exec */
+void stress_outstanding(api_loop_t* loop, void* arg)
+{
+    stress_balance_t* balance = (stress_balance_t*)arg;
+    api_pool_stats_t stats;
+
+    api_pool_stats(api_pool_default(loop), &stats);
+    balance->outstanding += (int64_t)(stats.allocs - stats.frees);
+}
+
+int64_t stress_balance(api_loop_t* loop)
+{
+    stress_balance_t balance;
+    size_t i;
+
+    balance.outstanding = 0;
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_exec(loop, loops[i], stress_outstanding, &balance,
+                      STRESS_STACK);
+
+    return balance.outstanding;
+}
+
+/* server side closes on its own once client is gone */
+int stress_balanced(api_loop_t* loop, int64_t expected)
+{
+    uint64_t deadline = api_time_current() + STRESS_WAIT;
+
+    while (stress_balance(loop) != expected)
+    {
+        if (api_time_current() >= deadline)
+            return 0;
+
+        api_loop_sleep(loop, 1);
+    }
+
+    return 1;
+}
+
+void stress_churn_task(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    api_pool_t* pool = api_pool_default(loop);
+    api_pool_stats_t before;
+    api_pool_stats_t after;
+    api_buf_t* buf;
+    api_buf_t* chain;
+    api_buf_t* copy;
+    api_buf_t* slice;
+    uint64_t round;
+    size_t size;
+    size_t offset;
+
+    worker->result = API_OK;
+
+    /* task does not switch, no other task of loop allocates meanwhile */
+    api_pool_stats(pool, &before);
+
+    for (round = 0; round < STRESS_ROUNDS; ++round)
+    {
+        /* mostly small sizes, some larger than pool classes */
+        size = 1 + (size_t)((round * 977 + worker->id * 131) %
+                            (round % 64 == 0 ? STRESS_CHUNK * 16 :
+                                               STRESS_CHUNK));
+
+        buf = api_buf_alloc(pool, size);
+        if (buf == 0)
+        {
+            worker->result = API_NO_MEMORY;
+            break;
+        }
+
+        stress_fill(buf->data, size, round);
+        buf->length = size;
+
+        /* three slices chained, block outlives its first buffer */
+        chain = api_buf_slice(buf, 0, size / 3);
+        if (chain != 0)
+            chain->next = api_buf_slice(buf, size / 3, size / 2 - size / 3);
+        if (chain != 0 && chain->next != 0)
+            chain->next->next = api_buf_slice(buf, size / 2,
+                                              size - size / 2);
+
+        api_buf_free(buf);
+
+        if (chain == 0 || chain->next == 0 || chain->next->next == 0)
+        {
+            api_buf_free_chain(chain);
+            worker->result = API_NO_MEMORY;
+            break;
+        }
+
+        /* slice of slice shares the same block */
+        copy = api_buf_slice(chain->next->next, 0,
+                             chain->next->next->length);
+
+        if (api_buf_chain_length(chain) != size)
+            ++worker->mismatches;
+
+        offset = 0;
+        for (slice = chain; slice != 0; slice = slice->next)
+        {
+            worker->mismatches += stress_check(slice->data, slice->length,
+                                               round + offset);
+            offset += slice->length;
+        }
+
+        api_buf_free_chain(chain);
+
+        if (copy != 0)
+        {
+            worker->mismatches += stress_check(copy->data, copy->length,
+                                               round + size / 2);
+            api_buf_free(copy);
+        }
+
+        worker->bytes += size;
+        ++worker->count;
+    }
+
+    api_pool_stats(pool, &after);
+
+    if (after.allocs - before.allocs != after.frees - before.frees)
+        ++worker->mismatches;
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+/* runs in first loop, silent connection is read until closed */
+void stress_serve(api_loop_t* loop, void* arg)
+{
+    api_tcp_t* tcp = (api_tcp_t*)arg;
+    api_stream_t* stream = &tcp->stream;
+    api_buf_t* buf;
+    char mode = 0;
+
+    if (API_OK == api_stream_attach(stream, loop))
+        api_stream_read(stream, &mode, 1);
+
+    while (mode != 0 &&
+           (buf = api_stream_read_buf(stream, STRESS_CHUNK)) != 0)
+    {
+        if (mode == STRESS_ECHO &&
+            api_stream_write_buf(stream, buf) != buf->length)
+        {
+            api_buf_free(buf);
+            break;
+        }
+
+        api_buf_free(buf);
+    }
+
+    api_stream_close(stream);
+    free(tcp);
+}
+
+void stress_listen(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    api_tcp_t* tcp;
+
+    worker->result = api_tcp_listen(&listener, loop, "127.0.0.1", port, 1024);
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+
+    if (worker->result != API_OK)
+        return;
+
+    /* until loop stops */
+    tcp = (api_tcp_t*)malloc(sizeof(api_tcp_t));
+    while (tcp != 0 && API_OK == api_tcp_accept(&listener, tcp))
+    {
+        api_loop_post(loop, stress_serve, tcp, STRESS_STACK);
+        tcp = (api_tcp_t*)malloc(sizeof(api_tcp_t));
+    }
+
+    free(tcp);
+    api_tcp_close(&listener);
+}
+
+int stress_connect(api_loop_t* loop, api_tcp_t* tcp, char mode)
+{
+    int error = api_tcp_connect(tcp, loop, "127.0.0.1", port, 5000);
+
+    if (error != API_OK)
+        return error;
+
+    if (1 != api_stream_write(&tcp->stream, &mode, 1))
+    {
+        api_stream_close(&tcp->stream);
+        return API_TERMINATE;
+    }
+
+    return API_OK;
+}
+
+/* write chunk at offset as two slices of one block */
+size_t stress_write(api_stream_t* stream, api_pool_t* pool, uint64_t offset)
+{
+    size_t size = (size_t)(bytes - offset);
+    size_t written = 0;
+    api_buf_t* buf;
+    api_buf_t* chain;
+
+    if (size > STRESS_CHUNK)
+        size = STRESS_CHUNK;
+
+    buf = api_buf_alloc(pool, size);
+    if (buf == 0)
+        return 0;
+
+    stress_fill(buf->data, size, offset);
+    buf->length = size;
+
+    chain = api_buf_slice(buf, 0, size / 2);
+    if (chain != 0)
+        chain->next = api_buf_slice(buf, size / 2, size - size / 2);
+
+    api_buf_free(buf);
+
+    if (chain != 0 && chain->next != 0)
+        written = api_stream_write_buf(stream, chain);
+
+    api_buf_free_chain(chain);
+
+    return written == size ? size : 0;
+}
+
+void stress_transfer_task(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    api_pool_t* pool = api_pool_default(loop);
+    api_stream_t* stream;
+    api_tcp_t tcp;
+    api_buf_t* buf;
+    api_buf_t* tail;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    size_t written;
+    size_t half;
+
+    worker->result = stress_connect(loop, &tcp, STRESS_ECHO);
+    if (worker->result != API_OK)
+    {
+        api_loop_post(worker->stress->main, stress_collect, worker, 0);
+        return;
+    }
+
+    stream = &tcp.stream;
+
+    while (received < bytes)
+    {
+        /* streams run with minimal socket buffers, a second chunk in
+           flight blocks both sides on write, larger chunks wait acks */
+        if (sent < bytes && sent == received)
+        {
+            written = stress_write(stream, pool, sent);
+            if (written == 0)
+                break;
+
+            sent += written;
+        }
+
+        buf = api_stream_read_buf(stream,
+                                  1 + (size_t)(received % STRESS_CHUNK));
+        if (buf == 0)
+            break;
+
+        /* every fourth read puts its tail back to be read again */
+        if (worker->count % 4 == 3 && buf->length > 1)
+        {
+            half = buf->length / 2;
+            tail = api_buf_slice(buf, half, buf->length - half);
+            if (tail != 0)
+            {
+                buf->length = half;
+                api_stream_unread_buf(stream, tail);
+            }
+        }
+
+        worker->mismatches += stress_check(buf->data, buf->length, received);
+        received += buf->length;
+        ++worker->count;
+
+        api_buf_free(buf);
+    }
+
+    if (received != bytes)
+        worker->result = API_TERMINATE;
+
+    worker->bytes = received;
+
+    api_stream_close(stream);
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+/* silent server never answers, read fails by timeout or by loop stop */
+void stress_silent_task(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    api_stream_t* stream;
+    api_tcp_t tcp;
+    api_buf_t* buf;
+    uint64_t started;
+
+    worker->result = stress_connect(loop, &tcp, STRESS_SILENT);
+
+    if (worker->connected != 0)
+        api_loop_post(worker->stress->main, stress_collect_connected,
+                      worker, 0);
+
+    if (worker->result != API_OK)
+    {
+        api_loop_post(worker->stress->main, stress_collect, worker, 0);
+        return;
+    }
+
+    stream = &tcp.stream;
+
+    if (worker->connected == 0)
+        stream->read_timeout = STRESS_TIMEOUT;
+
+    started = api_time_precise();
+
+    buf = api_stream_read_buf(stream, STRESS_CHUNK);
+
+    worker->elapsed = api_time_precise() - started;
+
+    if (buf != 0)
+        api_buf_free(buf);
+    else if (stream->status.read_timeout)
+        worker->result = API_TIMEDOUT;
+    else if (stream->status.terminated)
+        worker->result = API_TERMINATE;
+
+    api_stream_close(stream);
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_post_tasks(stress_worker_t* workers, size_t count,
+                       stress_t* stress, stress_t* connected,
+                       api_loop_t** targets, api_loop_fn callback)
+{
+    size_t i;
+
+    memset(workers, 0, count * sizeof(stress_worker_t));
+
+    for (i = 0; i < count; ++i)
+    {
+        workers[i].stress = stress;
+        workers[i].connected = connected;
+        workers[i].id = (uint32_t)i;
+        api_loop_post(targets[i % loops_count], callback,
+                      &workers[i], STRESS_STACK);
+    }
+}
+
+void stress_churn(api_loop_t* loop, stress_worker_t* workers)
+{
+    stress_t stress;
+    uint64_t started;
+    uint64_t elapsed;
+    size_t count = loops_count * connections;
+    int ok;
+
+    stress_init(&stress, loop, count);
+
+    started = api_time_precise();
+
+    stress_post_tasks(workers, count, &stress, 0, loops, stress_churn_task);
+
+    ok = stress_wait(&stress, loop);
+    elapsed = api_time_precise() - started;
+
+    ok = ok && stress.ok == count && stress.mismatches == 0 &&
+         stress.count == count * STRESS_ROUNDS;
+
+    stress_report("churn", ok,
+                  ", \"buffers\": %llu, \"bytes\": %llu, "
+                  "\"mismatches\": %llu, \"elapsed_us\": %llu, "
+                  "\"buffers_per_sec\": %.0f",
+                  (unsigned long long)stress.count,
+                  (unsigned long long)stress.bytes,
+                  (unsigned long long)stress.mismatches,
+                  (unsigned long long)elapsed,
+                  elapsed != 0 ? stress.count * 1e6 / elapsed : 0.0);
+}
+
+void stress_transfer(api_loop_t* loop, stress_worker_t* workers)
+{
+    stress_t stress;
+    uint64_t started;
+    uint64_t elapsed;
+    int64_t outstanding;
+    size_t count = loops_count * connections;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    outstanding = stress_balance(loop);
+
+    started = api_time_precise();
+
+    stress_post_tasks(workers, count, &stress, 0, loops, stress_transfer_task);
+
+    ok = stress_wait(&stress, loop);
+    elapsed = api_time_precise() - started;
+
+    ok = ok && stress.ok == count && stress.mismatches == 0 &&
+         stress.bytes == count * bytes;
+
+    /* every buffer and task of both sides released */
+    ok = stress_balanced(loop, outstanding) && ok;
+
+    stress_report("transfer", ok,
+                  ", \"bytes\": %llu, \"reads\": %llu, "
+                  "\"mismatches\": %llu, \"elapsed_us\": %llu, "
+                  "\"mb_per_sec\": %.1f",
+                  (unsigned long long)stress.bytes,
+                  (unsigned long long)stress.count,
+                  (unsigned long long)stress.mismatches,
+                  (unsigned long long)elapsed,
+                  elapsed != 0 ? stress.bytes / (double)elapsed : 0.0);
+}
+
+void stress_timeout(api_loop_t* loop, stress_worker_t* workers)
+{
+    stress_t stress;
+    int64_t outstanding;
+    size_t count = loops_count * connections;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    outstanding = stress_balance(loop);
+
+    stress_post_tasks(workers, count, &stress, 0, loops, stress_silent_task);
+
+    ok = stress_wait(&stress, loop);
+
+    /* timer resolution is a millisecond */
+    ok = ok && stress.timedout == count &&
+         stress.elapsed_min + 1000 >= STRESS_TIMEOUT * 1000;
+
+    ok = stress_balanced(loop, outstanding) && ok;
+
+    stress_report("timeout", ok,
+                  ", \"timedout\": %llu, \"elapsed_min_us\": %llu",
+                  (unsigned long long)stress.timedout,
+                  (unsigned long long)stress.elapsed_min);
+}
+
+void stress_terminate(api_loop_t* loop, stress_worker_t* workers)
+{
+    stress_t stress;
+    stress_t connected;
+    api_loop_t** clients;
+    size_t count = loops_count * connections;
+    size_t started = 0;
+    size_t i;
+    int ok;
+
+    clients = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&clients[i]))
+            break;
+
+        ++started;
+    }
+
+    if (started != loops_count)
+    {
+        for (i = 0; i < started; ++i)
+            api_loop_stop_and_wait(loop, clients[i]);
+
+        free(clients);
+        stress_report("terminate", 0, "");
+        return;
+    }
+
+    stress_init(&stress, loop, count);
+    stress_init(&connected, loop, count);
+
+    stress_post_tasks(workers, count, &stress, &connected, clients,
+                      stress_silent_task);
+
+    /* connected tasks go on to read, let them block there */
+    ok = stress_wait(&connected, loop);
+    api_loop_sleep(loop, STRESS_TIMEOUT);
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_stop_and_wait(loop, clients[i]);
+
+    ok = stress_wait(&stress, loop) && ok;
+    ok = ok && stress.terminated == count;
+
+    stress_report("terminate", ok,
+                  ", \"terminated\": %llu",
+                  (unsigned long long)stress.terminated);
+
+    free(clients);
+}
+
+void stress_main(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* workers;
+    stress_worker_t server;
+    stress_t listening;
+    size_t i;
+
+    loops = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+    workers = (stress_worker_t*)calloc(loops_count * connections,
+                                       sizeof(stress_worker_t));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&loops[i]))
+        {
+            failed = 1;
+            loops_count = i;
+            break;
+        }
+    }
+
+    printf("{\n  \"suite\": \"buf\",\n  \"loops\": %llu,\n"
+           "  \"connections\": %llu,\n  \"results\": [",
+           (unsigned long long)loops_count,
+           (unsigned long long)connections);
+
+    if (loops_count != 0)
+    {
+        stress_churn(loop, workers);
+
+        /* echo server runs on first loop */
+        stress_init(&listening, loop, 1);
+        memset(&server, 0, sizeof(server));
+        server.stress = &listening;
+
+        api_loop_post(loops[0], stress_listen, &server, STRESS_STACK);
+
+        if (!stress_wait(&listening, loop) || server.result != API_OK)
+        {
+            stress_report("listen", 0, ", \"port\": %d, \"error\": %d",
+                          port, server.result);
+        }
+        else
+        {
+            stress_transfer(loop, workers);
+            stress_timeout(loop, workers);
+            stress_terminate(loop, workers);
+        }
+    }
+
+    printf("\n  ]\n}\n");
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_stop_and_wait(loop, loops[i]);
+
+    free(workers);
+    free(loops);
+
+    api_loop_stop(loop);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        loops_count = (size_t)strtoul(argv[1], 0, 10);
+    if (argc > 2)
+        connections = (size_t)strtoul(argv[2], 0, 10);
+    if (argc > 3)
+        bytes = strtoull(argv[3], 0, 10);
+    if (argc > 4)
+        port = atoi(argv[4]);
+
+    if (loops_count == 0 || connections == 0 || port <= 0)
+    {
+        printf("usage: buf_stress [loops] [connections] [bytes] [port]\n");
+        return 1;
+    }
+
+    api_init();
+
+    if (API_OK != api_loop_run(stress_main, 0, STRESS_STACK))
+        return 1;
+
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,705 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Stress of api_channel_t across loops, results are printed to stdout
+ * as JSON and exit code is 1 if any check failed.
+ *
+ *   channel_stress [loops] [tasks] [items] [capacity]
+ *
+ * Channel has a single receiver, so every loop owns one channel
+ * and receives from it while tasks of all loops send.
+ *
+ * contention - tasks of every loop send to small channels of every
+ *              loop, item count and checksum must match
+ * timeout    - try_send and try_recv polled until deadline fill and
+ *              drain exactly capacity items
+ * terminate  - senders blocked on full channel and receivers blocked
+ *              on empty channels all return API_TERMINATE on close
+ * stop       - same waits return API_TERMINATE when their loops stop
+ *              while items keep cycling, channels stay usable after
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+
+#define STRESS_STACK (64 * 1024)
+#define STRESS_BATCH 8
+#define STRESS_WAIT (30 * 1000)
+
+typedef struct stress_item_t {
+    uint32_t producer;
+    uint32_t seq;
+} stress_item_t;
+
+typedef struct stress_t stress_t;
+
+typedef struct stress_worker_t {
+    stress_t* stress;
+    api_channel_t* channel;
+    uint32_t id;
+    uint64_t count;
+    uint64_t checksum;
+    int result;
+} stress_worker_t;
+
+typedef struct stress_cycle_t {
+    api_channel_t* channel;
+    api_event_t done;
+    int stop;           // main loop only
+    uint64_t cycles;
+} stress_cycle_t;
+
+struct stress_t {
+    api_loop_t* main;
+    api_event_t done;
+    size_t pending;     // main loop only
+    uint64_t count;
+    uint64_t checksum;
+    size_t terminated;
+};
+
+size_t loops_count = 4;
+size_t tasks = 8;
+uint64_t items = 100000;
+size_t capacity = 64;
+int reported = 0;
+int failed = 0;
+
+/* fields are appended after name and ok, format starts with comma */
+void stress_report(const char* name, int ok, const char* format, ...)
+{
+    va_list args;
+
+    printf("%s\n    {\"name\": \"%s\", \"ok\": %s",
+           reported++ ? "," : "", name, ok ? "true" : "false");
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+
+    printf("}");
+    fflush(stdout);
+
+    if (!ok)
+        failed = 1;
+}
+
+uint64_t stress_checksum(uint32_t producer, uint32_t seq)
+{
+    return (uint64_t)producer * 1000003 + seq;
+}
+
+/* runs in main loop, workers report here so counters need no atomics */
+void stress_collect(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_t* stress = worker->stress;
+
+    stress->count += worker->count;
+    stress->checksum += worker->checksum;
+
+    if (worker->result == API_TERMINATE)
+        ++stress->terminated;
+
+    if (--stress->pending == 0)
+        api_event_signal(&stress->done);
+}
+
+void stress_producer(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_item_t batch[STRESS_BATCH];
+    uint64_t per_task = items / (loops_count * tasks);
+    uint32_t seq = 0;
+    size_t sent;
+    size_t i;
+
+    worker->result = API_OK;
+
+    while (seq < per_task)
+    {
+        /* mix single sends with batches, batch wakes receiver once */
+        if (seq % 3 == 0 && per_task - seq >= STRESS_BATCH)
+        {
+            for (i = 0; i < STRESS_BATCH; ++i)
+            {
+                batch[i].producer = worker->id;
+                batch[i].seq = seq + (uint32_t)i;
+            }
+
+            sent = api_channel_send_batch(worker->channel, loop,
+                                          batch, STRESS_BATCH);
+            for (i = 0; i < sent; ++i)
+                worker->checksum += stress_checksum(worker->id, seq++);
+
+            if (sent < STRESS_BATCH)
+                break;
+        }
+        else
+        {
+            batch[0].producer = worker->id;
+            batch[0].seq = seq;
+
+            worker->result = api_channel_send(worker->channel, loop, batch);
+            if (worker->result != API_OK)
+                break;
+
+            worker->checksum += stress_checksum(worker->id, seq++);
+        }
+    }
+
+    worker->count = seq;
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_consumer(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_item_t batch[STRESS_BATCH * 2];
+    size_t received;
+    size_t i;
+
+    while (1)
+    {
+        received = api_channel_recv_batch(worker->channel, loop,
+                                          batch, STRESS_BATCH * 2);
+        if (received == 0)
+            break;
+
+        for (i = 0; i < received; ++i)
+            worker->checksum += stress_checksum(batch[i].producer,
+                                                batch[i].seq);
+
+        worker->count += received;
+
+        /* single receive in between */
+        worker->result = api_channel_recv(worker->channel, loop, batch);
+        if (worker->result != API_OK)
+            break;
+
+        worker->checksum += stress_checksum(batch[0].producer, batch[0].seq);
+        ++worker->count;
+    }
+
+    if (received == 0)
+        worker->result = API_TERMINATE;
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+/* wait for all posted workers to report, 0 if they did not in time */
+int stress_wait(stress_t* stress, api_loop_t* loop)
+{
+    return API_OK == api_event_wait(&stress->done, loop, STRESS_WAIT);
+}
+
+void stress_contention(api_loop_t* loop, api_loop_t** loops)
+{
+    stress_t producers;
+    stress_t consumers;
+    stress_worker_t* workers;
+    api_channel_t** channels;
+    uint64_t started;
+    uint64_t expected;
+    uint64_t elapsed;
+    size_t count = loops_count * tasks;
+    size_t i;
+    int ok = 1;
+
+    channels = (api_channel_t**)calloc(loops_count, sizeof(api_channel_t*));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_channel_create(&channels[i], sizeof(stress_item_t),
+                                         capacity))
+            ok = 0;
+    }
+
+    if (!ok)
+    {
+        for (i = 0; i < loops_count; ++i)
+            if (channels[i] != 0)
+                api_channel_free(channels[i]);
+
+        free(channels);
+        stress_report("contention", 0, "");
+        return;
+    }
+
+    workers = (stress_worker_t*)calloc(count + loops_count,
+                                       sizeof(stress_worker_t));
+
+    memset(&producers, 0, sizeof(producers));
+    memset(&consumers, 0, sizeof(consumers));
+    producers.main = consumers.main = loop;
+    producers.pending = count;
+    consumers.pending = loops_count;
+    api_event_init(&producers.done, EVENT_Manual);
+    api_event_init(&consumers.done, EVENT_Manual);
+
+    started = api_time_precise();
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        workers[count + i].stress = &consumers;
+        workers[count + i].channel = channels[i];
+        api_loop_post(loops[i], stress_consumer,
+                      &workers[count + i], STRESS_STACK);
+    }
+
+    /* tasks of each loop are spread over channels of all loops */
+    for (i = 0; i < count; ++i)
+    {
+        workers[i].stress = &producers;
+        workers[i].channel = channels[(i / loops_count) % loops_count];
+        workers[i].id = (uint32_t)i;
+        api_loop_post(loops[i % loops_count], stress_producer,
+                      &workers[i], STRESS_STACK);
+    }
+
+    ok = stress_wait(&producers, loop);
+
+    /* receivers drain what is left and get API_TERMINATE */
+    for (i = 0; i < loops_count; ++i)
+        api_channel_close(channels[i]);
+
+    ok = stress_wait(&consumers, loop) && ok;
+
+    elapsed = api_time_precise() - started;
+
+    expected = (items / count) * count;
+
+    ok = ok && producers.count == expected &&
+         consumers.count == expected &&
+         consumers.checksum == producers.checksum &&
+         consumers.terminated == loops_count;
+
+    stress_report("contention", ok,
+                  ", \"sent\": %llu, \"received\": %llu, "
+                  "\"elapsed_us\": %llu, \"items_per_sec\": %.0f",
+                  (unsigned long long)producers.count,
+                  (unsigned long long)consumers.count,
+                  (unsigned long long)elapsed,
+                  elapsed != 0 ? consumers.count * 1e6 / elapsed : 0.0);
+
+    /* on failure tasks may still use them */
+    if (ok)
+    {
+        for (i = 0; i < loops_count; ++i)
+            api_channel_free(channels[i]);
+
+        free(channels);
+        free(workers);
+    }
+}
+
+/*
+ * Channel has no timed waits, non blocking variants are polled instead
+ */
+void stress_timeout(api_loop_t* loop)
+{
+    api_channel_t* channel;
+    stress_item_t item;
+    uint64_t deadline;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t rounded = 2;
+    int result;
+    int ok;
+
+    if (API_OK != api_channel_create(&channel, sizeof(stress_item_t),
+                                     capacity))
+    {
+        stress_report("timeout", 0, "");
+        return;
+    }
+
+    item.producer = 0;
+    item.seq = 0;
+
+    deadline = api_time_current() + 20;
+    while (api_time_current() < deadline)
+    {
+        if (API_OK == api_channel_try_send(channel, &item))
+            ++sent;
+        else
+            api_loop_sleep(loop, 1);
+    }
+
+    deadline = api_time_current() + 20;
+    while (api_time_current() < deadline)
+    {
+        if (API_OK == api_channel_try_recv(channel, &item))
+            ++received;
+        else
+            api_loop_sleep(loop, 1);
+    }
+
+    api_channel_close(channel);
+    result = api_channel_try_recv(channel, &item);
+
+    /* capacity is rounded up to power of two, at least two */
+    while (rounded < capacity)
+        rounded <<= 1;
+
+    ok = sent == rounded && received == sent && result == API_TERMINATE;
+
+    stress_report("timeout", ok,
+                  ", \"sent\": %llu, \"received\": %llu",
+                  (unsigned long long)sent, (unsigned long long)received);
+
+    api_channel_free(channel);
+}
+
+void stress_blocked_send(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_item_t item;
+
+    memset(&item, 0, sizeof(item));
+
+    worker->result = api_channel_send(worker->channel, loop, &item);
+    if (worker->result == API_OK)
+        worker->count = 1;
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_blocked_recv(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_item_t item;
+
+    worker->result = api_channel_recv(worker->channel, loop, &item);
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_terminate(api_loop_t* loop, api_loop_t** loops)
+{
+    stress_t stress;
+    stress_worker_t* workers;
+    api_channel_t** channels;
+    api_channel_t* full;
+    stress_item_t item;
+    size_t count = loops_count * tasks;
+    size_t drained = 0;
+    size_t i;
+    int ok = 1;
+
+    /* last one is full channel, others stay empty */
+    channels = (api_channel_t**)calloc(loops_count + 1,
+                                       sizeof(api_channel_t*));
+
+    for (i = 0; i <= loops_count; ++i)
+    {
+        if (API_OK != api_channel_create(&channels[i], sizeof(item),
+                                         capacity))
+            ok = 0;
+    }
+
+    if (!ok)
+    {
+        for (i = 0; i <= loops_count; ++i)
+            if (channels[i] != 0)
+                api_channel_free(channels[i]);
+
+        free(channels);
+        stress_report("terminate", 0, "");
+        return;
+    }
+
+    full = channels[loops_count];
+
+    memset(&item, 0, sizeof(item));
+    while (API_OK == api_channel_try_send(full, &item))
+        ;
+
+    workers = (stress_worker_t*)calloc(count + loops_count,
+                                       sizeof(stress_worker_t));
+
+    memset(&stress, 0, sizeof(stress));
+    stress.main = loop;
+    stress.pending = count + loops_count;
+    api_event_init(&stress.done, EVENT_Manual);
+
+    for (i = 0; i < count; ++i)
+    {
+        workers[i].stress = &stress;
+        workers[i].channel = full;
+        api_loop_post(loops[i % loops_count], stress_blocked_send,
+                      &workers[i], STRESS_STACK);
+    }
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        workers[count + i].stress = &stress;
+        workers[count + i].channel = channels[i];
+        api_loop_post(loops[i], stress_blocked_recv,
+                      &workers[count + i], STRESS_STACK);
+    }
+
+    /* let them block, then close under them */
+    api_loop_sleep(loop, 50);
+
+    for (i = 0; i <= loops_count; ++i)
+        api_channel_close(channels[i]);
+
+    ok = stress_wait(&stress, loop);
+
+    /* items sent before close are still there */
+    while (API_OK == api_channel_try_recv(full, &item))
+        ++drained;
+
+    ok = ok && stress.terminated == count + loops_count && drained >= capacity;
+
+    stress_report("terminate", ok,
+                  ", \"blocked\": %llu, \"terminated\": %llu",
+                  (unsigned long long)(count + loops_count),
+                  (unsigned long long)stress.terminated);
+
+    if (ok)
+    {
+        for (i = 0; i <= loops_count; ++i)
+            api_channel_free(channels[i]);
+
+        free(channels);
+        free(workers);
+    }
+}
+
+/* takes item and puts it back, so senders blocked on channel are woken */
+void stress_cycle(api_loop_t* loop, void* arg)
+{
+    stress_cycle_t* cycle = (stress_cycle_t*)arg;
+    stress_item_t item;
+
+    while (!cycle->stop)
+    {
+        if (API_OK == api_channel_try_recv(cycle->channel, &item))
+        {
+            api_channel_try_send(cycle->channel, &item);
+            ++cycle->cycles;
+        }
+
+        api_loop_sleep(loop, 1);
+    }
+
+    api_event_signal(&cycle->done);
+}
+
+void stress_stop(api_loop_t* loop)
+{
+    stress_t stress;
+    stress_cycle_t cycle;
+    stress_worker_t* workers;
+    api_channel_t** channels;
+    api_channel_t* full;
+    api_loop_t** stopping;
+    stress_item_t item;
+    size_t count = loops_count * tasks;
+    size_t started = 0;
+    size_t i;
+    int ok = 1;
+
+    /* last one is full channel, others stay empty */
+    channels = (api_channel_t**)calloc(loops_count + 1,
+                                       sizeof(api_channel_t*));
+    stopping = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+
+    for (i = 0; i <= loops_count; ++i)
+    {
+        if (API_OK != api_channel_create(&channels[i], sizeof(item),
+                                         capacity))
+            ok = 0;
+    }
+
+    for (i = 0; ok && i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&stopping[i]))
+            ok = 0;
+        else
+            ++started;
+    }
+
+    if (!ok)
+    {
+        for (i = 0; i < started; ++i)
+            api_loop_stop_and_wait(loop, stopping[i]);
+
+        for (i = 0; i <= loops_count; ++i)
+            if (channels[i] != 0)
+                api_channel_free(channels[i]);
+
+        free(stopping);
+        free(channels);
+        stress_report("stop", 0, "");
+        return;
+    }
+
+    full = channels[loops_count];
+
+    memset(&item, 0, sizeof(item));
+    while (API_OK == api_channel_try_send(full, &item))
+        ;
+
+    workers = (stress_worker_t*)calloc(count + loops_count,
+                                       sizeof(stress_worker_t));
+
+    memset(&stress, 0, sizeof(stress));
+    stress.main = loop;
+    stress.pending = count + loops_count;
+    api_event_init(&stress.done, EVENT_Manual);
+
+    for (i = 0; i < count; ++i)
+    {
+        workers[i].stress = &stress;
+        workers[i].channel = full;
+        api_loop_post(stopping[i % loops_count], stress_blocked_send,
+                      &workers[i], STRESS_STACK);
+    }
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        workers[count + i].stress = &stress;
+        workers[count + i].channel = channels[i];
+        api_loop_post(stopping[i], stress_blocked_recv,
+                      &workers[count + i], STRESS_STACK);
+    }
+
+    api_loop_sleep(loop, 50);
+
+    /* senders are woken while their loops go down */
+    memset(&cycle, 0, sizeof(cycle));
+    cycle.channel = full;
+    api_event_init(&cycle.done, EVENT_Manual);
+    api_loop_post(loop, stress_cycle, &cycle, STRESS_STACK);
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_stop_and_wait(loop, stopping[i]);
+
+    ok = stress_wait(&stress, loop);
+
+    cycle.stop = 1;
+    ok = API_OK == api_event_wait(&cycle.done, loop, STRESS_WAIT) && ok;
+    /* cycled slot may be taken by a sender before its loop stops */
+    ok = ok && stress.terminated + stress.count == count + loops_count;
+
+    /* waiters of stopped loops are gone, nothing wakes them any more */
+    if (ok)
+    {
+        while (API_OK == api_channel_try_recv(full, &item))
+            ;
+
+        for (i = 0; i < loops_count; ++i)
+            api_channel_try_send(channels[i], &item);
+
+        for (i = 0; i <= loops_count; ++i)
+            api_channel_close(channels[i]);
+    }
+
+    stress_report("stop", ok,
+                  ", \"blocked\": %llu, \"terminated\": %llu, "
+                  "\"sent\": %llu, \"cycles\": %llu",
+                  (unsigned long long)(count + loops_count),
+                  (unsigned long long)stress.terminated,
+                  (unsigned long long)stress.count,
+                  (unsigned long long)cycle.cycles);
+
+    if (ok)
+    {
+        for (i = 0; i <= loops_count; ++i)
+            api_channel_free(channels[i]);
+
+        free(channels);
+        free(workers);
+    }
+
+    free(stopping);
+}
+
+void stress_main(api_loop_t* loop, void* arg)
+{
+    api_loop_t** loops;
+    size_t i;
+
+    loops = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&loops[i]))
+        {
+            failed = 1;
+            loops_count = i;
+            break;
+        }
+    }
+
+    printf("{\n  \"suite\": \"channel\",\n  \"loops\": %llu,\n"
+           "  \"tasks\": %llu,\n  \"results\": [",
+           (unsigned long long)loops_count, (unsigned long long)tasks);
+
+    if (loops_count != 0)
+    {
+        stress_contention(loop, loops);
+        stress_timeout(loop);
+        stress_terminate(loop, loops);
+        stress_stop(loop);
+    }
+
+    printf("\n  ]\n}\n");
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_stop_and_wait(loop, loops[i]);
+
+    free(loops);
+
+    api_loop_stop(loop);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        loops_count = (size_t)strtoul(argv[1], 0, 10);
+    if (argc > 2)
+        tasks = (size_t)strtoul(argv[2], 0, 10);
+    if (argc > 3)
+        items = strtoull(argv[3], 0, 10);
+    if (argc > 4)
+        capacity = (size_t)strtoul(argv[4], 0, 10);
+
+    if (loops_count == 0 || tasks == 0 || capacity == 0)
+    {
+        printf("usage: channel_stress [loops] [tasks] [items] [capacity]\n");
+        return 1;
+    }
+
+    api_init();
+
+    if (API_OK != api_loop_run(stress_main, 0, STRESS_STACK))
+        return 1;
+
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,442 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Microbenchmarks of runtime internals, results are printed to stdout
+ * as JSON to be compared across versions.
+ *
+ *   core_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+#include "../../api/src/api_task.h"
+#include "../../api/src/api_timer.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include "../../api/src/unix/api_loop.h"
+#include "../../api/src/unix/api_async.h"
+#include "../../api/src/unix/api_mpscq.h"
+#else
+#include "../../api/src/win/api_loop.h"
+#include "../../api/src/win/api_async.h"
+#endif
+
+#define BENCH_STACK (256 * 1024)
+
+uint64_t iterations = 1000000;
+int reported = 0;
+
+void bench_report(const char* name, uint64_t param, uint64_t ops,
+                  uint64_t elapsed)
+{
+    double ns = ops != 0 ? (double)elapsed * 1000.0 / (double)ops : 0;
+
+    printf("%s\n    {\"name\": \"%s\", \"param\": %llu, \"ops\": %llu, "
+           "\"elapsed_us\": %llu, \"ns_per_op\": %.1f, "
+           "\"ops_per_sec\": %.0f}",
+           reported++ ? "," : "", name, (unsigned long long)param,
+           (unsigned long long)ops, (unsigned long long)elapsed, ns,
+           ns > 0 ? 1e9 / ns : 0);
+    fflush(stdout);
+}
+
+/*
+ * Context switch, each exec and yield is a switch
+ */
+void* bench_yield_fn(api_task_t* task)
+{
+    while (1)
+        api_task_yield(task, 0);
+
+    return 0;
+}
+
+void bench_switch(api_loop_t* loop)
+{
+    api_scheduler_t* scheduler = &loop->base.scheduler;
+    api_task_t* task = api_task_create(scheduler, bench_yield_fn, 0);
+    uint64_t started;
+    uint64_t i;
+
+    started = api_time_precise();
+    for (i = 0; i < iterations; ++i)
+        api_task_exec(task);
+
+    bench_report("task_switch", 0, 2 * iterations,
+                 api_time_precise() - started);
+
+    api_task_delete(task);
+}
+
+/*
+ * Task lifetime, create, run to completion and delete
+ */
+void* bench_return_fn(api_task_t* task)
+{
+    return 0;
+}
+
+void bench_task_create(api_loop_t* loop)
+{
+    api_scheduler_t* scheduler = &loop->base.scheduler;
+    api_task_t* task;
+    uint64_t started;
+    uint64_t count = iterations / 4;
+    uint64_t i;
+
+    started = api_time_precise();
+    for (i = 0; i < count; ++i)
+    {
+        task = api_task_create(scheduler, bench_return_fn, 0);
+        api_task_delete(task);
+    }
+
+    bench_report("task_create_delete", 0, count,
+                 api_time_precise() - started);
+
+    started = api_time_precise();
+    for (i = 0; i < count; ++i)
+    {
+        task = api_task_create(scheduler, bench_return_fn, 0);
+        api_task_exec(task);
+        api_task_delete(task);
+    }
+
+    bench_report("task_create_run_delete", 0, count,
+                 api_time_precise() - started);
+}
+
+/*
+ * Posted task start, last one signals the waiting benchmark
+ */
+typedef struct bench_post_t {
+    api_event_t done;
+    uint64_t count;
+    uint64_t target;
+} bench_post_t;
+
+void bench_post_fn(api_loop_t* loop, void* arg)
+{
+    bench_post_t* post = (bench_post_t*)arg;
+
+    if (++post->count == post->target)
+        api_event_signal(&post->done);
+}
+
+void bench_post_run(api_loop_t* loop, api_loop_t* target, const char* name)
+{
+    /* other loop may still touch event when this one is woken */
+    static bench_post_t post;
+    uint64_t started;
+    uint64_t i;
+
+    api_event_init(&post.done, EVENT_Manual);
+    post.count = 0;
+    post.target = iterations / 4;
+
+    started = api_time_precise();
+    for (i = 0; i < post.target; ++i)
+        api_loop_post(target, bench_post_fn, &post, 0);
+
+    api_event_wait(&post.done, loop, 0);
+
+    bench_report(name, 0, post.target, api_time_precise() - started);
+}
+
+void bench_post(api_loop_t* loop, api_loop_t* other)
+{
+    bench_post_run(loop, loop, "loop_post_same");
+    bench_post_run(loop, other, "loop_post_cross");
+}
+
+/*
+ * Wakeup round trip between tasks of two loops
+ */
+typedef struct bench_ping_t {
+    api_loop_t* loop;
+    api_task_t* task;
+    api_loop_t* peer_loop;
+    api_task_t* peer;
+    api_event_t ready;
+    api_event_t finished;
+    volatile int done;
+} bench_ping_t;
+
+void bench_pong_fn(api_loop_t* loop, void* arg)
+{
+    bench_ping_t* ping = (bench_ping_t*)arg;
+
+    ping->peer = loop->base.scheduler.current;
+    api_event_signal(&ping->ready);
+
+    while (1)
+    {
+        api_task_sleep(ping->peer);
+
+        if (ping->done)
+            break;
+
+        api_async_wakeup(ping->loop, ping->task);
+    }
+
+    api_event_signal(&ping->finished);
+}
+
+void bench_wakeup(api_loop_t* loop, api_loop_t* other)
+{
+    static bench_ping_t ping;
+    uint64_t count = iterations / 10;
+    uint64_t started;
+    uint64_t i;
+
+    memset(&ping, 0, sizeof(ping));
+    api_event_init(&ping.ready, EVENT_Manual);
+    api_event_init(&ping.finished, EVENT_Manual);
+    ping.loop = loop;
+    ping.task = loop->base.scheduler.current;
+    ping.peer_loop = other;
+
+    api_loop_post(other, bench_pong_fn, &ping, 0);
+    api_event_wait(&ping.ready, loop, 0);
+
+    started = api_time_precise();
+    for (i = 0; i < count; ++i)
+    {
+        api_async_wakeup(other, ping.peer);
+        api_task_sleep(ping.task);
+    }
+
+    bench_report("async_wakeup_round_trip", 0, count,
+                 api_time_precise() - started);
+
+    ping.done = 1;
+    api_async_wakeup(other, ping.peer);
+    api_event_wait(&ping.finished, loop, 0);
+}
+
+/*
+ * Rearming timers among given number of armed ones, each with own value
+ */
+void bench_timers(api_loop_t* loop, uint64_t count)
+{
+    api_timers_t timers;
+    api_timer_t* timer;
+    uint64_t started;
+    uint64_t ops = iterations;
+    uint64_t i;
+    uint32_t x = 2463534242u;
+
+    memset(&timers, 0, sizeof(timers));
+    timers.pool = api_pool_default(loop);
+
+    timer = (api_timer_t*)calloc((size_t)count, sizeof(*timer));
+    if (timer == 0)
+        return;
+
+    for (i = 0; i < count; ++i)
+        api_timer_set(&timers, &timer[i], TIMER_Timeout, 1 + i);
+
+    started = api_time_precise();
+    for (i = 0; i < ops; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        api_timer_set(&timers, &timer[x % count], TIMER_Timeout,
+                      1 + (x >> 8) % count);
+    }
+
+    bench_report("timer_set", count, ops, api_time_precise() - started);
+
+    for (i = 0; i < count; ++i)
+        api_timer_set(&timers, &timer[i], TIMER_Timeout, 0);
+
+    free(timer);
+}
+
+/*
+ * Pool allocation, pairs and bursts
+ */
+void bench_alloc(api_loop_t* loop, size_t size)
+{
+    api_pool_t* pool = api_pool_default(loop);
+    void* burst[1024];
+    uint64_t started;
+    uint64_t i;
+    size_t j;
+
+    started = api_time_precise();
+    for (i = 0; i < iterations; ++i)
+        api_free(pool, size, api_alloc(pool, size));
+
+    bench_report("alloc_free", size, iterations,
+                 api_time_precise() - started);
+
+    started = api_time_precise();
+    for (i = 0; i < iterations / 1024; ++i)
+    {
+        for (j = 0; j < 1024; ++j)
+            burst[j] = api_alloc(pool, size);
+
+        for (j = 0; j < 1024; ++j)
+            api_free(pool, size, burst[j]);
+    }
+
+    bench_report("alloc_free_burst", size, (iterations / 1024) * 1024,
+                 api_time_precise() - started);
+}
+
+#if defined(__linux__)
+
+/*
+ * Intrusive queue of cross loop asyncs, single thread and with
+ * producers on other threads
+ */
+#define BENCH_PRODUCERS 4
+
+typedef struct bench_queue_t {
+    api_mpscq_t* queue;
+    api_mpscq_node_t* nodes;
+    uint64_t count;
+} bench_queue_t;
+
+void* bench_producer(void* arg)
+{
+    bench_queue_t* queue = (bench_queue_t*)arg;
+    uint64_t i;
+
+    for (i = 0; i < queue->count; ++i)
+        api_mpscq_push(queue->queue, &queue->nodes[i]);
+
+    return 0;
+}
+
+void bench_mpscq(api_loop_t* loop)
+{
+    bench_queue_t producers[BENCH_PRODUCERS];
+    pthread_t threads[BENCH_PRODUCERS];
+    api_mpscq_t queue;
+    api_mpscq_node_t* nodes;
+    uint64_t total = iterations * BENCH_PRODUCERS;
+    uint64_t popped = 0;
+    uint64_t started;
+    uint64_t i;
+
+    nodes = (api_mpscq_node_t*)calloc((size_t)total, sizeof(*nodes));
+    if (nodes == 0)
+        return;
+
+    api_mpscq_create(&queue);
+
+    started = api_time_precise();
+    for (i = 0; i < iterations; ++i)
+    {
+        api_mpscq_push(&queue, &nodes[0]);
+        api_mpscq_push(&queue, &nodes[1]);
+        api_mpscq_pop(&queue);
+        api_mpscq_pop(&queue);
+    }
+
+    bench_report("mpscq_push_pop", 1, 2 * iterations,
+                 api_time_precise() - started);
+
+    api_mpscq_create(&queue);
+
+    started = api_time_precise();
+    for (i = 0; i < BENCH_PRODUCERS; ++i)
+    {
+        producers[i].queue = &queue;
+        producers[i].nodes = nodes + i * iterations;
+        producers[i].count = iterations;
+        pthread_create(&threads[i], 0, bench_producer, &producers[i]);
+    }
+
+    while (popped < total)
+    {
+        if (api_mpscq_pop(&queue) != 0)
+            ++popped;
+    }
+
+    for (i = 0; i < BENCH_PRODUCERS; ++i)
+        pthread_join(threads[i], 0);
+
+    bench_report("mpscq_contended", BENCH_PRODUCERS, total,
+                 api_time_precise() - started);
+
+    free(nodes);
+}
+
+#endif
+
+void bench_main(api_loop_t* loop, void* arg)
+{
+    api_loop_t* other;
+    uint64_t count;
+
+    printf("{\n  \"suite\": \"core\",\n  \"iterations\": %llu,\n"
+           "  \"results\": [", (unsigned long long)iterations);
+
+    bench_switch(loop);
+    bench_task_create(loop);
+
+    if (API_OK == api_loop_start(&other))
+    {
+        bench_post(loop, other);
+        bench_wakeup(loop, other);
+        api_loop_stop_and_wait(loop, other);
+    }
+
+    for (count = 16; count <= 65536; count *= 16)
+        bench_timers(loop, count);
+
+    bench_alloc(loop, 64);
+    bench_alloc(loop, 1024);
+
+#if defined(__linux__)
+    bench_mpscq(loop);
+#endif
+
+    printf("\n  ]\n}\n");
+
+    api_loop_stop(loop);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        iterations = strtoull(argv[1], 0, 10);
+
+    if (iterations < 1024)
+        iterations = 1024;
+
+    api_init();
+
+    if (API_OK != api_loop_run(bench_main, 0, BENCH_STACK))
+        return 1;
+
+    return 0;
+}
\ No newline at end of file
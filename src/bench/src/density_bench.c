@@ -0,0 +1,513 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Memory cost of idle keep-alive connections held by a libapi server.
+ *
+ *   density_bench [-c connections] [-s stack_size] [-H] [-j] [port]
+ *
+ * Forked client opens connections from 127.0.0.x source addresses, 20000
+ * per address, sends one request on each and keeps them open. Server
+ * runs one task per connection blocked in read. Once all are served,
+ * growth of server RSS, pool and kernel memory is divided by connection
+ * count. Kernel part comes from system wide slab and TCP buffer usage,
+ * so it covers both ends of loopback and anything else running.
+ *
+ * A million connections need fs.nr_open and RLIMIT_NOFILE above that
+ * and net.core.somaxconn high enough to not drop connects.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../../api/include/api.h"
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+#define DENSITY_PER_ADDRESS 20000
+#define DENSITY_CONNECTING 512
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+#define RESPONSE "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n"
+
+typedef struct density_sample_t {
+    uint64_t rss;           /* resident bytes of this process */
+    uint64_t pool;          /* bytes in use of loop pool */
+    uint64_t slab;          /* system wide kernel slab bytes */
+    uint64_t tcp;           /* system wide TCP buffer bytes */
+} density_sample_t;
+
+int connections = 10000;
+size_t stack_size = 0;
+int huge_pages = 0;
+int json = 0;
+int port = 9100;
+
+/* client pipes, parent writes go and closes hold, child writes result */
+int go[2];
+int done[2];
+
+api_tcp_listener_t listener;
+size_t served = 0;
+int failed = 0;
+
+/*
+ * Client side, plain sockets in child process so its memory does not
+ * count against server
+ */
+
+int client_open(int index, struct epoll_event* e, int epoll)
+{
+    struct sockaddr_in address;
+    int on = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+    if (fd == -1)
+        return -1;
+
+    /* port is chosen at connect, so each address gets its own range */
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 +
+                                    index / DENSITY_PER_ADDRESS);
+
+    if (0 != bind(fd, (struct sockaddr*)&address, sizeof(address)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    if (0 != connect(fd, (struct sockaddr*)&address, sizeof(address)) &&
+        errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+
+    e->events = EPOLLOUT;
+    e->data.u64 = (uint64_t)fd << 1;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, e);
+
+    return fd;
+}
+
+/* returns 0 when all connections got response */
+int client_run()
+{
+    struct epoll_event events[256];
+    struct epoll_event e;
+    char buffer[256];
+    int connecting = 0;
+    int established = 0;
+    int opened = 0;
+    int epoll;
+    int error;
+    int fd;
+    int n;
+    int i;
+    socklen_t length;
+
+    epoll = epoll_create1(0);
+    if (epoll == -1)
+        return 1;
+
+    while (established < connections)
+    {
+        while (opened < connections && connecting < DENSITY_CONNECTING)
+        {
+            if (-1 == client_open(opened, &e, epoll))
+                return 1;
+
+            ++opened;
+            ++connecting;
+        }
+
+        n = epoll_wait(epoll, events, 256, 10000);
+        if (n <= 0)
+            return 1;
+
+        for (i = 0; i < n; ++i)
+        {
+            fd = (int)(events[i].data.u64 >> 1);
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                return 1;
+
+            if ((events[i].data.u64 & 1) == 0)
+            {
+                /* connected, send request and wait for response */
+                length = sizeof(error);
+                if (0 != getsockopt(fd, SOL_SOCKET, SO_ERROR, &error,
+                                    &length) || error != 0)
+                    return 1;
+
+                if (sizeof(REQUEST) - 1 != write(fd, REQUEST,
+                                                 sizeof(REQUEST) - 1))
+                    return 1;
+
+                e.events = EPOLLIN;
+                e.data.u64 = ((uint64_t)fd << 1) | 1;
+                epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &e);
+            }
+            else
+            {
+                if (0 >= read(fd, buffer, sizeof(buffer)))
+                    return 1;
+
+                /* idle from now on, keep descriptor open */
+                epoll_ctl(epoll, EPOLL_CTL_DEL, fd, &e);
+                --connecting;
+                ++established;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void client_main()
+{
+    char c;
+    char result;
+
+    close(go[1]);
+    close(done[0]);
+
+    if (1 != read(go[0], &c, 1))
+        _exit(1);
+
+    result = client_run() == 0 ? 'y' : 'n';
+    if (1 != write(done[1], &result, 1))
+        _exit(1);
+
+    /* hold connections until parent closes pipe */
+    while (0 < read(go[0], &c, 1));
+
+    _exit(0);
+}
+
+/*
+ * Server side
+ */
+
+uint64_t density_meminfo(const char* path, const char* key, int column)
+{
+    FILE* file = fopen(path, "r");
+    char line[256];
+    char* value;
+    uint64_t result = 0;
+    int i;
+
+    if (file == 0)
+        return 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (0 != strncmp(line, key, strlen(key)))
+            continue;
+
+        value = line + strlen(key);
+        for (i = 0; i < column && value != 0; ++i)
+            value = strchr(value + 1, ' ');
+
+        if (value != 0)
+            result = strtoull(value, 0, 10);
+
+        break;
+    }
+
+    fclose(file);
+
+    return result;
+}
+
+void density_sample(api_loop_t* loop, density_sample_t* sample)
+{
+    api_pool_stats_t stats;
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    FILE* file;
+
+    file = fopen("/proc/self/statm", "r");
+    if (file != 0)
+    {
+        if (2 != fscanf(file, "%llu %llu", &size, &resident))
+            resident = 0;
+
+        fclose(file);
+    }
+
+    api_pool_stats(api_pool_default(loop), &stats);
+
+    sample->rss = resident * page;
+    sample->pool = stats.region_bytes + stats.heap_bytes;
+
+    /* "Slab:   1234 kB" and "TCP: inuse 5 orphan 0 tw 0 alloc 7 mem 1" */
+    sample->slab = density_meminfo("/proc/meminfo", "Slab:", 0) * 1024;
+    sample->tcp = density_meminfo("/proc/net/sockstat", "TCP:", 9) * page;
+}
+
+void density_connection(api_loop_t* loop, void* arg)
+{
+    api_tcp_t* tcp = (api_tcp_t*)arg;
+    char buffer[512];
+
+    api_stream_attach(&tcp->stream, loop);
+
+    while (0 != api_stream_read(&tcp->stream, buffer, sizeof(buffer)))
+    {
+        if (sizeof(RESPONSE) - 1 != api_stream_write(&tcp->stream,
+                                        RESPONSE, sizeof(RESPONSE) - 1))
+            break;
+
+        ++served;
+    }
+
+    api_stream_close(&tcp->stream);
+    api_free(api_pool_default(loop), sizeof(*tcp), tcp);
+}
+
+void density_acceptor(api_loop_t* loop, void* arg)
+{
+    api_pool_t* pool = api_pool_default(loop);
+    api_tcp_t* tcp;
+
+    tcp = (api_tcp_t*)api_alloc(pool, sizeof(*tcp));
+    while (API_OK == api_tcp_accept(&listener, tcp))
+    {
+        if (API_OK != api_loop_post(loop, density_connection, tcp,
+                                    stack_size))
+            break;
+
+        tcp = (api_tcp_t*)api_alloc(pool, sizeof(*tcp));
+    }
+
+    api_free(pool, sizeof(*tcp), tcp);
+}
+
+long long density_per(uint64_t after, uint64_t before)
+{
+    return ((long long)after - (long long)before) / connections;
+}
+
+void density_print(density_sample_t* before, density_sample_t* after,
+                   double seconds)
+{
+    size_t stack = stack_size != 0 ? stack_size : 8 * 1024;
+    long long rss = density_per(after->rss, before->rss);
+    long long pool = density_per(after->pool, before->pool);
+    long long kernel = density_per(after->slab, before->slab) +
+                       density_per(after->tcp, before->tcp);
+
+    if (json)
+    {
+        printf("{\n  \"suite\": \"density\",\n  \"connections\": %d,\n"
+               "  \"stack_size\": %llu,\n  \"huge_pages\": %d,\n"
+               "  \"connect_seconds\": %.3f,\n",
+               connections, (unsigned long long)stack, huge_pages, seconds);
+        printf("  \"bytes_per_connection\": {\"rss\": %lld, \"stacks\": %llu, "
+               "\"pool\": %lld, \"other\": %lld, \"kernel\": %lld, "
+               "\"kernel_slab\": %lld, \"kernel_buffers\": %lld}\n}\n",
+               rss, (unsigned long long)stack, pool - (long long)stack,
+               rss - pool, kernel,
+               density_per(after->slab, before->slab),
+               density_per(after->tcp, before->tcp));
+
+        return;
+    }
+
+    printf("%d idle connections in %.1fs, %llu byte stacks%s\n",
+           connections, seconds, (unsigned long long)stack,
+           huge_pages ? ", huge pages" : "");
+    printf("  bytes per connection\n");
+    printf("    rss     %8lld\n", rss);
+    printf("      stack %8llu  task and its stack\n",
+           (unsigned long long)stack);
+    printf("      pool  %8lld  api_tcp_t and other pool memory\n",
+           pool - (long long)stack);
+    printf("      other %8lld  rss minus pool, below 0 if pool pages are untouched\n",
+           rss - pool);
+    printf("    kernel  %8lld  both ends of loopback\n", kernel);
+    printf("      slab  %8lld  sockets, files, epoll items\n",
+           density_per(after->slab, before->slab));
+    printf("      tcp   %8lld  socket buffers\n",
+           density_per(after->tcp, before->tcp));
+}
+
+void density_main(api_loop_t* loop, void* arg)
+{
+    density_sample_t before;
+    density_sample_t after;
+    uint64_t started;
+    uint64_t elapsed;
+    char result = 0;
+    ssize_t n;
+
+    if (API_OK != api_tcp_listen(&listener, loop, "127.0.0.1", port, 4096))
+    {
+        fprintf(stderr, "cannot listen on port %d\n", port);
+        return;
+    }
+
+    api_loop_post(loop, density_acceptor, 0, 0);
+
+    /* let acceptor start before baseline */
+    api_loop_sleep(loop, 10);
+    density_sample(loop, &before);
+
+    started = api_time_precise();
+
+    if (1 != write(go[1], "g", 1))
+        failed = 1;
+
+    while (!failed && served < (size_t)connections)
+    {
+        n = read(done[0], &result, 1);
+        if (n == 0 || (n == 1 && result != 'y'))
+            failed = 1;
+
+        if (API_OK != api_loop_sleep(loop, 100))
+            failed = 1;
+    }
+
+    elapsed = api_time_precise() - started;
+
+    if (failed)
+    {
+        fprintf(stderr, "client failed after %llu connections, check "
+                "descriptor limits and somaxconn\n",
+                (unsigned long long)served);
+    }
+    else
+    {
+        density_sample(loop, &after);
+        density_print(&before, &after, (double)elapsed / 1000000.0);
+    }
+
+    api_tcp_close(&listener);
+
+    /* child closes its connections and exits */
+    close(go[1]);
+    wait(0);
+
+    api_loop_stop(loop);
+}
+
+int usage()
+{
+    fprintf(stderr,
+        "usage: density_bench [-c connections] [-s stack_size] [-H] [-j]\n"
+        "                     [port]\n"
+        "  -c  idle connections to open, 10000\n"
+        "  -s  stack size of connection tasks, 0 for default\n"
+        "  -H  carve pool and stacks from huge pages\n"
+        "  -j  print results as JSON\n");
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    api_loop_config_t config;
+    struct rlimit limit;
+    rlim_t needed;
+    pid_t child;
+    int i;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "-j"))
+            json = 1;
+        else if (0 == strcmp(argv[i], "-H"))
+            huge_pages = 1;
+        else if (0 == strcmp(argv[i], "-c") && i + 1 < argc)
+            connections = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-s") && i + 1 < argc)
+            stack_size = (size_t)strtoull(argv[++i], 0, 10);
+        else if (argv[i][0] != '-')
+            port = atoi(argv[i]);
+        else
+            return usage();
+    }
+
+    if (connections <= 0 || port <= 0)
+        return usage();
+
+    /* both processes hold one descriptor per connection */
+    needed = (rlim_t)connections + 1024;
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < needed)
+    {
+        limit.rlim_cur = needed;
+        if (limit.rlim_max < needed)
+            limit.rlim_max = needed;
+
+        if (0 != setrlimit(RLIMIT_NOFILE, &limit))
+        {
+            fprintf(stderr, "cannot raise descriptor limit to %llu\n",
+                    (unsigned long long)needed);
+            return 1;
+        }
+    }
+
+    if (0 != pipe(go) || 0 != pipe(done))
+        return 1;
+
+    child = fork();
+    if (child == -1)
+        return 1;
+
+    if (child == 0)
+        client_main();
+
+    close(go[0]);
+    close(done[1]);
+    fcntl(done[0], F_SETFL, O_NONBLOCK);
+
+    api_init();
+
+    memset(&config, 0, sizeof(config));
+    config.huge_pages = huge_pages;
+
+    /* printf requires more stack */
+    if (API_OK != api_loop_run_ex(density_main, 0, 100 * 1024, &config))
+        return 1;
+
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,456 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Stress of api_event_t across loops, results are printed to stdout
+ * as JSON and exit code is 1 if any check failed.
+ *
+ *   event_stress [loops] [tasks] [rounds]
+ *
+ * contention - auto event passed as a lock between tasks of all loops,
+ *              every other wait is timed so timeouts race signals,
+ *              no two owners at once and no token lost
+ * gate       - manual event releases tasks of all loops at once
+ * timeout    - waits on event nobody signals return API_TIMEDOUT
+ * terminate  - infinite and timed waits return API_TERMINATE when
+ *              their loops stop, later signal finds no stale waiters
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+#include "../../api/src/api_atomic.h"
+
+#define STRESS_STACK (64 * 1024)
+#define STRESS_WAIT (30 * 1000)
+#define STRESS_TIMEOUT 20
+
+typedef struct stress_t stress_t;
+
+typedef struct stress_worker_t {
+    stress_t* stress;
+    api_event_t* event;
+    uint64_t timeout;
+    uint64_t count;
+    uint64_t timeouts;
+    uint64_t elapsed;
+    int result;
+} stress_worker_t;
+
+struct stress_t {
+    api_loop_t* main;
+    api_event_t done;
+    size_t pending;     // main loop only
+    uint64_t count;
+    uint64_t timeouts;
+    uint64_t elapsed_min;
+    size_t ok;
+    size_t timedout;
+    size_t terminated;
+};
+
+size_t loops_count = 4;
+size_t tasks = 8;
+uint64_t rounds = 1000;
+int reported = 0;
+int failed = 0;
+
+/* owned by the task holding the lock event */
+volatile long inside = 0;
+uint64_t counter = 0;
+int overlapped = 0;
+
+/* fields are appended after name and ok, format starts with comma */
+void stress_report(const char* name, int ok, const char* format, ...)
+{
+    va_list args;
+
+    printf("%s\n    {\"name\": \"%s\", \"ok\": %s",
+           reported++ ? "," : "", name, ok ? "true" : "false");
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+
+    printf("}");
+    fflush(stdout);
+
+    if (!ok)
+        failed = 1;
+}
+
+void stress_init(stress_t* stress, api_loop_t* loop, size_t pending)
+{
+    memset(stress, 0, sizeof(*stress));
+    stress->main = loop;
+    stress->pending = pending;
+    stress->elapsed_min = (uint64_t)-1;
+    api_event_init(&stress->done, EVENT_Manual);
+}
+
+/* runs in main loop, workers report here so counters need no atomics */
+void stress_collect(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_t* stress = worker->stress;
+
+    stress->count += worker->count;
+    stress->timeouts += worker->timeouts;
+
+    if (worker->elapsed < stress->elapsed_min)
+        stress->elapsed_min = worker->elapsed;
+
+    if (worker->result == API_OK)
+        ++stress->ok;
+    else if (worker->result == API_TIMEDOUT)
+        ++stress->timedout;
+    else if (worker->result == API_TERMINATE)
+        ++stress->terminated;
+
+    if (--stress->pending == 0)
+        api_event_signal(&stress->done);
+}
+
+int stress_wait(stress_t* stress, api_loop_t* loop)
+{
+    return API_OK == api_event_wait(&stress->done, loop, STRESS_WAIT);
+}
+
+void stress_locker(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    uint64_t i;
+
+    worker->result = API_OK;
+
+    for (i = 0; i < rounds; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            worker->result = api_event_wait(worker->event, loop, 0);
+        }
+        else
+        {
+            /* short timeout races with signal of previous owner */
+            while (API_TIMEDOUT ==
+                (worker->result = api_event_wait(worker->event, loop, 1)))
+                ++worker->timeouts;
+        }
+
+        if (worker->result != API_OK)
+            break;
+
+        if (api_atomic_add_long(&inside, 1) != 1)
+            overlapped = 1;
+
+        ++counter;
+
+        /* let other loops pile up on the event */
+        if (i % 256 == 0)
+            api_loop_sleep(loop, 1);
+
+        api_atomic_add_long(&inside, -1);
+
+        api_event_signal(worker->event);
+        ++worker->count;
+    }
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_waiter(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    uint64_t started = api_time_precise();
+
+    worker->result = api_event_wait(worker->event, loop, worker->timeout);
+    worker->elapsed = api_time_precise() - started;
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+/* post waiter to every task of every loop, timeout 0 waits infinitely */
+void stress_post_waiters(stress_t* stress, stress_worker_t* workers,
+                         api_loop_t** loops, api_event_t* event,
+                         uint64_t timeout)
+{
+    size_t i;
+
+    for (i = 0; i < loops_count * tasks; ++i)
+    {
+        workers[i].stress = stress;
+        workers[i].event = event;
+        workers[i].timeout = timeout;
+        api_loop_post(loops[i % loops_count], stress_waiter,
+                      &workers[i], STRESS_STACK);
+    }
+}
+
+void stress_contention(api_loop_t* loop, api_loop_t** loops,
+                       stress_worker_t* workers)
+{
+    stress_t stress;
+    api_event_t lock;
+    uint64_t started;
+    uint64_t elapsed;
+    size_t count = loops_count * tasks;
+    size_t i;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    api_event_init(&lock, EVENT_Auto);
+
+    counter = 0;
+    started = api_time_precise();
+
+    for (i = 0; i < count; ++i)
+    {
+        workers[i].stress = &stress;
+        workers[i].event = &lock;
+        api_loop_post(loops[i % loops_count], stress_locker,
+                      &workers[i], STRESS_STACK);
+    }
+
+    /* single token */
+    api_event_signal(&lock);
+
+    ok = stress_wait(&stress, loop);
+    elapsed = api_time_precise() - started;
+
+    ok = ok && !overlapped && stress.ok == count &&
+         stress.count == count * rounds && counter == stress.count &&
+         lock.signaled == 1;
+
+    stress_report("contention", ok,
+                  ", \"acquired\": %llu, \"timeouts\": %llu, "
+                  "\"elapsed_us\": %llu, \"handoffs_per_sec\": %.0f",
+                  (unsigned long long)stress.count,
+                  (unsigned long long)stress.timeouts,
+                  (unsigned long long)elapsed,
+                  elapsed != 0 ? stress.count * 1e6 / elapsed : 0.0);
+
+    /* waiters may still hold the event */
+    if (!ok)
+        api_loop_sleep(loop, STRESS_WAIT);
+}
+
+void stress_gate(api_loop_t* loop, api_loop_t** loops,
+                 stress_worker_t* workers)
+{
+    stress_t stress;
+    api_event_t gate;
+    api_event_t pulse;
+    size_t count = loops_count * tasks;
+    size_t released;
+    uint64_t pulses = 0;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    api_event_init(&gate, EVENT_Manual);
+
+    stress_post_waiters(&stress, workers, loops, &gate, 0);
+
+    api_loop_sleep(loop, 10);
+    api_event_signal(&gate);
+
+    ok = stress_wait(&stress, loop) && stress.ok == count;
+    released = stress.ok;
+
+    /* broadcast releases only tasks waiting now, pulse until all went */
+    stress_init(&stress, loop, count);
+    api_event_init(&pulse, EVENT_Manual);
+
+    stress_post_waiters(&stress, workers, loops, &pulse, 0);
+
+    while (stress.pending != 0 && pulses < STRESS_WAIT)
+    {
+        api_event_broadcast(&pulse);
+        ++pulses;
+
+        api_loop_sleep(loop, 1);
+    }
+
+    ok = ok && stress.pending == 0 && stress.ok == count &&
+         pulse.signaled == 0;
+
+    stress_report("gate", ok,
+                  ", \"released\": %llu, \"broadcasted\": %llu, "
+                  "\"pulses\": %llu",
+                  (unsigned long long)released,
+                  (unsigned long long)stress.ok,
+                  (unsigned long long)pulses);
+}
+
+void stress_timeout(api_loop_t* loop, api_loop_t** loops,
+                    stress_worker_t* workers)
+{
+    stress_t stress;
+    api_event_t never;
+    size_t count = loops_count * tasks;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    api_event_init(&never, EVENT_Auto);
+
+    stress_post_waiters(&stress, workers, loops, &never, STRESS_TIMEOUT);
+
+    ok = stress_wait(&stress, loop);
+
+    /* timer resolution is a millisecond */
+    ok = ok && stress.timedout == count && never.waiters == 0 &&
+         stress.elapsed_min + 1000 >= STRESS_TIMEOUT * 1000;
+
+    stress_report("timeout", ok,
+                  ", \"timedout\": %llu, \"elapsed_min_us\": %llu",
+                  (unsigned long long)stress.timedout,
+                  (unsigned long long)stress.elapsed_min);
+}
+
+void stress_terminate(api_loop_t* loop, stress_worker_t* workers)
+{
+    stress_t stress;
+    stress_t infinite;
+    api_event_t never;
+    api_loop_t** loops;
+    size_t count = loops_count * tasks;
+    size_t started = 0;
+    size_t i;
+    int ok;
+
+    loops = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&loops[i]))
+            break;
+
+        ++started;
+    }
+
+    if (started != loops_count)
+    {
+        for (i = 0; i < started; ++i)
+            api_loop_stop_and_wait(loop, loops[i]);
+
+        free(loops);
+        stress_report("terminate", 0, "");
+        return;
+    }
+
+    stress_init(&stress, loop, count);
+    stress_init(&infinite, loop, count);
+    api_event_init(&never, EVENT_Manual);
+
+    /* half of waits are timed, half are not */
+    stress_post_waiters(&stress, workers, loops, &never, STRESS_WAIT * 2);
+    stress_post_waiters(&infinite, workers + count, loops, &never, 0);
+
+    api_loop_sleep(loop, 50);
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_stop_and_wait(loop, loops[i]);
+
+    ok = stress_wait(&stress, loop);
+    ok = stress_wait(&infinite, loop) && ok;
+
+    /* records of stopped loops must be gone from the stack */
+    ok = ok && stress.terminated == count && infinite.terminated == count &&
+         never.waiters == 0;
+
+    stress_report("terminate", ok,
+                  ", \"timed\": %llu, \"infinite\": %llu",
+                  (unsigned long long)stress.terminated,
+                  (unsigned long long)infinite.terminated);
+
+    if (ok)
+        api_event_signal(&never);
+
+    free(loops);
+}
+
+void stress_main(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* workers;
+    api_loop_t** loops;
+    size_t i;
+
+    loops = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+    workers = (stress_worker_t*)calloc(loops_count * tasks * 2,
+                                       sizeof(stress_worker_t));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&loops[i]))
+        {
+            failed = 1;
+            loops_count = i;
+            break;
+        }
+    }
+
+    printf("{\n  \"suite\": \"event\",\n  \"loops\": %llu,\n"
+           "  \"tasks\": %llu,\n  \"results\": [",
+           (unsigned long long)loops_count, (unsigned long long)tasks);
+
+    if (loops_count != 0)
+    {
+        stress_contention(loop, loops, workers);
+        stress_gate(loop, loops, workers);
+        stress_timeout(loop, loops, workers);
+        stress_terminate(loop, workers);
+    }
+
+    printf("\n  ]\n}\n");
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_stop_and_wait(loop, loops[i]);
+
+    free(workers);
+    free(loops);
+
+    api_loop_stop(loop);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        loops_count = (size_t)strtoul(argv[1], 0, 10);
+    if (argc > 2)
+        tasks = (size_t)strtoul(argv[2], 0, 10);
+    if (argc > 3)
+        rounds = strtoull(argv[3], 0, 10);
+
+    if (loops_count == 0 || tasks == 0)
+    {
+        printf("usage: event_stress [loops] [tasks] [rounds]\n");
+        return 1;
+    }
+
+    api_init();
+
+    if (API_OK != api_loop_run(stress_main, 0, STRESS_STACK))
+        return 1;
+
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,689 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Stress of api_future_t across loops, results are printed to stdout
+ * as JSON and exit code is 1 if any check failed.
+ *
+ *   future_stress [loops] [tasks] [futures] [rounds]
+ *
+ * contention - tasks of every loop post futures to all other loops and
+ *              collect them with wait_any and wait_all, values must sum
+ * timeout    - wait_any and wait_all on held callbacks return
+ *              API_TIMEDOUT, same futures complete once released
+ * abandon    - futures freed while running or completing are released
+ *              by their owner loops
+ * terminate  - waits return API_TERMINATE when owner loops stop while
+ *              callbacks are held or about to complete
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+#include "../../api/src/api_atomic.h"
+
+#define STRESS_STACK (64 * 1024)
+#define STRESS_WAIT (30 * 1000)
+#define STRESS_TIMEOUT 20
+#define STRESS_FUTURES_MAX 64
+
+typedef struct stress_call_t {
+    api_event_t* hold;  // wait for it before completing if not 0
+    uint64_t delay;     // or sleep for milliseconds
+    uint64_t value;
+} stress_call_t;
+
+typedef struct stress_t stress_t;
+
+/* owner loop of terminate phase, used by its own tasks only */
+typedef struct stress_join_t {
+    stress_t* stress;
+    api_loop_t* owner;
+    size_t left;            // tasks which did not return yet
+    size_t count;
+    api_future_t** list;    // futures of all its tasks
+} stress_join_t;
+
+typedef struct stress_worker_t {
+    stress_t* stress;
+    stress_t* timed;    // first report of timeout phase
+    stress_call_t* calls;
+    stress_join_t* join;
+    uint32_t id;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t timeouts;
+    int result;
+} stress_worker_t;
+
+struct stress_t {
+    api_loop_t* main;
+    api_event_t done;
+    size_t pending;     // main loop only
+    uint64_t count;
+    uint64_t sum;
+    uint64_t timeouts;
+    size_t ok;
+    size_t terminated;
+};
+
+size_t loops_count = 4;
+size_t tasks = 8;
+size_t futures = 16;
+uint64_t rounds = 100;
+api_loop_t** loops = 0;
+volatile long completed = 0;
+int reported = 0;
+int failed = 0;
+
+/* fields are appended after name and ok, format starts with comma */
+void stress_report(const char* name, int ok, const char* format, ...)
+{
+    va_list args;
+
+    printf("%s\n    {\"name\": \"%s\", \"ok\": %s",
+           reported++ ? "," : "", name, ok ? "true" : "false");
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+
+    printf("}");
+    fflush(stdout);
+
+    if (!ok)
+        failed = 1;
+}
+
+void stress_init(stress_t* stress, api_loop_t* loop, size_t pending)
+{
+    memset(stress, 0, sizeof(*stress));
+    stress->main = loop;
+    stress->pending = pending;
+    api_event_init(&stress->done, EVENT_Manual);
+}
+
+/* runs in main loop, workers report here so counters need no atomics */
+void stress_collect(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_t* stress = worker->stress;
+
+    stress->count += worker->count;
+    stress->sum += worker->sum;
+    stress->timeouts += worker->timeouts;
+
+    if (worker->result == API_OK)
+        ++stress->ok;
+    else if (worker->result == API_TERMINATE)
+        ++stress->terminated;
+
+    if (--stress->pending == 0)
+        api_event_signal(&stress->done);
+}
+
+void stress_collect_timed(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+
+    if (--worker->timed->pending == 0)
+        api_event_signal(&worker->timed->done);
+}
+
+int stress_wait(stress_t* stress, api_loop_t* loop)
+{
+    return API_OK == api_event_wait(&stress->done, loop, STRESS_WAIT);
+}
+
+/* wait until callbacks stopped touching calls, they run on other loops */
+int stress_wait_completed(api_loop_t* loop, long expected)
+{
+    uint64_t deadline = api_time_current() + STRESS_WAIT;
+
+    while (completed != expected && api_time_current() < deadline)
+        api_loop_sleep(loop, 1);
+
+    return completed == expected;
+}
+
+void* stress_call(api_loop_t* loop, void* arg)
+{
+    stress_call_t* call = (stress_call_t*)arg;
+    uint64_t value;
+
+    if (call->hold != 0)
+        api_event_wait(call->hold, loop, 0);
+    else if (call->delay != 0)
+        api_loop_sleep(loop, call->delay);
+
+    value = call->value * 2 + 1;
+
+    /* call is not touched anymore */
+    api_atomic_add_long(&completed, 1);
+
+    return (void*)(size_t)value;
+}
+
+/* post futures of worker, each to the next loop after previous one */
+size_t stress_post(api_loop_t* loop, stress_worker_t* worker,
+                   api_future_t** list, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (API_OK != api_future_post(&list[i], loop,
+                            loops[(worker->id + i + 1) % loops_count],
+                            stress_call, &worker->calls[i], STRESS_STACK))
+            break;
+    }
+
+    return i;
+}
+
+void stress_contention_task(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    api_future_t* list[STRESS_FUTURES_MAX];
+    size_t posted;
+    size_t index;
+    uint64_t round;
+    size_t i;
+
+    worker->result = API_OK;
+
+    for (round = 0; round < rounds && worker->result == API_OK; ++round)
+    {
+        posted = stress_post(loop, worker, list, futures);
+        if (posted != futures)
+            worker->result = API_NO_MEMORY;
+
+        if ((worker->id + round) % 2 == 0)
+        {
+            if (worker->result == API_OK)
+                worker->result = api_future_wait_all(list, posted, 0);
+
+            for (i = 0; i < posted; ++i)
+            {
+                if (api_future_done(list[i]))
+                {
+                    worker->sum += (size_t)api_future_value(list[i]);
+                    ++worker->count;
+                }
+
+                api_future_free(list[i]);
+            }
+
+            continue;
+        }
+
+        /* take completed one out, last one takes its place */
+        while (posted != 0)
+        {
+            if (worker->result == API_OK)
+                worker->result = api_future_wait_any(list, posted,
+                                                     &index, 0);
+
+            if (worker->result != API_OK)
+            {
+                for (i = 0; i < posted; ++i)
+                    api_future_free(list[i]);
+
+                break;
+            }
+
+            worker->sum += (size_t)api_future_value(list[index]);
+            ++worker->count;
+
+            api_future_free(list[index]);
+            list[index] = list[--posted];
+        }
+    }
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_timeout_task(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    api_future_t* list[STRESS_FUTURES_MAX];
+    api_future_t* held[STRESS_FUTURES_MAX];
+    size_t posted;
+    size_t index;
+    size_t count = 0;
+    size_t i;
+    int result;
+
+    posted = stress_post(loop, worker, list, futures);
+
+    for (i = 0; i < posted; ++i)
+        if (worker->calls[i].hold != 0)
+            held[count++] = list[i];
+
+    /* any of held ones, while the rest of set is completing */
+    result = api_future_wait_any(held, count, &index, STRESS_TIMEOUT);
+    if (result == API_TIMEDOUT)
+        ++worker->timeouts;
+
+    result = api_future_wait_all(list, posted, STRESS_TIMEOUT);
+    if (result == API_TIMEDOUT)
+        ++worker->timeouts;
+
+    for (i = 0; i < posted; ++i)
+        if (api_future_done(list[i]))
+            ++worker->count;
+
+    /* main releases callbacks once every task timed out */
+    api_loop_post(worker->stress->main, stress_collect_timed, worker, 0);
+
+    worker->result = api_future_wait_all(list, posted, 0);
+    if (posted != futures)
+        worker->result = API_NO_MEMORY;
+
+    for (i = 0; i < posted; ++i)
+    {
+        worker->sum += (size_t)api_future_value(list[i]);
+        api_future_free(list[i]);
+    }
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_abandon_task(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    api_future_t* list[STRESS_FUTURES_MAX];
+    size_t posted;
+    size_t i;
+
+    /* held ones are freed while running, others race completion */
+    posted = stress_post(loop, worker, list, futures);
+
+    for (i = 0; i < posted; ++i)
+        api_future_free(list[i]);
+
+    worker->count = posted;
+    worker->result = posted == futures ? API_OK : API_NO_MEMORY;
+
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+}
+
+void stress_terminate_task(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* worker = (stress_worker_t*)arg;
+    stress_join_t* join = worker->join;
+    api_future_t* list[STRESS_FUTURES_MAX];
+    size_t posted;
+    size_t i;
+
+    posted = stress_post(loop, worker, list, futures);
+
+    worker->result = api_future_wait_all(list, posted, 0);
+    worker->count = posted;
+
+    /* main releases held callbacks once every wait returned */
+    api_loop_post(worker->stress->main, stress_collect, worker, 0);
+
+    for (i = 0; i < posted; ++i)
+        join->list[join->count++] = list[i];
+
+    /*
+     * Futures live in pool of this loop, callbacks have to complete
+     * before the loop is gone. Last task waits for all of them,
+     * spinning earlier would keep the rest from being terminated
+     */
+    if (--join->left != 0)
+        return;
+
+    for (i = 0; i < join->count; ++i)
+    {
+        while (!api_future_done(join->list[i]))
+            api_cpu_relax();
+
+        api_future_free(join->list[i]);
+    }
+}
+
+/* stop owner loop from main loop, waits of all owners run in parallel */
+void stress_join(api_loop_t* loop, void* arg)
+{
+    stress_join_t* join = (stress_join_t*)arg;
+
+    api_loop_stop_and_wait(loop, join->owner);
+
+    if (--join->stress->pending == 0)
+        api_event_signal(&join->stress->done);
+}
+
+/*
+ * Prepare calls of every worker, hold is set for every other call
+ * if given, delay for the rest
+ */
+uint64_t stress_prepare(stress_worker_t* workers, stress_call_t* calls,
+                        stress_t* stress, api_event_t* hold, uint64_t delay)
+{
+    size_t count = loops_count * tasks;
+    uint64_t sum = 0;
+    size_t i;
+    size_t j;
+
+    memset(workers, 0, count * sizeof(stress_worker_t));
+
+    for (i = 0; i < count; ++i)
+    {
+        workers[i].stress = stress;
+        workers[i].calls = &calls[i * futures];
+        workers[i].id = (uint32_t)i;
+
+        for (j = 0; j < futures; ++j)
+        {
+            calls[i * futures + j].value = i * futures + j;
+            calls[i * futures + j].hold = (hold != 0 && j % 2 == 0) ?
+                                          hold : 0;
+            calls[i * futures + j].delay = delay != 0 ? delay + j % 10 : 0;
+
+            sum += (i * futures + j) * 2 + 1;
+        }
+    }
+
+    completed = 0;
+
+    return sum;
+}
+
+void stress_post_tasks(stress_worker_t* workers, api_loop_t** targets,
+                       api_loop_fn callback)
+{
+    size_t i;
+
+    for (i = 0; i < loops_count * tasks; ++i)
+        api_loop_post(targets[i % loops_count], callback,
+                      &workers[i], STRESS_STACK);
+}
+
+void stress_contention(api_loop_t* loop, stress_worker_t* workers,
+                       stress_call_t* calls)
+{
+    stress_t stress;
+    uint64_t started;
+    uint64_t elapsed;
+    uint64_t sum;
+    size_t count = loops_count * tasks;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    sum = stress_prepare(workers, calls, &stress, 0, 0) * rounds;
+
+    started = api_time_precise();
+
+    stress_post_tasks(workers, loops, stress_contention_task);
+
+    ok = stress_wait(&stress, loop);
+    elapsed = api_time_precise() - started;
+
+    ok = ok && stress.ok == count && stress.count == count * futures * rounds &&
+         stress.sum == sum;
+
+    stress_report("contention", ok,
+                  ", \"futures\": %llu, \"elapsed_us\": %llu, "
+                  "\"futures_per_sec\": %.0f",
+                  (unsigned long long)stress.count,
+                  (unsigned long long)elapsed,
+                  elapsed != 0 ? stress.count * 1e6 / elapsed : 0.0);
+}
+
+void stress_timeout(api_loop_t* loop, stress_worker_t* workers,
+                    stress_call_t* calls)
+{
+    stress_t stress;
+    stress_t timed;
+    api_event_t hold;
+    uint64_t sum;
+    uint64_t early;
+    size_t count = loops_count * tasks;
+    size_t i;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    stress_init(&timed, loop, count);
+    api_event_init(&hold, EVENT_Manual);
+
+    /* every other call is held so part of each set completes */
+    sum = stress_prepare(workers, calls, &stress, &hold, 0);
+    for (i = 0; i < count; ++i)
+        workers[i].timed = &timed;
+
+    stress_post_tasks(workers, loops, stress_timeout_task);
+
+    ok = stress_wait(&timed, loop);
+
+    api_event_signal(&hold);
+
+    ok = stress_wait(&stress, loop) && ok;
+    ok = stress_wait_completed(loop, (long)(count * futures)) && ok;
+
+    /* none of held ones completed before release */
+    early = stress.count;
+
+    ok = ok && stress.timeouts == count * 2 && stress.ok == count &&
+         early <= count * (futures / 2) && stress.sum == sum;
+
+    stress_report("timeout", ok,
+                  ", \"timedout\": %llu, \"completed_early\": %llu",
+                  (unsigned long long)stress.timeouts,
+                  (unsigned long long)early);
+}
+
+void stress_abandon(api_loop_t* loop, stress_worker_t* workers,
+                    stress_call_t* calls)
+{
+    stress_t stress;
+    api_event_t hold;
+    size_t count = loops_count * tasks;
+    int ok;
+
+    stress_init(&stress, loop, count);
+    api_event_init(&hold, EVENT_Manual);
+
+    stress_prepare(workers, calls, &stress, &hold, 0);
+    stress_post_tasks(workers, loops, stress_abandon_task);
+
+    ok = stress_wait(&stress, loop);
+
+    api_event_signal(&hold);
+
+    ok = stress_wait_completed(loop, (long)(count * futures)) && ok;
+    ok = ok && stress.ok == count && stress.count == count * futures;
+
+    stress_report("abandon", ok,
+                  ", \"abandoned\": %llu",
+                  (unsigned long long)stress.count);
+}
+
+void stress_terminate(api_loop_t* loop, stress_worker_t* workers,
+                      stress_call_t* calls)
+{
+    stress_t stress;
+    stress_t joined;
+    stress_join_t* joins;
+    api_event_t hold;
+    api_loop_t** owners;
+    size_t count = loops_count * tasks;
+    size_t started = 0;
+    size_t i;
+    int ok;
+
+    owners = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&owners[i]))
+            break;
+
+        ++started;
+    }
+
+    if (started != loops_count)
+    {
+        for (i = 0; i < started; ++i)
+            api_loop_stop_and_wait(loop, owners[i]);
+
+        free(owners);
+        stress_report("terminate", 0, "");
+        return;
+    }
+
+    stress_init(&stress, loop, count);
+    stress_init(&joined, loop, loops_count);
+    api_event_init(&hold, EVENT_Manual);
+
+    joins = (stress_join_t*)calloc(loops_count, sizeof(stress_join_t));
+
+    /* held calls keep waits blocked, delayed ones complete around stop */
+    stress_prepare(workers, calls, &stress, &hold, STRESS_TIMEOUT * 2);
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        joins[i].left = tasks;
+        joins[i].list = (api_future_t**)calloc(tasks * futures,
+                                               sizeof(api_future_t*));
+    }
+
+    for (i = 0; i < count; ++i)
+        workers[i].join = &joins[i % loops_count];
+
+    stress_post_tasks(workers, owners, stress_terminate_task);
+
+    api_loop_sleep(loop, STRESS_TIMEOUT * 2);
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        joins[i].stress = &joined;
+        joins[i].owner = owners[i];
+        api_loop_post(loop, stress_join, &joins[i], STRESS_STACK);
+    }
+
+    ok = stress_wait(&stress, loop);
+
+    api_event_signal(&hold);
+
+    ok = stress_wait(&joined, loop) && ok;
+    ok = stress_wait_completed(loop, (long)(count * futures)) && ok;
+    ok = ok && stress.terminated == count && stress.count == count * futures;
+
+    stress_report("terminate", ok,
+                  ", \"terminated\": %llu",
+                  (unsigned long long)stress.terminated);
+
+    for (i = 0; i < loops_count; ++i)
+        free(joins[i].list);
+
+    free(joins);
+    free(owners);
+}
+
+void stress_main(api_loop_t* loop, void* arg)
+{
+    stress_worker_t* workers;
+    stress_call_t* calls;
+    size_t i;
+
+    loops = (api_loop_t**)calloc(loops_count, sizeof(api_loop_t*));
+    workers = (stress_worker_t*)calloc(loops_count * tasks,
+                                       sizeof(stress_worker_t));
+    calls = (stress_call_t*)calloc(loops_count * tasks * futures,
+                                   sizeof(stress_call_t));
+
+    for (i = 0; i < loops_count; ++i)
+    {
+        if (API_OK != api_loop_start(&loops[i]))
+        {
+            failed = 1;
+            loops_count = i;
+            break;
+        }
+    }
+
+    printf("{\n  \"suite\": \"future\",\n  \"loops\": %llu,\n"
+           "  \"tasks\": %llu,\n  \"futures\": %llu,\n  \"results\": [",
+           (unsigned long long)loops_count, (unsigned long long)tasks,
+           (unsigned long long)futures);
+
+    if (loops_count != 0)
+    {
+        stress_contention(loop, workers, calls);
+
+        if (!failed)
+            stress_timeout(loop, workers, calls);
+
+        if (!failed)
+            stress_abandon(loop, workers, calls);
+
+        if (!failed)
+            stress_terminate(loop, workers, calls);
+    }
+
+    printf("\n  ]\n}\n");
+
+    for (i = 0; i < loops_count; ++i)
+        api_loop_stop_and_wait(loop, loops[i]);
+
+    /* calls may still be referenced by callbacks of failed phase */
+    if (!failed)
+    {
+        free(calls);
+        free(workers);
+    }
+
+    free(loops);
+
+    api_loop_stop(loop);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        loops_count = (size_t)strtoul(argv[1], 0, 10);
+    if (argc > 2)
+        tasks = (size_t)strtoul(argv[2], 0, 10);
+    if (argc > 3)
+        futures = (size_t)strtoul(argv[3], 0, 10);
+    if (argc > 4)
+        rounds = strtoull(argv[4], 0, 10);
+
+    if (loops_count == 0 || tasks == 0 || futures < 2 ||
+        futures > STRESS_FUTURES_MAX)
+    {
+        printf("usage: future_stress [loops] [tasks] [futures 2-%d] "
+               "[rounds]\n", STRESS_FUTURES_MAX);
+        return 1;
+    }
+
+    api_init();
+
+    if (API_OK != api_loop_run(stress_main, 0, STRESS_STACK))
+        return 1;
+
+    return failed;
+}
\ No newline at end of file
@@ -0,0 +1,620 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * HTTP load generator over libapi loops.
+ *
+ *   load_gen [-t loops] [-c connections] [-d seconds] [-p depth]
+ *            [-r rate] [-j] ip port [path]
+ *
+ * Each connection keeps up to depth requests in flight. Without rate
+ * next request is sent as soon as a response frees its slot. With rate
+ * requests per second over all connections are scheduled ahead, and
+ * latency is measured from when request was due, not when it was sent,
+ * so a stalled server is not hidden by delayed sends (coordinated
+ * omission). Responses need Content-Length or connection close.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#define strncmp_nocase strncasecmp
+#else
+#pragma warning(disable: 4996)
+#define strncmp_nocase _strnicmp
+#endif
+
+#define LOAD_STACK (16 * 1024)
+#define LOAD_BUFFER 8192
+
+typedef struct load_stats_t {
+    uint64_t requests;      /* responses completed in test window */
+    uint64_t bytes;
+    uint64_t status;        /* responses other than 2xx and 3xx */
+    uint64_t connect;       /* failed connects */
+    uint64_t read;          /* broken or malformed responses */
+    uint64_t lost;          /* requests in flight when connection broke */
+    uint64_t reconnects;
+    api_histogram_t latency;
+} load_stats_t;
+
+typedef struct load_worker_t {
+    api_loop_t* loop;
+    load_stats_t stats;
+} load_worker_t;
+
+typedef struct load_connection_t {
+    load_worker_t* worker;
+    api_tcp_t tcp;
+    api_event_t slot;       /* reader completed a response */
+    api_event_t done;       /* reader exited */
+    uint64_t* stamps;       /* due times of requests in flight */
+    uint64_t sent;
+    uint64_t received;
+    uint64_t next;          /* due time of next request with rate */
+    uint64_t interval;
+    uint64_t remaining;     /* body bytes of current response */
+    int in_body;
+    int until_close;        /* body ends with connection */
+    int closing;            /* server asked to close */
+    int broken;
+    char* requests;         /* depth copies of request */
+    size_t length;
+    char buffer[LOAD_BUFFER];
+} load_connection_t;
+
+/* settings, written before workers start */
+const char* ip = 0;
+int port = 0;
+const char* path = "/";
+int loops = 2;
+int connections = 64;
+int depth = 1;
+uint64_t duration = 10;
+uint64_t rate = 0;
+int json = 0;
+
+char request[512];
+size_t request_length;
+
+uint64_t started;
+uint64_t deadline;
+volatile int stopping = 0;
+
+void load_complete(load_connection_t* connection)
+{
+    load_stats_t* stats = &connection->worker->stats;
+    uint64_t now = api_time_precise();
+    uint64_t due = connection->stamps[connection->received % depth];
+
+    ++connection->received;
+
+    if (now >= started && now <= deadline)
+    {
+        ++stats->requests;
+        api_histogram_record(&stats->latency, now > due ? now - due : 0);
+    }
+
+    api_event_signal(&connection->slot);
+}
+
+/*
+ * Consume responses in buffer, returns -1 on malformed response,
+ * otherwise bytes left unparsed
+ */
+int load_parse(load_connection_t* connection)
+{
+    load_stats_t* stats = &connection->worker->stats;
+    char* buffer = connection->buffer;
+    char* end;
+    char* line;
+    size_t header;
+    size_t taken;
+    int status;
+
+    while (connection->length > 0)
+    {
+        if (connection->in_body)
+        {
+            if (connection->until_close)
+            {
+                connection->length = 0;
+                return 0;
+            }
+
+            taken = connection->remaining < connection->length ?
+                        (size_t)connection->remaining : connection->length;
+
+            connection->remaining -= taken;
+            connection->length -= taken;
+            memmove(buffer, buffer + taken, connection->length);
+
+            if (connection->remaining > 0)
+                return 0;
+
+            connection->in_body = 0;
+            load_complete(connection);
+
+            if (connection->closing)
+                return 0;
+
+            continue;
+        }
+
+        buffer[connection->length] = 0;
+        end = strstr(buffer, "\r\n\r\n");
+        if (end == 0)
+            return connection->length < LOAD_BUFFER - 1 ? 0 : -1;
+
+        header = end + 4 - buffer;
+
+        if (0 != strncmp(buffer, "HTTP/1.", 7) || connection->length < 12)
+            return -1;
+
+        status = atoi(buffer + 9);
+        if (status < 200 || status >= 400)
+            ++stats->status;
+
+        connection->remaining = 0;
+        connection->until_close = 1;
+
+        for (line = strstr(buffer, "\r\n"); line != 0 && line < end;
+             line = strstr(line + 2, "\r\n"))
+        {
+            if (0 == strncmp_nocase(line + 2, "Content-Length:", 15))
+            {
+                connection->remaining = strtoull(line + 17, 0, 10);
+                connection->until_close = 0;
+            }
+            else if (0 == strncmp_nocase(line + 2, "Connection: close", 17))
+            {
+                connection->closing = 1;
+            }
+        }
+
+        if (status == 204 || status == 304 || (status >= 100 && status < 200))
+            connection->until_close = 0;
+
+        connection->in_body = 1;
+        connection->length -= header;
+        memmove(buffer, buffer + header, connection->length);
+
+        if (!connection->until_close && connection->remaining == 0)
+        {
+            connection->in_body = 0;
+            load_complete(connection);
+
+            if (connection->closing)
+                return 0;
+        }
+    }
+
+    return 0;
+}
+
+void load_reader(api_loop_t* loop, void* arg)
+{
+    load_connection_t* connection = (load_connection_t*)arg;
+    load_stats_t* stats = &connection->worker->stats;
+    size_t nread;
+
+    while (!connection->broken && !connection->closing)
+    {
+        nread = api_stream_read(&connection->tcp.stream,
+                    connection->buffer + connection->length,
+                    LOAD_BUFFER - 1 - connection->length);
+
+        if (nread == 0)
+        {
+            /* body delimited by close is complete */
+            if (connection->in_body && connection->until_close)
+            {
+                connection->in_body = 0;
+                load_complete(connection);
+            }
+            else if (!stopping && connection->received < connection->sent &&
+                     (connection->received == 0 || connection->length != 0))
+            {
+                /* closing between responses only loses requests */
+                ++stats->read;
+            }
+
+            break;
+        }
+
+        if (!stopping && api_time_precise() <= deadline)
+            stats->bytes += nread;
+
+        connection->length += nread;
+
+        if (load_parse(connection) < 0)
+        {
+            if (!stopping)
+                ++stats->read;
+
+            break;
+        }
+    }
+
+    connection->broken = 1;
+    api_event_signal(&connection->slot);
+    api_event_signal(&connection->done);
+}
+
+/*
+ * Send requests as slots free up or as they become due,
+ * returns when connection breaks or loop stops
+ */
+void load_writer(api_loop_t* loop, load_connection_t* connection)
+{
+    uint64_t now;
+    size_t slots;
+    size_t n;
+    size_t i;
+
+    while (!connection->broken && !connection->closing && !stopping)
+    {
+        slots = depth - (size_t)(connection->sent - connection->received);
+        if (slots == 0)
+        {
+            if (API_OK != api_event_wait(&connection->slot, loop, 0))
+                break;
+
+            continue;
+        }
+
+        now = api_time_precise();
+
+        if (rate != 0)
+        {
+            if (connection->next > now)
+            {
+                /* timers are in milliseconds, rounded up */
+                if (API_OK != api_loop_sleep(loop,
+                                (connection->next - now + 999) / 1000))
+                    break;
+
+                continue;
+            }
+
+            for (n = 0; n < slots && connection->next <= now; ++n)
+            {
+                i = (size_t)(connection->sent++ % depth);
+                connection->stamps[i] = connection->next;
+                connection->next += connection->interval;
+            }
+        }
+        else
+        {
+            for (n = 0; n < slots; ++n)
+            {
+                i = (size_t)(connection->sent++ % depth);
+                connection->stamps[i] = now;
+            }
+        }
+
+        if (n * request_length != api_stream_write(&connection->tcp.stream,
+                                    connection->requests, n * request_length))
+            break;
+    }
+}
+
+void load_connection(api_loop_t* loop, void* arg)
+{
+    load_connection_t* connection = (load_connection_t*)arg;
+    load_stats_t* stats = &connection->worker->stats;
+
+    while (!stopping)
+    {
+        if (API_OK != api_tcp_connect(&connection->tcp, loop, ip, port, 5000))
+        {
+            if (stopping)
+                break;
+
+            ++stats->connect;
+
+            if (API_OK != api_loop_sleep(loop, 10))
+                break;
+
+            continue;
+        }
+
+        connection->tcp.stream.read_timeout = 10 * 1000;
+        connection->tcp.stream.write_timeout = 10 * 1000;
+
+        connection->sent = 0;
+        connection->received = 0;
+        connection->length = 0;
+        connection->in_body = 0;
+        connection->closing = 0;
+        connection->broken = 0;
+
+        api_event_reset(&connection->slot);
+        api_event_reset(&connection->done);
+
+        if (API_OK != api_loop_post(loop, load_reader, connection,
+                                    LOAD_STACK))
+        {
+            api_stream_close(&connection->tcp.stream);
+            break;
+        }
+
+        load_writer(loop, connection);
+
+        if (API_OK != api_event_wait(&connection->done, loop, 0))
+            break;
+
+        api_stream_close(&connection->tcp.stream);
+
+        if (stopping)
+            break;
+
+        if (connection->received < connection->sent && !connection->closing)
+            stats->lost += connection->sent - connection->received;
+
+        ++stats->reconnects;
+    }
+}
+
+load_connection_t* load_connection_create(load_worker_t* worker)
+{
+    load_connection_t* connection;
+    int i;
+
+    connection = (load_connection_t*)calloc(1, sizeof(*connection));
+    if (connection == 0)
+        return 0;
+
+    connection->stamps = (uint64_t*)calloc(depth, sizeof(uint64_t));
+    connection->requests = (char*)malloc(depth * request_length);
+
+    if (connection->stamps == 0 || connection->requests == 0)
+    {
+        free(connection->stamps);
+        free(connection->requests);
+        free(connection);
+        return 0;
+    }
+
+    for (i = 0; i < depth; ++i)
+        memcpy(connection->requests + i * request_length, request,
+               request_length);
+
+    connection->worker = worker;
+    api_event_init(&connection->slot, EVENT_Auto);
+    api_event_init(&connection->done, EVENT_Manual);
+
+    /* spread first requests over interval so connections do not align */
+    if (rate != 0)
+    {
+        connection->interval = (uint64_t)connections * 1000000 / rate;
+        if (connection->interval == 0)
+            connection->interval = 1;
+
+        connection->next = started + (uint64_t)rand() % connection->interval;
+    }
+
+    return connection;
+}
+
+void load_print(load_stats_t* total, uint64_t elapsed)
+{
+    static const double percents[] = { 50, 75, 90, 99, 99.9, 99.99, 100 };
+    double seconds = (double)elapsed / 1000000.0;
+    size_t i;
+
+    if (json)
+    {
+        printf("{\n  \"suite\": \"load\",\n  \"target\": \"%s:%d%s\",\n"
+               "  \"loops\": %d,\n  \"connections\": %d,\n  \"depth\": %d,\n"
+               "  \"rate\": %llu,\n  \"seconds\": %.3f,\n",
+               ip, port, path, loops, connections, depth,
+               (unsigned long long)rate, seconds);
+        printf("  \"requests\": %llu,\n  \"requests_per_sec\": %.1f,\n"
+               "  \"bytes_per_sec\": %.1f,\n",
+               (unsigned long long)total->requests,
+               total->requests / seconds, total->bytes / seconds);
+        printf("  \"errors\": {\"connect\": %llu, \"read\": %llu, "
+               "\"status\": %llu, \"lost\": %llu, \"reconnects\": %llu},\n",
+               (unsigned long long)total->connect,
+               (unsigned long long)total->read,
+               (unsigned long long)total->status,
+               (unsigned long long)total->lost,
+               (unsigned long long)total->reconnects);
+        printf("  \"latency_us\": {");
+        for (i = 0; i < sizeof(percents) / sizeof(*percents); ++i)
+            printf("%s\"p%g\": %llu", i ? ", " : "", percents[i],
+                (unsigned long long)api_histogram_percentile(&total->latency,
+                                                             percents[i]));
+        printf(", \"mean\": %.1f}\n}\n", total->latency.count ?
+               (double)total->latency.sum / total->latency.count : 0.0);
+
+        return;
+    }
+
+    printf("%.1fs test @ %s:%d%s\n", seconds, ip, port, path);
+    printf("  %d loops, %d connections, depth %d", loops, connections, depth);
+    if (rate != 0)
+        printf(", %llu requests/sec scheduled", (unsigned long long)rate);
+    printf("\n  latency microseconds\n");
+
+    for (i = 0; i < sizeof(percents) / sizeof(*percents); ++i)
+        printf("    %7g%% %10llu\n", percents[i],
+               (unsigned long long)api_histogram_percentile(&total->latency,
+                                                            percents[i]));
+
+    printf("  %llu requests, %.1f requests/sec, %.1f MB/sec\n",
+           (unsigned long long)total->requests, total->requests / seconds,
+           total->bytes / seconds / (1024 * 1024));
+
+    if (total->connect || total->read || total->status || total->lost)
+        printf("  errors: connect %llu, read %llu, status %llu, lost %llu\n",
+               (unsigned long long)total->connect,
+               (unsigned long long)total->read,
+               (unsigned long long)total->status,
+               (unsigned long long)total->lost);
+
+    if (total->reconnects)
+        printf("  reconnects %llu\n", (unsigned long long)total->reconnects);
+}
+
+void load_main(api_loop_t* loop, void* arg)
+{
+    load_worker_t* workers;
+    load_connection_t* connection;
+    load_stats_t total;
+    int i;
+
+    workers = (load_worker_t*)calloc(loops, sizeof(*workers));
+    if (workers == 0)
+        return;
+
+    started = api_time_precise();
+    deadline = started + duration * 1000000;
+
+    for (i = 0; i < loops; ++i)
+    {
+        if (API_OK != api_loop_start(&workers[i].loop))
+        {
+            fprintf(stderr, "cannot start loop\n");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < connections; ++i)
+    {
+        connection = load_connection_create(&workers[i % loops]);
+        if (connection == 0)
+            break;
+
+        api_loop_post(workers[i % loops].loop, load_connection, connection,
+                      LOAD_STACK);
+    }
+
+    api_loop_sleep(loop, duration * 1000);
+
+    stopping = 1;
+
+    memset(&total, 0, sizeof(total));
+
+    for (i = 0; i < loops; ++i)
+    {
+        api_loop_stop_and_wait(loop, workers[i].loop);
+
+        total.requests += workers[i].stats.requests;
+        total.bytes += workers[i].stats.bytes;
+        total.status += workers[i].stats.status;
+        total.connect += workers[i].stats.connect;
+        total.read += workers[i].stats.read;
+        total.lost += workers[i].stats.lost;
+        total.reconnects += workers[i].stats.reconnects;
+        api_histogram_merge(&total.latency, &workers[i].stats.latency);
+    }
+
+    load_print(&total, deadline - started);
+
+    api_loop_stop(loop);
+}
+
+int usage()
+{
+    fprintf(stderr,
+        "usage: load_gen [-t loops] [-c connections] [-d seconds]\n"
+        "                [-p depth] [-r rate] [-j] ip port [path]\n"
+        "  -t  loops generating load, 2\n"
+        "  -c  connections over all loops, 64\n"
+        "  -d  test duration in seconds, 10\n"
+        "  -p  requests in flight per connection, 1\n"
+        "  -r  requests per second over all connections, 0 sends as\n"
+        "      fast as responses come\n"
+        "  -j  print results as JSON\n");
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+#if defined(__linux__)
+    struct rlimit limit;
+#endif
+    int positional = 0;
+    int i;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "-j"))
+            json = 1;
+        else if (argv[i][0] == '-' && argv[i][1] != 0 && i + 1 < argc)
+        {
+            switch (argv[i][1]) {
+            case 't': loops = atoi(argv[++i]); break;
+            case 'c': connections = atoi(argv[++i]); break;
+            case 'd': duration = strtoull(argv[++i], 0, 10); break;
+            case 'p': depth = atoi(argv[++i]); break;
+            case 'r': rate = strtoull(argv[++i], 0, 10); break;
+            default: return usage();
+            }
+        }
+        else if (positional == 0)
+            ip = argv[i], ++positional;
+        else if (positional == 1)
+            port = atoi(argv[i]), ++positional;
+        else if (positional == 2)
+            path = argv[i], ++positional;
+        else
+            return usage();
+    }
+
+    if (ip == 0 || port <= 0 || loops <= 0 || connections <= 0 ||
+        depth <= 0 || duration == 0)
+        return usage();
+
+    if (loops > connections)
+        loops = connections;
+
+#if defined(__linux__)
+    /* thousands of connections need more than default descriptors */
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+
+    request_length = snprintf(request, sizeof(request),
+                              "GET %s HTTP/1.1\r\nHost: %s:%d\r\n\r\n",
+                              path, ip, port);
+    if (request_length >= sizeof(request))
+        return usage();
+
+    api_init();
+
+    /* printf requires more stack */
+    if (API_OK != api_loop_run(load_main, 0, 100 * 1024))
+        return 1;
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,675 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Replay traffic recorded by capture filter against a server.
+ *
+ *   replay [-t loops] [-x speed] [-m copies] [-j] file ip port
+ *
+ * Data captured as read by server streams is sent again on a new
+ * connection for each captured one, at its recorded time divided by
+ * speed. Speed 0 sends next request as soon as response to previous one
+ * arrived. With copies each connection is replayed that many times at
+ * once. Responses are matched by byte count of captured ones, latency
+ * of a request is measured from when it was due until as many bytes as
+ * captured server wrote in reply have arrived.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+#include "../../capture/include/capture.h"
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#else
+#pragma warning(disable: 4996)
+#endif
+
+#define REPLAY_STACK (32 * 1024)
+
+/*
+ * Data captured as read by server, reply is what server wrote after it
+ * and until counts reply bytes of connection up to end of this reply
+ */
+typedef struct replay_step_t {
+    uint64_t time;
+    const char* data;
+    uint32_t length;
+    uint64_t reply;
+    uint64_t until;
+} replay_step_t;
+
+typedef struct replay_source_t {
+    uint64_t open;
+    replay_step_t* steps;
+    size_t count;
+    uint64_t total;         /* reply bytes of whole connection */
+} replay_source_t;
+
+typedef struct replay_stats_t {
+    uint64_t connections;
+    uint64_t requests;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t connect;       /* failed connects */
+    uint64_t broken;        /* failed reads or writes */
+    uint64_t short_replies; /* server closed before all reply bytes */
+    api_histogram_t latency;
+} replay_stats_t;
+
+typedef struct replay_worker_t {
+    api_loop_t* loop;
+    int index;
+    size_t active;
+    int launched;
+    api_event_t finished;
+    replay_stats_t stats;
+} replay_worker_t;
+
+typedef struct replay_connection_t {
+    replay_worker_t* worker;
+    replay_source_t* source;
+    api_tcp_t tcp;
+    api_event_t progress;   /* reply bytes arrived */
+    api_event_t sent;       /* request sent */
+    api_event_t done;       /* reader exited */
+    uint64_t start;
+    uint64_t* due;
+    size_t next;            /* steps sent */
+    size_t replied;         /* steps reply of which arrived */
+    uint64_t received;
+    int broken;
+    char buffer[4096];
+} replay_connection_t;
+
+/* settings, written before workers start */
+int loops = 2;
+double speed = 1.0;
+int copies = 1;
+int json = 0;
+const char* ip = 0;
+int port = 0;
+
+replay_source_t* sources = 0;
+size_t source_count = 0;
+size_t* order = 0;          /* sources by open time */
+uint64_t started;
+
+void replay_complete(replay_connection_t* connection)
+{
+    replay_source_t* source = connection->source;
+    replay_stats_t* stats = &connection->worker->stats;
+    replay_step_t* step;
+    uint64_t now = api_time_precise();
+
+    while (connection->replied < connection->next)
+    {
+        step = &source->steps[connection->replied];
+        if (connection->received < step->until)
+            break;
+
+        /* parts of request read before the last one have no reply */
+        if (step->reply != 0)
+        {
+            ++stats->requests;
+            api_histogram_record(&stats->latency,
+                now > connection->due[connection->replied] ?
+                now - connection->due[connection->replied] : 0);
+        }
+
+        ++connection->replied;
+    }
+
+    api_event_signal(&connection->progress);
+}
+
+/* reply bytes due before step next is sent, or all when every step is */
+uint64_t replay_expected(replay_connection_t* connection)
+{
+    replay_source_t* source = connection->source;
+    replay_step_t* step = &source->steps[connection->next];
+
+    if (connection->next == source->count)
+        return source->total;
+
+    return step->until - step->reply;
+}
+
+/* reads only while reply is due, so it never waits on an idle server */
+void replay_reader(api_loop_t* loop, void* arg)
+{
+    replay_connection_t* connection = (replay_connection_t*)arg;
+    replay_stats_t* stats = &connection->worker->stats;
+    size_t n;
+
+    while (!connection->broken)
+    {
+        if (connection->received >= replay_expected(connection))
+        {
+            if (connection->next == connection->source->count)
+                break;
+
+            if (API_OK != api_event_wait(&connection->sent, loop, 0))
+                break;
+
+            continue;
+        }
+
+        n = api_stream_read(&connection->tcp.stream, connection->buffer,
+                            sizeof(connection->buffer));
+        if (n == 0)
+        {
+            ++stats->short_replies;
+            break;
+        }
+
+        connection->received += n;
+        stats->received += n;
+
+        replay_complete(connection);
+    }
+
+    connection->broken = 1;
+    api_event_signal(&connection->progress);
+    api_event_signal(&connection->done);
+}
+
+void replay_writer(api_loop_t* loop, replay_connection_t* connection)
+{
+    replay_source_t* source = connection->source;
+    replay_stats_t* stats = &connection->worker->stats;
+    replay_step_t* step;
+    uint64_t now;
+
+    while (connection->next < source->count && !connection->broken)
+    {
+        step = &source->steps[connection->next];
+        now = api_time_precise();
+
+        if (speed > 0)
+        {
+            connection->due[connection->next] = connection->start +
+                (uint64_t)((double)(step->time - source->open) / speed);
+
+            if (connection->due[connection->next] > now)
+            {
+                /* timers are in milliseconds, rounded up */
+                if (API_OK != api_loop_sleep(loop,
+                        (connection->due[connection->next] - now + 999) /
+                        1000))
+                    break;
+
+                continue;
+            }
+        }
+        else
+        {
+            /* closed loop, wait for reply to previous request */
+            if (connection->received < replay_expected(connection))
+            {
+                if (API_OK != api_event_wait(&connection->progress, loop, 0))
+                    break;
+
+                continue;
+            }
+
+            connection->due[connection->next] = now;
+        }
+
+        ++connection->next;
+        api_event_signal(&connection->sent);
+
+        if (step->length != api_stream_write(&connection->tcp.stream,
+                                             step->data, step->length))
+        {
+            ++stats->broken;
+            break;
+        }
+
+        stats->sent += step->length;
+    }
+
+    /* reader stops waiting for requests that will not be sent */
+    if (connection->next < source->count)
+        connection->broken = 1;
+
+    api_event_signal(&connection->sent);
+}
+
+void replay_connection(api_loop_t* loop, void* arg)
+{
+    replay_connection_t* connection = (replay_connection_t*)arg;
+    replay_worker_t* worker = connection->worker;
+
+    api_event_init(&connection->progress, EVENT_Auto);
+    api_event_init(&connection->sent, EVENT_Auto);
+    api_event_init(&connection->done, EVENT_Manual);
+
+    if (API_OK != api_tcp_connect(&connection->tcp, loop, ip, port, 5000))
+    {
+        ++worker->stats.connect;
+    }
+    else
+    {
+        ++worker->stats.connections;
+
+        connection->tcp.stream.read_timeout = 10 * 1000;
+        connection->tcp.stream.write_timeout = 10 * 1000;
+
+        if (API_OK == api_loop_post(loop, replay_reader, connection,
+                                    REPLAY_STACK))
+        {
+            replay_writer(loop, connection);
+            api_event_wait(&connection->done, loop, 0);
+        }
+
+        api_stream_close(&connection->tcp.stream);
+    }
+
+    free(connection->due);
+    free(connection);
+
+    if (--worker->active == 0 && worker->launched)
+        api_event_signal(&worker->finished);
+}
+
+/* start connections of this worker at their captured open times */
+void replay_launcher(api_loop_t* loop, void* arg)
+{
+    replay_worker_t* worker = (replay_worker_t*)arg;
+    replay_connection_t* connection;
+    replay_source_t* source;
+    uint64_t offset;
+    uint64_t due;
+    uint64_t now;
+    size_t i;
+    int copy;
+
+    for (i = 0; i < source_count; ++i)
+    {
+        source = &sources[order[i]];
+
+        for (copy = 0; copy < copies; ++copy)
+        {
+            if ((i * copies + copy) % loops != (size_t)worker->index)
+                continue;
+
+            offset = source->open - sources[order[0]].open;
+            due = started + (speed > 0 ? (uint64_t)(offset / speed) : 0);
+
+            now = api_time_precise();
+            if (due > now &&
+                API_OK != api_loop_sleep(loop, (due - now + 999) / 1000))
+                break;
+
+            connection = (replay_connection_t*)calloc(1, sizeof(*connection));
+            if (connection == 0)
+                break;
+
+            connection->due = (uint64_t*)calloc(source->count + 1,
+                                                sizeof(uint64_t));
+            if (connection->due == 0)
+            {
+                free(connection);
+                break;
+            }
+
+            connection->worker = worker;
+            connection->source = source;
+            connection->start = due;
+
+            ++worker->active;
+            if (API_OK != api_loop_post(loop, replay_connection, connection,
+                                        REPLAY_STACK))
+            {
+                --worker->active;
+                free(connection->due);
+                free(connection);
+            }
+        }
+    }
+
+    worker->launched = 1;
+    if (worker->active == 0)
+        api_event_signal(&worker->finished);
+}
+
+int replay_compare(const void* a, const void* b)
+{
+    uint64_t open1 = sources[*(const size_t*)a].open;
+    uint64_t open2 = sources[*(const size_t*)b].open;
+
+    if (open1 < open2)
+        return -1;
+
+    return open1 > open2 ? 1 : 0;
+}
+
+/* split file into connections, returns 0 if file is not a capture */
+int replay_load(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    capture_record_t record;
+    replay_source_t* source;
+    replay_step_t* step;
+    replay_step_t* steps;
+    char* data;
+    long size;
+    size_t header;
+    size_t offset;
+    size_t used;
+    size_t count = 0;
+    size_t i;
+
+    if (file == 0)
+        return 0;
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    /* records point into data, it is kept until exit */
+    data = (char*)malloc(size > 0 ? size : 1);
+    if (data == 0 || size <= 0 || (size_t)size != fread(data, 1, size, file))
+    {
+        fclose(file);
+        return 0;
+    }
+
+    fclose(file);
+
+    header = capture_check(data, size);
+    if (header == 0)
+        return 0;
+
+    /* ids are given in order from 1 */
+    for (offset = header; offset < (size_t)size; offset += used)
+    {
+        used = capture_decode(data + offset, size - offset, &record);
+        if (used == 0)
+            break;
+
+        if (record.connection > source_count)
+            source_count = record.connection;
+
+        if (record.type == CAPTURE_Read)
+            ++count;
+    }
+
+    if (source_count == 0)
+        return 0;
+
+    sources = (replay_source_t*)calloc(source_count, sizeof(*sources));
+    steps = (replay_step_t*)calloc(count + 1, sizeof(*steps));
+    order = (size_t*)calloc(source_count, sizeof(*order));
+    if (sources == 0 || steps == 0 || order == 0)
+        return 0;
+
+    for (offset = header; offset < (size_t)size; offset += used)
+    {
+        used = capture_decode(data + offset, size - offset, &record);
+        if (used == 0)
+            break;
+
+        if (record.type == CAPTURE_Read)
+            ++sources[record.connection - 1].count;
+    }
+
+    /* each connection takes its slice of steps */
+    for (i = 0, count = 0; i < source_count; ++i)
+    {
+        sources[i].steps = steps + count;
+        count += sources[i].count;
+        sources[i].count = 0;
+        order[i] = i;
+    }
+
+    for (offset = header; offset < (size_t)size; offset += used)
+    {
+        used = capture_decode(data + offset, size - offset, &record);
+        if (used == 0)
+            break;
+
+        source = &sources[record.connection - 1];
+
+        switch (record.type) {
+        case CAPTURE_Open:
+            source->open = record.time;
+            break;
+        case CAPTURE_Read:
+            step = &source->steps[source->count++];
+            step->time = record.time;
+            step->data = record.data;
+            step->length = record.length;
+            step->until = source->total;
+            break;
+        case CAPTURE_Write:
+            /* greeting before first request counts only in total */
+            source->total += record.length;
+            if (source->count != 0)
+            {
+                step = &source->steps[source->count - 1];
+                step->reply += record.length;
+                step->until = source->total;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    qsort(order, source_count, sizeof(*order), replay_compare);
+
+    return 1;
+}
+
+void replay_print(replay_stats_t* total, uint64_t elapsed)
+{
+    static const double percents[] = { 50, 75, 90, 99, 99.9, 99.99, 100 };
+    double seconds = (double)elapsed / 1000000.0;
+    size_t i;
+
+    if (json)
+    {
+        printf("{\n  \"suite\": \"replay\",\n  \"target\": \"%s:%d\",\n"
+               "  \"loops\": %d,\n  \"speed\": %g,\n  \"copies\": %d,\n"
+               "  \"seconds\": %.3f,\n", ip, port, loops, speed, copies,
+               seconds);
+        printf("  \"connections\": %llu,\n  \"requests\": %llu,\n"
+               "  \"requests_per_sec\": %.1f,\n"
+               "  \"sent_bytes_per_sec\": %.1f,\n"
+               "  \"received_bytes_per_sec\": %.1f,\n",
+               (unsigned long long)total->connections,
+               (unsigned long long)total->requests,
+               total->requests / seconds, total->sent / seconds,
+               total->received / seconds);
+        printf("  \"errors\": {\"connect\": %llu, \"broken\": %llu, "
+               "\"short\": %llu},\n",
+               (unsigned long long)total->connect,
+               (unsigned long long)total->broken,
+               (unsigned long long)total->short_replies);
+        printf("  \"latency_us\": {");
+        for (i = 0; i < sizeof(percents) / sizeof(*percents); ++i)
+            printf("%s\"p%g\": %llu", i ? ", " : "", percents[i],
+                (unsigned long long)api_histogram_percentile(&total->latency,
+                                                             percents[i]));
+        printf(", \"mean\": %.1f}\n}\n", total->latency.count ?
+               (double)total->latency.sum / total->latency.count : 0.0);
+
+        return;
+    }
+
+    printf("%.1fs replay @ %s:%d\n", seconds, ip, port);
+    printf("  %d loops, %llu connections", loops,
+           (unsigned long long)total->connections);
+    if (speed > 0)
+        printf(", %gx speed", speed);
+    else
+        printf(", closed loop");
+    if (copies > 1)
+        printf(", %d copies", copies);
+    printf("\n  latency microseconds\n");
+
+    for (i = 0; i < sizeof(percents) / sizeof(*percents); ++i)
+        printf("    %7g%% %10llu\n", percents[i],
+               (unsigned long long)api_histogram_percentile(&total->latency,
+                                                            percents[i]));
+
+    printf("  %llu requests, %.1f requests/sec, %.1f MB/sec sent, "
+           "%.1f MB/sec received\n", (unsigned long long)total->requests,
+           total->requests / seconds, total->sent / seconds / (1024 * 1024),
+           total->received / seconds / (1024 * 1024));
+
+    if (total->connect || total->broken || total->short_replies)
+        printf("  errors: connect %llu, broken %llu, short %llu\n",
+               (unsigned long long)total->connect,
+               (unsigned long long)total->broken,
+               (unsigned long long)total->short_replies);
+}
+
+void replay_main(api_loop_t* loop, void* arg)
+{
+    replay_worker_t* workers;
+    replay_stats_t total;
+    uint64_t elapsed;
+    int i;
+
+    workers = (replay_worker_t*)calloc(loops, sizeof(*workers));
+    if (workers == 0)
+        return;
+
+    for (i = 0; i < loops; ++i)
+    {
+        workers[i].index = i;
+        api_event_init(&workers[i].finished, EVENT_Manual);
+
+        if (API_OK != api_loop_start(&workers[i].loop))
+        {
+            fprintf(stderr, "cannot start loop\n");
+            exit(1);
+        }
+    }
+
+    started = api_time_precise();
+
+    for (i = 0; i < loops; ++i)
+        api_loop_post(workers[i].loop, replay_launcher, &workers[i], 0);
+
+    memset(&total, 0, sizeof(total));
+
+    for (i = 0; i < loops; ++i)
+        api_event_wait(&workers[i].finished, loop, 0);
+
+    elapsed = api_time_precise() - started;
+
+    for (i = 0; i < loops; ++i)
+    {
+        api_loop_stop_and_wait(loop, workers[i].loop);
+
+        total.connections += workers[i].stats.connections;
+        total.requests += workers[i].stats.requests;
+        total.sent += workers[i].stats.sent;
+        total.received += workers[i].stats.received;
+        total.connect += workers[i].stats.connect;
+        total.broken += workers[i].stats.broken;
+        total.short_replies += workers[i].stats.short_replies;
+        api_histogram_merge(&total.latency, &workers[i].stats.latency);
+    }
+
+    replay_print(&total, elapsed);
+
+    api_loop_stop(loop);
+}
+
+int usage()
+{
+    fprintf(stderr,
+        "usage: replay [-t loops] [-x speed] [-m copies] [-j] file ip port\n"
+        "  -t  loops replaying connections, 2\n"
+        "  -x  times faster than captured, 1. 0 sends each request once\n"
+        "      previous one got its reply\n"
+        "  -m  concurrent copies of each captured connection, 1\n"
+        "  -j  print results as JSON\n");
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+#if defined(__linux__)
+    struct rlimit limit;
+#endif
+    const char* path = 0;
+    int positional = 0;
+    int i;
+
+    for (i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "-j"))
+            json = 1;
+        else if (argv[i][0] == '-' && argv[i][1] != 0 && i + 1 < argc)
+        {
+            switch (argv[i][1]) {
+            case 't': loops = atoi(argv[++i]); break;
+            case 'x': speed = atof(argv[++i]); break;
+            case 'm': copies = atoi(argv[++i]); break;
+            default: return usage();
+            }
+        }
+        else if (positional == 0)
+            path = argv[i], ++positional;
+        else if (positional == 1)
+            ip = argv[i], ++positional;
+        else if (positional == 2)
+            port = atoi(argv[i]), ++positional;
+        else
+            return usage();
+    }
+
+    if (ip == 0 || port <= 0 || loops <= 0 || copies <= 0 || speed < 0)
+        return usage();
+
+    if (!replay_load(path))
+    {
+        fprintf(stderr, "cannot load capture %s\n", path);
+        return 1;
+    }
+
+#if defined(__linux__)
+    /* copies of busy captures need more than default descriptors */
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+
+    api_init();
+
+    /* printf requires more stack */
+    if (API_OK != api_loop_run(replay_main, 0, 100 * 1024))
+        return 1;
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CAPTURE_H_INCLUDED
+#define CAPTURE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../../api/include/api.h"
+
+#ifdef _WIN32
+#if defined(BUILD_CAPTURE_SHARED)
+    #define CAPTURE_EXTERN __declspec(dllexport)
+#elif defined(USE_CAPTURE_SHARED)
+    #define CAPTURE_EXTERN __declspec(dllimport)
+#else
+    #define CAPTURE_EXTERN
+#endif
+#elif __GNUC__ >= 4
+    #define CAPTURE_EXTERN __attribute__((visibility("default")))
+#else
+    #define CAPTURE_EXTERN
+#endif
+
+/*
+ * Capture file is "APICAP1" and zero byte followed by records. Record
+ * header is 16 bytes little endian: microseconds since capture start
+ * (8), connection id (4), type in top 4 bits and data length in the
+ * rest (4), then data
+ */
+#define CAPTURE_MAGIC "APICAP1"
+#define CAPTURE_FILE_HEADER 8
+#define CAPTURE_RECORD_HEADER 16
+#define CAPTURE_MAX_LENGTH 0x0fffffff
+
+typedef enum capture_type_t {
+    CAPTURE_Open,           /* stream attached, no data */
+    CAPTURE_Read,           /* received by stream, from peer */
+    CAPTURE_Write,          /* sent by stream, to peer */
+    CAPTURE_Close           /* stream detached, no data */
+} capture_type_t;
+
+typedef struct capture_buffer_t capture_buffer_t;
+
+/*
+ * Capture file shared by streams of any loop. Records are appended to
+ * an in memory batch under lock and full batches are written to file
+ * by a task of the loop capture was started in, so streams never wait
+ * for disk. Batches over max_pending are dropped and counted
+ */
+typedef struct capture_t {
+    api_loop_t* loop;
+    api_stream_t file;
+    api_event_t ready;          /* batch filled or stopping */
+    api_event_t done;           /* writer task finished */
+    volatile long lock;
+    capture_buffer_t* current;
+    capture_buffer_t* head;     /* full batches waiting for writer */
+    capture_buffer_t* tail;
+    size_t pending;
+    size_t batch_size;          /* bytes, 64KB by default */
+    size_t max_pending;         /* batches, 64 by default */
+    uint64_t started;
+    uint32_t next_id;
+    uint64_t records;
+    uint64_t bytes;             /* written to file */
+    uint64_t dropped;           /* records lost while writer was behind */
+    int stopping;
+} capture_t;
+
+/*
+ * Filter recording everything read and written through stream it is
+ * attached to. Attach after ssl filter to capture plain text
+ */
+typedef struct capture_stream_t {
+    api_filter_t filter;
+    capture_t* capture;
+    uint32_t id;
+} capture_stream_t;
+
+/*
+ * Decoded record, data points into buffer that was decoded
+ */
+typedef struct capture_record_t {
+    uint64_t time;
+    uint32_t connection;
+    capture_type_t type;
+    uint32_t length;
+    const char* data;
+} capture_record_t;
+
+/*
+ * Create file at path and start writer task in loop, call from task of
+ * that loop. batch_size and max_pending may be set before call, 0 means
+ * default
+ */
+CAPTURE_EXTERN int capture_start(capture_t* capture, api_loop_t* loop,
+                                 const char* path);
+
+/*
+ * Write pending batches and close file, call from task of capture loop
+ * after all streams are detached
+ */
+CAPTURE_EXTERN void capture_stop(capture_t* capture);
+
+/*
+ * Can be called from any loop, records open and close of stream
+ */
+CAPTURE_EXTERN void capture_attach(capture_t* capture,
+                                   capture_stream_t* capture_stream,
+                                   api_stream_t* stream);
+CAPTURE_EXTERN void capture_detach(capture_stream_t* capture_stream);
+
+/*
+ * Returns size of file header if data starts with one, otherwise 0
+ */
+CAPTURE_EXTERN size_t capture_check(const char* data, size_t length);
+
+/*
+ * Decode record at data, returns bytes it takes or 0 if data is
+ * shorter than record
+ */
+CAPTURE_EXTERN size_t capture_decode(const char* data, size_t length,
+                                     capture_record_t* record);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // CAPTURE_H_INCLUDED
\ No newline at end of file
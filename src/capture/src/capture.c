@@ -0,0 +1,377 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "../include/capture.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#define capture_lock(c) \
+    while (__sync_lock_test_and_set(&(c)->lock, 1)) sched_yield()
+#define capture_unlock(c) __sync_lock_release(&(c)->lock)
+#else
+#include <windows.h>
+#define capture_lock(c) \
+    while (InterlockedExchange(&(c)->lock, 1)) SwitchToThread()
+#define capture_unlock(c) InterlockedExchange(&(c)->lock, 0)
+#endif
+
+#define CAPTURE_BATCH_SIZE (64 * 1024)
+#define CAPTURE_MAX_PENDING 64
+#define CAPTURE_FLUSH_PERIOD 1000
+#define CAPTURE_WRITER_STACK (64 * 1024)
+
+struct capture_buffer_t {
+    struct capture_buffer_t* next;
+    size_t length;
+    size_t size;
+    uint64_t records;
+    char data[1];
+};
+
+static void capture_put(char* p, uint64_t value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; ++i, value >>= 8)
+        p[i] = (char)(value & 0xff);
+}
+
+static uint64_t capture_get(const char* p, int bytes)
+{
+    uint64_t value = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; --i)
+        value = (value << 8) | (unsigned char)p[i];
+
+    return value;
+}
+
+static capture_buffer_t* capture_buffer_alloc(size_t size)
+{
+    capture_buffer_t* buffer;
+
+    buffer = (capture_buffer_t*)malloc(sizeof(*buffer) + size);
+    if (buffer == 0)
+        return 0;
+
+    buffer->next = 0;
+    buffer->length = 0;
+    buffer->size = size;
+    buffer->records = 0;
+
+    return buffer;
+}
+
+/* queue current batch for writer, or drop it if writer is behind */
+static int capture_queue(capture_t* capture)
+{
+    capture_buffer_t* buffer = capture->current;
+
+    if (buffer == 0 || buffer->length == 0)
+        return 0;
+
+    if (capture->pending >= capture->max_pending)
+    {
+        capture->dropped += buffer->records;
+        buffer->length = 0;
+        buffer->records = 0;
+        return 0;
+    }
+
+    if (capture->tail != 0)
+        capture->tail->next = buffer;
+    else
+        capture->head = buffer;
+
+    capture->tail = buffer;
+    capture->current = 0;
+    ++capture->pending;
+
+    return 1;
+}
+
+static void capture_append(capture_t* capture, uint32_t id,
+                           capture_type_t type, const char* data,
+                           size_t length)
+{
+    size_t size = CAPTURE_RECORD_HEADER + length;
+    capture_buffer_t* buffer;
+    int signal = 0;
+    char* p;
+
+    capture_lock(capture);
+
+    if (capture->stopping)
+    {
+        ++capture->dropped;
+        capture_unlock(capture);
+        return;
+    }
+
+    buffer = capture->current;
+    if (buffer != 0 && buffer->size - buffer->length < size)
+    {
+        signal = capture_queue(capture);
+        buffer = capture->current;
+    }
+
+    /* dropped batch is reused unless record does not fit */
+    if (buffer != 0 && buffer->size - buffer->length < size)
+    {
+        free(buffer);
+        capture->current = buffer = 0;
+    }
+
+    if (buffer == 0)
+    {
+        buffer = capture_buffer_alloc(size > capture->batch_size ?
+                                      size : capture->batch_size);
+        if (buffer == 0)
+        {
+            ++capture->dropped;
+            capture_unlock(capture);
+            return;
+        }
+
+        capture->current = buffer;
+    }
+
+    /* time is taken under lock so records are ordered in file */
+    p = buffer->data + buffer->length;
+    capture_put(p, api_time_precise() - capture->started, 8);
+    capture_put(p + 8, id, 4);
+    capture_put(p + 12, ((uint32_t)type << 28) | (uint32_t)length, 4);
+    if (length > 0)
+        memcpy(p + CAPTURE_RECORD_HEADER, data, length);
+
+    buffer->length += size;
+    ++buffer->records;
+    ++capture->records;
+
+    capture_unlock(capture);
+
+    if (signal)
+        api_event_signal(&capture->ready);
+}
+
+static void capture_record(capture_t* capture, uint32_t id,
+                           capture_type_t type, const char* data,
+                           size_t length)
+{
+    size_t chunk;
+
+    do
+    {
+        chunk = length < CAPTURE_MAX_LENGTH ? length : CAPTURE_MAX_LENGTH;
+        capture_append(capture, id, type, data, chunk);
+        data += chunk;
+        length -= chunk;
+    }
+    while (length > 0);
+}
+
+static void capture_writer(api_loop_t* loop, void* arg)
+{
+    capture_t* capture = (capture_t*)arg;
+    capture_buffer_t* buffer;
+    capture_buffer_t* next;
+    int stopping = 0;
+
+    while (!stopping)
+    {
+        if (API_TERMINATE == api_event_wait(&capture->ready, loop,
+                                            CAPTURE_FLUSH_PERIOD))
+            stopping = 1;
+
+        /* take full batches and flush partial one too */
+        capture_lock(capture);
+        capture_queue(capture);
+        buffer = capture->head;
+        capture->head = capture->tail = 0;
+        capture->pending = 0;
+        if (capture->stopping)
+            stopping = 1;
+        capture_unlock(capture);
+
+        while (buffer != 0)
+        {
+            next = buffer->next;
+
+            if (buffer->length == api_stream_write(&capture->file,
+                                            buffer->data, buffer->length))
+                capture->bytes += buffer->length;
+            else
+                capture->dropped += buffer->records;
+
+            free(buffer);
+            buffer = next;
+        }
+    }
+
+    api_event_signal(&capture->done);
+}
+
+int capture_start(capture_t* capture, api_loop_t* loop, const char* path)
+{
+    size_t batch_size = capture->batch_size;
+    size_t max_pending = capture->max_pending;
+    char header[CAPTURE_FILE_HEADER];
+    int error;
+
+    memset(capture, 0, sizeof(*capture));
+
+    capture->loop = loop;
+    capture->batch_size = batch_size != 0 ? batch_size : CAPTURE_BATCH_SIZE;
+    capture->max_pending = max_pending != 0 ?
+                            max_pending : CAPTURE_MAX_PENDING;
+    capture->started = api_time_precise();
+
+    api_event_init(&capture->ready, EVENT_Auto);
+    api_event_init(&capture->done, EVENT_Manual);
+
+    error = api_fs_create(&capture->file, path);
+    if (API_OK != error)
+        return error;
+
+    error = api_stream_attach(&capture->file, loop);
+    if (API_OK != error)
+    {
+        api_stream_close(&capture->file);
+        return error;
+    }
+
+    memcpy(header, CAPTURE_MAGIC, CAPTURE_FILE_HEADER);
+    if (CAPTURE_FILE_HEADER != api_stream_write(&capture->file, header,
+                                                CAPTURE_FILE_HEADER))
+    {
+        api_stream_close(&capture->file);
+        return API_IO_ERROR;
+    }
+
+    capture->bytes = CAPTURE_FILE_HEADER;
+
+    error = api_loop_post(loop, capture_writer, capture,
+                          CAPTURE_WRITER_STACK);
+    if (API_OK != error)
+        api_stream_close(&capture->file);
+
+    return error;
+}
+
+void capture_stop(capture_t* capture)
+{
+    capture_lock(capture);
+    capture->stopping = 1;
+    capture_unlock(capture);
+
+    api_event_signal(&capture->ready);
+    api_event_wait(&capture->done, capture->loop, 0);
+
+    free(capture->current);
+    capture->current = 0;
+
+    api_stream_close(&capture->file);
+}
+
+static size_t capture_on_read(api_filter_t* filter, char* buffer,
+                              size_t length)
+{
+    capture_stream_t* capture_stream = (capture_stream_t*)filter;
+    size_t n = filter->next->on_read(filter->next, buffer, length);
+
+    if (n != 0 && n != (size_t)-1)
+        capture_record(capture_stream->capture, capture_stream->id,
+                       CAPTURE_Read, buffer, n);
+
+    return n;
+}
+
+static size_t capture_on_write(api_filter_t* filter, const char* buffer,
+                               size_t length)
+{
+    capture_stream_t* capture_stream = (capture_stream_t*)filter;
+    size_t n = filter->next->on_write(filter->next, buffer, length);
+
+    if (n != 0 && n != (size_t)-1)
+        capture_record(capture_stream->capture, capture_stream->id,
+                       CAPTURE_Write, buffer, n);
+
+    return n;
+}
+
+void capture_attach(capture_t* capture, capture_stream_t* capture_stream,
+                    api_stream_t* stream)
+{
+    capture_lock(capture);
+    capture_stream->id = ++capture->next_id;
+    capture_unlock(capture);
+
+    capture_stream->capture = capture;
+
+    api_filter_attach(&capture_stream->filter, stream);
+    capture_stream->filter.on_read = capture_on_read;
+    capture_stream->filter.on_write = capture_on_write;
+
+    capture_append(capture, capture_stream->id, CAPTURE_Open, 0, 0);
+}
+
+void capture_detach(capture_stream_t* capture_stream)
+{
+    capture_append(capture_stream->capture, capture_stream->id,
+                   CAPTURE_Close, 0, 0);
+
+    api_filter_detach(&capture_stream->filter,
+                      capture_stream->filter.stream);
+}
+
+size_t capture_check(const char* data, size_t length)
+{
+    if (length < CAPTURE_FILE_HEADER ||
+        0 != memcmp(data, CAPTURE_MAGIC, CAPTURE_FILE_HEADER))
+        return 0;
+
+    return CAPTURE_FILE_HEADER;
+}
+
+size_t capture_decode(const char* data, size_t length,
+                      capture_record_t* record)
+{
+    uint32_t value;
+
+    if (length < CAPTURE_RECORD_HEADER)
+        return 0;
+
+    value = (uint32_t)capture_get(data + 12, 4);
+
+    record->time = capture_get(data, 8);
+    record->connection = (uint32_t)capture_get(data + 8, 4);
+    record->type = (capture_type_t)(value >> 28);
+    record->length = value & CAPTURE_MAX_LENGTH;
+    record->data = data + CAPTURE_RECORD_HEADER;
+
+    if (length - CAPTURE_RECORD_HEADER < record->length)
+        return 0;
+
+    return CAPTURE_RECORD_HEADER + record->length;
+}
\ No newline at end of file
@@ -24,13 +24,14 @@ void serve_connection(api_loop_t* loop, void* arg)
         api_stream_write(&tcp->stream, RESPONSE, sizeof(RESPONSE) - 1);
 
     api_stream_close(&tcp->stream);
-    api_free(api_pool_default(loop), sizeof(api_tcp_t), tcp);
+
+    /* allocated by acceptor loop, so not from this loop pool */
+    free(tcp);
 }
 
 /* single threaded hello server */
 void hello_server_st(api_loop_t* loop, void* arg)
 {
-    api_pool_t* pool = api_pool_default(loop);
     api_tcp_listener_t listener;
     api_tcp_t* tcp;
     int error;
@@ -50,14 +51,17 @@ void hello_server_st(api_loop_t* loop, void* arg)
     api_tcp_close(&listener);
 }
 
+#define BATCH_SIZE 32
+
 /* multithreaded hello server */
 void hello_server_mt(api_loop_t* loop, void* arg)
 {
     int threads = 4;
     api_loop_t** loops;
-    api_pool_t* pool = api_pool_default(loop);
     api_tcp_listener_t listener;
+    api_loop_post_t batch[BATCH_SIZE];
     api_tcp_t* tcp;
+    size_t n;
     int error;
     int i = 0;
 
@@ -75,20 +79,80 @@ void hello_server_mt(api_loop_t* loop, void* arg)
     tcp = (api_tcp_t*)malloc(sizeof(api_tcp_t));
     while (API_OK == api_tcp_accept(&listener, tcp))
     {
+        n = 0;
+
+        // collect connections already pending, hand off as one batch
+        do
+        {
+            batch[n].callback = serve_connection;
+            batch[n].arg = tcp;
+            batch[n].stack_size = 0;
+            ++n;
+
+            tcp = (api_tcp_t*)malloc(sizeof(api_tcp_t));
+        }
+        while (n < BATCH_SIZE &&
+               API_OK == api_tcp_try_accept(&listener, tcp));
+
         // round robin
-        api_loop_post(loops[i], serve_connection, tcp, 0);
+        api_loop_post_batch(loops[i], batch, n);
         i = (i + 1) % threads;
+    }
+    free(tcp);
 
+    api_tcp_close(&listener);
+}
+
+/* multithreaded hello server, idle loops steal queued connections */
+void hello_server_group(api_loop_t* loop, void* arg)
+{
+    int threads = 4;
+    api_loop_t** loops;
+    api_loop_group_t* group = 0;
+    api_tcp_listener_t listener;
+    api_tcp_t* tcp;
+    int error;
+    int i = 0;
+
+    error = api_tcp_listen(&listener, loop, "0.0.0.0", 8080, 128);
+    if (error != API_OK)
+        return;
+
+    // start worker loops and join them
+    loops = (api_loop_t**)malloc(threads * sizeof(api_loop_t*));
+    for (i = 0; i < threads; ++i)
+        api_loop_start(&loops[i]);
+
+    if (API_OK == api_loop_group_create(&group, loops, threads, 1024))
+    {
         tcp = (api_tcp_t*)malloc(sizeof(api_tcp_t));
+        while (API_OK == api_tcp_accept(&listener, tcp))
+        {
+            // least loaded, connection is not attached until task starts
+            i = (int)api_loop_group_pick(group, PICK_LeastConnections);
+            api_loop_group_post(group, i, serve_connection, tcp, 0);
+
+            tcp = (api_tcp_t*)malloc(sizeof(api_tcp_t));
+        }
+        free(tcp);
     }
-    free(tcp);
 
     api_tcp_close(&listener);
+
+    // group is freed only after its loops stopped
+    for (i = 0; i < threads; ++i)
+        api_loop_stop_and_wait(loop, loops[i]);
+
+    if (group != 0)
+        api_loop_group_free(group);
+
+    free(loops);
 }
 
 int main(int argc, char *argv[])
 {
-    // assign hello_server_st for single threaded
+    // assign hello_server_st for single threaded,
+    // hello_server_group for work stealing between loops
     api_loop_fn server = hello_server_mt;
 
     api_init();
@@ -0,0 +1,121 @@
+/*
+ * Stream migration, acceptor loop reads the greeting line of connection
+ * and moves it to one of worker loops which echoes the rest back.
+ * Try with: printf 'hi\none\ntwo\n' | nc 127.0.0.1 8080
+ */
+
+#include <malloc.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+
+#define WORKERS 4
+
+typedef struct connection_t {
+    api_tcp_t tcp;
+    api_loop_t* worker;
+} connection_t;
+
+/* runs in worker loop, stream is attached already with unread data */
+void echo_connection(api_loop_t* loop, void* arg)
+{
+    connection_t* connection = (connection_t*)arg;
+    api_stream_t* stream = &connection->tcp.stream;
+    char buffer[1024];
+    size_t done;
+
+    while (0 != (done = api_stream_read(stream, buffer, sizeof(buffer))))
+    {
+        if (done != api_stream_write(stream, buffer, done))
+            break;
+    }
+
+    api_stream_close(stream);
+
+    /* allocated by acceptor loop, so not from any loop pool */
+    free(connection);
+}
+
+/* runs in acceptor loop */
+void greet_connection(api_loop_t* loop, void* arg)
+{
+    connection_t* connection = (connection_t*)arg;
+    api_stream_t* stream = &connection->tcp.stream;
+    char buffer[1024];
+    char* line_end;
+    size_t done;
+    size_t line;
+
+    api_stream_attach(stream, loop);
+
+    done = api_stream_read(stream, buffer, sizeof(buffer));
+    line_end = (char*)memchr(buffer, '\n', done);
+    if (line_end == 0)
+    {
+        api_stream_close(stream);
+        free(connection);
+        return;
+    }
+
+    line = line_end - buffer + 1;
+
+    api_stream_write(stream, "welcome ", 8);
+    api_stream_write(stream, buffer, line);
+
+    /* lines sent along with greeting are echoed by worker */
+    api_stream_unread(stream, buffer + line, done - line);
+
+    if (API_OK != api_stream_migrate(stream, connection->worker,
+                                     echo_connection, connection, 0))
+    {
+        // not supported or worker is gone, echo here
+        echo_connection(loop, connection);
+    }
+}
+
+void migrate_server(api_loop_t* loop, void* arg)
+{
+    api_loop_t* workers[WORKERS];
+    api_tcp_listener_t listener;
+    connection_t* connection;
+    int error;
+    int i;
+
+    error = api_tcp_listen(&listener, loop, "0.0.0.0", 8080, 128);
+    if (error != API_OK)
+        return;
+
+    for (i = 0; i < WORKERS; ++i)
+        api_loop_start(&workers[i]);
+
+    i = 0;
+
+    connection = (connection_t*)malloc(sizeof(connection_t));
+    while (API_OK == api_tcp_accept(&listener, &connection->tcp))
+    {
+        // round robin
+        connection->worker = workers[i];
+        i = (i + 1) % WORKERS;
+
+        api_loop_post(loop, greet_connection, connection, 0);
+        connection = (connection_t*)malloc(sizeof(connection_t));
+    }
+    free(connection);
+
+    for (i = 0; i < WORKERS; ++i)
+        api_loop_stop_and_wait(loop, workers[i]);
+
+    api_tcp_close(&listener);
+}
+
+int main(int argc, char *argv[])
+{
+    api_init();
+
+    if (API_OK != api_loop_run(migrate_server, 0, 0))
+    {
+        return 1;
+    }
+
+    return 0;
+}
\ No newline at end of file
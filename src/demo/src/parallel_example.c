@@ -0,0 +1,132 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../api/include/api.h"
+
+/* scaling of api_loop_parallel_reduce over growing number of loops */
+
+#define MAX_LOOPS 16
+#define DATA_SIZE (256 * 1024 * 1024)
+#define GRAIN (256 * 1024)
+#define ROUNDS 5
+
+unsigned char* data;
+
+/* fnv-1a of every chunk, summed, so result does not depend on split */
+void checksum(api_loop_t* loop, size_t begin, size_t end,
+              void* partial, void* arg)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = begin; i < end; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    *(uint64_t*)partial += hash;
+}
+
+void combine(void* result, const void* partial, void* arg)
+{
+    *(uint64_t*)result += *(const uint64_t*)partial;
+}
+
+void benchmark(api_loop_t* loop, void* arg)
+{
+    api_loop_t* loops[MAX_LOOPS];
+    int count = *(int*)arg;
+    uint64_t single = 0;
+    uint64_t started;
+    uint64_t elapsed;
+    uint64_t sum;
+    int n;
+    int i;
+
+    /* caller loop takes part too */
+    loops[0] = loop;
+    for (i = 1; i < count; ++i)
+        api_loop_start(&loops[i]);
+
+    for (n = 1; n <= count; n *= 2)
+    {
+        started = api_time_precise();
+
+        for (i = 0; i < ROUNDS; ++i)
+        {
+            sum = 0;
+            api_loop_parallel_reduce(loop, loops, n, 0, DATA_SIZE, GRAIN,
+                                    &sum, sizeof(sum), checksum, combine, 0);
+        }
+
+        elapsed = (api_time_precise() - started) / ROUNDS;
+        if (n == 1)
+            single = elapsed;
+
+        printf("loops %2d: %8llu us, %5.2fx, checksum %016llx\r\n", n,
+            (unsigned long long)elapsed, (double)single / (double)elapsed,
+            (unsigned long long)sum);
+    }
+
+    for (i = 1; i < count; ++i)
+        api_loop_stop_and_wait(loop, loops[i]);
+
+    api_loop_stop(loop);
+}
+
+void start(api_loop_t* loop, void* arg)
+{
+    /* printf requires more stack */
+    api_loop_post(loop, benchmark, arg, 100 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 4;
+    size_t i;
+
+    if (count < 1 || count > MAX_LOOPS)
+        count = 4;
+
+    data = (unsigned char*)malloc(DATA_SIZE);
+    if (data == 0)
+        return 1;
+
+    for (i = 0; i < DATA_SIZE; ++i)
+        data[i] = (unsigned char)(i * 31);
+
+    api_init();
+
+    if (API_OK != api_loop_run(start, &count, 0))
+    {
+        free(data);
+        return 1;
+    }
+
+    free(data);
+
+    return 0;
+}
\ No newline at end of file
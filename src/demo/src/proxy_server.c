@@ -1,8 +1,13 @@
 /*
  * Simple raw proxy server implementation
+ *
+ *   proxy_server [capture_file]
+ *
+ * With capture file given, traffic of clients is recorded for replay
  */
 
 #include "../../api/include/api.h"
+#include "../../capture/include/capture.h"
 
 const char* listen_ip = "0.0.0.0";
 int listen_port = 8085;
@@ -10,6 +15,9 @@ int listen_port = 8085;
 const char* backend_ip = "127.0.0.1"; // or any ip
 int backend_port = 80;
 
+const char* capture_path = 0;
+capture_t capture;
+
 typedef struct proxy_t {
     api_event_t ready;
     api_tcp_t* client;
@@ -27,7 +35,7 @@ void transfer_request(api_loop_t* loop, void* arg)
         0  /* we dont need bytes transferred */
         );
 
-    api_event_signal(&proxy->ready, loop);
+    api_event_signal(&proxy->ready);
 }
 
 void on_client(api_loop_t* loop, void* arg)
@@ -35,9 +43,13 @@ void on_client(api_loop_t* loop, void* arg)
     api_tcp_t* client = (api_tcp_t*)arg;
     api_tcp_t server;
     proxy_t proxy;
+    capture_stream_t recorder;
 
     api_stream_attach(&client->stream, loop);
 
+    if (capture_path != 0)
+        capture_attach(&capture, &recorder, &client->stream);
+
     client->stream.read_timeout = 10 * 1000;
     client->stream.write_timeout = 10 * 1000;
 
@@ -46,7 +58,7 @@ void on_client(api_loop_t* loop, void* arg)
         server.stream.read_timeout = 10 * 1000;
         server.stream.write_timeout = 10 * 1000;
 
-        api_event_init(&proxy.ready, loop);
+        api_event_init(&proxy.ready, EVENT_Manual);
         
         proxy.client = client;
         proxy.server = &server;
@@ -57,11 +69,14 @@ void on_client(api_loop_t* loop, void* arg)
         // transfer response
         api_stream_transfer(&client->stream, &server.stream, 100 * 1024, 0);
 
-        api_event_wait(&proxy.ready, 0);
+        api_event_wait(&proxy.ready, loop, 0);
 
         api_stream_close(&server.stream);
     }
 
+    if (capture_path != 0)
+        capture_detach(&recorder);
+
     api_stream_close(&client->stream);
     api_free(api_pool_default(loop), sizeof(api_tcp_t), client);
 }
@@ -72,6 +87,10 @@ void proxy_server(api_loop_t* loop, void* arg)
     api_tcp_listener_t listener;
     api_tcp_t* tcp;
 
+    if (capture_path != 0 &&
+        API_OK != capture_start(&capture, loop, capture_path))
+        return;
+
     if (API_OK != api_tcp_listen(&listener, loop, listen_ip, listen_port, 128))
         return;
 
@@ -85,10 +104,16 @@ void proxy_server(api_loop_t* loop, void* arg)
     api_free(pool, sizeof(api_tcp_t), tcp);
 
     api_tcp_close(&listener);
+
+    if (capture_path != 0)
+        capture_stop(&capture);
 }
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1)
+        capture_path = argv[1];
+
     api_init();
 
     if (API_OK != api_loop_run(proxy_server, 0, 0))
@@ -10,6 +10,7 @@
 #include "../../api/include/api.h"
 #include "../../http/include/http.h"
 #include "../../ssl/include/ssl.h"
+#include "../../metrics/include/metrics.h"
 
 #if defined(__linux__)
 
@@ -33,11 +34,16 @@ const char* site = "d:/shared/site";
 
 const int http_port = 8080;
 const int https_port = 8081;
+const int metrics_port = 9464;
 
 #define NOTFOUND "HTTP/1.1 404 Not Found\r\n"
 
 ssl_session_t ssl_session;
 
+metrics_t metrics;
+metrics_entry_t web_loop_entry;
+metrics_entry_t web_pool_entry;
+
 /* get mime type from file name */
 const char* get_mime_type(const char* name)
 {
@@ -57,14 +63,54 @@ const char* get_mime_type(const char* name)
     return "application/octet-stream";
 }
 
+/* file system call done in offload thread, disk may block */
+typedef struct fs_request_t {
+    const char* path;
+    api_stat_t* stat;
+    api_stream_t* file;
+    int error;
+} fs_request_t;
+
+void fs_stat_blocking(void* arg)
+{
+    fs_request_t* request = (fs_request_t*)arg;
+    request->error = api_fs_stat(request->path, request->stat);
+}
+
+void fs_open_blocking(void* arg)
+{
+    fs_request_t* request = (fs_request_t*)arg;
+    request->error = api_fs_open(request->file, request->path);
+}
+
+int fs_stat(api_loop_t* loop, const char* path, api_stat_t* stat)
+{
+    fs_request_t request = { path, stat, 0, API_OK };
+
+    if (API_OK != api_loop_offload(loop, fs_stat_blocking, &request))
+        return api_fs_stat(path, stat);
+
+    return request.error;
+}
+
+int fs_open(api_loop_t* loop, api_stream_t* file, const char* path)
+{
+    fs_request_t request = { path, 0, file, API_OK };
+
+    if (API_OK != api_loop_offload(loop, fs_open_blocking, &request))
+        return api_fs_open(file, path);
+
+    return request.error;
+}
+
 /* send http status line and headers for particular file */
-int send_headers(api_tcp_t* tcp, const char* path)
+int send_headers(api_loop_t* loop, api_tcp_t* tcp, const char* path)
 {
     api_stat_t stat;
     const char* mime = get_mime_type(path);
     char content_length[50];
 
-    if (API_OK != api_fs_stat(path, &stat) || stat.size == 0)
+    if (API_OK != fs_stat(loop, path, &stat) || stat.size == 0)
     {
         api_stream_write(&tcp->stream, NOTFOUND, sizeof(NOTFOUND) - 1);
         return -1;
@@ -114,11 +160,11 @@ void serve_file(api_loop_t* loop, void* arg)
             strcat(path, "index.html");
 
         /* send http status line and headers */
-        if (API_OK != send_headers(tcp, path))
+        if (API_OK != send_headers(loop, tcp, path))
             break;
 
         /* open requested file as stream */
-        if (API_OK != api_fs_open(&file, path))
+        if (API_OK != fs_open(loop, &file, path))
             break;
 
         /* attach file stream to loop */
@@ -241,8 +287,24 @@ void https_server(api_loop_t* loop, void* arg)
     ssl_session_stop(&ssl_session);
 }
 
+/* prometheus scrapes are served by a loop of their own */
+void metrics_server(api_loop_t* loop, void* arg)
+{
+    metrics_serve(&metrics, loop, "0.0.0.0", metrics_port);
+}
+
 void web_server(api_loop_t* loop, void* arg)
 {
+    api_loop_t* metrics_loop;
+
+    /* export this loop and its memory */
+    metrics_init(&metrics);
+    metrics_add_loop(&metrics, &web_loop_entry, "web", loop);
+    metrics_add_pool(&metrics, &web_pool_entry, "web", api_pool_default(loop));
+
+    if (API_OK == api_loop_start(&metrics_loop))
+        api_loop_post(metrics_loop, metrics_server, 0, 64 * 1024);
+
     /* start http server */
     api_loop_post(loop, http_server, 0, 0);
 
@@ -255,6 +317,9 @@ int main(int argc, char *argv[])
     /* initialize api library */
     api_init();
 
+    /* report handlers blocking the loop for more than half a second */
+    api_watchdog_start(500, 0, 0);
+
     /* convert current thread to loop and run web_server */
     if (API_OK != api_loop_run(web_server, 0, 0))
         return 1;
@@ -78,6 +78,8 @@ typedef struct http_request_t {
     http_param_t* params;
     http_header_t* headers;
     http_cookie_t* cookies;
+    /* url, header names and values point into it */
+    api_buf_t* buffer;
 } http_request_t;
 
 HTTP_EXTERN const char* http_request_parse(http_request_t* request,
@@ -73,63 +73,109 @@ char *str_ndup(api_pool_t* pool, const char *string, size_t s)
 #define strcmp_nocase _stricmp
 #endif
 
-typedef struct buffer_t {
-    char* data;
-    size_t used;
-    size_t alloc;
-} buffer_t;
-
 typedef enum state_t {
+    STATE_None,
     STATE_Url,
     STATE_HeaderName,
     STATE_HeaderValue
 } state_t;
 
+/*
+ * Url, header names and values are not copied, they are
+ * tokens inside request buffer terminated in place
+ */
 typedef struct http_parser_t {
     http_request_t* request;
     api_pool_t* pool;
     int headers_done;
     http_header_t* header;
     state_t state;
-    buffer_t buffer;
-    int last_was_value;
+    char* token;
+    size_t token_length;
 } http_parser_t;
 
-void concat(api_pool_t* pool, buffer_t* buffer, const char* at, size_t length)
+void finish_token(http_parser_t* ctx)
 {
-    char* buf;
-    size_t last;
+    if (ctx->token == 0)
+        return;
+
+    /* delimiter after token is already consumed by parser */
+    ctx->token[ctx->token_length] = 0;
 
-    if (buffer->data == 0)
+    switch (ctx->state)
     {
-        buffer->alloc = length + 1;
-        buffer->data = (char*)api_alloc(pool, buffer->alloc);
-        buffer->used = length;
+    case STATE_Url:
+        ctx->request->url = ctx->token;
+        break;
+    case STATE_HeaderName:
+        ctx->header->name = ctx->token;
+        break;
+    case STATE_HeaderValue:
+        ctx->header->value = ctx->token;
+        break;
+    default:
+        break;
+    }
+
+    ctx->token = 0;
+    ctx->token_length = 0;
+}
 
-        strncpy(buffer->data, at, length);
-        buffer->data[length] = 0;
+void append_token(http_parser_t* ctx, state_t state,
+                  const char* at, size_t length)
+{
+    if (ctx->state != state)
+    {
+        finish_token(ctx);
+        ctx->state = state;
     }
-    else
+
+    if (ctx->token == 0)
     {
-        if (buffer->alloc - buffer->used - 1 >= length)
-        {
-            strncpy(buffer->data + buffer->used, at, length);
-            buffer->used += length;
-            buffer->data[buffer->used] = 0;
-        }
-        else
-        {
-            last = buffer->alloc;
-            buffer->alloc = buffer->used + 2 * length;
-            buf = (char*)api_alloc(pool, buffer->alloc);
-            strcpy(buf, buffer->data);
-            strncpy(buf + buffer->used, at, length);
-            api_free(pool, last, buffer->data);
-
-            buffer->data = buf;
-            buffer->used += length;
-            buffer->data[buffer->used] = 0;
-        }
+        ctx->token = (char*)at;
+        ctx->token_length = length;
+        return;
+    }
+
+    /* folded header line, join with the bytes parsed before */
+    if (at != ctx->token + ctx->token_length)
+        memmove(ctx->token + ctx->token_length, at, length);
+
+    ctx->token_length += length;
+}
+
+void push_header(http_parser_t* ctx)
+{
+    if (ctx->header == 0)
+        return;
+
+    if (ctx->header->value == 0)
+        ctx->header->value = ctx->header->name + strlen(ctx->header->name);
+
+    ctx->header->next = ctx->request->headers;
+    ctx->request->headers = ctx->header;
+    ctx->header = 0;
+}
+
+/* request buffer moved, shift all tokens pointing into it */
+void rebase_tokens(http_parser_t* ctx, char* from, char* to)
+{
+    http_header_t* header = ctx->request->headers;
+
+    if (ctx->request->url != 0)
+        ctx->request->url = to + (ctx->request->url - from);
+
+    if (ctx->token != 0)
+        ctx->token = to + (ctx->token - from);
+
+    if (ctx->header != 0 && ctx->header->name != 0)
+        ctx->header->name = to + (ctx->header->name - from);
+
+    while (header != 0)
+    {
+        header->name = to + (header->name - from);
+        header->value = to + (header->value - from);
+        header = header->next;
     }
 }
 
@@ -142,8 +188,7 @@ int http_on_url_cb(http_parser* parser, const char *at, size_t length)
 {
     http_parser_t* ctx = (http_parser_t*)parser->data;
 
-    ctx->state = STATE_Url;
-    concat(ctx->pool, &ctx->buffer, at, length);
+    append_token(ctx, STATE_Url, at, length);
     return 0;
 }
 
@@ -156,38 +201,19 @@ int http_on_header_field_cb(http_parser* parser, const char *at, size_t length)
 {
     http_parser_t* ctx = (http_parser_t*)parser->data;
 
-    if (ctx->state == STATE_Url)
-    {
-        ctx->request->url = ctx->buffer.data;
-        ctx->buffer.alloc = 0;
-        ctx->buffer.used = 0;
-        ctx->buffer.data = 0;
-    }
-
-    ctx->state = STATE_HeaderName;
-
-    if (ctx->last_was_value)
+    if (ctx->state != STATE_HeaderName)
     {
-        ctx->header->value = ctx->buffer.data;
-        ctx->buffer.alloc = 0;
-        ctx->buffer.used = 0;
-        ctx->buffer.data = 0;
+        finish_token(ctx);
+        push_header(ctx);
 
-        ctx->header->next = ctx->request->headers;
-        ctx->request->headers = ctx->header;
-        ctx->header = 0;
-
-        ctx->last_was_value = 0;
-    }
-
-    if (ctx->header == 0)
-    {
         ctx->header = (http_header_t*)api_alloc(ctx->pool, sizeof(*ctx->header));
+        if (ctx->header == 0)
+            return 1;
+
         memset(ctx->header, 0, sizeof(*ctx->header));
     }
 
-    concat(ctx->pool, &ctx->buffer, at, length);
-    
+    append_token(ctx, STATE_HeaderName, at, length);
     return 0;
 }
 
@@ -195,18 +221,7 @@ int http_on_header_value_cb(http_parser* parser, const char *at, size_t length)
 {
     http_parser_t* ctx = (http_parser_t*)parser->data;
 
-    if (!ctx->last_was_value)
-    {
-        ctx->header->name = ctx->buffer.data;
-        ctx->buffer.alloc = 0;
-        ctx->buffer.used = 0;
-        ctx->buffer.data = 0;
-    }
-
-    ctx->last_was_value = 1;
-
-    concat(ctx->pool, &ctx->buffer, at, length);
-
+    append_token(ctx, STATE_HeaderValue, at, length);
     return 0;
 }
 
@@ -214,23 +229,13 @@ int http_on_headers_complete_cb(http_parser* parser)
 {
     http_parser_t* ctx = (http_parser_t*)parser->data;
 
-    if (ctx->header != 0)
-    {
-        ctx->header->value = ctx->buffer.data;
-        ctx->header->next = ctx->request->headers;
-        ctx->request->headers = ctx->header;
-        ctx->header = 0;
-    }
-    else
-    {
-        ctx->request->url = ctx->buffer.data;
-    }
-
-    ctx->buffer.alloc = 0;
-    ctx->buffer.used = 0;
-    ctx->buffer.data = 0;
+    finish_token(ctx);
+    push_header(ctx);
+    ctx->state = STATE_None;
 
     ctx->headers_done = 1;
+
+    /* body is left in stream for the caller */
     return 1;
 }
 
@@ -241,6 +246,8 @@ int http_on_body_cb(http_parser* parser, const char *at, size_t length)
 
 int http_on_message_complete_cb(http_parser* parser)
 {
+    /* do not run into pipelined request */
+    http_parser_pause(parser, 1);
     return 0;
 }
 
@@ -330,9 +337,19 @@ void parse_query(api_pool_t* pool, http_request_t* request)
     }
 }
 
+#define HTTP_BUFFER_SIZE 4096
+
+/*
+ * Reads into request buffer, growing it when headers do not fit.
+ * Bytes after headers are given back to stream as a slice
+ * of request buffer, so nothing is copied for the body
+ */
 const char* http_request_parse(http_request_t* request, api_stream_t* stream)
 {
-    char buffer[1024];
+    api_buf_t* buffer;
+    api_buf_t* grown;
+    api_buf_t* rest;
+    size_t parsed = 0;
     size_t nread;
     size_t size;
     http_parser_t ctx;
@@ -360,18 +377,45 @@ const char* http_request_parse(http_request_t* request, api_stream_t* stream)
 
     http_parser_init(&parser, HTTP_REQUEST);
 
+    /* unreaded data from previous request is taken as is */
+    buffer = api_stream_read_buf(stream, HTTP_BUFFER_SIZE);
+
+    /* tokens are terminated in place, slice of other buffer is copied */
+    if (buffer != 0 && api_buf_shared(buffer))
+    {
+        grown = api_buf_alloc(ctx.pool, buffer->length > HTTP_BUFFER_SIZE ?
+                                        buffer->length : HTTP_BUFFER_SIZE);
+        if (grown != 0)
+        {
+            memcpy(grown->data, buffer->data, buffer->length);
+            grown->length = buffer->length;
+        }
+        else
+        {
+            result = "out of memory";
+        }
+
+        api_buf_free(buffer);
+        buffer = grown;
+    }
+
+    request->buffer = buffer;
+
     while (1)
     {
-        nread = api_stream_read(stream, buffer, 1024);
-        if (nread == 0)
+        if (buffer == 0)
         {
-            result = "stream not readable";
+            if (result == 0)
+                result = "stream not readable";
             break;
         }
 
-        size = http_parser_execute(&parser, &settings, buffer, nread);
-    
-        if (parser.http_errno > 0)
+        size = http_parser_execute(&parser, &settings,
+                                   buffer->data + parsed,
+                                   buffer->length - parsed);
+        parsed += size;
+
+        if (parser.http_errno > 0 && parser.http_errno != HPE_PAUSED)
         {
             result = 
                 http_errno_description((enum http_errno)parser.http_errno);
@@ -380,11 +424,43 @@ const char* http_request_parse(http_request_t* request, api_stream_t* stream)
 
         if (ctx.headers_done)
         {
-            if (size < nread)
-                api_stream_unread(stream, buffer + size, nread - size);
+            if (parsed < buffer->length)
+            {
+                rest = api_buf_slice(buffer, parsed, buffer->length - parsed);
+                if (rest != 0)
+                    api_stream_unread_buf(stream, rest);
+            }
+
+            break;
+        }
+
+        if (buffer->length == buffer->size)
+        {
+            grown = api_buf_alloc(ctx.pool, 2 * buffer->size);
+            if (grown == 0)
+            {
+                result = "out of memory";
+                break;
+            }
+
+            memcpy(grown->data, buffer->data, buffer->length);
+            grown->length = buffer->length;
+            rebase_tokens(&ctx, buffer->data, grown->data);
+
+            api_buf_free(buffer);
+            buffer = grown;
+            request->buffer = buffer;
+        }
 
+        nread = api_stream_read(stream, buffer->data + buffer->length,
+                                buffer->size - buffer->length);
+        if (nread == 0)
+        {
+            result = "stream not readable";
             break;
         }
+
+        buffer->length += nread;
     }
 
     request->major = parser.http_major;
@@ -434,16 +510,9 @@ const char* http_request_parse(http_request_t* request, api_stream_t* stream)
             result = "invalud uri";
         }
     }
-    
-    if (ctx.buffer.data != 0)
-        api_free(ctx.pool, ctx.buffer.alloc, ctx.buffer.data);
 
     if (ctx.header != 0)
-    {
-        str_free(ctx.pool, ctx.header->name);
-        str_free(ctx.pool, ctx.header->value);
         api_free(ctx.pool, sizeof(*ctx.header), ctx.header);
-    }
 
     if (result != 0)
         http_request_clean(request, ctx.pool);
@@ -460,7 +529,6 @@ void http_request_clean(http_request_t* request, api_pool_t* pool)
     http_param_t* param = request->params;
     http_param_t* next_p;
 
-    str_free(pool, request->url);
     str_free(pool, request->body);
     str_free(pool, request->uri.fragment);
     str_free(pool, request->uri.host);
@@ -468,14 +536,11 @@ void http_request_clean(http_request_t* request, api_pool_t* pool)
     str_free(pool, request->uri.query);
     str_free(pool, request->uri.schema);
 
+    /* names and values live in request buffer */
     while (header != 0)
     {
         next = header->next;
-
-        str_free(pool, header->name);
-        str_free(pool, header->value);
         api_free(pool, sizeof(*header), header);
-
         header = next;
     }
 
@@ -501,6 +566,11 @@ void http_request_clean(http_request_t* request, api_pool_t* pool)
 
         param = next_p;
     }
+
+    if (request->buffer != 0)
+        api_buf_free(request->buffer);
+
+    memset(request, 0, sizeof(*request));
 }
 
 const char* http_request_get_header(http_request_t* request, const char* name)
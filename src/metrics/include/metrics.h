@@ -0,0 +1,107 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../../api/include/api.h"
+
+#ifdef _WIN32
+#if defined(BUILD_METRICS_SHARED)
+    #define METRICS_EXTERN __declspec(dllexport)
+#elif defined(USE_METRICS_SHARED)
+    #define METRICS_EXTERN __declspec(dllimport)
+#else
+    #define METRICS_EXTERN
+#endif
+#elif __GNUC__ >= 4
+    #define METRICS_EXTERN __attribute__((visibility("default")))
+#else
+    #define METRICS_EXTERN
+#endif
+
+typedef enum metrics_kind_t {
+    METRICS_Loop,
+    METRICS_Pool,
+    METRICS_Stream
+} metrics_kind_t;
+
+/*
+ * Registered object, storage is provided by caller and must stay
+ * valid until metrics_remove. Name becomes label value, not copied
+ */
+typedef struct metrics_entry_t {
+    struct metrics_entry_t* next;
+    struct metrics_entry_t* prev;
+    metrics_kind_t kind;
+    const char* name;
+    void* object;
+} metrics_entry_t;
+
+/*
+ * Registry of loops, pools and streams exported in Prometheus text
+ * format. Objects are read while their loops run, each counter is
+ * consistent on its own but not with the others
+ */
+typedef struct metrics_t {
+    metrics_entry_t* head;
+    metrics_entry_t* tail;
+    volatile long lock;
+    api_tcp_listener_t listener;
+} metrics_t;
+
+METRICS_EXTERN void metrics_init(metrics_t* metrics);
+
+/*
+ * Registration calls can be made from any loop or thread
+ */
+METRICS_EXTERN void metrics_add_loop(metrics_t* metrics,
+                metrics_entry_t* entry, const char* name, api_loop_t* loop);
+METRICS_EXTERN void metrics_add_pool(metrics_t* metrics,
+                metrics_entry_t* entry, const char* name, api_pool_t* pool);
+METRICS_EXTERN void metrics_add_stream(metrics_t* metrics,
+                metrics_entry_t* entry, const char* name, api_stream_t* stream);
+METRICS_EXTERN void metrics_remove(metrics_t* metrics, metrics_entry_t* entry);
+
+/*
+ * Render all registered objects and offload pool counters as
+ * Prometheus text into chain of buffers taken from pool.
+ * Returns 0 if pool is out of memory
+ */
+METRICS_EXTERN api_buf_t* metrics_format(metrics_t* metrics, api_pool_t* pool);
+
+/*
+ * Serve GET /metrics on ip:port from calling task, each scrape
+ * connection runs as its own task of the loop. Returns when loop stops.
+ * Run it in a loop of its own to keep scrapes off the data path
+ */
+METRICS_EXTERN int metrics_serve(metrics_t* metrics, api_loop_t* loop,
+                                 const char* ip, int port);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // METRICS_H_INCLUDED
\ No newline at end of file
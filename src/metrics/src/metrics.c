@@ -0,0 +1,750 @@
+/* Copyright (c) 2014, Artak Khnkoyan <artak.khnkoyan@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include "../include/metrics.h"
+#include "../../http/include/http.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#define metrics_lock(m) \
+    while (__sync_lock_test_and_set(&(m)->lock, 1)) sched_yield()
+#define metrics_unlock(m) __sync_lock_release(&(m)->lock)
+#else
+#pragma warning(disable: 4996)
+#define metrics_lock(m) \
+    while (InterlockedExchange(&(m)->lock, 1)) SwitchToThread()
+#define metrics_unlock(m) InterlockedExchange(&(m)->lock, 0)
+#define snprintf _snprintf
+#endif
+
+#define METRICS_CHUNK 16384
+#define METRICS_NAME 256
+
+/* metric name with labels in braces, or alone when there are none */
+#define METRICS_SAMPLE "%s%s%s%s "
+#define METRICS_LABELS(metric, labels) \
+    metric, *(labels) ? "{" : "", labels, *(labels) ? "}" : ""
+
+#define NOTFOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+#define UNAVAILABLE "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n"
+
+typedef struct metrics_writer_t {
+    api_pool_t* pool;
+    api_buf_t* head;
+    api_buf_t* tail;
+    int failed;
+} metrics_writer_t;
+
+typedef struct metrics_connection_t {
+    api_tcp_t tcp;
+    metrics_t* metrics;
+} metrics_connection_t;
+
+static const char* g_metrics_latency[LATENCY_Count] = {
+    "read", "write", "accept", "connect", "queue", "timer", "rtt"
+};
+
+static const double g_metrics_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+void metrics_init(metrics_t* metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+static void metrics_add(metrics_t* metrics, metrics_entry_t* entry,
+                        metrics_kind_t kind, const char* name, void* object)
+{
+    entry->kind = kind;
+    entry->name = name;
+    entry->object = object;
+    entry->next = 0;
+
+    metrics_lock(metrics);
+
+    entry->prev = metrics->tail;
+    if (metrics->tail != 0)
+        metrics->tail->next = entry;
+    else
+        metrics->head = entry;
+    metrics->tail = entry;
+
+    metrics_unlock(metrics);
+}
+
+void metrics_add_loop(metrics_t* metrics,
+                metrics_entry_t* entry, const char* name, api_loop_t* loop)
+{
+    metrics_add(metrics, entry, METRICS_Loop, name, loop);
+}
+
+void metrics_add_pool(metrics_t* metrics,
+                metrics_entry_t* entry, const char* name, api_pool_t* pool)
+{
+    metrics_add(metrics, entry, METRICS_Pool, name, pool);
+}
+
+void metrics_add_stream(metrics_t* metrics,
+                metrics_entry_t* entry, const char* name, api_stream_t* stream)
+{
+    metrics_add(metrics, entry, METRICS_Stream, name, stream);
+}
+
+void metrics_remove(metrics_t* metrics, metrics_entry_t* entry)
+{
+    metrics_lock(metrics);
+
+    if (entry->prev != 0)
+        entry->prev->next = entry->next;
+    else
+        metrics->head = entry->next;
+
+    if (entry->next != 0)
+        entry->next->prev = entry->prev;
+    else
+        metrics->tail = entry->prev;
+
+    metrics_unlock(metrics);
+
+    entry->next = 0;
+    entry->prev = 0;
+}
+
+static void metrics_print(metrics_writer_t* writer, const char* format, ...)
+{
+    api_buf_t* buf = writer->tail;
+    size_t available;
+    va_list args;
+    int length;
+
+    if (writer->failed)
+        return;
+
+    /* lines are short, so a line that does not fit starts a new chunk */
+    while (1)
+    {
+        if (buf != 0)
+        {
+            available = buf->size - buf->length;
+
+            va_start(args, format);
+            length = vsnprintf(buf->data + buf->length, available,
+                               format, args);
+            va_end(args);
+
+            if (length >= 0 && (size_t)length < available)
+            {
+                buf->length += length;
+                return;
+            }
+
+            if (buf->length == 0)
+            {
+                /* does not fit even in empty chunk */
+                writer->failed = 1;
+                return;
+            }
+        }
+
+        buf = api_buf_alloc(writer->pool, METRICS_CHUNK);
+        if (buf == 0)
+        {
+            writer->failed = 1;
+            return;
+        }
+
+        if (writer->tail != 0)
+            writer->tail->next = buf;
+        else
+            writer->head = buf;
+        writer->tail = buf;
+    }
+}
+
+/* label values escape backslash, quote and new line */
+static void metrics_escape(char* out, const char* name)
+{
+    size_t i = 0;
+
+    if (name == 0)
+        name = "";
+
+    while (*name != 0 && i < METRICS_NAME - 3)
+    {
+        if (*name == '\\' || *name == '"')
+        {
+            out[i++] = '\\';
+            out[i++] = *name;
+        }
+        else if (*name == '\n')
+        {
+            out[i++] = '\\';
+            out[i++] = 'n';
+        }
+        else
+        {
+            out[i++] = *name;
+        }
+
+        ++name;
+    }
+
+    out[i] = 0;
+}
+
+/* microseconds as seconds, without going through floating point */
+static void metrics_seconds(char* out, size_t size, uint64_t microseconds)
+{
+    snprintf(out, size, "%llu.%06llu",
+             (unsigned long long)(microseconds / 1000000),
+             (unsigned long long)(microseconds % 1000000));
+}
+
+static void metrics_print_seconds(metrics_writer_t* writer, const char* metric,
+                                  const char* labels, uint64_t microseconds)
+{
+    char value[32];
+
+    metrics_seconds(value, sizeof(value), microseconds);
+    metrics_print(writer, METRICS_SAMPLE "%s\n", METRICS_LABELS(metric, labels),
+                  value);
+}
+
+static void metrics_print_value(metrics_writer_t* writer, const char* metric,
+                                const char* labels, uint64_t value)
+{
+    metrics_print(writer, METRICS_SAMPLE "%llu\n",
+                  METRICS_LABELS(metric, labels), (unsigned long long)value);
+}
+
+static void metrics_print_family(metrics_writer_t* writer, const char* metric,
+                                 const char* type, const char* help)
+{
+    metrics_print(writer, "# HELP %s %s\n# TYPE %s %s\n",
+                  metric, help, metric, type);
+}
+
+/* histograms of microseconds are exported as summaries in seconds */
+static void metrics_print_summary(metrics_writer_t* writer, const char* metric,
+                                  const char* labels,
+                                  api_histogram_t* histogram)
+{
+    char value[32];
+    size_t i;
+
+    for (i = 0; i < sizeof(g_metrics_quantiles) / sizeof(double); ++i)
+    {
+        metrics_seconds(value, sizeof(value), api_histogram_percentile(
+                            histogram, 100 * g_metrics_quantiles[i]));
+        metrics_print(writer, "%s{%s,quantile=\"%g\"} %s\n", metric, labels,
+                      g_metrics_quantiles[i], value);
+    }
+
+    metrics_seconds(value, sizeof(value), histogram->sum);
+    metrics_print(writer, "%s_sum{%s} %s\n", metric, labels, value);
+    metrics_print(writer, "%s_count{%s} %llu\n", metric, labels,
+                  (unsigned long long)histogram->count);
+}
+
+typedef enum metrics_value_t {
+    VALUE_Count,        /* uint64_t */
+    VALUE_Count32,      /* uint32_t */
+    VALUE_Seconds,      /* uint64_t microseconds */
+    VALUE_Seconds32,    /* uint32_t microseconds */
+    VALUE_Size,         /* size_t */
+    VALUE_PerMille      /* int */
+} metrics_value_t;
+
+/*
+ * Family of counters read from snapshot of registered object,
+ * field is offset in snapshot structure
+ */
+typedef struct metrics_family_t {
+    const char* metric;
+    const char* type;
+    const char* help;
+    size_t field;
+    metrics_value_t value;
+} metrics_family_t;
+
+typedef struct metrics_stream_stats_t {
+    uint64_t read;
+    uint64_t read_period;
+    uint64_t sent;
+    uint64_t write_period;
+    api_tcp_info_t tcp;
+} metrics_stream_stats_t;
+
+typedef union metrics_stats_t {
+    api_loop_stats_t loop;
+    api_pool_stats_t pool;
+    metrics_stream_stats_t stream;
+    api_offload_stats_t offload;
+} metrics_stats_t;
+
+#define LOOP(name) offsetof(api_loop_stats_t, name)
+#define POOL(name) offsetof(api_pool_stats_t, name)
+#define STREAM(name) offsetof(metrics_stream_stats_t, name)
+#define TCP(name) offsetof(metrics_stream_stats_t, tcp.name)
+#define OFFLOAD(name) offsetof(api_offload_stats_t, name)
+
+static const metrics_family_t g_metrics_loop[] = {
+    { "api_loop_iterations_total", "counter",
+      "Times loop waited for events", LOOP(iterations), VALUE_Count },
+    { "api_loop_events_total", "counter",
+      "Events returned by loop waits", LOOP(events), VALUE_Count },
+    { "api_loop_events_max", "gauge",
+      "Most events returned by one wait", LOOP(events_max), VALUE_Count },
+    { "api_loop_blocked_seconds_total", "counter",
+      "Time loop waited for events", LOOP(blocked), VALUE_Seconds },
+    { "api_loop_busy_seconds_total", "counter",
+      "Time loop was running", LOOP(busy), VALUE_Seconds },
+    { "api_loop_tasks_created_total", "counter",
+      "Tasks created", LOOP(tasks_created), VALUE_Count },
+    { "api_loop_tasks_completed_total", "counter",
+      "Tasks completed", LOOP(tasks_completed), VALUE_Count },
+    { "api_loop_switches_total", "counter",
+      "Task context switches", LOOP(switches), VALUE_Count },
+    { "api_loop_timers_total", "counter",
+      "Sleeps, idles and timeouts fired", LOOP(timers), VALUE_Count },
+    { "api_loop_asyncs_total", "counter",
+      "Posts, execs and wakeups processed", LOOP(asyncs), VALUE_Count },
+    { "api_loop_async_depth_max", "gauge",
+      "Most asyncs drained at once", LOOP(async_depth_max), VALUE_Count },
+    { "api_loop_tasks", "gauge",
+      "Tasks created and not finished", LOOP(tasks), VALUE_Size },
+    { "api_loop_streams", "gauge",
+      "Streams attached", LOOP(streams), VALUE_Size },
+    { "api_loop_utilisation", "gauge",
+      "Part of time loop was not waiting for events", LOOP(utilisation),
+      VALUE_PerMille }
+};
+
+static const metrics_family_t g_metrics_pool[] = {
+    { "api_pool_allocs_total", "counter",
+      "Allocations", POOL(allocs), VALUE_Count },
+    { "api_pool_frees_total", "counter",
+      "Frees", POOL(frees), VALUE_Count },
+    { "api_pool_regions", "gauge",
+      "2MB regions mapped", POOL(regions), VALUE_Count },
+    { "api_pool_hugetlb_regions", "gauge",
+      "Regions backed by MAP_HUGETLB", POOL(hugetlb), VALUE_Count },
+    { "api_pool_thp_regions", "gauge",
+      "Regions advised for transparent huge pages", POOL(thp), VALUE_Count },
+    { "api_pool_region_bytes", "gauge",
+      "Bytes in use carved from regions", POOL(region_bytes), VALUE_Count },
+    { "api_pool_huge_bytes", "gauge",
+      "Bytes in use backed by huge pages", POOL(huge_bytes), VALUE_Count },
+    { "api_pool_heap_bytes", "gauge",
+      "Bytes in use outside of regions", POOL(heap_bytes), VALUE_Count }
+};
+
+static const metrics_family_t g_metrics_stream[] = {
+    { "api_stream_read_bytes_total", "counter",
+      "Bytes read", STREAM(read), VALUE_Count },
+    { "api_stream_read_seconds_total", "counter",
+      "Time spent reading", STREAM(read_period), VALUE_Seconds },
+    { "api_stream_write_bytes_total", "counter",
+      "Bytes written", STREAM(sent), VALUE_Count },
+    { "api_stream_write_seconds_total", "counter",
+      "Time spent writing", STREAM(write_period), VALUE_Seconds }
+};
+
+/* tcp streams sampled with tcp_info_period */
+static const metrics_family_t g_metrics_tcp[] = {
+    { "api_tcp_rtt_seconds", "gauge",
+      "Smoothed round trip time", TCP(rtt), VALUE_Seconds32 },
+    { "api_tcp_rtt_var_seconds", "gauge",
+      "Round trip time variance", TCP(rtt_var), VALUE_Seconds32 },
+    { "api_tcp_cwnd_segments", "gauge",
+      "Congestion window", TCP(cwnd), VALUE_Count32 },
+    { "api_tcp_retransmits_total", "counter",
+      "Segments retransmitted", TCP(retransmits), VALUE_Count },
+    { "api_tcp_delivery_rate_bytes", "gauge",
+      "Delivery rate per second", TCP(delivery_rate), VALUE_Count },
+    { "api_tcp_unacked_bytes", "gauge",
+      "Bytes sent and not acknowledged", TCP(unacked), VALUE_Count }
+};
+
+static const metrics_family_t g_metrics_offload[] = {
+    { "api_offload_threads", "gauge",
+      "Offload worker threads", OFFLOAD(threads), VALUE_Count },
+    { "api_offload_submitted_total", "counter",
+      "Blocking callbacks submitted", OFFLOAD(submitted), VALUE_Count },
+    { "api_offload_completed_total", "counter",
+      "Blocking callbacks completed", OFFLOAD(completed), VALUE_Count },
+    { "api_offload_rejected_total", "counter",
+      "Callbacks rejected by queue limit", OFFLOAD(rejected), VALUE_Count },
+    { "api_offload_queued", "gauge",
+      "Callbacks waiting for a thread", OFFLOAD(queued), VALUE_Count },
+    { "api_offload_queued_max", "gauge",
+      "Most callbacks waiting for a thread", OFFLOAD(queued_max),
+      VALUE_Count },
+    { "api_offload_wait_seconds_total", "counter",
+      "Time from submit to start", OFFLOAD(wait_total), VALUE_Seconds },
+    { "api_offload_wait_seconds_max", "gauge",
+      "Longest time from submit to start", OFFLOAD(wait_max),
+      VALUE_Seconds },
+    { "api_offload_run_seconds_total", "counter",
+      "Time from start to completion", OFFLOAD(run_total), VALUE_Seconds },
+    { "api_offload_run_seconds_max", "gauge",
+      "Longest time from start to completion", OFFLOAD(run_max),
+      VALUE_Seconds }
+};
+
+static const char* g_metrics_label[] = { "loop", "pool", "stream" };
+
+/*
+ * Objects are read while their loops run, loops publish counters as
+ * plain stores so this is a copy without stopping anybody
+ */
+static void metrics_snapshot(metrics_entry_t* entry, metrics_stats_t* stats)
+{
+    api_stream_t* stream;
+
+    switch (entry->kind) {
+    case METRICS_Loop:
+        api_loop_stats_snapshot((api_loop_t*)entry->object, &stats->loop);
+        break;
+    case METRICS_Pool:
+        api_pool_stats((api_pool_t*)entry->object, &stats->pool);
+        break;
+    case METRICS_Stream:
+        stream = (api_stream_t*)entry->object;
+        stats->stream.read = stream->read_bandwidth.read;
+        stats->stream.read_period = stream->read_bandwidth.period;
+        stats->stream.sent = stream->write_bandwidth.sent;
+        stats->stream.write_period = stream->write_bandwidth.period;
+
+        if (stream->type == STREAM_Tcp)
+            stats->stream.tcp = ((api_tcp_t*)stream)->info;
+        else
+            memset(&stats->stream.tcp, 0, sizeof(stats->stream.tcp));
+        break;
+    }
+}
+
+static void metrics_print_field(metrics_writer_t* writer,
+                                const metrics_family_t* family,
+                                const char* labels, metrics_stats_t* stats)
+{
+    char* field = (char*)stats + family->field;
+    int permille;
+
+    switch (family->value) {
+    case VALUE_Count:
+        metrics_print_value(writer, family->metric, labels,
+                            *(uint64_t*)field);
+        break;
+    case VALUE_Count32:
+        metrics_print_value(writer, family->metric, labels,
+                            *(uint32_t*)field);
+        break;
+    case VALUE_Seconds:
+        metrics_print_seconds(writer, family->metric, labels,
+                              *(uint64_t*)field);
+        break;
+    case VALUE_Seconds32:
+        metrics_print_seconds(writer, family->metric, labels,
+                              *(uint32_t*)field);
+        break;
+    case VALUE_Size:
+        metrics_print_value(writer, family->metric, labels,
+                            *(size_t*)field);
+        break;
+    case VALUE_PerMille:
+        permille = *(int*)field;
+        metrics_print(writer, METRICS_SAMPLE "%d.%03d\n",
+                      METRICS_LABELS(family->metric, labels),
+                      permille / 1000, permille % 1000);
+        break;
+    }
+}
+
+static void metrics_format_families(metrics_t* metrics,
+                                    metrics_writer_t* writer,
+                                    metrics_kind_t kind,
+                                    const metrics_family_t* families,
+                                    size_t count)
+{
+    metrics_entry_t* entry;
+    metrics_stats_t stats;
+    char name[METRICS_NAME];
+    char labels[METRICS_NAME + 16];
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        metrics_print_family(writer, families[i].metric, families[i].type,
+                             families[i].help);
+
+        for (entry = metrics->head; entry != 0; entry = entry->next)
+        {
+            if (entry->kind != kind)
+                continue;
+
+            /* transport state only of tcp streams that were sampled */
+            metrics_snapshot(entry, &stats);
+            if (families == g_metrics_tcp && stats.stream.tcp.samples == 0)
+                continue;
+            metrics_escape(name, entry->name);
+            snprintf(labels, sizeof(labels), "%s=\"%s\"",
+                     g_metrics_label[kind], name);
+
+            metrics_print_field(writer, &families[i], labels, &stats);
+        }
+    }
+}
+
+static void metrics_format_latency(metrics_t* metrics, metrics_writer_t* writer,
+                                   api_histogram_t* histogram)
+{
+    metrics_entry_t* entry;
+    api_stream_t* stream;
+    char name[METRICS_NAME];
+    char labels[METRICS_NAME + 32];
+    int kind;
+
+    metrics_print_family(writer, "api_loop_latency_seconds", "summary",
+                         "Latency of loop operations");
+
+    for (entry = metrics->head; entry != 0; entry = entry->next)
+    {
+        if (entry->kind != METRICS_Loop)
+            continue;
+
+        metrics_escape(name, entry->name);
+
+        for (kind = 0; kind < LATENCY_Count; ++kind)
+        {
+            api_loop_latency((api_loop_t*)entry->object,
+                             (api_latency_t)kind, histogram);
+
+            snprintf(labels, sizeof(labels), "loop=\"%s\",op=\"%s\"",
+                     name, g_metrics_latency[kind]);
+            metrics_print_summary(writer, "api_loop_latency_seconds",
+                                  labels, histogram);
+        }
+    }
+
+    metrics_print_family(writer, "api_stream_latency_seconds", "summary",
+                         "Latency of stream reads and writes");
+
+    for (entry = metrics->head; entry != 0; entry = entry->next)
+    {
+        if (entry->kind != METRICS_Stream)
+            continue;
+
+        stream = (api_stream_t*)entry->object;
+        metrics_escape(name, entry->name);
+
+        if (stream->read_latency != 0)
+        {
+            memcpy(histogram, stream->read_latency, sizeof(*histogram));
+            snprintf(labels, sizeof(labels), "stream=\"%s\",op=\"read\"",
+                     name);
+            metrics_print_summary(writer, "api_stream_latency_seconds",
+                                  labels, histogram);
+        }
+
+        if (stream->write_latency != 0)
+        {
+            memcpy(histogram, stream->write_latency, sizeof(*histogram));
+            snprintf(labels, sizeof(labels), "stream=\"%s\",op=\"write\"",
+                     name);
+            metrics_print_summary(writer, "api_stream_latency_seconds",
+                                  labels, histogram);
+        }
+    }
+}
+
+api_buf_t* metrics_format(metrics_t* metrics, api_pool_t* pool)
+{
+    metrics_writer_t writer;
+    metrics_stats_t stats;
+    api_histogram_t* histogram;
+    size_t i;
+
+    /* too large for small task stacks */
+    histogram = (api_histogram_t*)api_alloc(pool, sizeof(*histogram));
+    if (histogram == 0)
+        return 0;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.pool = pool;
+
+    api_offload_stats(&stats.offload);
+    for (i = 0; i < sizeof(g_metrics_offload) / sizeof(*g_metrics_offload);
+         ++i)
+    {
+        metrics_print_family(&writer, g_metrics_offload[i].metric,
+                g_metrics_offload[i].type, g_metrics_offload[i].help);
+        metrics_print_field(&writer, &g_metrics_offload[i], "", &stats);
+    }
+
+    /* registry is walked under lock, nothing here suspends the task */
+    metrics_lock(metrics);
+
+    metrics_format_families(metrics, &writer, METRICS_Loop, g_metrics_loop,
+                            sizeof(g_metrics_loop) / sizeof(*g_metrics_loop));
+    metrics_format_families(metrics, &writer, METRICS_Pool, g_metrics_pool,
+                            sizeof(g_metrics_pool) / sizeof(*g_metrics_pool));
+    metrics_format_families(metrics, &writer, METRICS_Stream,
+            g_metrics_stream, sizeof(g_metrics_stream) / sizeof(*g_metrics_stream));
+    metrics_format_families(metrics, &writer, METRICS_Stream,
+            g_metrics_tcp, sizeof(g_metrics_tcp) / sizeof(*g_metrics_tcp));
+    metrics_format_latency(metrics, &writer, histogram);
+
+    metrics_unlock(metrics);
+
+    api_free(pool, sizeof(*histogram), histogram);
+
+    if (writer.failed)
+    {
+        api_buf_free_chain(writer.head);
+        return 0;
+    }
+
+    return writer.head;
+}
+
+static int metrics_respond(api_tcp_t* tcp, metrics_t* metrics,
+                           http_request_t* request)
+{
+    api_buf_t* body;
+    char headers[256];
+    int length;
+    int error = API_OK;
+
+    if (request->uri.path == 0 || 0 != strcmp(request->uri.path, "/metrics"))
+    {
+        if (sizeof(NOTFOUND) - 1 != api_stream_write(&tcp->stream,
+                                        NOTFOUND, sizeof(NOTFOUND) - 1))
+            return API_IO_ERROR;
+
+        return API_OK;
+    }
+
+    body = metrics_format(metrics, api_pool_default(tcp->stream.loop));
+    if (body == 0)
+    {
+        if (sizeof(UNAVAILABLE) - 1 != api_stream_write(&tcp->stream,
+                                        UNAVAILABLE, sizeof(UNAVAILABLE) - 1))
+            return API_IO_ERROR;
+
+        return API_OK;
+    }
+
+    length = snprintf(headers, sizeof(headers),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %llu\r\n\r\n",
+        (unsigned long long)api_buf_chain_length(body));
+
+    if ((size_t)length != api_stream_write(&tcp->stream, headers, length) ||
+        api_buf_chain_length(body) != api_stream_write_buf(&tcp->stream, body))
+        error = API_IO_ERROR;
+
+    api_buf_free_chain(body);
+
+    return error;
+}
+
+static void metrics_connection(api_loop_t* loop, void* arg)
+{
+    metrics_connection_t* connection = (metrics_connection_t*)arg;
+    api_tcp_t* tcp = &connection->tcp;
+    api_pool_t* pool = api_pool_default(loop);
+    http_request_t request;
+    const char* value;
+    int keep_alive = 1;
+
+    api_stream_attach(&tcp->stream, loop);
+
+    /* scrapers keep connection between scrapes */
+    tcp->stream.read_timeout = 5 * 60 * 1000;
+    tcp->stream.write_timeout = 10 * 1000;
+
+    while (keep_alive)
+    {
+        if (http_request_parse(&request, &tcp->stream))
+            break;
+
+        value = http_request_get_header(&request, "Connection");
+        keep_alive = request.minor > 0 ? value == 0 ||
+                        0 != strcmp(value, "close") : value != 0;
+
+        if (API_OK != metrics_respond(tcp, connection->metrics, &request))
+            keep_alive = 0;
+
+        http_request_clean(&request, pool);
+    }
+
+    api_stream_close(&tcp->stream);
+    api_free(pool, sizeof(*connection), connection);
+}
+
+int metrics_serve(metrics_t* metrics, api_loop_t* loop,
+                  const char* ip, int port)
+{
+    api_pool_t* pool = api_pool_default(loop);
+    metrics_connection_t* connection;
+    int error;
+
+    error = api_tcp_listen(&metrics->listener, loop, ip, port, 16);
+    if (API_OK != error)
+        return error;
+
+    while (1)
+    {
+        connection = (metrics_connection_t*)api_alloc(pool,
+                                                      sizeof(*connection));
+        if (connection == 0)
+        {
+            error = API_NO_MEMORY;
+            break;
+        }
+
+        connection->metrics = metrics;
+
+        error = api_tcp_accept(&metrics->listener, &connection->tcp);
+        if (API_OK != error)
+        {
+            api_free(pool, sizeof(*connection), connection);
+            break;
+        }
+
+        /* http parsing and formatting need more than default stack */
+        if (API_OK != api_loop_post(loop, metrics_connection, connection,
+                                    64 * 1024))
+        {
+            api_stream_close(&connection->tcp.stream);
+            api_free(pool, sizeof(*connection), connection);
+        }
+    }
+
+    api_tcp_close(&metrics->listener);
+
+    return error;
+}
\ No newline at end of file
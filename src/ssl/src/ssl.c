@@ -79,9 +79,9 @@ size_t ssl_on_read(struct api_filter_t* filter, char* buffer, size_t length)
 
 size_t ssl_on_write(struct api_filter_t* filter, const char* buffer, size_t length)
 {
-    char buf[1024];
-    int bytes_read = 0;
     ssl_stream_t* ssl_stream = (ssl_stream_t*)filter;
+    char* data;
+    long pending;
 
     int r = SSL_write((SSL*)ssl_stream->ssl, buffer, length);
     if (r <= 0)
@@ -90,11 +90,15 @@ size_t ssl_on_write(struct api_filter_t* filter, const char* buffer, size_t leng
         return 0;
     }
 
-    while ((bytes_read = BIO_read((BIO*)ssl_stream->bio_write, 
-                                    buf, sizeof(buf))) > 0)
+    /* pass encrypted data directly from memory bio, without copy */
+    pending = BIO_get_mem_data((BIO*)ssl_stream->bio_write, &data);
+    if (pending > 0)
     {
-        if (filter->next->on_write(filter->next, buf, bytes_read) == 0)
+        if (filter->next->on_write(filter->next, data, pending) !=
+                                                        (size_t)pending)
             return 0;
+
+        (void)BIO_reset((BIO*)ssl_stream->bio_write);
     }
 
     return length;